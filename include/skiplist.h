@@ -50,12 +50,14 @@ struct _skiplist_node;
     typedef std::atomic<uint8_t>           atm_uint8_t;
     typedef std::atomic<uint16_t>          atm_uint16_t;
     typedef std::atomic<uint32_t>          atm_uint32_t;
+    typedef std::atomic<uint64_t>          atm_uint64_t;
 #else
     typedef struct _skiplist_node*         atm_node_ptr;
     typedef uint8_t                        atm_bool;
     typedef uint8_t                        atm_uint8_t;
     typedef uint16_t                       atm_uint16_t;
     typedef uint32_t                       atm_uint32_t;
+    typedef uint64_t                       atm_uint64_t;
 #endif
 
 #ifdef __cplusplus
@@ -64,12 +66,10 @@ extern "C" {
 
 typedef struct _skiplist_node {
     atm_node_ptr *next;
-    atm_bool is_fully_linked;
-    atm_bool being_modified;
-    atm_bool removed;
-    uint8_t top_layer; // 0: bottom
-    atm_uint16_t ref_count;
-    atm_uint32_t accessing_next;
+    // Flags, lock of `next`, top layer, inline tower size, and
+    // reference count, packed so that each is read or updated by one
+    // atomic operation. See `_SL_ST_*` in `sl_engine.h`.
+    atm_uint64_t state;
 } skiplist_node;
 
 // *a  < *b : return neg
@@ -77,23 +77,173 @@ typedef struct _skiplist_node {
 // *a  > *b : return pos
 typedef int skiplist_cmp_t(skiplist_node *a, skiplist_node *b, void *aux);
 
+// Callback invoked on a node that has left the skiplist for good,
+// e.g., to free the memory of a retired node.
+typedef void skiplist_node_cb_t(skiplist_node *node, void *ctx);
+
+typedef struct _skiplist_raw skiplist_raw;
+
+// Return the top layer of `node` to be inserted (0: bottom only).
+// Result larger than `maxLayer - 1` will be truncated.
+typedef size_t skiplist_level_gen_t(skiplist_raw *slist, skiplist_node *node);
+
+// Hash of the key of `node`, for `skiplist_level_gen_hash()`.
+typedef uint64_t skiplist_hash_t(skiplist_node *node, void *aux);
+
+typedef enum {
+    // Every traversal step grabs the reference count of the next node, and
+    // erased nodes are freed once `skiplist_is_safe_to_free()` is true.
+    SKIPLIST_RECLAIM_REFCOUNT = 0,
+    // Readers announce an epoch once per operation, and erased nodes
+    // are handed to `skiplist_retire_node()`, which frees them after
+    // all readers of older epochs are gone.
+    SKIPLIST_RECLAIM_EPOCH = 1,
+    // Readers publish the nodes they are visiting in per-thread hazard
+    // slots, and `skiplist_retire_node()` frees erased nodes that are
+    // not in any slot. Unlike epoch, a slow reader holds only the nodes
+    // it is pointing to, so the number of retired nodes is bounded.
+    SKIPLIST_RECLAIM_HAZARD = 2,
+    // Nothing protects nodes, for insert-only skiplists whose nodes are
+    // freed only after all readers are gone, e.g., memtables. Readers
+    // neither touch the reference count nor announce epochs, and
+    // `skiplist_retire_node()` frees the node right away.
+    SKIPLIST_RECLAIM_NONE = 3,
+} skiplist_reclaim_mode;
+
+typedef enum {
+    // Writers flag the predecessors (being modified) and lock their
+    // `next` pointers, and start over on conflict.
+    SKIPLIST_SYNC_LOCK = 0,
+    // Writers link and unlink nodes by CAS on `next` pointers, and
+    // erased nodes are marked on the lowest bit of their own `next`
+    // pointers, so that any thread passing by can finish unlinking them.
+    // No thread waits for another. Nodes of the same key are ordered by
+    // address. Available in `SKIPLIST_RECLAIM_EPOCH` and `_NONE` modes
+    // only, as other modes rely on the locks to free nodes safely.
+    SKIPLIST_SYNC_LOCK_FREE = 1,
+} skiplist_sync_mode;
+
+typedef enum {
+    // Call `sched_yield()` on every check while waiting for a lock.
+    SKIPLIST_WAIT_YIELD = 0,
+    // Spin with exponential backoff for a while, and then park on
+    // a futex of the lock until it is released. Better when there are
+    // more threads than cores. Yield instead of futex on non-Linux.
+    SKIPLIST_WAIT_SPIN_PARK = 1,
+} skiplist_wait_mode;
+
 typedef struct {
     size_t fanout;
     size_t maxLayer;
     void *aux;
+    skiplist_reclaim_mode reclaimMode;
+    // NULL: `skiplist_level_gen_fast()`.
+    skiplist_level_gen_t *levelGen;
+    // Used by `skiplist_level_gen_hash()`.
+    skiplist_hash_t *hashFunc;
+    // Seed of `skiplist_level_gen_hash()`. The other built-in
+    // generators ignore it: `skiplist_level_gen_fast()` keeps a state
+    // per thread shared by all skiplists, and `_rand()` uses `rand()`.
+    uint64_t levelSeed;
+    // `SKIPLIST_SYNC_LOCK` if not supported by `reclaimMode`.
+    skiplist_sync_mode syncMode;
+    // How writers and readers wait for the locks of `SKIPLIST_SYNC_LOCK`.
+    skiplist_wait_mode waitMode;
+    // Non-zero: keep the `prev` link of each node, so that
+    // `skiplist_prev()` takes O(1) instead of a search from the head.
+    // Costs a lock on the next node per insert and erase, and a slot
+    // at the end of the tower of each node. Should be set while the
+    // list is empty, and ignored in `SKIPLIST_SYNC_LOCK_FREE`.
+    int backwardLinks;
+    // Non-zero: keep the span (number of layer-0 steps) of each link,
+    // so that `skiplist_rank()`, `skiplist_select()` and
+    // `skiplist_count()` take O(log n) instead of a walk on layer 0.
+    // All writers (inserts and erases) are serialized by one sequence
+    // lock of the skiplist, hence an indexable skiplist is single-writer
+    // at a time, while lookups and iterations still run concurrently.
+    // Rank, select and count retry if a writer has been in the middle,
+    // and take the lock themselves after a few retries, so that they
+    // make progress under sustained writes. Should be set while the list
+    // is empty, and ignored in `SKIPLIST_SYNC_LOCK_FREE`.
+    int indexable;
+    // Non-zero: keep multiple versions for `skiplist_snapshot()`.
+    // Every insert and erase gets a sequence number, kept in two slots
+    // at the end of the tower of each node, and an erased node
+    // stays in the list (hidden from the latest view) until all older
+    // snapshots are released. Hence erased nodes should be handed over
+    // to `skiplist_retire_node()` rather than freed by caller.
+    // Erased nodes still linked are counted by `skiplist_rank()` and
+    // `skiplist_count()`. Should be set while the list is empty, and
+    // ignored in `SKIPLIST_SYNC_LOCK_FREE`.
+    int versioned;
+    // Number of nodes prefetched ahead by `skiplist_next()` (and the
+    // iterators of the containers), starting from the tower of the
+    // returned node, 0: none. Other nodes are reached by reading the
+    // links of unprotected nodes, which is safe only in
+    // `SKIPLIST_RECLAIM_EPOCH` and `SKIPLIST_RECLAIM_NONE`, so other
+    // modes stop at one. Up to 255. Can be changed on a live skiplist
+    // by `skiplist_set_prefetch()`.
+    int prefetchDepth;
+    // Non-zero (default): prefetch the next node and its links at each
+    // step of a search (and of `skiplist_find_batch()`), while the
+    // current one is being compared. Can be turned off on a live
+    // skiplist by `skiplist_set_prefetch()`, e.g., to measure the gain
+    // (see `prefetch_bench`).
+    int searchPrefetch;
+    // Non-zero: back the node pools of the containers (`sl_map`,
+    // `sl_set`) by huge pages, falling back to transparent huge pages
+    // and then to regular memory. The C API leaves node allocation to
+    // the caller, so it does not use this. Should be set while the
+    // container is empty.
+    int hugePages;
 } skiplist_raw_config;
 
-typedef struct {
+struct _skiplist_reclaim;
+
+// Sequence numbers, snapshots and erased nodes of a versioned skiplist.
+struct _skiplist_versions;
+
+// Per-thread shard of the entry counter.
+struct _skiplist_size_shard;
+
+// Hazard slot that keeps a node alive in `SKIPLIST_RECLAIM_HAZARD` mode,
+// instead of the reference count.
+typedef struct _skiplist_hazard skiplist_hazard;
+
+struct _skiplist_raw {
     skiplist_node head;
     skiplist_node tail;
     skiplist_cmp_t *cmp_func;
     void *aux;
-    atm_uint32_t num_entries;
+    // Sum of the deltas flushed from `size_shards`.
+    atm_uint64_t num_entries;
+    struct _skiplist_size_shard* size_shards;
+    // Number of nodes whose top layer is `ii`, for `ii >= 1`.
     atm_uint32_t* layer_entries;
+    // Raised on insert, and lowered when the last node of the top layer
+    // is erased. It can be lower than the actual one for a while
+    // under races, which only makes searches start lower.
     atm_uint8_t top_layer;
     uint8_t fanout;
     uint8_t max_layer;
-} skiplist_raw;
+    uint8_t reclaim_mode;
+    uint8_t sync_mode;
+    uint8_t wait_mode;
+    uint8_t backward_links;
+    uint8_t indexable;
+    // Sequence lock of an indexable skiplist: odd while a writer is
+    // updating links and spans.
+    atm_uint64_t index_seq;
+    uint8_t versioned;
+    struct _skiplist_versions* versions;
+    uint8_t prefetch_depth;
+    uint8_t search_prefetch;
+    uint8_t huge_pages;
+    struct _skiplist_reclaim* reclaim;
+    skiplist_level_gen_t* level_gen;
+    skiplist_hash_t* hash_func;
+    uint64_t level_seed;
+};
 
 #ifndef _get_entry
 #define _get_entry(ELEM, STRUCT, MEMBER)                              \
@@ -107,19 +257,102 @@ void skiplist_free(skiplist_raw* slist);
 void skiplist_init_node(skiplist_node* node);
 void skiplist_free_node(skiplist_node* node);
 
+// Inline tower: `next` array (and spans of the links, used by an
+// indexable skiplist) placed right after the user struct,
+// instead of being allocated on heap on every insert. E.g.,
+//
+//   size_t top = skiplist_decide_top_layer(slist, NULL);
+//   my_struct* s = malloc(skiplist_inline_node_size(slist, sizeof(*s), top));
+//   skiplist_init_node_inline(&s->snode, s, sizeof(*s), top);
+//
+// Bytes of a struct of `struct_size` embedding a node, followed by
+// the tower up to `top_layer`, along with the room for the options of
+// `slist` (e.g., `backwardLinks`). The node should be inserted into
+// `slist` only, and the options should not change meanwhile.
+size_t skiplist_inline_node_size(skiplist_raw* slist,
+                                 size_t struct_size,
+                                 size_t top_layer);
+// Use it instead of `skiplist_init_node()`. `mem` is the beginning of
+// the struct allocated with the size above. The node is always inserted
+// with `top_layer`, and needs no `skiplist_free_node()`.
+void skiplist_init_node_inline(skiplist_node* node,
+                               void* mem,
+                               size_t struct_size,
+                               size_t top_layer);
+// Ask the level generator of `slist` for the top layer of a new node.
+// `node` can be NULL if the generator does not look at the key
+// (e.g., `skiplist_level_gen_fast()`).
+size_t skiplist_decide_top_layer(skiplist_raw* slist,
+                                 skiplist_node* node);
+
+// Exact number of entries, summing up all shards of the counter.
 size_t skiplist_get_size(skiplist_raw* slist);
+// Cheap estimate from the global counter only, which can be off by up to
+// 1K entries while shards hold their deltas not flushed yet.
+size_t skiplist_get_size_approx(skiplist_raw* slist);
 
 skiplist_raw_config skiplist_get_default_config();
 skiplist_raw_config skiplist_get_config(skiplist_raw* slist);
 
+// Options other than the prefetch ones should be set while the list
+// is empty and no other thread is using it.
 void skiplist_set_config(skiplist_raw* slist,
                          skiplist_raw_config config);
 
+// Change `prefetchDepth` and `searchPrefetch` only, which is safe at
+// any time, even while other threads are using the list: they are
+// hints read once per step.
+void skiplist_set_prefetch(skiplist_raw* slist,
+                           int prefetch_depth,
+                           int search_prefetch);
+
+// Built-in level generators.
+// `rand()`: the legacy one, serialized by the lock inside libc.
+size_t skiplist_level_gen_rand(skiplist_raw* slist,
+                               skiplist_node* node);
+// Thread-local xorshift, a single random number per insert.
+// Not seeded by `levelSeed`.
+size_t skiplist_level_gen_fast(skiplist_raw* slist,
+                               skiplist_node* node);
+// Derived from `hashFunc` and `levelSeed`, so that the shape of
+// skiplist is reproducible regardless of insertion order and threads.
+size_t skiplist_level_gen_hash(skiplist_raw* slist,
+                               skiplist_node* node);
+
 int skiplist_insert(skiplist_raw* slist,
                     skiplist_node* node);
 int skiplist_insert_nodup(skiplist_raw *slist,
                           skiplist_node *node);
 
+// Insert `nodes` sorted in ascending order. Each insert starts searching
+// from the position of the previous one, instead of the head.
+// Unsorted input is still inserted correctly, but slower.
+// Note that nodes on the search path are grabbed until it returns,
+// so erasing them in refcount mode may wait for it.
+// Returns the number of inserted nodes.
+size_t skiplist_insert_batch(skiplist_raw* slist,
+                             skiplist_node** nodes,
+                             size_t num_nodes);
+// `results` (optional) gets the result of each node,
+// same as `skiplist_insert_nodup()`.
+size_t skiplist_insert_batch_nodup(skiplist_raw* slist,
+                                   skiplist_node** nodes,
+                                   size_t num_nodes,
+                                   int* results);
+
+// Build the whole skiplist in one pass from `nodes` sorted in
+// ascending order. Tower heights are decided by position, not by
+// the level generator (except for nodes with inline tower).
+// Skiplist should be empty, and should not be accessed by others
+// until it returns. Returns -1 if not empty, including erased nodes
+// that are still kept for snapshots.
+int skiplist_bulk_load(skiplist_raw* slist,
+                       skiplist_node** nodes,
+                       size_t num_nodes);
+// Top layer that `skiplist_bulk_load()` gives to `index`-th node.
+size_t skiplist_bulk_load_top_layer(skiplist_raw* slist,
+                                    size_t index);
+
 skiplist_node* skiplist_find(skiplist_raw* slist,
                              skiplist_node* query);
 skiplist_node* skiplist_find_smaller_or_equal(skiplist_raw* slist,
@@ -127,6 +360,30 @@ skiplist_node* skiplist_find_smaller_or_equal(skiplist_raw* slist,
 skiplist_node* skiplist_find_greater_or_equal(skiplist_raw* slist,
                                               skiplist_node* query);
 
+// Same as above, but search from `hint` (grabbed by caller) instead of
+// the head. If `hint` is close to `query`, it takes O(log d) where `d`
+// is the distance between them, rather than O(log n).
+// If `query` is not greater than `hint`, it is the same as search
+// from the head.
+skiplist_node* skiplist_find_from(skiplist_raw* slist,
+                                  skiplist_node* hint,
+                                  skiplist_node* query);
+skiplist_node* skiplist_find_smaller_or_equal_from(skiplist_raw* slist,
+                                                   skiplist_node* hint,
+                                                   skiplist_node* query);
+skiplist_node* skiplist_find_greater_or_equal_from(skiplist_raw* slist,
+                                                   skiplist_node* hint,
+                                                   skiplist_node* query);
+
+// `skiplist_find()` on each of `queries`, the result (or NULL) goes to
+// `results` in the same order. The searches advance together, so that
+// one makes progress while others wait for memory. Returns the number
+// of found ones, each of which should be released by caller.
+size_t skiplist_find_batch(skiplist_raw* slist,
+                           skiplist_node** queries,
+                           skiplist_node** results,
+                           size_t num_queries);
+
 int skiplist_erase_node_passive(skiplist_raw* slist,
                                 skiplist_node* node);
 int skiplist_erase_node(skiplist_raw *slist,
@@ -134,6 +391,39 @@ int skiplist_erase_node(skiplist_raw *slist,
 int skiplist_erase(skiplist_raw* slist,
                    skiplist_node* query);
 
+// Erase all nodes in `[from, to)` at once, where NULL `from` (or `to`)
+// means from the beginning (or to the end). `on_removed` is called for
+// each node right after it is unlinked, e.g., `skiplist_retire_node()`.
+// The boundaries are searched once, so that it takes O(log n + k) for
+// `k` nodes (O(k log n) in `SKIPLIST_RECLAIM_HAZARD` mode).
+// Returns the number of erased nodes.
+size_t skiplist_erase_range(skiplist_raw* slist,
+                            skiplist_node* from,
+                            skiplist_node* to,
+                            skiplist_node_cb_t* on_removed,
+                            void* ctx);
+// Erase all nodes smaller than `to`. No search is needed, as the head
+// is the predecessor of every node to erase.
+size_t skiplist_truncate_before(skiplist_raw* slist,
+                                skiplist_node* to,
+                                skiplist_node_cb_t* on_removed,
+                                void* ctx);
+
+// Number of entries smaller than `query`.
+size_t skiplist_rank(skiplist_raw* slist,
+                     skiplist_node* query);
+// Entry at rank `k` (0: the smallest one), NULL if `k` is out of range.
+skiplist_node* skiplist_select(skiplist_raw* slist,
+                               size_t k);
+// Number of entries in `[from, to)`, NULL means unbounded as above.
+// The two ranks are taken from the same snapshot, so the result is
+// exact even under concurrent writers.
+// All three take O(log n) if `indexable` is set, otherwise they walk on
+// layer 0 and the result is not a snapshot.
+size_t skiplist_count(skiplist_raw* slist,
+                      skiplist_node* from,
+                      skiplist_node* to);
+
 int skiplist_is_valid_node(skiplist_node* node);
 int skiplist_is_safe_to_free(skiplist_node* node);
 void skiplist_wait_for_free(skiplist_node* node);
@@ -141,6 +431,61 @@ void skiplist_wait_for_free(skiplist_node* node);
 void skiplist_grab_node(skiplist_node* node);
 void skiplist_release_node(skiplist_node* node);
 
+// Hand an erased (and released) node over to the skiplist, so that
+// `free_func` is called once no reader can access it anymore.
+// In `SKIPLIST_RECLAIM_REFCOUNT` mode, it is the same as
+// `skiplist_wait_for_free()` followed by `free_func`, except for nodes
+// kept for snapshots of a versioned skiplist: they are freed by a later
+// retire, snapshot release or `skiplist_reclaim()` once nobody holds them.
+void skiplist_retire_node(skiplist_raw* slist,
+                          skiplist_node* node,
+                          skiplist_node_cb_t* free_func,
+                          void* ctx);
+// Free retired nodes that became safe, returns the number of freed nodes.
+size_t skiplist_reclaim(skiplist_raw* slist);
+
+// Hazard slot APIs, available in `SKIPLIST_RECLAIM_HAZARD` mode only
+// (`skiplist_hazard_acquire()` returns NULL in other modes).
+skiplist_hazard* skiplist_hazard_acquire(skiplist_raw* slist);
+void skiplist_hazard_release(skiplist_raw* slist,
+                             skiplist_hazard* hazard);
+// `node` should be protected by caller when it is set (e.g., grabbed,
+// or set to other hazard slot), and it is safe to drop that protection
+// afterwards.
+void skiplist_hazard_set(skiplist_hazard* hazard,
+                         skiplist_node* node);
+skiplist_node* skiplist_hazard_get(skiplist_hazard* hazard);
+// Move the hazard slot to the next (or prev) node and return it.
+// Return NULL if there is no more node, and then the slot is cleared.
+skiplist_node* skiplist_hazard_next(skiplist_raw* slist,
+                                    skiplist_hazard* hazard);
+skiplist_node* skiplist_hazard_prev(skiplist_raw* slist,
+                                    skiplist_hazard* hazard);
+
+// Take a snapshot of a versioned skiplist, and return its sequence
+// number: scans with it see the entries inserted before the snapshot,
+// and not erased before it, regardless of writes after that.
+// Returns 0 if `versioned` is not set, which sees the latest view.
+uint64_t skiplist_snapshot(skiplist_raw* slist);
+// Let erased nodes go, which were kept only for the snapshot of `seq`.
+void skiplist_snapshot_release(skiplist_raw* slist,
+                               uint64_t seq);
+// Same as the ones without `snapshot`, on the snapshot of `seq`.
+skiplist_node* skiplist_snapshot_find(skiplist_raw* slist,
+                                      uint64_t seq,
+                                      skiplist_node* query);
+skiplist_node* skiplist_snapshot_find_greater_or_equal(skiplist_raw* slist,
+                                                       uint64_t seq,
+                                                       skiplist_node* query);
+skiplist_node* skiplist_snapshot_next(skiplist_raw* slist,
+                                      uint64_t seq,
+                                      skiplist_node* node);
+skiplist_node* skiplist_snapshot_prev(skiplist_raw* slist,
+                                      uint64_t seq,
+                                      skiplist_node* node);
+skiplist_node* skiplist_snapshot_begin(skiplist_raw* slist,
+                                       uint64_t seq);
+
 skiplist_node* skiplist_next(skiplist_raw* slist,
                              skiplist_node* node);
 skiplist_node* skiplist_prev(skiplist_raw* slist,
@@ -0,0 +1,328 @@
+/**
+ * Copyright (C) 2017-present Jung-Sang Ahn <jungsang.ahn@gmail.com>
+ * All rights reserved.
+ *
+ * https://github.com/greensky00
+ *
+ * Skiplist checkpoint format
+ * Version: 0.2.0
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <type_traits>
+
+#include <stdint.h>
+#include <string.h>
+
+// Checkpoint of `sl_map` or `sl_set`, in the byte order of the host:
+//
+//   header:  magic "SLCKPT01", version, flags, key size, value size,
+//            CRC32 of the fields before it (all 4 bytes but magic).
+//   blocks:  number of records, payload size, CRC32 of them and the
+//            payload (4 bytes each), and then the payload: records in
+//            key order.
+//   end:     a block of 0 records, whose payload is the total number
+//            of records (8 bytes).
+//
+// A record is the key, followed by the value for `sl_map`, each written
+// by its `sl_serializer`. Key or value size in the header is 0 if its
+// records are length-prefixed.
+
+#define _SL_CKPT_MAGIC "SLCKPT01"
+#define _SL_CKPT_VERSION (1)
+#define _SL_CKPT_HAS_VALUE (0x1)
+// Records are flushed as a block once its payload reaches this size.
+#define _SL_CKPT_BLOCK_SIZE (64 * 1024)
+
+// Write and read a key or a value. The default one copies the bytes of
+// a trivially copyable type (fixed size). Specialize it for other types,
+// with `fixed_size = 0`, e.g., as done for `std::string`.
+template<typename T, typename Enable = void>
+struct sl_serializer {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "specialize sl_serializer for this type");
+    // Size of every record, or 0 if they vary.
+    static const uint32_t fixed_size = sizeof(T);
+
+    static void write(const T& val, std::string& buf) {
+        buf.append(reinterpret_cast<const char*>(&val), sizeof(T));
+    }
+
+    // Read from `pos` and advance it, false if it passes `end`.
+    static bool read(const char*& pos, const char* end, T& val) {
+        if ((size_t)(end - pos) < sizeof(T)) return false;
+        memcpy(&val, pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+};
+
+template<>
+struct sl_serializer<std::string> {
+    static const uint32_t fixed_size = 0;
+
+    static void write(const std::string& val, std::string& buf) {
+        uint32_t len = val.size();
+        buf.append(reinterpret_cast<const char*>(&len), sizeof(len));
+        buf.append(val);
+    }
+
+    static bool read(const char*& pos, const char* end, std::string& val) {
+        uint32_t len;
+        if ((size_t)(end - pos) < sizeof(len)) return false;
+        memcpy(&len, pos, sizeof(len));
+        pos += sizeof(len);
+        if ((size_t)(end - pos) < len) return false;
+        val.assign(pos, len);
+        pos += len;
+        return true;
+    }
+};
+
+// Value of the records of `sl_set`, which has none.
+struct sl_checkpoint_no_value {};
+
+template<>
+struct sl_serializer<sl_checkpoint_no_value> {
+    static const uint32_t fixed_size = 0;
+
+    static void write(const sl_checkpoint_no_value&, std::string&) {}
+
+    static bool read(const char*&, const char*, sl_checkpoint_no_value&) {
+        return true;
+    }
+};
+
+// CRC32 (IEEE 802.3) of `len` bytes at `data`, continued from `crc`.
+inline uint32_t sl_crc32(const void* data, size_t len, uint32_t crc = 0) {
+    struct Table {
+        Table() {
+            for (uint32_t ii = 0; ii < 256; ++ii) {
+                uint32_t cc = ii;
+                for (int jj = 0; jj < 8; ++jj) {
+                    cc = (cc & 1) ? (0xedb88320 ^ (cc >> 1)) : (cc >> 1);
+                }
+                entries[ii] = cc;
+            }
+        }
+        uint32_t entries[256];
+    };
+    static const Table table;
+
+    const uint8_t* pos = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (size_t ii = 0; ii < len; ++ii) {
+        crc = table.entries[(crc ^ pos[ii]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+struct sl_checkpoint_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t key_size;
+    uint32_t value_size;
+    uint32_t crc;
+};
+
+struct sl_checkpoint_block {
+    uint32_t num_records;
+    uint32_t size;
+    uint32_t crc;
+};
+
+// CRC32 of `blk` and its payload.
+inline uint32_t _sl_ckpt_block_crc(const sl_checkpoint_block& blk,
+                                   const std::string& payload) {
+    uint32_t crc = sl_crc32(&blk, offsetof(sl_checkpoint_block, crc));
+    return sl_crc32(payload.data(), payload.size(), crc);
+}
+
+// Whether records of `V` have values in the header.
+template<typename V>
+inline uint32_t _sl_ckpt_flags() {
+    return std::is_same<V, sl_checkpoint_no_value>::value
+           ? 0 : _SL_CKPT_HAS_VALUE;
+}
+
+// Stream of records to `out`, buffered and written block by block.
+template<typename K, typename V>
+class sl_checkpoint_writer {
+public:
+    sl_checkpoint_writer(std::ostream& _out)
+        : out(_out), numRecords(0), numTotal(0)
+    {
+        sl_checkpoint_header hdr;
+        memcpy(hdr.magic, _SL_CKPT_MAGIC, sizeof(hdr.magic));
+        hdr.version = _SL_CKPT_VERSION;
+        hdr.flags = _sl_ckpt_flags<V>();
+        hdr.key_size = sl_serializer<K>::fixed_size;
+        hdr.value_size = sl_serializer<V>::fixed_size;
+        hdr.crc = sl_crc32(&hdr, offsetof(sl_checkpoint_header, crc));
+        out.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        buf.reserve(_SL_CKPT_BLOCK_SIZE + 1024);
+    }
+
+    void add(const K& key, const V& value) {
+        sl_serializer<K>::write(key, buf);
+        sl_serializer<V>::write(value, buf);
+        numRecords++;
+        if (buf.size() >= _SL_CKPT_BLOCK_SIZE) flush();
+    }
+
+    // Write the rest and the end block. Return 0 on success,
+    // -1 if `out` failed.
+    int finish() {
+        flush();
+        buf.assign(reinterpret_cast<const char*>(&numTotal),
+                   sizeof(numTotal));
+        flush();
+        out.flush();
+        return out.good() ? 0 : -1;
+    }
+
+private:
+    void flush() {
+        if (buf.empty()) return;
+        sl_checkpoint_block blk;
+        blk.num_records = numRecords;
+        blk.size = buf.size();
+        blk.crc = _sl_ckpt_block_crc(blk, buf);
+        out.write(reinterpret_cast<const char*>(&blk), sizeof(blk));
+        out.write(buf.data(), buf.size());
+        numTotal += numRecords;
+        numRecords = 0;
+        buf.clear();
+    }
+
+    std::ostream& out;
+    std::string buf;
+    uint32_t numRecords;
+    uint64_t numTotal;
+};
+
+// Records of a checkpoint from `in`, verified block by block.
+template<typename K, typename V>
+class sl_checkpoint_reader {
+public:
+    sl_checkpoint_reader(std::istream& _in)
+        : in(_in), numLeft(0), numTotal(0)
+        , pos(nullptr), end(nullptr) {}
+
+    // Return 0 if the header matches `K`, `V`, and their serializers,
+    // -1 if `in` ends, -2 otherwise.
+    int open() {
+        sl_checkpoint_header hdr;
+        if (!readBytes(&hdr, sizeof(hdr))) return -1;
+        uint32_t key_size = sl_serializer<K>::fixed_size;
+        uint32_t value_size = sl_serializer<V>::fixed_size;
+        if ( memcmp(hdr.magic, _SL_CKPT_MAGIC, sizeof(hdr.magic)) ||
+             hdr.crc != sl_crc32(&hdr, offsetof(sl_checkpoint_header, crc)) ||
+             hdr.version != _SL_CKPT_VERSION ||
+             hdr.flags != _sl_ckpt_flags<V>() ||
+             hdr.key_size != key_size ||
+             hdr.value_size != value_size ) {
+            return -2;
+        }
+        return 0;
+    }
+
+    // Read the next record. Return 1 if read, 0 at the end, -1 if `in`
+    // ends before the end block, -2 if a block is broken.
+    int next(K& key, V& value) {
+        while (!numLeft) {
+            if (pos != end) return -2;
+            sl_checkpoint_block blk;
+            if (!readBytes(&blk, sizeof(blk))) return -1;
+            if (!validSize(blk)) return -2;
+            if (!readPayload(blk.size)) return -1;
+            if (blk.crc != _sl_ckpt_block_crc(blk, buf)) return -2;
+            pos = buf.data();
+            end = pos + buf.size();
+
+            if (!blk.num_records) {
+                uint64_t total;
+                if (buf.size() != sizeof(total)) return -2;
+                memcpy(&total, pos, sizeof(total));
+                pos = end;
+                return (total == numTotal) ? 0 : -2;
+            }
+            numLeft = blk.num_records;
+            numTotal += blk.num_records;
+        }
+
+        if (!sl_serializer<K>::read(pos, end, key)) return -2;
+        if (!sl_serializer<V>::read(pos, end, value)) return -2;
+        numLeft--;
+        return 1;
+    }
+
+private:
+    bool readBytes(void* dst, size_t len) {
+        in.read(static_cast<char*>(dst), len);
+        return (size_t)in.gcount() == len;
+    }
+
+    // Whether the payload size of `blk` is one the writer can make.
+    // With fixed-size records, a block has room for just one more
+    // record than `_SL_CKPT_BLOCK_SIZE`.
+    static bool validSize(const sl_checkpoint_block& blk) {
+        if (!blk.num_records) return blk.size == sizeof(uint64_t);
+        bool no_value = std::is_same<V, sl_checkpoint_no_value>::value;
+        uint64_t key_size = sl_serializer<K>::fixed_size;
+        uint64_t value_size = sl_serializer<V>::fixed_size;
+        if (!key_size || (!value_size && !no_value)) return true;
+        uint64_t record_size = key_size + value_size;
+        return blk.size == blk.num_records * record_size &&
+               blk.size < _SL_CKPT_BLOCK_SIZE + record_size;
+    }
+
+    // Read `len` bytes of payload into `buf`, growing it as they
+    // arrive, so that a broken size allocates no more than `in` has.
+    bool readPayload(size_t len) {
+        buf.clear();
+        while (buf.size() < len) {
+            size_t done = buf.size();
+            size_t chunk = std::min<size_t>(len - done, _SL_CKPT_BLOCK_SIZE);
+            buf.resize(done + chunk);
+            if (!readBytes(&buf[done], chunk)) return false;
+        }
+        return true;
+    }
+
+    std::istream& in;
+    std::string buf;
+    uint32_t numLeft;
+    uint64_t numTotal;
+    const char* pos;
+    const char* end;
+};
+
@@ -0,0 +1,3106 @@
+/**
+ * Copyright (C) 2017-present Jung-Sang Ahn <jungsang.ahn@gmail.com>
+ * All rights reserved.
+ *
+ * https://github.com/greensky00
+ *
+ * Skiplist engine
+ * Version: 0.2.9
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Skiplist engine, templated on the comparator so that it can be inlined.
+// The C API in `skiplist.cc` instantiates it with `cmp_func`, and the
+// C++ containers (`sl_map`, `sl_set`) with their key comparison.
+//
+// `Cmp` is constructed from `skiplist_raw*` at the beginning of each
+// operation, and `cmp(a, b)` returns negative, 0, or positive like
+// `skiplist_cmp_t`. Head and tail are never passed to it: searches start
+// from the head, and the tail is recognized by address before comparing.
+
+#pragma once
+
+#ifndef __cplusplus
+    #error "Skiplist engine is available with C++ compiler only."
+#endif
+
+#include "skiplist.h"
+
+#include <stdlib.h>
+#include <thread>
+
+#if defined(__linux__)
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+#define __SLD_RT_INS(e, n, t, c)
+#define __SLD_NC_INS(n, nn, t, c)
+#define __SLD_RT_RMV(e, n, t, c)
+#define __SLD_NC_RMV(n, nn, t, c)
+#define __SLD_BM(n)
+#define __SLD_ASSERT(cond)
+#define __SLD_P(args...)
+#define __SLD_(b)
+
+//#define __SL_DEBUG (1)
+#ifdef __SL_DEBUG
+    #include "skiplist_debug.h"
+#endif
+
+#define __SL_YIELD (1)
+#ifdef __SL_YIELD
+    #define YIELD() std::this_thread::yield()
+#else
+    #define YIELD()
+#endif
+
+// Hints to load the nodes on the way ahead of time.
+// Build with `_SL_NO_PREFETCH` to drop all of them. The ones on the search
+// path can also be turned off at runtime by `searchPrefetch`.
+#ifndef _SL_NO_PREFETCH
+    #define __SL_PREFETCH (1)
+#endif
+#ifdef __SL_PREFETCH
+    #define PREFETCH(addr) __builtin_prefetch((addr), 0, 3)
+#else
+    #define PREFETCH(addr)
+#endif
+
+#if defined(_STL_ATOMIC)
+    // C++ (STL) atomic operations
+    #define MOR                         std::memory_order_relaxed
+    #define ATM_GET(var)                (var).load(MOR)
+    #define ATM_LOAD(var, val)          (val) = (var).load(MOR)
+    #define ATM_STORE(var, val)         (var).store((val), MOR)
+    #define ATM_CAS(var, exp, val)      (var).compare_exchange_weak((exp), (val))
+    #define ATM_FETCH_ADD(var, val)     (var).fetch_add(val, MOR)
+    #define ATM_FETCH_SUB(var, val)     (var).fetch_sub(val, MOR)
+    #define ATM_FETCH_AND(var, val)     (var).fetch_and(val, MOR)
+    #define ATM_FETCH_OR(var, val)      (var).fetch_or(val, MOR)
+    #define ATM_STORE_REL(var, val)     \
+            (var).store((val), std::memory_order_release)
+    #define ATM_FENCE()                 \
+            std::atomic_thread_fence(std::memory_order_seq_cst)
+    #define ALLOC_(type, var, count)    (var) = new type[count]
+    #define FREE_(var)                  delete[] (var)
+#else
+    // GCC built-in atomic operations
+    #define MOR                         __ATOMIC_RELAXED
+    #define ATM_GET(var)                (var)
+    #define ATM_LOAD(var, val)          __atomic_load(&(var), &(val), MOR)
+    #define ATM_STORE(var, val)         __atomic_store(&(var), &(val), MOR)
+    #define ATM_CAS(var, exp, val)      \
+            __atomic_compare_exchange(&(var), &(exp), &(val), 1, MOR, MOR)
+    #define ATM_FETCH_ADD(var, val)     __atomic_fetch_add(&(var), (val), MOR)
+    #define ATM_FETCH_SUB(var, val)     __atomic_fetch_sub(&(var), (val), MOR)
+    #define ATM_FETCH_AND(var, val)     __atomic_fetch_and(&(var), (val), MOR)
+    #define ATM_FETCH_OR(var, val)      __atomic_fetch_or(&(var), (val), MOR)
+    #define ATM_STORE_REL(var, val)     \
+            __atomic_store(&(var), &(val), __ATOMIC_RELEASE)
+    #define ATM_FENCE()                 __atomic_thread_fence(__ATOMIC_SEQ_CST)
+    #define ALLOC_(type, var, count)    \
+            (var) = (type*)calloc(count, sizeof(type))
+    #define FREE_(var)                  free(var)
+#endif
+
+// ==== Memory reclamation records (see `skiplist.cc`) ====
+
+// Number of limbo entries that triggers reclamation of a record.
+#define _SL_LIMBO_THRESHOLD (64)
+
+// Max number of nodes that an operation protects at the same time.
+#define _SL_NUM_HAZARDS (8)
+
+typedef struct {
+    skiplist_node* node;
+    skiplist_node_cb_t* free_func;
+    void* ctx;
+    uint64_t epoch;
+} _sl_limbo_entry;
+
+typedef struct _sl_reclaim_rec {
+    // Epoch announced by the current operation, 0 if quiescent.
+    atm_uint64_t epoch;
+    atm_node_ptr hazards[_SL_NUM_HAZARDS];
+    atm_bool in_use;
+    // Record of the outer operation of this thread, if nested.
+    struct _sl_reclaim_rec* saved;
+    _sl_limbo_entry* limbo;
+    size_t num_limbo;
+    size_t limbo_size;
+    // Reclaim when `num_limbo` reaches this number.
+    size_t reclaim_at;
+    struct _sl_reclaim_rec* next;
+    // To avoid false sharing between records.
+    uint8_t padding[64];
+} _sl_reclaim_rec;
+
+#if defined(_STL_ATOMIC)
+    typedef std::atomic<_sl_reclaim_rec*> atm_rec_ptr;
+    typedef std::atomic<skiplist_hazard*> atm_hazard_ptr;
+#else
+    typedef _sl_reclaim_rec* atm_rec_ptr;
+    typedef skiplist_hazard* atm_hazard_ptr;
+#endif
+
+struct _skiplist_reclaim {
+    // Unique ID, to validate the record cached by each thread.
+    uint64_t id;
+    atm_uint64_t global_epoch;
+    atm_rec_ptr recs;
+    // Hazard slots for iterators.
+    atm_hazard_ptr hazards;
+};
+
+// ==== Entry counters ====
+
+// Number of shards of the entry counter, and the delta at which a shard
+// is flushed into `slist->num_entries`.
+#define _SL_SIZE_SHARDS (16)
+#define _SL_SIZE_BATCH (64)
+
+struct _skiplist_size_shard {
+    // Signed, in two's complement.
+    atm_uint64_t delta;
+    // To avoid false sharing between shards.
+    uint8_t padding[64];
+};
+
+// Shard of the current thread, assigned in round-robin.
+inline size_t _sl_shard_idx()
+{
+    static atm_uint32_t next_idx(0);
+    static thread_local size_t idx =
+        ATM_FETCH_ADD(next_idx, 1) % _SL_SIZE_SHARDS;
+    return idx;
+}
+
+// ==== Versions (see `skiplist.cc`) ====
+
+// `erase_seq` of a node not erased.
+#define _SL_SEQ_NONE (UINT64_MAX)
+// Sequence number to see the latest view, instead of a snapshot.
+#define _SL_SEQ_LATEST (UINT64_MAX)
+
+typedef struct _sl_snapshot_slot {
+    // Sequence number of a snapshot, `_SL_SEQ_NONE` if not in use.
+    atm_uint64_t seq;
+    struct _sl_snapshot_slot* next;
+} _sl_snapshot_slot;
+
+// Erased node handed over to `skiplist_retire_node()`,
+// while it is still linked for old snapshots.
+typedef struct _sl_version_entry {
+    skiplist_node* node;
+    skiplist_node_cb_t* free_func;
+    void* ctx;
+    // `erase_seq` of `node`, the order of the pending list.
+    uint64_t erase_seq;
+    struct _sl_version_entry* prev;
+    struct _sl_version_entry* next;
+} _sl_version_entry;
+
+#if defined(_STL_ATOMIC)
+    typedef std::atomic<_sl_snapshot_slot*> atm_slot_ptr;
+    typedef std::atomic<_sl_version_entry*> atm_version_ptr;
+#else
+    typedef _sl_snapshot_slot* atm_slot_ptr;
+    typedef _sl_version_entry* atm_version_ptr;
+#endif
+
+struct _skiplist_versions {
+    // Sequence number given to the last write.
+    atm_uint64_t last_seq;
+    // Writes up to this number are done, and seen by new snapshots.
+    atm_uint64_t visible_seq;
+    atm_slot_ptr snapshots;
+    // Erased nodes still linked, in ascending order of `erase_seq`, so
+    // that a purge stops at the first one still seen by a snapshot.
+    // Erases are retired mostly in order, hence inserted near the tail.
+    atm_bool pending_lock;
+    _sl_version_entry* pending_head;
+    _sl_version_entry* pending_tail;
+    // Unlinked nodes still referenced by readers in
+    // `SKIPLIST_RECLAIM_REFCOUNT` mode, freed by a later purge.
+    atm_version_ptr deferred;
+};
+
+// Get a sequence number for a write.
+inline uint64_t _sl_seq_begin(skiplist_raw* slist)
+{
+    return ATM_FETCH_ADD(slist->versions->last_seq, 1) + 1;
+}
+
+// Make the write of `seq` visible, after all writes before it,
+// so that a snapshot sees either all or none of the writes up to `seq`.
+inline void _sl_seq_end(skiplist_raw* slist,
+                        uint64_t seq)
+{
+    uint64_t visible = 0;
+    for (;;) {
+        ATM_LOAD(slist->versions->visible_seq, visible);
+        if (visible == seq - 1) break;
+        YIELD();
+    }
+    ATM_FENCE();
+    ATM_STORE(slist->versions->visible_seq, seq);
+    ATM_FENCE();
+}
+
+// Erased nodes of `erase_seq` up to the returned number
+// are not seen by any snapshot, including the ones taken later.
+inline uint64_t _sl_oldest_snapshot(skiplist_raw* slist)
+{
+    uint64_t oldest = 0, seq = 0;
+    ATM_LOAD(slist->versions->visible_seq, oldest);
+    ATM_FENCE();
+    _sl_snapshot_slot* slot = NULL;
+    ATM_LOAD(slist->versions->snapshots, slot);
+    for (; slot; slot = slot->next) {
+        ATM_LOAD(slot->seq, seq);
+        if (seq < oldest) oldest = seq;
+    }
+    return oldest;
+}
+
+// Grab a free record of `rc`, defined in `skiplist.cc`.
+_sl_reclaim_rec* _sl_rec_acquire(struct _skiplist_reclaim* rc);
+
+inline void _sl_rec_release(_sl_reclaim_rec* rec)
+{
+    bool bool_false = false;
+    ATM_STORE_REL(rec->in_use, bool_false);
+}
+
+// Record of the current operation in hazard pointer mode.
+// Being an inline function, there is only one across all binaries.
+inline _sl_reclaim_rec*& _sl_hp_rec()
+{
+    static thread_local _sl_reclaim_rec* rec = NULL;
+    return rec;
+}
+
+// ==== Traversal primitives ====
+// Begin an operation, returns NULL in refcount mode.
+inline _sl_reclaim_rec* _sl_op_begin(skiplist_raw* slist)
+{
+    if ( slist->reclaim_mode == SKIPLIST_RECLAIM_REFCOUNT ||
+         slist->reclaim_mode == SKIPLIST_RECLAIM_NONE ) {
+        return NULL;
+    }
+
+    struct _skiplist_reclaim* rc = slist->reclaim;
+    _sl_reclaim_rec* rec = _sl_rec_acquire(rc);
+
+    if (slist->reclaim_mode == SKIPLIST_RECLAIM_HAZARD) {
+        rec->saved = _sl_hp_rec();
+        _sl_hp_rec() = rec;
+        return rec;
+    }
+
+    uint64_t epoch = 0, epoch_again = 0;
+    ATM_LOAD(rc->global_epoch, epoch);
+    for (;;) {
+        ATM_STORE(rec->epoch, epoch);
+        ATM_FENCE();
+        // Global epoch may have moved before we announce it.
+        ATM_LOAD(rc->global_epoch, epoch_again);
+        if (epoch == epoch_again) break;
+        epoch = epoch_again;
+    }
+    return rec;
+}
+
+inline void _sl_op_end(skiplist_raw* slist,
+                       _sl_reclaim_rec* rec)
+{
+    if (!rec) return;
+    if (slist->reclaim_mode == SKIPLIST_RECLAIM_HAZARD) {
+        _sl_hp_rec() = rec->saved;
+        rec->saved = NULL;
+    } else {
+        uint64_t epoch = 0;
+        ATM_STORE_REL(rec->epoch, epoch);
+    }
+    _sl_rec_release(rec);
+}
+
+inline void _sl_hp_set(skiplist_node* node)
+{
+    if (!node) return;
+    _sl_reclaim_rec* rec = _sl_hp_rec();
+    skiplist_node* empty = NULL;
+    size_t ii;
+    for (ii = 0; ii < _SL_NUM_HAZARDS; ++ii) {
+        ATM_LOAD(rec->hazards[ii], empty);
+        if (!empty) {
+            ATM_STORE(rec->hazards[ii], node);
+            return;
+        }
+    }
+    // Should not happen: exceeded `_SL_NUM_HAZARDS`.
+    __SLD_ASSERT(0);
+}
+
+inline void _sl_hp_clear(skiplist_node* node)
+{
+    if (!node) return;
+    _sl_reclaim_rec* rec = _sl_hp_rec();
+    skiplist_node* cur = NULL;
+    skiplist_node* null_node = NULL;
+    size_t ii;
+    for (ii = 0; ii < _SL_NUM_HAZARDS; ++ii) {
+        ATM_LOAD(rec->hazards[ii], cur);
+        if (cur == node) {
+            ATM_STORE_REL(rec->hazards[ii], null_node);
+            return;
+        }
+    }
+    __SLD_ASSERT(0);
+}
+
+// ==== Node state ====
+
+// Fields of `skiplist_node::state`, so that a check of the state is
+// a single load, and each update is a single atomic operation:
+//   * bits 0-31: `accessing_next` (`_SL_AN_*` below), the low half so
+//     that futex can wait on it.
+//   * bit 32: fully linked, bit 33: being modified, bit 34: removed.
+//   * bits 35-41: top layer, bits 42-48: layers of the inline tower,
+//     or if `next` is on heap, 0 or `SKIPLIST_MAX_LAYER` plus the
+//     slots for options it was allocated with (see `_sl_node_init()`).
+//   * bits 49-63: `ref_count`, at the top so that it cannot carry over
+//     into other fields.
+#define _SL_ST_AN           (0x00000000ffffffffULL)
+#define _SL_ST_LINKED       (0x0000000100000000ULL)
+#define _SL_ST_MODIFYING    (0x0000000200000000ULL)
+#define _SL_ST_REMOVED      (0x0000000400000000ULL)
+#define _SL_ST_TOP_SHIFT    (35)
+#define _SL_ST_TOWER_SHIFT  (42)
+#define _SL_ST_LAYER_MASK   (0x7fULL)
+#define _SL_ST_REF_SHIFT    (49)
+#define _SL_ST_REF          (1ULL << _SL_ST_REF_SHIFT)
+
+inline uint64_t _sl_state(skiplist_node* node)
+{
+    uint64_t state = 0;
+    ATM_LOAD(node->state, state);
+    return state;
+}
+
+inline bool _sl_fully_linked(skiplist_node* node)
+{
+    return _sl_state(node) & _SL_ST_LINKED;
+}
+
+inline bool _sl_being_modified(skiplist_node* node)
+{
+    return _sl_state(node) & _SL_ST_MODIFYING;
+}
+
+inline bool _sl_removed(skiplist_node* node)
+{
+    return _sl_state(node) & _SL_ST_REMOVED;
+}
+
+inline size_t _sl_top_layer(skiplist_node* node)
+{
+    return (_sl_state(node) >> _SL_ST_TOP_SHIFT) & _SL_ST_LAYER_MASK;
+}
+
+inline size_t _sl_tower_size(skiplist_node* node)
+{
+    size_t tower = (_sl_state(node) >> _SL_ST_TOWER_SHIFT) & _SL_ST_LAYER_MASK;
+    return (tower <= SKIPLIST_MAX_LAYER) ? tower : 0;
+}
+
+// Slots for options that the heap tower of `node` was allocated with.
+inline size_t _sl_heap_ext_slots(skiplist_node* node)
+{
+    size_t tower = (_sl_state(node) >> _SL_ST_TOWER_SHIFT) & _SL_ST_LAYER_MASK;
+    return (tower > SKIPLIST_MAX_LAYER) ? tower - SKIPLIST_MAX_LAYER : 0;
+}
+
+inline uint32_t _sl_ref_count(skiplist_node* node)
+{
+    return _sl_state(node) >> _SL_ST_REF_SHIFT;
+}
+
+// Set or clear `flag` (`_SL_ST_LINKED`, ...).
+inline void _sl_set_state(skiplist_node* node, uint64_t flag, bool on)
+{
+    if (on) {
+        ATM_FETCH_OR(node->state, flag);
+    } else {
+        ATM_FETCH_AND(node->state, ~flag);
+    }
+}
+
+// Set `flag`, and return false if it was already set.
+inline bool _sl_try_set_state(skiplist_node* node, uint64_t flag)
+{
+    return !(ATM_FETCH_OR(node->state, flag) & flag);
+}
+
+inline void _sl_set_layers(skiplist_node* node,
+                           size_t top_layer,
+                           size_t tower_size)
+{
+    uint64_t mask = (_SL_ST_LAYER_MASK << _SL_ST_TOP_SHIFT) |
+                    (_SL_ST_LAYER_MASK << _SL_ST_TOWER_SHIFT);
+    uint64_t layers = ((uint64_t)top_layer << _SL_ST_TOP_SHIFT) |
+                      ((uint64_t)tower_size << _SL_ST_TOWER_SHIFT);
+    uint64_t state = _sl_state(node);
+    uint64_t new_state;
+    do {
+        new_state = (state & ~mask) | layers;
+    } while (!ATM_CAS(node->state, state, new_state));
+}
+
+// Protect `node` during a traversal step. In epoch mode,
+// the epoch announced by the operation already does it,
+// and in `SKIPLIST_RECLAIM_NONE` nodes are never freed.
+// `node` should be already protected, use `_sl_grab_next()`
+// to protect a node newly read from a link.
+inline void _sl_grab(skiplist_raw* slist,
+                     skiplist_node* node)
+{
+    if (slist->reclaim_mode == SKIPLIST_RECLAIM_REFCOUNT) {
+        ATM_FETCH_ADD(node->state, _SL_ST_REF);
+    } else if (slist->reclaim_mode == SKIPLIST_RECLAIM_HAZARD) {
+        _sl_hp_set(node);
+    }
+}
+
+inline void _sl_release(skiplist_raw* slist,
+                        skiplist_node* node)
+{
+    if (slist->reclaim_mode == SKIPLIST_RECLAIM_REFCOUNT) {
+        ATM_FETCH_SUB(node->state, _SL_ST_REF);
+    } else if (slist->reclaim_mode == SKIPLIST_RECLAIM_HAZARD) {
+        _sl_hp_clear(node);
+    }
+}
+
+// Nodes returned by API always carry `ref_count`,
+// as they should stay alive after the operation is done.
+inline skiplist_node* _sl_pin(skiplist_raw* slist,
+                              skiplist_node* node)
+{
+    if (node && slist->reclaim_mode != SKIPLIST_RECLAIM_REFCOUNT) {
+        ATM_FETCH_ADD(node->state, _SL_ST_REF);
+        if (slist->reclaim_mode == SKIPLIST_RECLAIM_HAZARD) {
+            // `ref_count` should be visible before clearing the slot.
+            ATM_FENCE();
+            _sl_hp_clear(node);
+        }
+    }
+    return node;
+}
+
+// Number of `atm_node_ptr` slots of a tower of `num_layers`: `next`
+// pointers followed by the spans of the links (`atm_uint32_t` each).
+inline size_t _sl_tower_slots(size_t num_layers)
+{
+    size_t span_bytes = num_layers * sizeof(atm_uint32_t);
+    return num_layers +
+           (span_bytes + sizeof(atm_node_ptr) - 1) / sizeof(atm_node_ptr);
+}
+
+// Number of layers the tower of `node` has room for.
+inline size_t _sl_tower_layers(skiplist_node *node)
+{
+    uint64_t state = _sl_state(node);
+    size_t num_layers = (state >> _SL_ST_TOWER_SHIFT) & _SL_ST_LAYER_MASK;
+    if (!num_layers || num_layers > SKIPLIST_MAX_LAYER) {
+        num_layers = ((state >> _SL_ST_TOP_SHIFT) & _SL_ST_LAYER_MASK) + 1;
+    }
+    return num_layers;
+}
+
+// Spans of the links of `node`: `span[layer]` is the number of
+// layer-0 steps from `node` to `next[layer]`. Maintained in an indexable
+// skiplist only, and not meaningful for the links to the tail.
+inline atm_uint32_t* _sl_span(skiplist_node *node)
+{
+    return (atm_uint32_t*)(node->next + _sl_tower_layers(node));
+}
+
+// Slots taken by a sequence number at the end of the tower.
+#define _SL_SEQ_SLOTS \
+    ((sizeof(atm_uint64_t) + sizeof(atm_node_ptr) - 1) / sizeof(atm_node_ptr))
+
+// Slots at the end of the tower, only for the options of the skiplist
+// that need them: `prev` if `backward_links` is set, and then the
+// insert and erase sequence numbers if `versioned` is set.
+// Head and tail always have room for all of them.
+#define _SL_EXT_SLOTS_MAX (1 + 2 * _SL_SEQ_SLOTS)
+
+inline size_t _sl_ext_slots(skiplist_raw *slist)
+{
+    return (slist->backward_links ? 1 : 0) +
+           (slist->versioned ? 2 * _SL_SEQ_SLOTS : 0);
+}
+
+inline atm_node_ptr* _sl_ext(skiplist_node *node)
+{
+    return node->next + _sl_tower_slots(_sl_tower_layers(node));
+}
+
+// Previous node on layer 0, if `backward_links` is set.
+inline atm_node_ptr& _sl_prev_ptr(skiplist_node *node)
+{
+    return _sl_ext(node)[0];
+}
+
+// Sequence numbers of the insert and erase of `node`,
+// if `versioned` is set.
+inline atm_uint64_t& _sl_insert_seq(skiplist_raw *slist,
+                                    skiplist_node *node)
+{
+    return *(atm_uint64_t*)(_sl_ext(node) + (slist->backward_links ? 1 : 0));
+}
+
+inline atm_uint64_t& _sl_erase_seq(skiplist_raw *slist,
+                                   skiplist_node *node)
+{
+    return *(atm_uint64_t*)(_sl_ext(node) + (slist->backward_links ? 1 : 0) +
+                            _SL_SEQ_SLOTS);
+}
+
+// Whether `node` is seen by the snapshot of `seq`.
+inline bool _sl_visible(skiplist_raw* slist,
+                        skiplist_node* node,
+                        uint64_t seq)
+{
+    if ( !slist->versioned ||
+         node == &slist->head ||
+         node == &slist->tail ) {
+        return true;
+    }
+    uint64_t insert_seq = 0, erase_seq = 0;
+    ATM_LOAD(_sl_erase_seq(slist, node), erase_seq);
+    if (seq == _SL_SEQ_LATEST) return (erase_seq == _SL_SEQ_NONE);
+    ATM_LOAD(_sl_insert_seq(slist, node), insert_seq);
+    return (insert_seq <= seq && seq < erase_seq);
+}
+
+// `ext_slots`: see `_sl_ext_slots()`, for a tower allocated here.
+inline void _sl_node_init(skiplist_node *node,
+                          size_t top_layer,
+                          size_t ext_slots)
+{
+    // Head and tail have `SKIPLIST_MAX_LAYER` at most.
+    if (top_layer > SKIPLIST_MAX_LAYER) top_layer = SKIPLIST_MAX_LAYER;
+
+    __SLD_ASSERT(!_sl_fully_linked(node));
+    __SLD_ASSERT(!_sl_being_modified(node));
+
+    _sl_set_state(node, _SL_ST_LINKED | _SL_ST_MODIFYING | _SL_ST_REMOVED,
+                  false);
+
+    size_t tower_size = _sl_tower_size(node);
+    if (tower_size) {
+        // Inline tower: the height is fixed.
+        __SLD_ASSERT(top_layer < tower_size);
+        _sl_set_layers(node, top_layer, tower_size);
+        return;
+    }
+
+    // The slots for options may differ from those of the last insert.
+    if (_sl_top_layer(node) != top_layer ||
+        node->next == NULL ||
+        _sl_heap_ext_slots(node) != ext_slots) {
+
+        _sl_set_layers(node, top_layer,
+                       ext_slots ? SKIPLIST_MAX_LAYER + ext_slots : 0);
+
+        if (node->next) FREE_(node->next);
+        ALLOC_(atm_node_ptr, node->next,
+               _sl_tower_slots(top_layer+1) + ext_slots);
+    }
+}
+
+inline bool _sl_valid_node(skiplist_node *node) {
+    return _sl_fully_linked(node);
+}
+
+// In lock-free mode, the lowest bit of `next` pointers of a node
+// tells that the node is being erased on that layer.
+inline bool _sl_is_marked(skiplist_node *ptr) {
+    return (uintptr_t)ptr & 0x1;
+}
+
+inline skiplist_node* _sl_mark(skiplist_node *ptr) {
+    return (skiplist_node*)((uintptr_t)ptr | 0x1);
+}
+
+inline skiplist_node* _sl_unmark(skiplist_node *ptr) {
+    return (skiplist_node*)((uintptr_t)ptr & ~(uintptr_t)0x1);
+}
+
+// `accessing_next` (the low half of `state`) is a reader-writer lock
+// on the `next` pointers:
+// number of writers on the upper 12 bits, and readers on the lower 19
+// bits. A registered writer blocks new readers, so that writers are
+// not starved by readers. The bit in between tells that some threads
+// are parked on it, and whoever releases the lock wakes them up.
+#define _SL_AN_READER       (0x00000001)
+#define _SL_AN_READERS      (0x0007ffff)
+#define _SL_AN_PARKED       (0x00080000)
+#define _SL_AN_WRITER       (0x00100000)
+#define _SL_AN_WRITERS      (0xfff00000)
+
+// Max number of pause instructions of a single backoff step
+// in `SKIPLIST_WAIT_SPIN_PARK` mode, before parking.
+#define _SL_SPIN_MAX        (1024)
+
+inline void _sl_cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+// `accessing_next` of `node`, to wait on.
+inline uint32_t* _sl_an_addr(skiplist_node* node)
+{
+    uint32_t* addr = (uint32_t*)&node->state;
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    addr++;
+#endif
+    return addr;
+}
+
+// Sleep while `*addr == val`, or yield if futex is not available.
+inline void _sl_futex_wait(uint32_t* addr, uint32_t val)
+{
+#if defined(__linux__)
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val,
+            NULL, NULL, 0);
+#else
+    (void)addr;
+    (void)val;
+    YIELD();
+#endif
+}
+
+inline void _sl_futex_wake_all(uint32_t* addr)
+{
+#if defined(__linux__)
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT32_MAX,
+            NULL, NULL, 0);
+#else
+    (void)addr;
+#endif
+}
+
+// Wait until none of `mask` bits is set in `accessing_next` of `node`.
+inline void _sl_an_wait(skiplist_raw* slist,
+                        skiplist_node* node,
+                        uint32_t mask)
+{
+    uint64_t state = _sl_state(node);
+    if (!(state & mask)) return;
+
+    if (slist->wait_mode != SKIPLIST_WAIT_SPIN_PARK) {
+        while (state & mask) {
+            YIELD();
+            state = _sl_state(node);
+        }
+        return;
+    }
+
+    // Spin with exponential backoff first, as the lock is
+    // usually held for a few link updates.
+    uint32_t backoff, ii;
+    for (backoff = 1; backoff <= _SL_SPIN_MAX; backoff <<= 1) {
+        for (ii = 0; ii < backoff; ++ii) _sl_cpu_relax();
+        state = _sl_state(node);
+        if (!(state & mask)) return;
+    }
+
+    // And then park. Changes of the other fields of `state` just wake
+    // it up early, as futex looks at `accessing_next` only.
+    for (;;) {
+        state = _sl_state(node);
+        if (!(state & mask)) return;
+        uint64_t parked = state | _SL_AN_PARKED;
+        if ( !(state & _SL_AN_PARKED) &&
+             !ATM_CAS(node->state, state, parked) ) {
+            continue;
+        }
+        _sl_futex_wait(_sl_an_addr(node), (uint32_t)parked);
+    }
+}
+
+// Take `val` back from `accessing_next` of `node`,
+// and wake up parked threads if any.
+inline void _sl_an_release(skiplist_node* node,
+                           uint32_t val)
+{
+    uint64_t prev = ATM_FETCH_SUB(node->state, (uint64_t)val);
+    if (prev & _SL_AN_PARKED) {
+        ATM_FETCH_AND(node->state, ~(uint64_t)_SL_AN_PARKED);
+        _sl_futex_wake_all(_sl_an_addr(node));
+    }
+}
+
+inline void _sl_read_lock_an(skiplist_raw* slist,
+                             skiplist_node* node) {
+    for(;;) {
+        // Wait for active writer to release the lock
+        _sl_an_wait(slist, node, _SL_AN_WRITERS);
+
+        uint64_t accessing_next =
+            ATM_FETCH_ADD(node->state, (uint64_t)_SL_AN_READER);
+        if ((accessing_next & _SL_AN_WRITERS) == 0) {
+            return;
+        }
+
+        _sl_an_release(node, _SL_AN_READER);
+    }
+}
+
+inline void _sl_read_unlock_an(skiplist_node* node) {
+    _sl_an_release(node, _SL_AN_READER);
+}
+
+inline void _sl_write_lock_an(skiplist_raw* slist,
+                              skiplist_node* node) {
+    for(;;) {
+        // Wait for active writer to release the lock
+        _sl_an_wait(slist, node, _SL_AN_WRITERS);
+
+        uint64_t accessing_next =
+            ATM_FETCH_ADD(node->state, (uint64_t)_SL_AN_WRITER);
+        if ((accessing_next & _SL_AN_WRITERS) == 0) {
+            // Wait until there's no more readers
+            _sl_an_wait(slist, node, _SL_AN_READERS);
+            return;
+        }
+
+        _sl_an_release(node, _SL_AN_WRITER);
+    }
+}
+
+inline void _sl_write_unlock_an(skiplist_node* node) {
+    _sl_an_release(node, _SL_AN_WRITER);
+}
+
+// Start loading the header of `node`, and the key of its entry,
+// which is usually right after the header, at the same time.
+inline void _sl_prefetch_node(skiplist_node* node)
+{
+    (void)node;
+    PREFETCH(node);
+    PREFETCH(node + 1);
+}
+
+// Read `node->next[layer]` and grab it.
+// Return NULL if `node` has been unlinked in the meantime.
+inline skiplist_node* _sl_grab_next(skiplist_raw* slist,
+                                    skiplist_node* node,
+                                    int layer)
+{
+    skiplist_node* next = NULL;
+    ATM_LOAD(node->next[layer], next);
+    // Grabbing touches the header, and the comparator reads the key next.
+    if (next && slist->search_prefetch) _sl_prefetch_node(_sl_unmark(next));
+    if (slist->reclaim_mode != SKIPLIST_RECLAIM_HAZARD) {
+        // Readers simply pass through marked nodes.
+        next = _sl_unmark(next);
+        _sl_grab(slist, next);
+        return next;
+    }
+
+    // The hazard slot protects `next` only if it is still reachable
+    // after publishing it: `node` is linked and still points to `next`.
+    skiplist_node* next_again = NULL;
+    for (;;) {
+        _sl_hp_set(next);
+        ATM_FENCE();
+        ATM_LOAD(node->next[layer], next_again);
+        if (next == next_again) break;
+        _sl_hp_clear(next);
+        next = next_again;
+    }
+    if (!_sl_valid_node(node)) {
+        _sl_hp_clear(next);
+        return NULL;
+    }
+    return next;
+}
+
+// Note: it increases the `ref_count` of returned node.
+//       Caller is responsible to decrease it.
+inline skiplist_node* _sl_next(skiplist_raw* slist,
+                               skiplist_node* cur_node,
+                               int layer,
+                               skiplist_node* node_to_find,
+                               bool* found)
+{
+    skiplist_node *next_node = NULL;
+    // In epoch or hazard pointer mode, nodes are not freed while this
+    // operation is accessing them, hence no need to block writers.
+    bool guard = (slist->reclaim_mode == SKIPLIST_RECLAIM_REFCOUNT);
+
+    // Turn on `accessing_next`:
+    // now `cur_node` is not removable from skiplist,
+    // which means that `cur_node->next` will be consistent
+    // until clearing `accessing_next`.
+    if (guard) _sl_read_lock_an(slist, cur_node);
+    {
+        if (!_sl_valid_node(cur_node)) {
+            if (guard) _sl_read_unlock_an(cur_node);
+            return NULL;
+        }
+        next_node = _sl_grab_next(slist, cur_node, layer);
+        // Increase ref count of `next_node`:
+        // now `next_node` is not destroyable.
+
+        //   << Remaining issue >>
+        // 1) initially: A -> B
+        // 2) T1: call _sl_next(A):
+        //        A.accessing_next := true;
+        //        next_node := B;
+        // ----- context switch happens here -----
+        // 3) T2: insert C:
+        //        A -> C -> B
+        // 4) T2: and then erase B, and free B.
+        //        A -> C    B(freed)
+        // ----- context switch back again -----
+        // 5) T1: try to do something with B,
+        //        but crash happens.
+        //
+        // ... maybe resolved using RW spinlock (Aug 21, 2017).
+        if (!next_node) {
+            // `cur_node` has been unlinked (hazard pointer mode).
+            if (guard) _sl_read_unlock_an(cur_node);
+            return NULL;
+        }
+        __SLD_ASSERT(_sl_top_layer(next_node) >= layer);
+    }
+    if (guard) _sl_read_unlock_an(cur_node);
+
+    size_t num_nodes = 0;
+    skiplist_node* nodes[256];
+
+    while ( (next_node && !_sl_valid_node(next_node)) ||
+             next_node == node_to_find ) {
+        if (found && node_to_find == next_node) *found = true;
+
+        skiplist_node* temp = next_node;
+        if (guard) _sl_read_lock_an(slist, temp);
+        {
+            __SLD_ASSERT(next_node);
+            if (!_sl_valid_node(temp)) {
+                if (guard) _sl_read_unlock_an(temp);
+                _sl_release(slist, temp);
+                next_node = NULL;
+                break;
+            }
+            next_node = _sl_grab_next(slist, temp, layer);
+            nodes[num_nodes++] = temp;
+            if (!next_node) {
+                if (guard) _sl_read_unlock_an(temp);
+                break;
+            }
+            __SLD_ASSERT(_sl_top_layer(next_node) >= layer);
+        }
+        if (guard) _sl_read_unlock_an(temp);
+    }
+
+    for (size_t ii=0; ii<num_nodes; ++ii) {
+        _sl_release(slist, nodes[ii]);
+    }
+
+    return next_node;
+}
+
+// Backward links: `prev` of a node is changed only by the writer holding
+// `being_modified` of the node right before `node`, under the write lock
+// of `node`. As the writer erasing `prev` updates it before returning,
+// `prev` read under the read lock of `node` (in refcount mode) or still
+// there after publishing it (hazard pointer mode) is not freed yet.
+inline void _sl_set_prev(skiplist_raw* slist,
+                         skiplist_node* node,
+                         skiplist_node* prev)
+{
+    _sl_write_lock_an(slist, node);
+    ATM_STORE(_sl_prev_ptr(node), prev);
+    _sl_write_unlock_an(node);
+}
+
+// Read `prev` of `node` and grab it, NULL if it is not available.
+inline skiplist_node* _sl_grab_prev(skiplist_raw* slist,
+                                    skiplist_node* node)
+{
+    skiplist_node* prev = NULL;
+    ATM_LOAD(_sl_prev_ptr(node), prev);
+    if (!prev) return NULL;
+    if (slist->reclaim_mode != SKIPLIST_RECLAIM_HAZARD) {
+        _sl_grab(slist, prev);
+        return prev;
+    }
+
+    skiplist_node* prev_again = NULL;
+    for (;;) {
+        _sl_hp_set(prev);
+        ATM_FENCE();
+        ATM_LOAD(_sl_prev_ptr(node), prev_again);
+        if (prev == prev_again) break;
+        _sl_hp_clear(prev);
+        if (!prev_again) return NULL;
+        prev = prev_again;
+    }
+    return prev;
+}
+
+// Return the node right before `node` on layer 0 using the backward link
+// (grabbed, the head if `node` is the first one), or NULL if the link is
+// not usable at the moment so that caller should search for it instead.
+inline skiplist_node* _sl_prev_link(skiplist_raw* slist,
+                                    skiplist_node* node)
+{
+    if (!slist->backward_links) return NULL;
+
+    bool guard = (slist->reclaim_mode == SKIPLIST_RECLAIM_REFCOUNT);
+    if (guard) _sl_read_lock_an(slist, node);
+    skiplist_node* prev = _sl_grab_prev(slist, node);
+    if (guard) _sl_read_unlock_an(node);
+    if (!prev) return NULL;
+
+    // Usable only if both are linked, and next to each other.
+    skiplist_node* prev_next = NULL;
+    ATM_LOAD(prev->next[0], prev_next);
+    if ( prev_next != node ||
+         !_sl_valid_node(prev) ||
+         !_sl_valid_node(node) ) {
+        _sl_release(slist, prev);
+        return NULL;
+    }
+    return prev;
+}
+
+// Writer side of `index_seq`: make it odd, waiting for other writers.
+inline void _sl_index_lock(skiplist_raw* slist)
+{
+    for (;;) {
+        uint64_t seq = 0;
+        ATM_LOAD(slist->index_seq, seq);
+        uint64_t locked = seq + 1;
+        if ( !(seq & 0x1) &&
+             ATM_CAS(slist->index_seq, seq, locked) ) {
+            break;
+        }
+        YIELD();
+    }
+    ATM_FENCE();
+}
+
+inline void _sl_index_unlock(skiplist_raw* slist)
+{
+    ATM_FENCE();
+    ATM_FETCH_ADD(slist->index_seq, 1);
+}
+
+// Optimistic reads of an indexable skiplist before taking the lock.
+#define _SL_INDEX_READ_TRIES (4)
+// Returned by `_sl_index_read_begin()` if the reader holds the lock.
+#define _SL_INDEX_SEQ_LOCKED (~(uint64_t)0)
+
+// Reader side of `index_seq`: wait for the writer in the middle (if any),
+// and return the sequence number to be validated. After `tries` failed
+// attempts, take the lock as writers do, so that sustained writes do not
+// starve the reader.
+inline uint64_t _sl_index_read_begin(skiplist_raw* slist,
+                                     int tries)
+{
+    if (tries >= _SL_INDEX_READ_TRIES) {
+        _sl_index_lock(slist);
+        return _SL_INDEX_SEQ_LOCKED;
+    }
+    uint64_t seq = 0;
+    for (;;) {
+        ATM_LOAD(slist->index_seq, seq);
+        if (!(seq & 0x1)) break;
+        YIELD();
+    }
+    ATM_FENCE();
+    return seq;
+}
+
+// End the read of `seq`: true if a writer has been in the middle since
+// `seq`. Should be called on every path, as it releases the lock.
+inline bool _sl_index_read_end(skiplist_raw* slist,
+                               uint64_t seq)
+{
+    if (seq == _SL_INDEX_SEQ_LOCKED) {
+        _sl_index_unlock(slist);
+        return false;
+    }
+    ATM_FENCE();
+    uint64_t seq_again = 0;
+    ATM_LOAD(slist->index_seq, seq_again);
+    return seq != seq_again;
+}
+
+// Add `diff` to the span of the link over position `pos` (1: the first
+// node) on each layer from `from_layer`, after a node at `pos` is linked
+// (or unlinked) on the layers below. Links after `pos` still have old
+// spans, which keep their end positions `>= pos` in both cases.
+// Writers are serialized, so that nodes are read without grabbing.
+inline void _sl_index_adjust(skiplist_raw* slist,
+                             uint64_t pos,
+                             int from_layer,
+                             int diff)
+{
+    skiplist_node* cur_node = &slist->head;
+    uint64_t rank = 0;
+    int layer;
+    for (layer = slist->max_layer - 1; layer >= from_layer; --layer) {
+        for (;;) {
+            skiplist_node* next_node = NULL;
+            ATM_LOAD(cur_node->next[layer], next_node);
+            if (next_node == &slist->tail) break;
+            uint32_t span = 0;
+            ATM_LOAD(_sl_span(cur_node)[layer], span);
+            if (rank + span >= pos) break;
+            rank += span;
+            cur_node = next_node;
+        }
+        ATM_FETCH_ADD(_sl_span(cur_node)[layer], (uint32_t)diff);
+    }
+}
+
+inline size_t _sl_decide_top_layer(skiplist_raw *slist,
+                                   skiplist_node *node)
+{
+    // Node with inline tower has its own height.
+    size_t tower_size = _sl_tower_size(node);
+    size_t layer = tower_size ? tower_size - 1
+                              : slist->level_gen(slist, node);
+    if (layer+1 > slist->max_layer) layer = slist->max_layer - 1;
+    return layer;
+}
+
+// Add `diff` to the sharded counter of entries.
+inline void _sl_update_size(skiplist_raw *slist,
+                            int diff)
+{
+    struct _skiplist_size_shard* shard = &slist->size_shards[_sl_shard_idx()];
+    uint64_t delta = ATM_FETCH_ADD(shard->delta, (uint64_t)(int64_t)diff);
+    delta += (uint64_t)(int64_t)diff;
+    if ( (int64_t)delta >= _SL_SIZE_BATCH ||
+         (int64_t)delta <= -_SL_SIZE_BATCH ) {
+        uint64_t zero = 0;
+        if (ATM_CAS(shard->delta, delta, zero)) {
+            ATM_FETCH_ADD(slist->num_entries, delta);
+        }
+    }
+}
+
+// Update the number of entries and `top_layer` of `slist`,
+// after `node` is inserted (`diff` = 1) or erased (-1).
+inline void _sl_update_entries(skiplist_raw *slist,
+                               skiplist_node *node,
+                               int diff)
+{
+    // A versioned skiplist counts an erased node out on its erase,
+    // even though it stays in the list for a while.
+    if (diff > 0 || !slist->versioned) _sl_update_size(slist, diff);
+
+    // Nodes on layer 0 only do not affect `top_layer`.
+    uint8_t layer = _sl_top_layer(node);
+    if (!layer) return;
+
+    uint8_t top_layer = 0;
+    if (diff > 0) {
+        ATM_FETCH_ADD(slist->layer_entries[layer], 1);
+        ATM_LOAD(slist->top_layer, top_layer);
+        while (top_layer < layer) {
+            if (ATM_CAS(slist->top_layer, top_layer, layer)) break;
+        }
+        return;
+    }
+
+    uint32_t num_left = ATM_FETCH_SUB(slist->layer_entries[layer], 1) - 1;
+    ATM_LOAD(slist->top_layer, top_layer);
+    if (num_left || top_layer != layer) return;
+
+    // The last node on the top layer: find the next one below.
+    uint8_t new_top = layer;
+    uint32_t num_entries = 0;
+    while (new_top) {
+        ATM_LOAD(slist->layer_entries[new_top], num_entries);
+        if (num_entries) break;
+        new_top--;
+    }
+    // Fails if raised by an insert in the meantime.
+    ATM_CAS(slist->top_layer, top_layer, new_top);
+}
+
+inline void _sl_clr_flags(skiplist_node** node_arr,
+                          int start_layer,
+                          int top_layer)
+{
+    int layer;
+    for (layer = start_layer; layer <= top_layer; ++layer) {
+        if ( layer == top_layer ||
+             node_arr[layer] != node_arr[layer+1] ) {
+
+            __SLD_ASSERT(_sl_being_modified(node_arr[layer]));
+            _sl_set_state(node_arr[layer], _SL_ST_MODIFYING, false);
+        }
+    }
+}
+
+inline bool _sl_valid_prev_next(skiplist_node *prev,
+                                skiplist_node *next) {
+    return _sl_valid_node(prev) && _sl_valid_node(next);
+}
+
+inline void _sl_release_path(skiplist_raw *slist,
+                             skiplist_node **path,
+                             int from_layer,
+                             int to_layer)
+{
+    int layer;
+    for (layer = from_layer; layer <= to_layer; ++layer) {
+        _sl_release(slist, path[layer]);
+    }
+}
+
+typedef enum {
+    _SL_SM   = -2,
+    _SL_SMEQ = -1,
+    _SL_EQ   =  0,
+    _SL_GTEQ =  1,
+    _SL_GT   =  2
+} _sl_find_mode;
+
+// Whether to move right from `next_node`, where `cmp` is the result of
+// comparing `query` with `next_node`.
+inline bool _sl_go_right(int cmp, _sl_find_mode mode)
+{
+    return cmp > 0 || (mode == _SL_GT && cmp == 0);
+}
+
+// ==== Engine (templated on comparator) ====
+
+// Compare `query` with `next`, a node read from a link: it is either
+// a user node or the tail, as nothing points to the head.
+template<typename Cmp>
+inline int _sl_cmp_next(skiplist_raw *slist,
+                        const Cmp& comp,
+                        skiplist_node *query,
+                        skiplist_node *next)
+{
+    if (next == &slist->tail) return -1;
+    return comp(query, next);
+}
+
+// Jump to `finger` on the current layer, if it is ahead of `*cur_node`
+// but still smaller than `node`.
+template<typename Cmp>
+inline void _sl_finger_jump(skiplist_raw *slist,
+                            const Cmp& comp,
+                            skiplist_node *node,
+                            skiplist_node *finger,
+                            skiplist_node **cur_node)
+{
+    if ( !finger ||
+         finger == *cur_node ||
+         finger == &slist->head ||
+         !_sl_valid_node(finger) ||
+         ( *cur_node != &slist->head &&
+           comp(finger, *cur_node) <= 0 ) ||
+         comp(node, finger) <= 0 ) {
+        return;
+    }
+    _sl_grab(slist, finger);
+    _sl_release(slist, *cur_node);
+    *cur_node = finger;
+}
+
+// ==== Lock-free mode (`SKIPLIST_SYNC_LOCK_FREE`) ====
+
+// Compare nodes by key, and then by address: as nodes are linked
+// layer by layer without locks, nodes of the same key should have
+// a fixed order to be placed consistently on all layers.
+template<typename Cmp>
+inline int _sl_lf_cmp(const Cmp& comp,
+                      skiplist_node *a,
+                      skiplist_node *b)
+{
+    int cmp = comp(a, b);
+    if (cmp) return cmp;
+    if ((uintptr_t)a < (uintptr_t)b) return -1;
+    if ((uintptr_t)a > (uintptr_t)b) return 1;
+    return 0;
+}
+
+// Find the position of `node` on each layer: `preds[layer] < node <=
+// succs[layer]` for layers `0 ~ top_layer`. Marked nodes on the way are
+// unlinked, so that `node` itself is unlinked from all layers once it
+// has been marked. Returns true if `node` is linked on the bottom layer.
+//
+// Starts over from the head only if a CAS fails, which means that
+// another thread has changed the link in the meantime.
+template<typename Cmp>
+inline bool _sl_lf_find(skiplist_raw *slist,
+                        const Cmp& comp,
+                        skiplist_node *node,
+                        int top_layer,
+                        skiplist_node **preds,
+                        skiplist_node **succs)
+{
+lf_find_retry:
+    int cur_layer = slist->top_layer;
+    if (top_layer > cur_layer) cur_layer = top_layer;
+
+    skiplist_node *pred = &slist->head;
+    skiplist_node *cur = NULL;
+    skiplist_node *succ = NULL;
+    for (; cur_layer >= 0; --cur_layer) {
+        ATM_LOAD(pred->next[cur_layer], cur);
+        cur = _sl_unmark(cur);
+        while (cur != &slist->tail) {
+            ATM_LOAD(cur->next[cur_layer], succ);
+            if (_sl_is_marked(succ)) {
+                // `cur` is being erased: help unlinking it.
+                skiplist_node *exp = cur;
+                skiplist_node *val = _sl_unmark(succ);
+                if (!ATM_CAS(pred->next[cur_layer], exp, val)) {
+                    goto lf_find_retry;
+                }
+                cur = val;
+                continue;
+            }
+            if (_sl_lf_cmp(comp, node, cur) <= 0) break;
+            pred = cur;
+            cur = succ;
+        }
+        if (cur_layer <= top_layer) {
+            preds[cur_layer] = pred;
+            succs[cur_layer] = cur;
+        }
+    }
+    return succs[0] == node;
+}
+
+// Builds the node of an insert only once its position is found, so that
+// nothing is built if the key is already there. `func` returns the node
+// with a tower for `top_layer`, or NULL if it fails, and the insert sets
+// `node` to what it returned.
+struct _sl_node_maker {
+    skiplist_node* (*func)(void* ctx, size_t top_layer);
+    void* ctx;
+    skiplist_node* node;
+};
+
+// Link `node` on the bottom layer first, which makes it a member of
+// the skiplist, and then on upper layers one by one. It becomes visible
+// (`is_fully_linked`) and erasable after all layers are linked.
+// `existing` and `maker` are the same as in `_sl_insert_node()`, except
+// that the node of `maker` may have been built when another thread
+// inserts the same key, which returns -1 as well.
+template<typename Cmp>
+inline int _sl_lf_insert(skiplist_raw *slist,
+                         const Cmp& comp,
+                         skiplist_node *node,
+                         bool no_dup,
+                         skiplist_node **existing,
+                         _sl_node_maker *maker)
+{
+    int top_layer = _sl_decide_top_layer(slist, node);
+    skiplist_node* query = node;
+    if (!maker) _sl_node_init(node, top_layer, _sl_ext_slots(slist));
+
+    skiplist_node* preds[SKIPLIST_MAX_LAYER];
+    skiplist_node* succs[SKIPLIST_MAX_LAYER];
+    int layer;
+
+    for (;;) {
+        _sl_lf_find(slist, comp, query, top_layer, preds, succs);
+        if (no_dup) {
+            // Nodes of the same key are adjacent to `node`.
+            skiplist_node* dup = NULL;
+            if ( preds[0] != &slist->head &&
+                 comp(preds[0], node) == 0 ) {
+                dup = preds[0];
+            } else if ( succs[0] != &slist->tail &&
+                        comp(node, succs[0]) == 0 ) {
+                dup = succs[0];
+            }
+            if (dup) {
+                // Not grabbed, but not freed until the operation
+                // ends (epoch mode).
+                if (existing) *existing = dup;
+                return -1;
+            }
+        }
+        if (maker && !maker->node) {
+            node = maker->func(maker->ctx, top_layer);
+            if (!node) return -2;
+            maker->node = node;
+            _sl_node_init(node, top_layer, _sl_ext_slots(slist));
+        }
+        for (layer = 0; layer <= top_layer; ++layer) {
+            ATM_STORE(node->next[layer], succs[layer]);
+        }
+        // `node` should be initialized before it is published.
+        ATM_FENCE();
+        skiplist_node *exp = succs[0];
+        if (ATM_CAS(preds[0]->next[0], exp, node)) break;
+    }
+
+    for (layer = 1; layer <= top_layer; ++layer) {
+        for (;;) {
+            skiplist_node *exp = succs[layer];
+            if (ATM_CAS(preds[layer]->next[layer], exp, node)) break;
+            // Changed in the meantime, find the new position.
+            _sl_lf_find(slist, comp, node, top_layer, preds, succs);
+            ATM_STORE(node->next[layer], succs[layer]);
+        }
+    }
+
+    _sl_set_state(node, _SL_ST_LINKED, true);
+    _sl_update_entries(slist, node, 1);
+    return 0;
+}
+
+// Mark `next` pointers of `node` from the top layer, and the thread
+// that marks the bottom layer erases it. Return values are the same as
+// `_sl_erase_node_passive()`, except that it never returns -2.
+template<typename Cmp>
+inline int _sl_lf_erase_node(skiplist_raw *slist,
+                             const Cmp& comp,
+                             skiplist_node *node)
+{
+    int top_layer = _sl_top_layer(node);
+    skiplist_node *succ = NULL;
+    skiplist_node *marked = NULL;
+    int layer;
+
+    ATM_LOAD(node->next[0], succ);
+    if (_sl_is_marked(succ)) {
+        // already removed
+        return -1;
+    }
+    if (!_sl_valid_node(node)) {
+        // not linked yet, or insertion is in progress.
+        return -3;
+    }
+
+    for (layer = top_layer; layer >= 1; --layer) {
+        ATM_LOAD(node->next[layer], succ);
+        while (!_sl_is_marked(succ)) {
+            marked = _sl_mark(succ);
+            if (ATM_CAS(node->next[layer], succ, marked)) break;
+        }
+    }
+
+    ATM_LOAD(node->next[0], succ);
+    for (;;) {
+        if (_sl_is_marked(succ)) {
+            // other thread has erased it.
+            return -1;
+        }
+        marked = _sl_mark(succ);
+        if (ATM_CAS(node->next[0], succ, marked)) break;
+    }
+    _sl_set_state(node, _SL_ST_LINKED, false);
+    _sl_set_state(node, _SL_ST_REMOVED, true);
+
+    skiplist_node* preds[SKIPLIST_MAX_LAYER];
+    skiplist_node* succs[SKIPLIST_MAX_LAYER];
+    _sl_lf_find(slist, comp, node, top_layer, preds, succs);
+
+    _sl_update_entries(slist, node, -1);
+    return 0;
+}
+
+// Init `node` to be linked up to `top_layer` by the insert of `seq`.
+inline void _sl_insert_prepare(skiplist_raw *slist,
+                               skiplist_node *node,
+                               int top_layer,
+                               uint64_t seq)
+{
+    _sl_node_init(node, top_layer, _sl_ext_slots(slist));
+    if (slist->versioned) {
+        uint64_t none = _SL_SEQ_NONE;
+        ATM_STORE(_sl_insert_seq(slist, node), seq);
+        ATM_STORE(_sl_erase_seq(slist, node), none);
+    }
+    _sl_write_lock_an(slist, node);
+}
+
+// `fingers` (optional) is the search path of the previous insert of
+// a batch: the predecessor of the previous key on each layer, grabbed.
+// If it is still smaller than `node`, the search jumps to it instead of
+// walking from the head, and then `fingers` is updated to the new path.
+//
+// `existing` (optional): if `no_dup` and the key is already there,
+// the node of the key found by the same search (grabbed).
+//
+// `maker` (optional): `node` is then a query of the key only, and the
+// node to link is built by `maker` once the search has reached the
+// bottom layer without a duplicate. Returns -2 if it fails.
+//
+// `seq`: sequence number of this insert, if `versioned` is set.
+template<typename Cmp>
+inline int _sl_insert_node(skiplist_raw *slist,
+                           const Cmp& comp,
+                           skiplist_node *node,
+                           bool no_dup,
+                           skiplist_node **fingers,
+                           skiplist_node **existing,
+                           _sl_node_maker *maker,
+                           uint64_t seq)
+{
+    __SLD_(
+        thread_local std::thread::id tid = std::this_thread::get_id();
+        thread_local size_t tid_hash = std::hash<std::thread::id>{}(tid) % 256;
+        (void)tid_hash;
+    )
+
+    int top_layer = _sl_decide_top_layer(slist, node);
+
+    // init node before insertion
+    if (!maker) _sl_insert_prepare(slist, node, top_layer, seq);
+
+    skiplist_node* prevs[SKIPLIST_MAX_LAYER];
+    skiplist_node* nexts[SKIPLIST_MAX_LAYER];
+    // Search path of this insert, grabbed if `fingers` is given.
+    skiplist_node* path[SKIPLIST_MAX_LAYER];
+    // Positions of `prevs`, used by an indexable skiplist.
+    uint64_t ranks[SKIPLIST_MAX_LAYER];
+    uint64_t rank = 0;
+
+    __SLD_P("%02x ins %p begin\n", (int)tid_hash, node);
+
+insert_retry:
+    // in pure C, a label can only be part of a stmt.
+    (void)top_layer;
+
+    int cmp = 0, cur_layer = 0, layer;
+    skiplist_node *cur_node = &slist->head;
+    _sl_grab(slist, cur_node);
+    rank = 0;
+
+    __SLD_(size_t nh = 0);
+    __SLD_(thread_local skiplist_node* history[1024]; (void)history);
+
+    int sl_top_layer = slist->top_layer;
+    if (top_layer > sl_top_layer) sl_top_layer = top_layer;
+    int path_low = sl_top_layer + 1;
+    for (cur_layer = sl_top_layer; cur_layer >= 0; --cur_layer) {
+        if (fingers) {
+            _sl_finger_jump(slist, comp, node, fingers[cur_layer], &cur_node);
+        }
+        do {
+            __SLD_( history[nh++] = cur_node );
+
+            skiplist_node *next_node = _sl_next(slist, cur_node, cur_layer,
+                                                NULL, NULL);
+            if (!next_node) {
+                _sl_clr_flags(prevs, cur_layer+1, top_layer);
+                _sl_release(slist, cur_node);
+                if (fingers) _sl_release_path(slist, path, path_low,
+                                              sl_top_layer);
+                YIELD();
+                goto insert_retry;
+            }
+            cmp = _sl_cmp_next(slist, comp, node, next_node);
+            // An erased version of the same key is not a duplicate.
+            bool dup = no_dup && cmp == 0 &&
+                       _sl_visible(slist, next_node, _SL_SEQ_LATEST);
+            if (cmp > 0) {
+                // cur_node < next_node < node
+                // => move to next node
+                if (slist->indexable) {
+                    rank += ATM_GET(_sl_span(cur_node)[cur_layer]);
+                }
+                skiplist_node* temp = cur_node;
+                cur_node = next_node;
+                _sl_release(slist, temp);
+                continue;
+            } else if (dup && existing) {
+                // Hand over `next_node` as it is.
+                *existing = next_node;
+            } else {
+                // otherwise: cur_node < node <= next_node
+                _sl_release(slist, next_node);
+            }
+            if (fingers) {
+                _sl_grab(slist, cur_node);
+                path[cur_layer] = cur_node;
+                path_low = cur_layer;
+            }
+
+            if (dup) {
+                // Duplicate key is not allowed.
+                _sl_clr_flags(prevs, cur_layer+1, top_layer);
+                _sl_release(slist, cur_node);
+                if (fingers) _sl_release_path(slist, path, path_low,
+                                              sl_top_layer);
+                return -1;
+            }
+
+            if (cur_layer <= top_layer) {
+                prevs[cur_layer] = cur_node;
+                nexts[cur_layer] = next_node;
+                ranks[cur_layer] = rank;
+                // both 'prev' and 'next' should be fully linked before
+                // insertion, and no other thread should not modify 'prev'
+                // at the same time.
+
+                int error_code = 0;
+                int locked_layer = cur_layer + 1;
+
+                // check if prev node is duplicated with upper layer
+                if (cur_layer < top_layer &&
+                    prevs[cur_layer] == prevs[cur_layer+1]) {
+                    // duplicate
+                    // => which means that 'being_modified' flag is already true
+                    // => do nothing
+                } else {
+                    if (_sl_try_set_state(prevs[cur_layer],
+                                          _SL_ST_MODIFYING)) {
+                        locked_layer = cur_layer;
+                    } else {
+                        error_code = -1;
+                    }
+                }
+
+                if (error_code == 0 &&
+                    !_sl_valid_prev_next(prevs[cur_layer], nexts[cur_layer])) {
+                    error_code = -2;
+                }
+
+                if (error_code != 0) {
+                    __SLD_RT_INS(error_code, node, top_layer, cur_layer);
+                    _sl_clr_flags(prevs, locked_layer, top_layer);
+                    _sl_release(slist, cur_node);
+                    if (fingers) _sl_release_path(slist, path, path_low,
+                                                  sl_top_layer);
+                    YIELD();
+                    goto insert_retry;
+                }
+
+                // check if `cur_node->next` has been changed from `next_node`.
+                skiplist_node* next_node_again =
+                    _sl_next(slist, cur_node, cur_layer, NULL, NULL);
+                if (next_node_again) _sl_release(slist, next_node_again);
+                if (next_node_again != next_node) {
+                    __SLD_NC_INS(cur_node, next_node, top_layer, cur_layer);
+                    // clear including the current layer
+                    // as we already set modification flag above.
+                    _sl_clr_flags(prevs, cur_layer, top_layer);
+                    _sl_release(slist, cur_node);
+                    if (fingers) _sl_release_path(slist, path, path_low,
+                                                  sl_top_layer);
+                    YIELD();
+                    goto insert_retry;
+                }
+            }
+
+            if (cur_layer) {
+                // non-bottom layer => go down
+                break;
+            }
+
+            // bottom layer => insertion succeeded
+            if (maker) {
+                node = maker->func(maker->ctx, top_layer);
+                if (!node) {
+                    _sl_clr_flags(prevs, 0, top_layer);
+                    _sl_release(slist, cur_node);
+                    return -2;
+                }
+                maker->node = node;
+                _sl_insert_prepare(slist, node, top_layer, seq);
+            }
+            // set current node's pointers, not visible until linked
+            for (layer = 0; layer <= top_layer; ++layer) {
+                ATM_STORE(node->next[layer], nexts[layer]);
+            }
+            if (slist->backward_links) {
+                ATM_STORE(_sl_prev_ptr(node), prevs[0]);
+            }
+            // change prev/next nodes' prev/next pointers from 0 ~ top_layer
+            for (layer = 0; layer <= top_layer; ++layer) {
+                // `accessing_next` works as a spin-lock.
+                _sl_write_lock_an(slist, prevs[layer]);
+                skiplist_node* exp = nexts[layer];
+                if ( !ATM_CAS(prevs[layer]->next[layer], exp, node) ) {
+                    __SLD_P("%02x ASSERT ins %p[%d] -> %p (expected %p)\n",
+                            (int)tid_hash, prevs[layer], cur_layer,
+                            ATM_GET(prevs[layer]->next[layer]), nexts[layer] );
+                    __SLD_ASSERT(0);
+                }
+                __SLD_P("%02x ins %p[%d] -> %p -> %p\n",
+                        (int)tid_hash, prevs[layer], layer,
+                        node, ATM_GET(node->next[layer]) );
+                _sl_write_unlock_an(prevs[layer]);
+            }
+            if (slist->backward_links) {
+                _sl_set_prev(slist, nexts[0], node);
+            }
+            if (slist->indexable) {
+                // Split the span of each `prevs` at this node.
+                uint64_t pos = ranks[0] + 1;
+                for (layer = 0; layer <= top_layer; ++layer) {
+                    uint32_t span = 0;
+                    ATM_LOAD(_sl_span(prevs[layer])[layer], span);
+                    uint32_t dist = pos - ranks[layer];
+                    uint32_t rest = span + 1 - dist;
+                    ATM_STORE(_sl_span(node)[layer], rest);
+                    ATM_STORE(_sl_span(prevs[layer])[layer], dist);
+                }
+                _sl_index_adjust(slist, pos, top_layer + 1, 1);
+            }
+
+            // now this node is fully linked
+            _sl_set_state(node, _SL_ST_LINKED, true);
+
+            // allow removing next nodes
+            _sl_write_unlock_an(node);
+
+            __SLD_P("%02x ins %p done\n", (int)tid_hash, node);
+
+            _sl_update_entries(slist, node, 1);
+
+            // modification is done for all layers
+            _sl_clr_flags(prevs, 0, top_layer);
+            _sl_release(slist, cur_node);
+
+            if (fingers) {
+                // Hand over the search path to the next insert.
+                for (layer = 0; layer <= sl_top_layer; ++layer) {
+                    if (fingers[layer]) _sl_release(slist, fingers[layer]);
+                    fingers[layer] = path[layer];
+                }
+            }
+            return 0;
+        } while (cur_node != &slist->tail);
+    }
+    return 0;
+}
+
+template<typename Cmp>
+inline int _skiplist_insert(skiplist_raw *slist,
+                            const Cmp& comp,
+                            skiplist_node *node,
+                            bool no_dup,
+                            skiplist_node **fingers,
+                            skiplist_node **existing,
+                            _sl_node_maker *maker)
+{
+    if (slist->sync_mode == SKIPLIST_SYNC_LOCK_FREE) {
+        return _sl_lf_insert(slist, comp, node, no_dup, existing, maker);
+    }
+    uint64_t seq = 0;
+    if (slist->versioned) seq = _sl_seq_begin(slist);
+
+    int ret = 0;
+    if (!slist->indexable) {
+        ret = _sl_insert_node(slist, comp, node, no_dup, fingers,
+                              existing, maker, seq);
+    } else {
+        _sl_index_lock(slist);
+        ret = _sl_insert_node(slist, comp, node, no_dup, fingers,
+                              existing, maker, seq);
+        _sl_index_unlock(slist);
+    }
+
+    if (slist->versioned) _sl_seq_end(slist, seq);
+    return ret;
+}
+
+// Prefetch the tower of `node` and `prefetch_depth - 1` nodes after it
+// on layer 0, so that the following steps of an iteration find them in
+// the cache. Nodes after `node` are neither grabbed nor in hazard slots,
+// and may be freed while we read their links, except in epoch mode
+// where nothing is freed until the current operation ends, and in
+// `SKIPLIST_RECLAIM_NONE` where nothing is erased.
+inline void _sl_prefetch_ahead(skiplist_raw* slist,
+                               skiplist_node* node)
+{
+    size_t depth = slist->prefetch_depth;
+    if ( slist->reclaim_mode != SKIPLIST_RECLAIM_EPOCH &&
+         slist->reclaim_mode != SKIPLIST_RECLAIM_NONE && depth > 1 ) {
+        depth = 1;
+    }
+    size_t ii;
+    for (ii = 0; ii < depth && node; ++ii) {
+        PREFETCH(node->next);
+        if (ii + 1 == depth) break;
+
+        skiplist_node* next = NULL;
+        ATM_LOAD(node->next[0], next);
+        next = _sl_unmark(next);
+        if (!next || next == &slist->tail) break;
+        _sl_prefetch_node(next);
+        node = next;
+    }
+}
+
+// Search from `cur_node` on `start_layer`, where `cur_node < query`.
+// `cur_node` should be grabbed by caller, and will be released.
+// If `cur_node` became invalid in the middle, set `retry` and return NULL.
+//
+// Note: it increases the `ref_count` of returned node.
+//       Caller is responsible to decrease it.
+template<typename Cmp>
+inline skiplist_node* _sl_find_down(skiplist_raw *slist,
+                                    const Cmp& comp,
+                                    skiplist_node *cur_node,
+                                    int start_layer,
+                                    skiplist_node *query,
+                                    _sl_find_mode mode,
+                                    bool *retry)
+{
+    // mode:
+    //  _SL_SM   -2: smaller
+    //  _SL_SMEQ -1: smaller or equal
+    //  _SL_EQ    0: equal
+    //  _SL_GTEQ  1: greater or equal
+    //  _SL_GT    2: greater
+    int cmp = 0;
+    int cur_layer = 0;
+
+    __SLD_(size_t nh = 0);
+    __SLD_(thread_local skiplist_node* history[1024]; (void)history);
+
+    for (cur_layer = start_layer; cur_layer >= 0; --cur_layer) {
+        do {
+            __SLD_(history[nh++] = cur_node);
+
+            skiplist_node *next_node = _sl_next(slist, cur_node, cur_layer,
+                                                NULL, NULL);
+            if (!next_node) {
+                _sl_release(slist, cur_node);
+                *retry = true;
+                return NULL;
+            }
+            // Load the link to follow if we move right,
+            // while comparing the key.
+            if (next_node != &slist->tail && slist->search_prefetch) {
+                PREFETCH(next_node->next + cur_layer);
+            }
+            cmp = _sl_cmp_next(slist, comp, query, next_node);
+            if (_sl_go_right(cmp, mode)) {
+                // cur_node < next_node < query
+                // (or next_node == query in greater mode)
+                // => move to next node
+                skiplist_node* temp = cur_node;
+                cur_node = next_node;
+                _sl_release(slist, temp);
+                continue;
+            } else if (-1 <= mode && mode <= 1 && cmp == 0) {
+                // cur_node < query == next_node .. return
+                _sl_release(slist, cur_node);
+                return next_node;
+            }
+
+            // otherwise: cur_node < query < next_node
+            if (cur_layer) {
+                // non-bottom layer => go down
+                _sl_release(slist, next_node);
+                break;
+            }
+
+            // bottom layer
+            if (mode < 0 && cur_node != &slist->head) {
+                // smaller mode
+                _sl_release(slist, next_node);
+                return cur_node;
+            } else if (mode > 0 && next_node != &slist->tail) {
+                // greater mode
+                _sl_release(slist, cur_node);
+                return next_node;
+            }
+            // otherwise: exact match mode OR not found
+            _sl_release(slist, cur_node);
+            _sl_release(slist, next_node);
+            return NULL;
+        } while (cur_node != &slist->tail);
+    }
+
+    return NULL;
+}
+
+// Note: it increases the `ref_count` of returned node.
+//       Caller is responsible to decrease it.
+template<typename Cmp>
+inline skiplist_node* _sl_find(skiplist_raw *slist,
+                               const Cmp& comp,
+                               skiplist_node *query,
+                               _sl_find_mode mode)
+{
+find_retry:
+    (void)mode;
+    bool retry = false;
+    skiplist_node *cur_node = &slist->head;
+    _sl_grab(slist, cur_node);
+
+    uint8_t sl_top_layer = slist->top_layer;
+    skiplist_node *ret = _sl_find_down(slist, comp, cur_node, sl_top_layer,
+                                       query, mode, &retry);
+    if (retry) {
+        YIELD();
+        goto find_retry;
+    }
+    return ret;
+}
+
+// Finger search: climb up the towers from `hint` while the next node on
+// the upper layer is still smaller than `query`, and then go down as
+// usual. It visits O(log d) nodes where `d` is the distance between
+// `hint` and `query`. `hint` should be grabbed by caller.
+//
+// Without backward links, it falls back to `_sl_find()`
+// if `query` is not greater than `hint`.
+template<typename Cmp>
+inline skiplist_node* _sl_find_from(skiplist_raw *slist,
+                                    const Cmp& comp,
+                                    skiplist_node *hint,
+                                    skiplist_node *query,
+                                    _sl_find_mode mode)
+{
+    if ( !hint ||
+         hint == &slist->head ||
+         hint == &slist->tail ||
+         !_sl_valid_node(hint) ||
+         comp(query, hint) <= 0 ) {
+        return _sl_find(slist, comp, query, mode);
+    }
+
+    int cmp = 0;
+    int cur_layer = 0;
+    bool retry = false;
+    skiplist_node *ret = NULL;
+    skiplist_node *cur_node = hint;
+    _sl_grab(slist, cur_node);
+
+    for (;;) {
+        // Climb up.
+        while (cur_layer < (int)_sl_top_layer(cur_node)) {
+            skiplist_node *up_node = _sl_next(slist, cur_node, cur_layer + 1,
+                                              NULL, NULL);
+            if (!up_node) goto find_from_fail;
+            cmp = _sl_cmp_next(slist, comp, query, up_node);
+            _sl_release(slist, up_node);
+            if (!_sl_go_right(cmp, mode)) break;
+            cur_layer++;
+        }
+
+        // Move right on the current layer.
+        skiplist_node *next_node = _sl_next(slist, cur_node, cur_layer,
+                                            NULL, NULL);
+        if (!next_node) goto find_from_fail;
+        cmp = _sl_cmp_next(slist, comp, query, next_node);
+        if (!_sl_go_right(cmp, mode)) {
+            _sl_release(slist, next_node);
+            break;
+        }
+        skiplist_node* temp = cur_node;
+        cur_node = next_node;
+        _sl_release(slist, temp);
+    }
+
+    ret = _sl_find_down(slist, comp, cur_node, cur_layer, query, mode, &retry);
+    if (!retry) return ret;
+    return _sl_find(slist, comp, query, mode);
+
+find_from_fail:
+    _sl_release(slist, cur_node);
+    return _sl_find(slist, comp, query, mode);
+}
+
+// ==== Versioned reads ====
+// Nodes of the same key are ordered from the newest to the oldest, as
+// insert puts a node before the same keys. The latest view has at most
+// one version of a key (if inserted with `no_dup`), which is the first.
+
+// The first node not smaller than `query` on layer 0 (grabbed),
+// unlike `_sl_find()` which may return any of the same keys.
+template<typename Cmp>
+inline skiplist_node* _sl_find_first(skiplist_raw *slist,
+                                     const Cmp& comp,
+                                     skiplist_node *query)
+{
+    for (;;) {
+        skiplist_node* cur_node = _sl_find(slist, comp, query, _SL_SM);
+        if (!cur_node) {
+            cur_node = &slist->head;
+            _sl_grab(slist, cur_node);
+        }
+        skiplist_node* next_node = _sl_next(slist, cur_node, 0, NULL, NULL);
+        _sl_release(slist, cur_node);
+        if (next_node) return next_node;
+        YIELD();
+    }
+}
+
+// The first node at or after `node` (grabbed, and will be released)
+// seen by the snapshot of `seq`, or the tail.
+template<typename Cmp>
+inline skiplist_node* _sl_next_visible(skiplist_raw *slist,
+                                       const Cmp& comp,
+                                       skiplist_node *node,
+                                       uint64_t seq)
+{
+    while (node != &slist->tail && !_sl_visible(slist, node, seq)) {
+        skiplist_node* next = _sl_next(slist, node, 0, NULL, NULL);
+        if (!next) {
+            // Unlinked: no snapshot sees it, nor the versions after it.
+            next = _sl_find(slist, comp, node, _SL_GT);
+            if (!next) {
+                next = &slist->tail;
+                _sl_grab(slist, next);
+            }
+        }
+        _sl_release(slist, node);
+        node = next;
+    }
+    return node;
+}
+
+// The last node at or before `node` (grabbed, and will be released)
+// seen by the snapshot of `seq`, or the head.
+template<typename Cmp>
+inline skiplist_node* _sl_prev_visible(skiplist_raw *slist,
+                                       const Cmp& comp,
+                                       skiplist_node *node,
+                                       uint64_t seq)
+{
+    while (node != &slist->head && !_sl_visible(slist, node, seq)) {
+        // Newer versions of the same key are right before `node`.
+        skiplist_node* cur = _sl_find_first(slist, comp, node);
+        while ( cur && cur != node &&
+                _sl_cmp_next(slist, comp, node, cur) == 0 ) {
+            if (_sl_visible(slist, cur, seq)) {
+                _sl_release(slist, node);
+                return cur;
+            }
+            skiplist_node* next = _sl_next(slist, cur, 0, NULL, NULL);
+            _sl_release(slist, cur);
+            cur = next;
+        }
+        if (cur) _sl_release(slist, cur);
+
+        skiplist_node* prev = _sl_find(slist, comp, node, _SL_SM);
+        if (!prev) {
+            prev = &slist->head;
+            _sl_grab(slist, prev);
+        }
+        _sl_release(slist, node);
+        node = prev;
+    }
+    return node;
+}
+
+// `_sl_find()` on the snapshot of `seq`.
+template<typename Cmp>
+inline skiplist_node* _sl_find_visible(skiplist_raw *slist,
+                                       const Cmp& comp,
+                                       skiplist_node *query,
+                                       _sl_find_mode mode,
+                                       uint64_t seq)
+{
+    if (!slist->versioned) return _sl_find(slist, comp, query, mode);
+
+    skiplist_node* ret = NULL;
+    if (mode == _SL_SM) {
+        ret = _sl_find(slist, comp, query, _SL_SM);
+        if (!ret) return NULL;
+        ret = _sl_prev_visible(slist, comp, ret, seq);
+        if (ret == &slist->head) {
+            _sl_release(slist, ret);
+            return NULL;
+        }
+        return ret;
+    }
+
+    if (mode == _SL_GT) {
+        ret = _sl_find(slist, comp, query, _SL_GT);
+        if (!ret) return NULL;
+    } else {
+        ret = _sl_find_first(slist, comp, query);
+    }
+    ret = _sl_next_visible(slist, comp, ret, seq);
+    if (ret == &slist->tail) {
+        _sl_release(slist, ret);
+        ret = NULL;
+    }
+    if (ret && mode != _SL_GTEQ && mode != _SL_GT && comp(ret, query) != 0) {
+        // Exact match only: `_SL_EQ`, or `_SL_SMEQ` that falls back to
+        // smaller below.
+        _sl_release(slist, ret);
+        ret = NULL;
+    }
+    if (!ret && mode == _SL_SMEQ) {
+        return _sl_find_visible(slist, comp, query, _SL_SM, seq);
+    }
+    return ret;
+}
+
+// Number of searches of `_sl_find_group()` advanced in lockstep.
+#define _SL_FIND_GROUP      (16)
+
+// Exact match searches of `queries` at once, the results (grabbed, or
+// NULL) are stored in `results`. Each round takes one step of every
+// search, after prefetching the links and the nodes that the steps will
+// read, so that the cache misses of the searches overlap each other
+// instead of being waited for one by one.
+// Up to `_SL_FIND_GROUP` queries.
+template<typename Cmp>
+inline void _sl_find_group(skiplist_raw *slist,
+                           const Cmp& comp,
+                           skiplist_node **queries,
+                           skiplist_node **results,
+                           size_t num_queries)
+{
+    skiplist_node* cur_nodes[_SL_FIND_GROUP];
+    int cur_layers[_SL_FIND_GROUP];
+    size_t ii, num_active = num_queries;
+    uint8_t sl_top_layer = slist->top_layer;
+    for (ii = 0; ii < num_queries; ++ii) {
+        results[ii] = NULL;
+        cur_nodes[ii] = &slist->head;
+        cur_layers[ii] = sl_top_layer;
+        _sl_grab(slist, &slist->head);
+    }
+
+    bool prefetch = slist->search_prefetch;
+    while (num_active) {
+        // The links to follow.
+        for (ii = 0; prefetch && ii < num_queries; ++ii) {
+            if (!cur_nodes[ii]) continue;
+            PREFETCH(cur_nodes[ii]->next + cur_layers[ii]);
+        }
+        // The nodes they point to. They may be changed in the meantime,
+        // which only makes a useless prefetch.
+        for (ii = 0; prefetch && ii < num_queries; ++ii) {
+            if (!cur_nodes[ii]) continue;
+            skiplist_node* next = NULL;
+            ATM_LOAD(cur_nodes[ii]->next[cur_layers[ii]], next);
+            next = _sl_unmark(next);
+            if (next) _sl_prefetch_node(next);
+        }
+
+        // One step of each search, same as `_sl_find_down()`.
+        for (ii = 0; ii < num_queries; ++ii) {
+            skiplist_node* cur_node = cur_nodes[ii];
+            if (!cur_node) continue;
+
+            skiplist_node* next_node = _sl_next(slist, cur_node,
+                                                cur_layers[ii], NULL, NULL);
+            if (!next_node) {
+                // `cur_node` became invalid, start over.
+                _sl_release(slist, cur_node);
+                cur_nodes[ii] = &slist->head;
+                cur_layers[ii] = slist->top_layer;
+                _sl_grab(slist, &slist->head);
+                continue;
+            }
+
+            int cmp = _sl_cmp_next(slist, comp, queries[ii], next_node);
+            if (_sl_go_right(cmp, _SL_EQ)) {
+                cur_nodes[ii] = next_node;
+                _sl_release(slist, cur_node);
+                continue;
+            }
+            if (cmp == 0) {
+                results[ii] = next_node;
+            } else {
+                _sl_release(slist, next_node);
+                if (cur_layers[ii]) {
+                    // Go down.
+                    cur_layers[ii]--;
+                    continue;
+                }
+            }
+            _sl_release(slist, cur_node);
+            cur_nodes[ii] = NULL;
+            num_active--;
+        }
+    }
+}
+
+// `fingers` (optional) works the same as in `_sl_insert_node()`, for
+// erasing consecutive nodes: the predecessors of the previous node.
+// As links above the top layer of `node` are not touched, the search
+// starts from the finger on that layer, so that it costs O(1) per node.
+template<typename Cmp>
+inline int _sl_erase_node(skiplist_raw *slist,
+                          const Cmp& comp,
+                          skiplist_node *node,
+                          skiplist_node **fingers)
+{
+    __SLD_(
+        thread_local std::thread::id tid = std::this_thread::get_id();
+        thread_local size_t tid_hash = std::hash<std::thread::id>{}(tid) % 256;
+        (void)tid_hash;
+    )
+
+    int top_layer = _sl_top_layer(node);
+
+    if (_sl_removed(node)) {
+        // already removed
+        return -1;
+    }
+
+    skiplist_node* prevs[SKIPLIST_MAX_LAYER];
+    skiplist_node* nexts[SKIPLIST_MAX_LAYER];
+    // Positions of `prevs`, used by an indexable skiplist.
+    uint64_t ranks[SKIPLIST_MAX_LAYER];
+    uint64_t rank = 0;
+
+    if (!_sl_try_set_state(node, _SL_ST_MODIFYING)) {
+        // already being modified .. cannot work on this node for now.
+        __SLD_BM(node);
+        return -2;
+    }
+
+    // set removed flag first, so that reader cannot read this node.
+    _sl_set_state(node, _SL_ST_REMOVED, true);
+
+    __SLD_P("%02x rmv %p begin\n", (int)tid_hash, node);
+
+erase_node_retry:
+    if (!_sl_fully_linked(node)) {
+        // already unlinked .. remove is done by other thread
+        _sl_set_state(node, _SL_ST_REMOVED | _SL_ST_MODIFYING, false);
+        return -3;
+    }
+
+    int cmp = 0;
+    bool found_node_to_erase = false;
+    (void)found_node_to_erase;
+    skiplist_node *cur_node = &slist->head;
+    _sl_grab(slist, cur_node);
+    rank = 0;
+
+    __SLD_(size_t nh = 0);
+    __SLD_(thread_local skiplist_node* history[1024]; (void)history);
+
+    int cur_layer = slist->top_layer;
+    if (top_layer > cur_layer) cur_layer = top_layer;
+    if (fingers && fingers[top_layer]) {
+        _sl_finger_jump(slist, comp, node, fingers[top_layer], &cur_node);
+        if ( cur_node != &slist->head ||
+             fingers[top_layer] == &slist->head ) {
+            cur_layer = top_layer;
+        }
+    }
+    for (; cur_layer >= 0; --cur_layer) {
+        if (fingers) {
+            _sl_finger_jump(slist, comp, node, fingers[cur_layer], &cur_node);
+        }
+        do {
+            __SLD_( history[nh++] = cur_node );
+
+            bool node_found = false;
+            skiplist_node *next_node = _sl_next(slist, cur_node, cur_layer,
+                                                node, &node_found);
+            if (!next_node) {
+                _sl_clr_flags(prevs, cur_layer+1, top_layer);
+                _sl_release(slist, cur_node);
+                YIELD();
+                goto erase_node_retry;
+            }
+
+            // Note: unlike insert(), we should find exact position of `node`.
+            cmp = _sl_cmp_next(slist, comp, node, next_node);
+            if (cmp > 0 || (cur_layer <= top_layer && !node_found) ) {
+                // cur_node <= next_node < node
+                // => move to next node
+                if (slist->indexable) {
+                    rank += ATM_GET(_sl_span(cur_node)[cur_layer]);
+                }
+                skiplist_node* temp = cur_node;
+                cur_node = next_node;
+                __SLD_( if (cmp > 0) {
+                    int cmp2 = comp(cur_node, node);
+                    if (cmp2 > 0) {
+                        // node < cur_node <= next_node: not found.
+                        _sl_clr_flags(prevs, cur_layer+1, top_layer);
+                        _sl_release(slist, temp);
+                        _sl_release(slist, next_node);
+                        __SLD_ASSERT(0);
+                    }
+                } )
+                _sl_release(slist, temp);
+                continue;
+            } else {
+                // otherwise: cur_node <= node <= next_node
+                _sl_release(slist, next_node);
+            }
+
+            if (cur_layer <= top_layer) {
+                prevs[cur_layer] = cur_node;
+                // note: 'next_node' and 'node' should not be the same,
+                //       as 'removed' flag is already set.
+                __SLD_ASSERT(next_node != node);
+                nexts[cur_layer] = next_node;
+                ranks[cur_layer] = rank;
+
+                // check if prev node duplicates with upper layer
+                int error_code = 0;
+                int locked_layer = cur_layer + 1;
+                if (cur_layer < top_layer &&
+                    prevs[cur_layer] == prevs[cur_layer+1]) {
+                    // duplicate with upper layer
+                    // => which means that 'being_modified' flag is already true
+                    // => do nothing.
+                } else {
+                    if (_sl_try_set_state(prevs[cur_layer],
+                                          _SL_ST_MODIFYING)) {
+                        locked_layer = cur_layer;
+                    } else {
+                        error_code = -1;
+                    }
+                }
+
+                if (error_code == 0 &&
+                    !_sl_valid_prev_next(prevs[cur_layer], nexts[cur_layer])) {
+                    error_code = -2;
+                }
+
+                if (error_code != 0) {
+                    __SLD_RT_RMV(error_code, node, top_layer, cur_layer);
+                    _sl_clr_flags(prevs, locked_layer, top_layer);
+                    _sl_release(slist, cur_node);
+                    YIELD();
+                    goto erase_node_retry;
+                }
+
+                skiplist_node* next_node_again =
+                    _sl_next(slist, cur_node, cur_layer, node, NULL);
+                if (next_node_again) _sl_release(slist, next_node_again);
+                if (next_node_again != nexts[cur_layer]) {
+                    // `next` pointer has been changed, retry.
+                    __SLD_NC_RMV(cur_node, nexts[cur_layer], top_layer, cur_layer);
+                    _sl_clr_flags(prevs, cur_layer, top_layer);
+                    _sl_release(slist, cur_node);
+                    YIELD();
+                    goto erase_node_retry;
+                }
+            }
+            if (cur_layer == 0) found_node_to_erase = true;
+            if (fingers && cur_layer > top_layer) {
+                // Keep the path above `top_layer` for the next node.
+                _sl_grab(slist, cur_node);
+                if (fingers[cur_layer]) _sl_release(slist, fingers[cur_layer]);
+                fingers[cur_layer] = cur_node;
+            }
+            // go down
+            break;
+        } while (cur_node != &slist->tail);
+    }
+    // Not exist in the skiplist, should not happen.
+    __SLD_ASSERT(found_node_to_erase);
+    // bottom layer => removal succeeded.
+    // mark this node unlinked
+    _sl_write_lock_an(slist, node); {
+        _sl_set_state(node, _SL_ST_LINKED, false);
+    } _sl_write_unlock_an(node);
+
+    // change prev nodes' next pointer from 0 ~ top_layer
+    for (cur_layer = 0; cur_layer <= top_layer; ++cur_layer) {
+        _sl_write_lock_an(slist, prevs[cur_layer]);
+        skiplist_node* exp = node;
+        __SLD_ASSERT(exp != nexts[cur_layer]);
+        __SLD_ASSERT(_sl_fully_linked(nexts[cur_layer]));
+        if ( !ATM_CAS(prevs[cur_layer]->next[cur_layer],
+                      exp, nexts[cur_layer]) ) {
+            __SLD_P("%02x ASSERT rmv %p[%d] -> %p (node %p)\n",
+                    (int)tid_hash, prevs[cur_layer], cur_layer,
+                    ATM_GET(prevs[cur_layer]->next[cur_layer]), node );
+            __SLD_ASSERT(0);
+        }
+        __SLD_ASSERT(_sl_top_layer(nexts[cur_layer]) >= cur_layer);
+        __SLD_P("%02x rmv %p[%d] -> %p (node %p)\n",
+                (int)tid_hash, prevs[cur_layer], cur_layer,
+                nexts[cur_layer], node);
+        _sl_write_unlock_an(prevs[cur_layer]);
+    }
+    if (slist->backward_links) {
+        _sl_set_prev(slist, nexts[0], prevs[0]);
+    }
+    if (slist->indexable) {
+        // Merge the span of this node into each `prevs`.
+        for (cur_layer = 0; cur_layer <= top_layer; ++cur_layer) {
+            uint32_t span = 0;
+            ATM_LOAD(_sl_span(node)[cur_layer], span);
+            ATM_FETCH_ADD(_sl_span(prevs[cur_layer])[cur_layer], span - 1);
+        }
+        _sl_index_adjust(slist, ranks[0] + 1, top_layer + 1, -1);
+    }
+
+    __SLD_P("%02x rmv %p done\n", (int)tid_hash, node);
+
+    _sl_update_entries(slist, node, -1);
+
+    if (fingers) {
+        // `prevs` cannot be freed until their flags are cleared below.
+        for (cur_layer = 0; cur_layer <= top_layer; ++cur_layer) {
+            _sl_grab(slist, prevs[cur_layer]);
+            if (fingers[cur_layer]) _sl_release(slist, fingers[cur_layer]);
+            fingers[cur_layer] = prevs[cur_layer];
+        }
+    }
+
+    // modification is done for all layers
+    _sl_clr_flags(prevs, 0, top_layer);
+    _sl_release(slist, cur_node);
+
+    _sl_set_state(node, _SL_ST_MODIFYING, false);
+
+    return 0;
+}
+
+// Unlink `node` from the list.
+template<typename Cmp>
+inline int _sl_unlink_node(skiplist_raw *slist,
+                           const Cmp& comp,
+                           skiplist_node *node,
+                           skiplist_node **fingers)
+{
+    if (slist->sync_mode == SKIPLIST_SYNC_LOCK_FREE) {
+        return _sl_lf_erase_node(slist, comp, node);
+    }
+    if (!slist->indexable) {
+        return _sl_erase_node(slist, comp, node, fingers);
+    }
+    _sl_index_lock(slist);
+    int ret = _sl_erase_node(slist, comp, node, fingers);
+    _sl_index_unlock(slist);
+    return ret;
+}
+
+// Erase `node` from the latest view of a versioned skiplist. It is
+// unlinked right away if no snapshot can see it, otherwise it stays
+// until `skiplist_retire_node()` finds all older snapshots released.
+template<typename Cmp>
+inline int _sl_erase_version(skiplist_raw *slist,
+                             const Cmp& comp,
+                             skiplist_node *node)
+{
+    if (!_sl_valid_node(node)) return -3;
+
+    uint64_t seq = _sl_seq_begin(slist);
+    uint64_t erase_seq = _SL_SEQ_NONE;
+    bool erased = false;
+    do {
+        erased = ATM_CAS(_sl_erase_seq(slist, node), erase_seq, seq);
+    } while (!erased && erase_seq == _SL_SEQ_NONE);
+    _sl_seq_end(slist, seq);
+    if (!erased) {
+        // Already erased.
+        return -1;
+    }
+    _sl_update_size(slist, -1);
+
+    if (_sl_oldest_snapshot(slist) >= seq) {
+        int ret = 0;
+        do {
+            ret = _sl_unlink_node(slist, comp, node, NULL);
+        } while (ret == -2);
+    }
+    return 0;
+}
+
+template<typename Cmp>
+inline int _sl_erase_node_passive(skiplist_raw *slist,
+                                  const Cmp& comp,
+                                  skiplist_node *node,
+                                  skiplist_node **fingers)
+{
+    if (slist->versioned) return _sl_erase_version(slist, comp, node);
+    return _sl_unlink_node(slist, comp, node, fingers);
+}
+
+// Erase all nodes in `[from, to)`, and call `on_removed` for each of
+// them once it is unlinked. NULL `from` or `to` means unbounded.
+// Consecutive nodes are erased using the search path of the previous one,
+// so the whole range costs O(log n + k) for `k` nodes (except in hazard
+// pointer mode, which does not have enough slots to keep the path, and
+// in lock-free mode, where each node is erased with its own search; an
+// indexable skiplist also searches from the head to get the positions,
+// and a versioned one may leave the erased nodes in the path).
+// Without `from`, the path is the head on all layers from the beginning.
+template<typename Cmp>
+inline size_t _sl_erase_range(skiplist_raw *slist,
+                              const Cmp& comp,
+                              skiplist_node *from,
+                              skiplist_node *to,
+                              skiplist_node_cb_t *on_removed,
+                              void *ctx)
+{
+    skiplist_node* fingers[SKIPLIST_MAX_LAYER];
+    bool use_fingers = (slist->reclaim_mode != SKIPLIST_RECLAIM_HAZARD &&
+                        slist->sync_mode != SKIPLIST_SYNC_LOCK_FREE &&
+                        !slist->indexable && !slist->versioned);
+    size_t ii, num_removed = 0;
+    for (ii = 0; ii < SKIPLIST_MAX_LAYER; ++ii) {
+        fingers[ii] = NULL;
+        if (use_fingers && !from) {
+            _sl_grab(slist, &slist->head);
+            fingers[ii] = &slist->head;
+        }
+    }
+
+    skiplist_node* cur = NULL;
+    if (from) {
+        cur = _sl_find(slist, comp, from, _SL_GTEQ);
+    } else {
+        while (!cur) cur = _sl_next(slist, &slist->head, 0, NULL, NULL);
+    }
+
+    while ( cur && cur != &slist->tail &&
+            (!to || comp(cur, to) < 0) ) {
+        int ret = 0;
+        do {
+            ret = _sl_erase_node_passive(slist, comp, cur,
+                                         use_fingers ? fingers : NULL);
+            // if ret == -2, other thread is accessing the same node
+            // at the same time. try again.
+        } while (ret == -2);
+
+        // The next node is right after the predecessor of `cur`, unless
+        // a node smaller than `from` has been inserted in the meantime.
+        skiplist_node* next = NULL;
+        if (use_fingers && fingers[0]) {
+            next = _sl_next(slist, fingers[0], 0, NULL, NULL);
+            if ( next && next != &slist->tail &&
+                 from && comp(next, from) < 0 ) {
+                _sl_release(slist, next);
+                next = NULL;
+            }
+        }
+        if (!next) next = _sl_find(slist, comp, cur, _SL_GT);
+
+        _sl_release(slist, cur);
+        if (ret == 0) {
+            num_removed++;
+            if (on_removed) on_removed(cur, ctx);
+        }
+        cur = next;
+    }
+    if (cur) _sl_release(slist, cur);
+
+    for (ii = 0; ii < SKIPLIST_MAX_LAYER; ++ii) {
+        if (fingers[ii]) _sl_release(slist, fingers[ii]);
+    }
+    return num_removed;
+}
+
+// Number of nodes smaller than `query` (all nodes if NULL), by the spans
+// if `indexed`, otherwise by walking on layer 0.
+// If a node became invalid in the middle, set `retry` and return 0.
+template<typename Cmp>
+inline uint64_t _sl_rank_walk(skiplist_raw *slist,
+                              const Cmp& comp,
+                              skiplist_node *query,
+                              bool indexed,
+                              bool *retry)
+{
+    uint64_t rank = 0;
+    skiplist_node *cur_node = &slist->head;
+    _sl_grab(slist, cur_node);
+
+    int cur_layer = indexed ? (int)slist->top_layer : 0;
+    for (; cur_layer >= 0; --cur_layer) {
+        for (;;) {
+            skiplist_node *next_node = _sl_next(slist, cur_node, cur_layer,
+                                                NULL, NULL);
+            if (!next_node) {
+                _sl_release(slist, cur_node);
+                *retry = true;
+                return 0;
+            }
+            if ( next_node == &slist->tail ||
+                 (query && comp(next_node, query) >= 0) ) {
+                _sl_release(slist, next_node);
+                break;
+            }
+            rank += indexed ? ATM_GET(_sl_span(cur_node)[cur_layer]) : 1;
+            skiplist_node* temp = cur_node;
+            cur_node = next_node;
+            _sl_release(slist, temp);
+        }
+    }
+    _sl_release(slist, cur_node);
+    return rank;
+}
+
+// Number of nodes in `[from, to)`, both ranks from the same snapshot
+// of `index_seq` in an indexable skiplist.
+template<typename Cmp>
+inline uint64_t _sl_count(skiplist_raw *slist,
+                          const Cmp& comp,
+                          skiplist_node *from,
+                          skiplist_node *to)
+{
+    int tries = 0;
+count_retry:
+    bool retry = false;
+    bool indexed = slist->indexable;
+    uint64_t seq = indexed ? _sl_index_read_begin(slist, tries++) : 0;
+
+    uint64_t to_rank = _sl_rank_walk(slist, comp, to, indexed, &retry);
+    uint64_t from_rank = 0;
+    if (!retry && from) {
+        from_rank = _sl_rank_walk(slist, comp, from, indexed, &retry);
+    }
+    if (indexed && _sl_index_read_end(slist, seq)) retry = true;
+    if (retry) {
+        YIELD();
+        goto count_retry;
+    }
+    return (to_rank > from_rank) ? to_rank - from_rank : 0;
+}
+
+// Node at rank `k` (grabbed), or NULL if out of range.
+inline skiplist_node* _sl_select(skiplist_raw *slist,
+                                 uint64_t k)
+{
+    int tries = 0;
+select_retry:
+    bool indexed = slist->indexable;
+    uint64_t seq = indexed ? _sl_index_read_begin(slist, tries++) : 0;
+
+    // Position of the target: the first node is at 1.
+    uint64_t pos = k + 1, rank = 0;
+    skiplist_node *cur_node = &slist->head;
+    _sl_grab(slist, cur_node);
+
+    int cur_layer = indexed ? (int)slist->top_layer : 0;
+    for (; cur_layer >= 0 && rank < pos; --cur_layer) {
+        while (rank < pos) {
+            skiplist_node *next_node = _sl_next(slist, cur_node, cur_layer,
+                                                NULL, NULL);
+            if (!next_node) {
+                _sl_release(slist, cur_node);
+                if (indexed) _sl_index_read_end(slist, seq);
+                YIELD();
+                goto select_retry;
+            }
+            uint64_t step = indexed ? ATM_GET(_sl_span(cur_node)[cur_layer])
+                                    : 1;
+            if (next_node == &slist->tail || rank + step > pos) {
+                _sl_release(slist, next_node);
+                break;
+            }
+            rank += step;
+            skiplist_node* temp = cur_node;
+            cur_node = next_node;
+            _sl_release(slist, temp);
+        }
+    }
+    if (rank != pos) {
+        _sl_release(slist, cur_node);
+        cur_node = NULL;
+    }
+    if (indexed && _sl_index_read_end(slist, seq)) {
+        if (cur_node) _sl_release(slist, cur_node);
+        YIELD();
+        goto select_retry;
+    }
+    return cur_node;
+}
+
+// Operations of the engine on `slist` with comparator `Cmp`,
+// each of which is a whole operation (`_sl_op_begin()` ~ `_sl_op_end()`).
+// Semantics and return values are the same as the C API of the same name.
+template<typename Cmp>
+class sl_engine {
+public:
+    static int insert(skiplist_raw* slist,
+                      skiplist_node* node) {
+        Cmp comp(slist);
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+        int ret = _skiplist_insert(slist, comp, node, false, NULL, NULL,
+                                   NULL);
+        _sl_op_end(slist, rec);
+        return ret;
+    }
+
+    static int insert_nodup(skiplist_raw* slist,
+                            skiplist_node* node) {
+        Cmp comp(slist);
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+        int ret = _skiplist_insert(slist, comp, node, true, NULL, NULL,
+                                   NULL);
+        _sl_op_end(slist, rec);
+        return ret;
+    }
+
+    // `insert_nodup()` that also returns the node of the same key if it
+    // is already there, found by the same search: 0 if inserted, or -1
+    // with the node in `existing` (pinned, caller should release it).
+    static int insert_or_find(skiplist_raw* slist,
+                              skiplist_node* node,
+                              skiplist_node** existing) {
+        Cmp comp(slist);
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+        *existing = NULL;
+        int ret = _skiplist_insert(slist, comp, node, true, NULL, existing,
+                                   NULL);
+        if (ret != 0) _sl_pin(slist, *existing);
+        _sl_op_end(slist, rec);
+        return ret;
+    }
+
+    // `insert_or_find()` of the key of `query`, whose node is built by
+    // `maker` only if the key is not there, by the same search. Returns
+    // -2 if `maker` fails. On -1, `maker->node` is set if it was built
+    // before another thread inserted the key (lock-free mode).
+    static int insert_or_make(skiplist_raw* slist,
+                              skiplist_node* query,
+                              _sl_node_maker* maker,
+                              skiplist_node** existing) {
+        Cmp comp(slist);
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+        *existing = NULL;
+        maker->node = NULL;
+        int ret = _skiplist_insert(slist, comp, query, true, NULL, existing,
+                                   maker);
+        if (ret == -1) _sl_pin(slist, *existing);
+        _sl_op_end(slist, rec);
+        return ret;
+    }
+
+    static size_t insert_batch(skiplist_raw* slist,
+                               skiplist_node** nodes,
+                               size_t num_nodes) {
+        return insert_batch_internal(slist, nodes, num_nodes, false, NULL);
+    }
+
+    static size_t insert_batch_nodup(skiplist_raw* slist,
+                                     skiplist_node** nodes,
+                                     size_t num_nodes,
+                                     int* results) {
+        return insert_batch_internal(slist, nodes, num_nodes, true, results);
+    }
+
+    // Read operations see the snapshot of `seq` (see `skiplist_snapshot()`)
+    // if it is given, otherwise the latest view.
+    static skiplist_node* find(skiplist_raw* slist,
+                               skiplist_node* query,
+                               uint64_t seq = _SL_SEQ_LATEST) {
+        return find_pinned(slist, query, _SL_EQ, seq);
+    }
+
+    static skiplist_node* find_smaller_or_equal(skiplist_raw* slist,
+                                                skiplist_node* query,
+                                                uint64_t seq = _SL_SEQ_LATEST) {
+        return find_pinned(slist, query, _SL_SMEQ, seq);
+    }
+
+    static skiplist_node* find_greater_or_equal(skiplist_raw* slist,
+                                                skiplist_node* query,
+                                                uint64_t seq = _SL_SEQ_LATEST) {
+        return find_pinned(slist, query, _SL_GTEQ, seq);
+    }
+
+    static skiplist_node* find_from(skiplist_raw* slist,
+                                    skiplist_node* hint,
+                                    skiplist_node* query) {
+        return find_from_pinned(slist, hint, query, _SL_EQ);
+    }
+
+    static skiplist_node* find_smaller_or_equal_from(skiplist_raw* slist,
+                                                     skiplist_node* hint,
+                                                     skiplist_node* query) {
+        return find_from_pinned(slist, hint, query, _SL_SMEQ);
+    }
+
+    static skiplist_node* find_greater_or_equal_from(skiplist_raw* slist,
+                                                     skiplist_node* hint,
+                                                     skiplist_node* query) {
+        return find_from_pinned(slist, hint, query, _SL_GTEQ);
+    }
+
+    // Same as `find()` on each of `queries`, but the searches are
+    // interleaved (see `_sl_find_group()`). Returns the number of found.
+    static size_t find_batch(skiplist_raw* slist,
+                             skiplist_node** queries,
+                             skiplist_node** results,
+                             size_t num_queries) {
+        Cmp comp(slist);
+        // Hazard slots are not enough to hold the nodes of a group,
+        // and a versioned skiplist filters the versions of the results.
+        size_t group = _SL_FIND_GROUP;
+        if ( slist->reclaim_mode == SKIPLIST_RECLAIM_HAZARD ||
+             slist->versioned ) {
+            group = 1;
+        }
+
+        size_t ii, jj, num_found = 0;
+        for (ii = 0; ii < num_queries; ii += group) {
+            size_t num = (num_queries - ii < group) ? num_queries - ii
+                                                     : group;
+            _sl_reclaim_rec* rec = _sl_op_begin(slist);
+            if (group == 1) {
+                results[ii] = _sl_find_visible(slist, comp, queries[ii],
+                                               _SL_EQ, _SL_SEQ_LATEST);
+            } else {
+                _sl_find_group(slist, comp, queries + ii, results + ii, num);
+            }
+            for (jj = ii; jj < ii + num; ++jj) {
+                if (!results[jj]) continue;
+                _sl_pin(slist, results[jj]);
+                num_found++;
+            }
+            _sl_op_end(slist, rec);
+        }
+        return num_found;
+    }
+
+    static int erase_node_passive(skiplist_raw* slist,
+                                  skiplist_node* node) {
+        Cmp comp(slist);
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+        int ret = _sl_erase_node_passive(slist, comp, node, NULL);
+        _sl_op_end(slist, rec);
+        return ret;
+    }
+
+    static int erase_node(skiplist_raw* slist,
+                          skiplist_node* node) {
+        Cmp comp(slist);
+        int ret = 0;
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+        do {
+            ret = _sl_erase_node_passive(slist, comp, node, NULL);
+            // if ret == -2, other thread is accessing the same node
+            // at the same time. try again.
+        } while (ret == -2);
+        _sl_op_end(slist, rec);
+        return ret;
+    }
+
+    static int erase(skiplist_raw* slist,
+                     skiplist_node* query) {
+        Cmp comp(slist);
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+        skiplist_node *found = _sl_find_visible(slist, comp, query, _SL_EQ,
+                                                _SL_SEQ_LATEST);
+        if (!found) {
+            // key not found
+            _sl_op_end(slist, rec);
+            return -4;
+        }
+
+        int ret = 0;
+        do {
+            ret = _sl_erase_node_passive(slist, comp, found, NULL);
+            // if ret == -2, other thread is accessing the same node
+            // at the same time. try again.
+        } while (ret == -2);
+
+        _sl_release(slist, found);
+        _sl_op_end(slist, rec);
+        return ret;
+    }
+
+    static size_t erase_range(skiplist_raw* slist,
+                              skiplist_node* from,
+                              skiplist_node* to,
+                              skiplist_node_cb_t* on_removed,
+                              void* ctx) {
+        Cmp comp(slist);
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+        size_t ret = _sl_erase_range(slist, comp, from, to, on_removed, ctx);
+        _sl_op_end(slist, rec);
+        return ret;
+    }
+
+    static size_t truncate_before(skiplist_raw* slist,
+                                  skiplist_node* to,
+                                  skiplist_node_cb_t* on_removed,
+                                  void* ctx) {
+        return erase_range(slist, NULL, to, on_removed, ctx);
+    }
+
+    static size_t rank(skiplist_raw* slist,
+                       skiplist_node* query) {
+        Cmp comp(slist);
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+        size_t ret = _sl_count(slist, comp, NULL, query);
+        _sl_op_end(slist, rec);
+        return ret;
+    }
+
+    static skiplist_node* select(skiplist_raw* slist,
+                                 size_t k) {
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+        skiplist_node* ret = _sl_pin(slist, _sl_select(slist, k));
+        _sl_op_end(slist, rec);
+        return ret;
+    }
+
+    static size_t count(skiplist_raw* slist,
+                        skiplist_node* from,
+                        skiplist_node* to) {
+        Cmp comp(slist);
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+        size_t ret = _sl_count(slist, comp, from, to);
+        _sl_op_end(slist, rec);
+        return ret;
+    }
+
+    static skiplist_node* begin(skiplist_raw* slist,
+                                uint64_t seq = _SL_SEQ_LATEST) {
+        Cmp comp(slist);
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+        skiplist_node *next = NULL;
+        while (!next) {
+            next = _sl_next(slist, &slist->head, 0, NULL, NULL);
+        }
+        next = _sl_next_visible(slist, comp, next, seq);
+        if (next == &slist->tail) {
+            _sl_release(slist, next);
+            next = NULL;
+        }
+        _sl_prefetch_ahead(slist, next);
+        _sl_pin(slist, next);
+        _sl_op_end(slist, rec);
+        return next;
+    }
+
+    // See the comment in `skiplist_next()`.
+    static skiplist_node* next(skiplist_raw* slist,
+                               skiplist_node* node,
+                               uint64_t seq = _SL_SEQ_LATEST) {
+        Cmp comp(slist);
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+        skiplist_node *next = _sl_next(slist, node, 0, NULL, NULL);
+        if (!next) next = _sl_find(slist, comp, node, _SL_GT);
+        if (next) next = _sl_next_visible(slist, comp, next, seq);
+
+        if (next == &slist->tail) {
+            _sl_release(slist, next);
+            next = NULL;
+        }
+        _sl_prefetch_ahead(slist, next);
+        _sl_pin(slist, next);
+        _sl_op_end(slist, rec);
+        return next;
+    }
+
+    // Same as `find*()` and `next()`, but the returned node is not
+    // pinned: only for `SKIPLIST_RECLAIM_NONE`, where nodes stay until
+    // the skiplist is freed. Snapshots are not supported.
+    static skiplist_node* find_unpinned(skiplist_raw* slist,
+                                        skiplist_node* query,
+                                        _sl_find_mode mode) {
+        Cmp comp(slist);
+        return _sl_find_visible(slist, comp, query, mode, _SL_SEQ_LATEST);
+    }
+
+    // `node` is the head to get the first one.
+    static skiplist_node* next_unpinned(skiplist_raw* slist,
+                                        skiplist_node* node) {
+        skiplist_node* next = _sl_next(slist, node, 0, NULL, NULL);
+        if (!next || next == &slist->tail) return NULL;
+        _sl_prefetch_ahead(slist, next);
+        return next;
+    }
+
+    static skiplist_node* prev(skiplist_raw* slist,
+                               skiplist_node* node,
+                               uint64_t seq = _SL_SEQ_LATEST) {
+        Cmp comp(slist);
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+        skiplist_node *prev = _sl_prev_link(slist, node);
+        if (!prev) prev = _sl_find(slist, comp, node, _SL_SM);
+        if (prev) prev = _sl_prev_visible(slist, comp, prev, seq);
+        if (prev == &slist->head) {
+            _sl_release(slist, prev);
+            prev = NULL;
+        }
+        _sl_pin(slist, prev);
+        _sl_op_end(slist, rec);
+        return prev;
+    }
+
+    static skiplist_node* hazard_next(skiplist_raw* slist,
+                                      skiplist_hazard* hazard,
+                                      uint64_t seq = _SL_SEQ_LATEST) {
+        skiplist_node* node = skiplist_hazard_get(hazard);
+        if (!node) return NULL;
+
+        // Same as `next()`, but the result is moved to
+        // the hazard slot instead of being pinned.
+        Cmp comp(slist);
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+        skiplist_node *next = _sl_next(slist, node, 0, NULL, NULL);
+        if (!next) next = _sl_find(slist, comp, node, _SL_GT);
+        if (next) next = _sl_next_visible(slist, comp, next, seq);
+
+        if (next == &slist->tail) {
+            _sl_release(slist, next);
+            next = NULL;
+        }
+        _sl_prefetch_ahead(slist, next);
+        skiplist_hazard_set(hazard, next);
+        if (next) _sl_release(slist, next);
+        _sl_op_end(slist, rec);
+        return next;
+    }
+
+    static skiplist_node* hazard_prev(skiplist_raw* slist,
+                                      skiplist_hazard* hazard,
+                                      uint64_t seq = _SL_SEQ_LATEST) {
+        skiplist_node* node = skiplist_hazard_get(hazard);
+        if (!node) return NULL;
+
+        Cmp comp(slist);
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+        skiplist_node *prev = _sl_prev_link(slist, node);
+        if (!prev) prev = _sl_find(slist, comp, node, _SL_SM);
+        if (prev) prev = _sl_prev_visible(slist, comp, prev, seq);
+        if (prev == &slist->head) {
+            _sl_release(slist, prev);
+            prev = NULL;
+        }
+        skiplist_hazard_set(hazard, prev);
+        if (prev) _sl_release(slist, prev);
+        _sl_op_end(slist, rec);
+        return prev;
+    }
+
+private:
+    static size_t insert_batch_internal(skiplist_raw* slist,
+                                        skiplist_node** nodes,
+                                        size_t num_nodes,
+                                        bool no_dup,
+                                        int* results) {
+        Cmp comp(slist);
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+
+        // In hazard pointer mode, the search path cannot be kept alive
+        // across inserts due to the limited number of slots.
+        // Lock-free insert always searches from the head, and so does
+        // an indexable skiplist to get the positions of the path.
+        skiplist_node* fingers[SKIPLIST_MAX_LAYER];
+        bool use_fingers = (slist->reclaim_mode != SKIPLIST_RECLAIM_HAZARD &&
+                        slist->sync_mode != SKIPLIST_SYNC_LOCK_FREE &&
+                        !slist->indexable);
+        size_t ii, num_inserted = 0;
+        for (ii = 0; ii < SKIPLIST_MAX_LAYER; ++ii) fingers[ii] = NULL;
+
+        for (ii = 0; ii < num_nodes; ++ii) {
+            int ret = _skiplist_insert(slist, comp, nodes[ii], no_dup,
+                                       use_fingers ? fingers : NULL, NULL,
+                                       NULL);
+            if (results) results[ii] = ret;
+            if (ret == 0) num_inserted++;
+        }
+
+        for (ii = 0; ii < SKIPLIST_MAX_LAYER; ++ii) {
+            if (fingers[ii]) _sl_release(slist, fingers[ii]);
+        }
+        _sl_op_end(slist, rec);
+        return num_inserted;
+    }
+
+    static skiplist_node* find_pinned(skiplist_raw* slist,
+                                      skiplist_node* query,
+                                      _sl_find_mode mode,
+                                      uint64_t seq) {
+        Cmp comp(slist);
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+        skiplist_node* ret =
+            _sl_pin(slist, _sl_find_visible(slist, comp, query, mode, seq));
+        _sl_op_end(slist, rec);
+        return ret;
+    }
+
+    static skiplist_node* find_from_pinned(skiplist_raw* slist,
+                                           skiplist_node* hint,
+                                           skiplist_node* query,
+                                           _sl_find_mode mode) {
+        Cmp comp(slist);
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+        // Versions of the same key may be on both sides of `hint`.
+        skiplist_node* ret = slist->versioned
+            ? _sl_find_visible(slist, comp, query, mode, _SL_SEQ_LATEST)
+            : _sl_find_from(slist, comp, hint, query, mode);
+        _sl_pin(slist, ret);
+        _sl_op_end(slist, rec);
+        return ret;
+    }
+};
+
+// Comparator of the C API: `cmp_func` of the skiplist.
+struct _sl_fn_cmp {
+    _sl_fn_cmp(skiplist_raw* slist)
+        : func(slist->cmp_func), aux(slist->aux) {}
+    int operator()(skiplist_node* a, skiplist_node* b) const {
+        return func(a, b, aux);
+    }
+    skiplist_cmp_t* func;
+    void* aux;
+};
+
+// Internal macros are not exposed to the users of containers.
+#ifndef _SL_ENGINE_KEEP_MACROS
+    #undef __SLD_RT_INS
+    #undef __SLD_NC_INS
+    #undef __SLD_RT_RMV
+    #undef __SLD_NC_RMV
+    #undef __SLD_BM
+    #undef __SLD_ASSERT
+    #undef __SLD_P
+    #undef __SLD_
+    #undef __SL_YIELD
+    #undef YIELD
+    #undef __SL_PREFETCH
+    #undef PREFETCH
+    #undef MOR
+    #undef ATM_GET
+    #undef ATM_LOAD
+    #undef ATM_STORE
+    #undef ATM_CAS
+    #undef ATM_FETCH_ADD
+    #undef ATM_FETCH_SUB
+    #undef ATM_FETCH_AND
+    #undef ATM_FETCH_OR
+    #undef ATM_STORE_REL
+    #undef ATM_FENCE
+    #undef ALLOC_
+    #undef FREE_
+#endif
@@ -32,11 +32,18 @@
 #pragma once
 
 #include "skiplist.h"
+#include "sl_checkpoint.h"
+#include "sl_engine.h"
+#include "sl_node_pool.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cstdlib>
+#include <exception>
 #include <mutex>
+#include <new>
 #include <thread>
+#include <tuple>
 #include <utility>
 #include <vector>
 
@@ -45,6 +52,13 @@ struct map_node {
     map_node() {
         skiplist_init_node(&snode);
     }
+    // `kv` is built from `args`.
+    template<typename A, typename... Args>
+    explicit map_node(A&& a, Args&&... args)
+        : kv(std::forward<A>(a), std::forward<Args>(args)...)
+    {
+        skiplist_init_node(&snode);
+    }
     ~map_node() {
         skiplist_free_node(&snode);
     }
@@ -56,6 +70,36 @@ struct map_node {
         if (aa->kv.first > bb->kv.first) return 1;
         return 0;
     }
+    // Comparator of `sl_engine`, so that `cmp()` is inlined.
+    struct key_cmp {
+        key_cmp(skiplist_raw*) {}
+        int operator()(skiplist_node* a, skiplist_node* b) const {
+            return cmp(a, b, nullptr);
+        }
+    };
+    // Allocate a node along with its inline tower up to `top_layer`
+    // from `pool`, and build `kv` from `args`.
+    template<typename... Args>
+    static map_node* create(size_t top_layer,
+                            sl_node_pool* pool,
+                            Args&&... args) {
+        void* mem = pool->alloc(top_layer);
+        map_node* node = new (mem) map_node(std::forward<Args>(args)...);
+        skiplist_init_node_inline(&node->snode, node,
+                                  sizeof(map_node), top_layer);
+        return node;
+    }
+    // `pool` should be the one given to `create()`.
+    static void dispose(map_node* node, sl_node_pool* pool) {
+        size_t top_layer = _sl_tower_size(&node->snode) - 1;
+        node->~map_node();
+        pool->free(node, top_layer);
+    }
+    // `ctx`: the pool of the node.
+    static void destroy(skiplist_node* node, void* ctx) {
+        dispose( _get_entry(node, map_node, snode),
+                 static_cast<sl_node_pool*>(ctx) );
+    }
 
     skiplist_node snode;
     std::pair<K, V> kv;
@@ -63,6 +107,7 @@ struct map_node {
 
 template<typename K, typename V> class sl_map;
 template<typename K, typename V> class sl_map_gc;
+template<typename K, typename V> class sl_map_merge_iterator;
 
 template<typename K, typename V>
 class map_iterator {
@@ -72,29 +117,54 @@ class map_iterator {
 private:
     using T = std::pair<K, V>;
     using Node = map_node<K, V>;
+    using Engine = sl_engine<typename Node::key_cmp>;
 
 public:
-    map_iterator() : slist(nullptr), cursor(nullptr) {}
+    map_iterator()
+        : slist(nullptr), cursor(nullptr), hazard(nullptr)
+        , seq(_SL_SEQ_LATEST) {}
 
     map_iterator(map_iterator&& src)
-        : slist(src.slist), cursor(src.cursor)
+        : slist(src.slist), cursor(src.cursor), hazard(src.hazard)
+        , seq(src.seq)
     {
         // Mimic perfect forwarding.
         src.slist = nullptr;
         src.cursor = nullptr;
+        src.hazard = nullptr;
     }
 
     ~map_iterator() {
-        if (cursor) skiplist_release_node(cursor);
+        release();
     }
 
     void operator=(const map_iterator& src) {
+        if (this == &src) return;
+        if (src.hazard) {
+            // Hazard pointer mode: reuse our slot if we have one.
+            if (!hazard) {
+                release();
+                hazard = skiplist_hazard_acquire(src.slist);
+            }
+            skiplist_hazard_set(hazard, src.cursor);
+            slist = src.slist;
+            cursor = src.cursor;
+            seq = src.seq;
+            return;
+        }
+
         // This reference counting is similar to that of shared_ptr.
         skiplist_node* tmp = cursor;
+        skiplist_hazard* tmp_hazard = hazard;
         if (src.cursor)
             skiplist_grab_node(src.cursor);
+        slist = src.slist;
         cursor = src.cursor;
-        if (tmp)
+        hazard = nullptr;
+        seq = src.seq;
+        if (tmp_hazard)
+            skiplist_hazard_release(slist, tmp_hazard);
+        else if (tmp)
             skiplist_release_node(tmp);
     }
 
@@ -116,7 +186,11 @@ public:
             cursor = nullptr;
             return *this;
         }
-        skiplist_node* next = skiplist_next(slist, cursor);
+        if (hazard) {
+            cursor = Engine::hazard_next(slist, hazard, seq);
+            return *this;
+        }
+        skiplist_node* next = Engine::next(slist, cursor, seq);
         skiplist_release_node(cursor);
         cursor = next;
         return *this;
@@ -129,7 +203,11 @@ public:
             cursor = nullptr;
             return *this;
         }
-        skiplist_node* prev = skiplist_prev(slist, cursor);
+        if (hazard) {
+            cursor = Engine::hazard_prev(slist, hazard, seq);
+            return *this;
+        }
+        skiplist_node* prev = Engine::prev(slist, cursor, seq);
         skiplist_release_node(cursor);
         cursor = prev;
         return *this;
@@ -138,38 +216,115 @@ public:
     map_iterator operator--(int) { return operator--(); }
 
 private:
+    // `_cursor` should be grabbed by caller, and then owned by iterator.
+    // With `_seq`, it moves on the snapshot of that sequence number.
     map_iterator(skiplist_raw* _slist,
-                 skiplist_node* _cursor)
-        : slist(_slist), cursor(_cursor) {}
+                 skiplist_node* _cursor,
+                 uint64_t _seq = _SL_SEQ_LATEST)
+        : slist(_slist), cursor(_cursor), hazard(nullptr), seq(_seq)
+    {
+        // In hazard pointer mode, keep `cursor` alive
+        // by a hazard slot instead of `ref_count`.
+        hazard = (slist && cursor) ? skiplist_hazard_acquire(slist) : nullptr;
+        if (hazard) {
+            skiplist_hazard_set(hazard, cursor);
+            skiplist_release_node(cursor);
+        }
+    }
+
+    void release() {
+        if (hazard) {
+            skiplist_hazard_release(slist, hazard);
+            hazard = nullptr;
+        } else if (cursor) {
+            skiplist_release_node(cursor);
+        }
+        cursor = nullptr;
+    }
 
     skiplist_raw* slist;
     skiplist_node* cursor;
+    skiplist_hazard* hazard;
+    uint64_t seq;
 };
 
 
 
 template<typename K, typename V>
 class sl_map {
+    friend class sl_map_merge_iterator<K, V>;
+
 private:
     using T = std::pair<K, V>;
     using Node = map_node<K, V>;
+    using Engine = sl_engine<typename Node::key_cmp>;
 
 public:
     using iterator = map_iterator<K, V>;
     using reverse_iterator = map_iterator<K, V>;
 
-    sl_map() {
+    sl_map() : pool(sizeof(Node), &slist) {
         skiplist_init(&slist, Node::cmp);
     }
 
+    // E.g., `reclaimMode = SKIPLIST_RECLAIM_EPOCH` or `_HAZARD` lets
+    // `erase()` return without waiting for readers of the erased node.
+    sl_map(const skiplist_raw_config& config) : pool(sizeof(Node), &slist) {
+        skiplist_init(&slist, Node::cmp);
+        skiplist_set_config(&slist, config);
+        pool.setHugePages(config.hugePages);
+    }
+
+    // Build from `[first, last)` at once, duplicate keys are skipped.
+    // It takes O(n) if the input is sorted by key.
+    template<typename InputIt>
+    sl_map(InputIt first, InputIt last,
+           const skiplist_raw_config& config = skiplist_get_default_config())
+        : pool(sizeof(Node), &slist)
+    {
+        skiplist_init(&slist, Node::cmp);
+        skiplist_set_config(&slist, config);
+        pool.setHugePages(config.hugePages);
+
+        std::vector<T> items(first, last);
+        bool sorted = true;
+        for (size_t ii = 1; ii < items.size(); ++ii) {
+            if (items[ii].first < items[ii-1].first) {
+                sorted = false;
+                break;
+            }
+        }
+        if (!sorted) {
+            std::stable_sort(items.begin(), items.end(),
+                             [](const T& a, const T& b) {
+                                 return a.first < b.first;
+                             });
+        }
+
+        // Keep the first one among the same keys.
+        std::vector<skiplist_node*> snodes;
+        snodes.reserve(items.size());
+        for (size_t ii = 0; ii < items.size(); ++ii) {
+            if (ii && !(items[ii-1].first < items[ii].first)) continue;
+            Node* node = Node::create
+                         ( skiplist_bulk_load_top_layer(&slist, snodes.size()),
+                           &pool );
+            node->kv = items[ii];
+            snodes.push_back(&node->snode);
+        }
+        if (!snodes.empty()) {
+            skiplist_bulk_load(&slist, &snodes[0], snodes.size());
+        }
+    }
+
     virtual
     ~sl_map() {
         skiplist_node* cursor = skiplist_begin(&slist);
         while (cursor) {
             Node* node = _get_entry(cursor, Node, snode);
-            cursor = skiplist_next(&slist, cursor);
+            cursor = Engine::next(&slist, cursor);
             // Don't need to care about release.
-            delete node;
+            Node::dispose(node, &pool);
         }
         skiplist_free(&slist);
     }
@@ -185,51 +340,259 @@ public:
 
     size_t size() { return skiplist_get_size(&slist); }
 
+    // Preallocate nodes for `n` more entries at once, e.g., before
+    // a bulk of inserts. Erased nodes are reused by later inserts.
+    void reserve(size_t n) {
+        skiplist_raw_config config = skiplist_get_config(&slist);
+        pool.reserve(n, config.fanout, config.maxLayer);
+    }
+
     std::pair<iterator, bool> insert(const std::pair<K, V>& kv) {
-        do {
-            Node* node = new Node();
-            node->kv = kv;
-
-            int rc = skiplist_insert_nodup(&slist, &node->snode);
-            if (rc == 0) {
-                skiplist_grab_node(&node->snode);
-                return std::pair<iterator, bool>
-                       ( iterator(&slist, &node->snode), true );
-            }
-            delete node;
+        return insertNode(newNode(kv.first, kv));
+    }
 
-            Node query;
-            query.kv.first = kv.first;
-            skiplist_node* cursor = skiplist_find(&slist, &query.snode);
-            if (cursor) {
-                return std::pair<iterator, bool>
-                       ( iterator(&slist, cursor), false );
-            }
-        } while (true);
+    std::pair<iterator, bool> insert(std::pair<K, V>&& kv) {
+        return insertNode(newNode(kv.first, std::move(kv)));
+    }
+
+    // The entry is built in place from `args`. If the key is already
+    // there, it is dropped and the existing one is returned.
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        if (!keyedLevels()) {
+            return insertNode( Node::create( skiplist_decide_top_layer
+                                                 (&slist, nullptr),
+                                             &pool,
+                                             std::forward<Args>(args)... ) );
+        }
+        // The level generator needs the key before allocation.
+        T kv(std::forward<Args>(args)...);
+        return insertNode(newNode(kv.first, std::move(kv)));
+    }
+
+    // Same as `emplace()` of `key` and `V(args...)`, but `key` and
+    // `args` are left untouched if `key` is already there: the entry is
+    // built only once the search for `key` finds its place. They are
+    // consumed only if another thread inserts `key` in the meantime
+    // (lock-free mode).
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const K& key, Args&&... args) {
+        return makeNode(key, [&](size_t top_layer) {
+            return Node::create( top_layer, &pool, std::piecewise_construct,
+                                 std::forward_as_tuple(key),
+                                 std::forward_as_tuple
+                                     (std::forward<Args>(args)...) );
+        });
+    }
 
-        // NOTE: Should not reach here.
-        return std::pair<iterator, bool>(iterator(), false);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(K&& key, Args&&... args) {
+        return makeNode(key, [&](size_t top_layer) {
+            return Node::create( top_layer, &pool, std::piecewise_construct,
+                                 std::forward_as_tuple(std::move(key)),
+                                 std::forward_as_tuple
+                                     (std::forward<Args>(args)...) );
+        });
+    }
+
+    // Insert, or assign `obj` to the value of the existing `key`.
+    // The assignment is not atomic against readers of the value.
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const K& key, M&& obj) {
+        return insertNode(newNode(key, key, std::forward<M>(obj)), true);
+    }
+
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(K&& key, M&& obj) {
+        return insertNode
+               ( newNode(key, std::move(key), std::forward<M>(obj)), true );
+    }
+
+    // Duplicate keys (including the ones in the input) are skipped.
+    // If the input is sorted by key, it is inserted as a batch.
+    template<typename InputIt>
+    void insert(InputIt first, InputIt last) {
+        std::vector<Node*> nodes;
+        std::vector<skiplist_node*> snodes;
+        bool sorted = true;
+        for (InputIt ii = first; ii != last; ++ii) {
+            Node* node = newNode(ii->first);
+            node->kv = *ii;
+            if ( !nodes.empty() &&
+                 node->kv.first < nodes.back()->kv.first ) {
+                sorted = false;
+            }
+            nodes.push_back(node);
+            snodes.push_back(&node->snode);
+        }
+        if (nodes.empty()) return;
+
+        std::vector<int> results(nodes.size());
+        if (sorted) {
+            Engine::insert_batch_nodup(&slist, &snodes[0], snodes.size(),
+                                       &results[0]);
+        } else {
+            for (size_t ii = 0; ii < snodes.size(); ++ii) {
+                results[ii] = Engine::insert_nodup(&slist, snodes[ii]);
+            }
+        }
+        for (size_t ii = 0; ii < nodes.size(); ++ii) {
+            if (results[ii] != 0) Node::dispose(nodes[ii], &pool);
+        }
     }
 
     iterator find(K key) {
         Node query;
         query.kv.first = key;
-        skiplist_node* cursor = skiplist_find(&slist, &query.snode);
+        skiplist_node* cursor = Engine::find(&slist, &query.snode);
+        return iterator(&slist, cursor);
+    }
+
+    // `find()` on each of `keys`, the results are in the same order.
+    // The searches advance together, so that their cache misses overlap.
+    std::vector<iterator> multi_find(const std::vector<K>& keys) {
+        size_t num = keys.size();
+        std::vector<Node> queries(num);
+        std::vector<skiplist_node*> query_nodes(num);
+        std::vector<skiplist_node*> results(num);
+        for (size_t ii = 0; ii < num; ++ii) {
+            queries[ii].kv.first = keys[ii];
+            query_nodes[ii] = &queries[ii].snode;
+        }
+        std::vector<iterator> ret;
+        if (!num) return ret;
+
+        Engine::find_batch(&slist, &query_nodes[0], &results[0], num);
+        ret.reserve(num);
+        for (size_t ii = 0; ii < num; ++ii) {
+            ret.push_back(iterator(&slist, results[ii]));
+        }
+        return ret;
+    }
+
+    // Entry at rank `k` (0: the smallest one), `end()` if out of range.
+    // O(log n) if `indexable` is set in the config, O(k) otherwise.
+    iterator nth(size_t k) {
+        return iterator(&slist, Engine::select(&slist, k));
+    }
+
+    // Number of entries smaller than `key`.
+    size_t rank(K key) {
+        Node query;
+        query.kv.first = key;
+        return Engine::rank(&slist, &query.snode);
+    }
+
+    // Take a snapshot, which needs `versioned` in the config.
+    // Iterators from `snapshot_begin()` and `snapshot_find()` with it
+    // see the entries as of then, until `release_snapshot()` is called.
+    uint64_t snapshot() {
+        return skiplist_snapshot(&slist);
+    }
+
+    void release_snapshot(uint64_t seq) {
+        skiplist_snapshot_release(&slist, seq);
+    }
+
+    iterator snapshot_begin(uint64_t seq) {
+        return iterator(&slist, Engine::begin(&slist, seq), seq);
+    }
+
+    iterator snapshot_find(uint64_t seq, K key) {
+        Node query;
+        query.kv.first = key;
+        skiplist_node* cursor = Engine::find(&slist, &query.snode, seq);
+        return iterator(&slist, cursor, seq);
+    }
+
+    // Write all entries to `out` in the format of `sl_checkpoint.h`.
+    // Writers are not blocked, and with `versioned` in the config, it
+    // is a snapshot as of the call. Return 0 on success.
+    int checkpoint(std::ostream& out) {
+        sl_checkpoint_writer<K, V> writer(out);
+        uint64_t seq = snapshot();
+        for (iterator itr = snapshot_begin(seq); itr != end(); ++itr) {
+            writer.add(itr->first, itr->second);
+        }
+        release_snapshot(seq);
+        return writer.finish();
+    }
+
+    // Load entries from `checkpoint()`, skipping the ones that exist.
+    // An empty map is built at once in O(n), which should not run
+    // along with other writers. Return 0 on success, -1 if `in` ends
+    // early, or -2 if the checkpoint is broken or of other types, in
+    // which case nothing is loaded.
+    int load_checkpoint(std::istream& in) {
+        sl_checkpoint_reader<K, V> reader(in);
+        int rc = reader.open();
+        if (rc < 0) return rc;
+
+        std::vector<T> kvs;
+        bool sorted = true;
+        T kv;
+        while ((rc = reader.next(kv.first, kv.second)) > 0) {
+            if (!kvs.empty() && !(kvs.back().first < kv.first)) sorted = false;
+            kvs.push_back(std::move(kv));
+        }
+        if (rc < 0) return rc;
+        if (!sorted) {
+            std::stable_sort(kvs.begin(), kvs.end(),
+                             [](const T& a, const T& b) {
+                                 return a.first < b.first;
+                             });
+        }
+        // The first one of each key.
+        kvs.erase( std::unique( kvs.begin(), kvs.end(),
+                                [](const T& a, const T& b) {
+                                    return !(a.first < b.first);
+                                } ),
+                   kvs.end() );
+
+        // Heights by the final positions, as `skiplist_bulk_load()`
+        // gives them, now that sorting and dedup are done.
+        std::vector<skiplist_node*> snodes;
+        snodes.reserve(kvs.size());
+        for (size_t ii = 0; ii < kvs.size(); ++ii) {
+            Node* node = Node::create
+                         ( skiplist_bulk_load_top_layer(&slist, ii), &pool );
+            node->kv = std::move(kvs[ii]);
+            snodes.push_back(&node->snode);
+        }
+        if (snodes.empty()) return 0;
+        if (skiplist_bulk_load(&slist, &snodes[0], snodes.size()) == 0) {
+            return 0;
+        }
+
+        // Not empty.
+        std::vector<int> results(snodes.size());
+        Engine::insert_batch_nodup(&slist, &snodes[0], snodes.size(),
+                                   &results[0]);
+        for (size_t ii = 0; ii < snodes.size(); ++ii) {
+            if (results[ii] == 0) continue;
+            Node::dispose(_get_entry(snodes[ii], Node, snode), &pool);
+        }
+        return 0;
+    }
+
+    // Search from `hint`, cheap if `key` is close to (and after) it.
+    iterator find(const iterator& hint, K key) {
+        Node query;
+        query.kv.first = key;
+        skiplist_node* cursor =
+            Engine::find_from(&slist, hint.cursor, &query.snode);
         return iterator(&slist, cursor);
     }
 
     virtual
     iterator erase(iterator& position) {
         skiplist_node* cursor = position.cursor;
-        skiplist_node* next = skiplist_next(&slist, cursor);
+        skiplist_node* next = Engine::next(&slist, cursor);
 
-        skiplist_erase_node(&slist, cursor);
-        skiplist_release_node(cursor);
-        skiplist_wait_for_free(cursor);
-        Node* node = _get_entry(cursor, Node, snode);
-        delete node;
+        Engine::erase_node(&slist, cursor);
+        position.release();
+        skiplist_retire_node(&slist, cursor, Node::destroy, &pool);
 
-        position.cursor = nullptr;
         return iterator(&slist, next);
     }
 
@@ -238,22 +601,45 @@ public:
         size_t count = 0;
         Node query;
         query.kv.first = key;
-        skiplist_node* cursor = skiplist_find(&slist, &query.snode);
+        skiplist_node* cursor = Engine::find(&slist, &query.snode);
         while (cursor) {
             Node* node = _get_entry(cursor, Node, snode);
             if (node->kv.first != key) break;
 
-            cursor = skiplist_next(&slist, cursor);
+            cursor = Engine::next(&slist, cursor);
 
-            skiplist_erase_node(&slist, &node->snode);
+            Engine::erase_node(&slist, &node->snode);
             skiplist_release_node(&node->snode);
-            skiplist_wait_for_free(&node->snode);
-            delete node;
+            skiplist_retire_node(&slist, &node->snode, Node::destroy, &pool);
         }
         if (cursor) skiplist_release_node(cursor);
         return count;
     }
 
+    // Erase `[first, last)` at once, and return `last`.
+    // `first` is released, as the node it points to is erased.
+    iterator erase(iterator& first, const iterator& last) {
+        iterator ret;
+        ret = last;
+        if (!first.cursor || first == last) return ret;
+
+        Node from;
+        from.kv.first = first->first;
+        first.release();
+        Engine::erase_range(&slist, &from.snode, last.cursor, retireCb, this);
+        return ret;
+    }
+    iterator erase(iterator&& first, const iterator& last) {
+        return erase(first, last);
+    }
+
+    // Erase all keys smaller than `key`, and return the number of them.
+    size_t truncate_before(const K& key) {
+        Node to;
+        to.kv.first = key;
+        return Engine::truncate_before(&slist, &to.snode, retireCb, this);
+    }
+
     iterator begin() {
         skiplist_node* cursor = skiplist_begin(&slist);
         return iterator(&slist, cursor);
@@ -267,6 +653,95 @@ public:
     reverse_iterator rend() { return reverse_iterator(); }
 
 protected:
+    // Called for each node erased by `erase(first, last)`.
+    virtual
+    void retireNode(Node* node) {
+        skiplist_retire_node(&slist, &node->snode, Node::destroy, &pool);
+    }
+    static void retireCb(skiplist_node* node, void* ctx) {
+        static_cast<sl_map*>(ctx)->retireNode(_get_entry(node, Node, snode));
+    }
+
+    // Built-in random generators do not look at the key.
+    bool keyedLevels() const {
+        return slist.level_gen != skiplist_level_gen_fast &&
+               slist.level_gen != skiplist_level_gen_rand;
+    }
+
+    // `kv` of the node is built from `args`, `key` is for its top layer.
+    template<typename... Args>
+    Node* newNode(const K& key, Args&&... args) {
+        size_t top_layer;
+        if (!keyedLevels()) {
+            top_layer = skiplist_decide_top_layer(&slist, nullptr);
+        } else {
+            Node query;
+            query.kv.first = key;
+            top_layer = skiplist_decide_top_layer(&slist, &query.snode);
+        }
+        return Node::create(top_layer, &pool, std::forward<Args>(args)...);
+    }
+
+    // Insert `node`, or dispose of it and return the node of the same
+    // key found by the same search, after moving the value of `node`
+    // to it if `assign`.
+    std::pair<iterator, bool> insertNode(Node* node, bool assign = false) {
+        skiplist_node* existing = nullptr;
+        if (Engine::insert_or_find(&slist, &node->snode, &existing) == 0) {
+            skiplist_grab_node(&node->snode);
+            return std::pair<iterator, bool>
+                   ( iterator(&slist, &node->snode), true );
+        }
+        if (assign) {
+            _get_entry(existing, Node, snode)->kv.second =
+                std::move(node->kv.second);
+        }
+        Node::dispose(node, &pool);
+        return std::pair<iterator, bool>(iterator(&slist, existing), false);
+    }
+
+    // `_sl_node_maker` that calls `make(top_layer)`, and keeps what it
+    // throws to rethrow after the insert is done.
+    template<typename F>
+    struct NodeMaker {
+        static skiplist_node* func(void* ctx, size_t top_layer) {
+            NodeMaker* self = static_cast<NodeMaker*>(ctx);
+            try {
+                return &self->make(top_layer)->snode;
+            } catch (...) {
+                self->error = std::current_exception();
+                return nullptr;
+            }
+        }
+        F& make;
+        std::exception_ptr error;
+    };
+
+    // Insert the node of `make(top_layer)` only if `key` is not there,
+    // otherwise return the node of `key` found by the same search.
+    template<typename F>
+    std::pair<iterator, bool> makeNode(const K& key, F make) {
+        Node query;
+        query.kv.first = key;
+        NodeMaker<F> node_maker = {make, nullptr};
+        _sl_node_maker maker = {NodeMaker<F>::func, &node_maker, nullptr};
+        skiplist_node* existing = nullptr;
+        int ret = Engine::insert_or_make(&slist, &query.snode,
+                                         &maker, &existing);
+        if (ret == 0) {
+            skiplist_grab_node(maker.node);
+            return std::pair<iterator, bool>
+                   ( iterator(&slist, maker.node), true );
+        }
+        if (ret == -2) std::rethrow_exception(node_maker.error);
+        if (maker.node) {
+            Node::dispose(_get_entry(maker.node, Node, snode), &pool);
+        }
+        return std::pair<iterator, bool>(iterator(&slist, existing), false);
+    }
+
+    // Nodes and their towers.
+    sl_node_pool pool;
     skiplist_raw slist;
 };
 
@@ -276,6 +751,7 @@ class sl_map_gc : public sl_map<K, V> {
 private:
     using T = std::pair<K, V>;
     using Node = map_node<K, V>;
+    using Engine = sl_engine<typename Node::key_cmp>;
 
 public:
     using iterator = map_iterator<K, V>;
@@ -295,23 +771,24 @@ public:
         execGc();
         for (std::atomic<Node*>*& a_node: gcVector) {
             Node* node = a_node->load();
-            delete node;
+            if (node) Node::dispose(node, &this->pool);
             delete a_node;
         }
     }
 
+    using sl_map<K, V>::erase;
+
     iterator erase(iterator& position) {
         skiplist_node* cursor = position.cursor;
-        skiplist_node* next = skiplist_next(&this->slist, cursor);
+        skiplist_node* next = Engine::next(&this->slist, cursor);
 
-        skiplist_erase_node(&this->slist, cursor);
+        Engine::erase_node(&this->slist, cursor);
 
         Node* node = _get_entry(cursor, Node, snode);
         gcPush(node);
-        skiplist_release_node(cursor);
+        position.release();
         execGc();
 
-        position.cursor = nullptr;
         return iterator(&this->slist, next);
     }
 
@@ -319,14 +796,14 @@ public:
         size_t count = 0;
         Node query;
         query.kv.first = key;
-        skiplist_node* cursor = skiplist_find(&this->slist, &query.snode);
+        skiplist_node* cursor = Engine::find(&this->slist, &query.snode);
         while (cursor) {
             Node* node = _get_entry(cursor, Node, snode);
             if (node->kv.first != key) break;
 
-            cursor = skiplist_next(&this->slist, cursor);
+            cursor = Engine::next(&this->slist, cursor);
 
-            skiplist_erase_node(&this->slist, &node->snode);
+            Engine::erase_node(&this->slist, &node->snode);
             gcPush(node);
             skiplist_release_node(&node->snode);
         }
@@ -336,6 +813,11 @@ public:
         return count;
     }
 
+protected:
+    void retireNode(Node* node) {
+        gcPush(node);
+    }
+
 private:
     void gcPush(Node* node) {
         size_t v_len = gcVector.size();
@@ -373,7 +855,7 @@ private:
                 a_node.compare_exchange_strong
                        ( exp, val, std::memory_order_relaxed );
 
-                delete node;
+                Node::dispose(node, &this->pool);
             }
         }
     }
@@ -0,0 +1,305 @@
+/**
+ * Copyright (C) 2017-present Jung-Sang Ahn <jungsang.ahn@gmail.com>
+ * All rights reserved.
+ *
+ * https://github.com/greensky00
+ *
+ * Skiplist memtable
+ * Version: 0.2.0
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "skiplist.h"
+#include "sl_engine.h"
+#include "sl_map.h"
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Arena blocks are of this size, and larger allocations than a quarter
+// of it get their own blocks.
+#define _SL_MEMTABLE_BLOCK_SIZE (256 * 1024)
+
+// Bump allocator of a memtable: each shard carves the block it is
+// holding, and nothing is freed until the arena is destroyed.
+class sl_memtable_arena {
+public:
+    sl_memtable_arena() : memUsage(0) {
+        for (Shard& shard: shards) {
+            shard.cur = nullptr;
+            shard.end = nullptr;
+        }
+    }
+
+    ~sl_memtable_arena() {
+        for (void* block: blocks) ::operator delete(block);
+    }
+
+    void* alloc(size_t size) {
+        size_t align = alignof(std::max_align_t);
+        size = (size + align - 1) / align * align;
+        if (size > _SL_MEMTABLE_BLOCK_SIZE / 4) return newBlock(size);
+
+        Shard& shard = shards[_sl_shard_idx()];
+        std::lock_guard<std::mutex> l(shard.lock);
+        if (!shard.cur || shard.cur + size > shard.end) {
+            // The rest of the current block is wasted.
+            shard.cur = static_cast<uint8_t*>
+                        ( newBlock(_SL_MEMTABLE_BLOCK_SIZE) );
+            shard.end = shard.cur + _SL_MEMTABLE_BLOCK_SIZE;
+        }
+        void* ret = shard.cur;
+        shard.cur += size;
+        return ret;
+    }
+
+    // Bytes of all blocks.
+    size_t memoryUsage() const { return memUsage.load(); }
+
+private:
+    struct alignas(64) Shard {
+        std::mutex lock;
+        uint8_t* cur;
+        uint8_t* end;
+    };
+
+    void* newBlock(size_t size) {
+        void* block = ::operator new(size);
+        {
+            std::lock_guard<std::mutex> l(blocksLock);
+            blocks.push_back(block);
+        }
+        memUsage.fetch_add(size);
+        return block;
+    }
+
+    Shard shards[_SL_SIZE_SHARDS];
+    std::atomic<size_t> memUsage;
+    std::mutex blocksLock;
+    std::vector<void*> blocks;
+};
+
+template<typename K, typename V> class sl_memtable;
+
+// Forward iterator of `sl_memtable`, which holds nothing: entries stay
+// until the memtable is destroyed.
+template<typename K, typename V>
+class memtable_iterator {
+    friend class sl_memtable<K, V>;
+
+private:
+    using T = std::pair<K, V>;
+    using Node = map_node<K, V>;
+    using Engine = sl_engine<typename Node::key_cmp>;
+
+public:
+    memtable_iterator() : slist(nullptr), cursor(nullptr) {}
+
+    bool operator==(const memtable_iterator& src) const { return (cursor == src.cursor); }
+    bool operator!=(const memtable_iterator& src) const { return !operator==(src); }
+
+    const T* operator->() const {
+        Node* node = _get_entry(cursor, Node, snode);
+        return &node->kv;
+    }
+    const T& operator*() const {
+        Node* node = _get_entry(cursor, Node, snode);
+        return node->kv;
+    }
+
+    // ++A
+    memtable_iterator& operator++() {
+        if (slist && cursor) cursor = Engine::next_unpinned(slist, cursor);
+        return *this;
+    }
+    // A++
+    memtable_iterator& operator++(int) { return operator++(); }
+
+private:
+    memtable_iterator(skiplist_raw* _slist, skiplist_node* _cursor)
+        : slist(_slist), cursor(_cursor) {}
+
+    skiplist_raw* slist;
+    skiplist_node* cursor;
+};
+
+// Insert-only map for write buffers, e.g., memtables of LSM-trees.
+// Entries are never erased, so the skiplist runs in
+// `SKIPLIST_RECLAIM_NONE` and `SKIPLIST_SYNC_LOCK_FREE`: inserts do not
+// flag or lock their predecessors, and lookups and iterators touch
+// neither reference counts nor epochs. Nodes are carved from an arena,
+// and freed all at once along with the memtable.
+//
+// Once `freeze()` returns, the memtable is immutable and can be flushed
+// by iterating from `begin()`, while readers keep looking it up.
+template<typename K, typename V>
+class sl_memtable {
+private:
+    using T = std::pair<K, V>;
+    using Node = map_node<K, V>;
+    using Engine = sl_engine<typename Node::key_cmp>;
+
+public:
+    using iterator = memtable_iterator<K, V>;
+
+    sl_memtable() {
+        init(skiplist_get_default_config());
+    }
+
+    // `reclaimMode` and `syncMode` of `config` are ignored.
+    sl_memtable(const skiplist_raw_config& config) {
+        init(config);
+    }
+
+    ~sl_memtable() {
+        skiplist_node* cursor = Engine::next_unpinned(&slist, &slist.head);
+        while (cursor) {
+            Node* node = _get_entry(cursor, Node, snode);
+            cursor = Engine::next_unpinned(&slist, cursor);
+            // Memory goes back along with the arena.
+            node->~Node();
+        }
+        skiplist_free(&slist);
+    }
+
+    sl_memtable(const sl_memtable&) = delete;
+    sl_memtable& operator=(const sl_memtable&) = delete;
+
+    bool empty() { return begin() == end(); }
+
+    size_t size() { return skiplist_get_size(&slist); }
+
+    // Bytes taken by the nodes, including the ones of rejected inserts
+    // and the unused rest of arena blocks. Memory owned by keys and
+    // values themselves (e.g., of `std::string`) is not counted.
+    size_t memory_usage() const { return arena.memoryUsage(); }
+
+    // The existing one if `kv.first` is already there. Returns `end()`
+    // with `false` once the memtable is frozen.
+    std::pair<iterator, bool> insert(const std::pair<K, V>& kv) {
+        Writer w(this);
+        if (frozenFlag.load()) {
+            return std::pair<iterator, bool>(end(), false);
+        }
+
+        Node* node = newNode(kv.first);
+        node->kv = kv;
+        if (Engine::insert_nodup(&slist, &node->snode) == 0) {
+            return std::pair<iterator, bool>
+                   ( iterator(&slist, &node->snode), true );
+        }
+
+        // Its memory is left in the arena.
+        skiplist_node* cursor =
+            Engine::find_unpinned(&slist, &node->snode, _SL_EQ);
+        node->~Node();
+        return std::pair<iterator, bool>(iterator(&slist, cursor), false);
+    }
+
+    iterator find(const K& key) {
+        Node query;
+        query.kv.first = key;
+        return iterator(&slist,
+                        Engine::find_unpinned(&slist, &query.snode, _SL_EQ));
+    }
+
+    iterator lower_bound(const K& key) {
+        Node query;
+        query.kv.first = key;
+        return iterator(&slist,
+                        Engine::find_unpinned(&slist, &query.snode, _SL_GTEQ));
+    }
+
+    iterator begin() {
+        return iterator(&slist, Engine::next_unpinned(&slist, &slist.head));
+    }
+
+    iterator end() { return iterator(); }
+
+    // Reject inserts from now on, and wait for the ones in progress.
+    void freeze() {
+        frozenFlag.store(true);
+        for (Shard& shard: writers) {
+            while (shard.count.load()) std::this_thread::yield();
+        }
+    }
+
+    bool frozen() const { return frozenFlag.load(); }
+
+private:
+    // Inserts in progress, per shard of threads.
+    struct alignas(64) Shard {
+        std::atomic<size_t> count;
+    };
+
+    // Counted from before checking the flag, so that `freeze()`
+    // either waits for the insert or the insert sees the flag.
+    struct Writer {
+        Writer(sl_memtable* mt)
+            : shard(mt->writers[_sl_shard_idx()]) { shard.count.fetch_add(1); }
+        ~Writer() { shard.count.fetch_sub(1); }
+        Shard& shard;
+    };
+
+    void init(skiplist_raw_config config) {
+        frozenFlag.store(false);
+        for (Shard& shard: writers) shard.count.store(0);
+        config.reclaimMode = SKIPLIST_RECLAIM_NONE;
+        config.syncMode = SKIPLIST_SYNC_LOCK_FREE;
+        skiplist_init(&slist, Node::cmp);
+        skiplist_set_config(&slist, config);
+    }
+
+    Node* newNode(const K& key) {
+        size_t top_layer;
+        // Built-in random generators do not look at the key.
+        if ( slist.level_gen == skiplist_level_gen_fast ||
+             slist.level_gen == skiplist_level_gen_rand ) {
+            top_layer = skiplist_decide_top_layer(&slist, nullptr);
+        } else {
+            Node query;
+            query.kv.first = key;
+            top_layer = skiplist_decide_top_layer(&slist, &query.snode);
+        }
+        void* mem = arena.alloc
+                    ( skiplist_inline_node_size(&slist, sizeof(Node),
+                                                top_layer) );
+        Node* node = new (mem) Node();
+        skiplist_init_node_inline(&node->snode, node,
+                                  sizeof(Node), top_layer);
+        return node;
+    }
+
+    sl_memtable_arena arena;
+    Shard writers[_SL_SIZE_SHARDS];
+    std::atomic<bool> frozenFlag;
+    skiplist_raw slist;
+};
+
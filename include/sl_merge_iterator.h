@@ -0,0 +1,232 @@
+/**
+ * Copyright (C) 2017-present Jung-Sang Ahn <jungsang.ahn@gmail.com>
+ * All rights reserved.
+ *
+ * https://github.com/greensky00
+ *
+ * Skiplist merge iterator
+ * Version: 0.2.0
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "skiplist.h"
+#include "sl_engine.h"
+#include "sl_map.h"
+
+#include <utility>
+#include <vector>
+
+enum sl_merge_policy {
+    // Among the same keys, only the node of the first list (newest).
+    SL_MERGE_NEWEST = 0,
+    // All of them, in the order of the lists.
+    SL_MERGE_ALL = 1,
+};
+
+// Iterator over the union of skiplists in key order, which compares
+// nodes by `Cmp` of the first list. Lists are given from the newest one,
+// e.g., the active memtable followed by immutable ones.
+//
+// The current node of each list is kept in a loser tree: the internal
+// nodes hold the list that lost the match there, and `tree[0]` the
+// overall winner. Moving on replays only the matches on the path of the
+// winner, which takes log2(N) comparisons, where a binary heap needs up
+// to twice as many. Only the list that moved is touched: its next node
+// is pinned, and the old one is released.
+template<typename Cmp = _sl_fn_cmp>
+class sl_merge_iterator {
+private:
+    using Engine = sl_engine<Cmp>;
+
+public:
+    // `lists` should not be empty. Not positioned until `seek*()`.
+    sl_merge_iterator(const std::vector<skiplist_raw*>& _lists,
+                      sl_merge_policy _policy = SL_MERGE_NEWEST)
+        : lists(_lists)
+        , cursors(lists.size(), nullptr)
+        , tree(lists.size(), 0)
+        , policy(_policy)
+        , comp(lists[0]) {}
+
+    sl_merge_iterator(const sl_merge_iterator&) = delete;
+    sl_merge_iterator& operator=(const sl_merge_iterator&) = delete;
+
+    ~sl_merge_iterator() {
+        releaseAll();
+    }
+
+    void seek_to_first() {
+        releaseAll();
+        for (size_t ii = 0; ii < lists.size(); ++ii) {
+            cursors[ii] = Engine::begin(lists[ii]);
+        }
+        build();
+    }
+
+    // Move to the first node not smaller than `query`.
+    void seek(skiplist_node* query) {
+        releaseAll();
+        for (size_t ii = 0; ii < lists.size(); ++ii) {
+            cursors[ii] = Engine::find_greater_or_equal(lists[ii], query);
+        }
+        build();
+    }
+
+    bool valid() const {
+        return cursors[tree[0]] != nullptr;
+    }
+
+    // Current node, valid until the iterator moves.
+    skiplist_node* node() const {
+        return cursors[tree[0]];
+    }
+
+    // Index of the list of `node()`.
+    size_t source() const {
+        return tree[0];
+    }
+
+    void next() {
+        size_t winner = tree[0];
+        skiplist_node* last = cursors[winner];
+        if (!last) return;
+
+        // `last` is kept until the older ones of its key are skipped.
+        cursors[winner] = Engine::next(lists[winner], last);
+        replay(winner);
+        if (policy == SL_MERGE_NEWEST) {
+            while (valid() && comp(cursors[tree[0]], last) == 0) {
+                winner = tree[0];
+                skiplist_node* dup = cursors[winner];
+                cursors[winner] = Engine::next(lists[winner], dup);
+                skiplist_release_node(dup);
+                replay(winner);
+            }
+        }
+        skiplist_release_node(last);
+    }
+
+private:
+    // True if the node of list `a` comes before that of list `b`.
+    // Exhausted lists come last, and ties go to the newer list.
+    bool beats(size_t a, size_t b) {
+        if (!cursors[a] || !cursors[b]) {
+            if (cursors[a] || cursors[b]) return cursors[a] != nullptr;
+            return a < b;
+        }
+        int cmp = comp(cursors[a], cursors[b]);
+        return cmp < 0 || (cmp == 0 && a < b);
+    }
+
+    // Play the matches of the subtree at `tt`, and return its winner.
+    // Leaves are `[N, 2N)`, and the parent of `tt` is `tt / 2`.
+    size_t play(size_t tt) {
+        size_t num = lists.size();
+        if (tt >= num) return tt - num;
+        size_t aa = play(tt * 2);
+        size_t bb = play(tt * 2 + 1);
+        if (beats(aa, bb)) {
+            tree[tt] = bb;
+            return aa;
+        }
+        tree[tt] = aa;
+        return bb;
+    }
+
+    // `seek*()` lands on the newest node of its key, and the older ones
+    // are skipped by `next()`.
+    void build() {
+        tree[0] = (lists.size() > 1) ? play(1) : 0;
+    }
+
+    // After the node of `src` changed.
+    void replay(size_t src) {
+        size_t winner = src;
+        for (size_t tt = (src + lists.size()) / 2; tt > 0; tt /= 2) {
+            if (beats(tree[tt], winner)) std::swap(tree[tt], winner);
+        }
+        tree[0] = winner;
+    }
+
+    void releaseAll() {
+        for (skiplist_node*& cursor: cursors) {
+            if (cursor) skiplist_release_node(cursor);
+            cursor = nullptr;
+        }
+    }
+
+    std::vector<skiplist_raw*> lists;
+    std::vector<skiplist_node*> cursors;
+    std::vector<size_t> tree;
+    sl_merge_policy policy;
+    Cmp comp;
+};
+
+// Merge iterator over `sl_map`s, e.g., for LSM-style reads and flushes
+// over memtables in a single pass.
+template<typename K, typename V>
+class sl_map_merge_iterator {
+private:
+    using T = std::pair<K, V>;
+    using Node = map_node<K, V>;
+
+public:
+    // `maps` from the newest one, should not be empty.
+    sl_map_merge_iterator(const std::vector<sl_map<K, V>*>& maps,
+                          sl_merge_policy policy = SL_MERGE_NEWEST)
+        : itr(rawLists(maps), policy) {}
+
+    void seek_to_first() { itr.seek_to_first(); }
+
+    // Move to the first entry whose key is not smaller than `key`.
+    void seek(const K& key) {
+        Node query;
+        query.kv.first = key;
+        itr.seek(&query.snode);
+    }
+
+    bool valid() const { return itr.valid(); }
+    void next() { itr.next(); }
+    size_t source() const { return itr.source(); }
+
+    const T& operator*() const {
+        return _get_entry(itr.node(), Node, snode)->kv;
+    }
+    const T* operator->() const {
+        return &_get_entry(itr.node(), Node, snode)->kv;
+    }
+
+private:
+    static std::vector<skiplist_raw*>
+        rawLists(const std::vector<sl_map<K, V>*>& maps)
+    {
+        std::vector<skiplist_raw*> ret;
+        for (sl_map<K, V>* map: maps) ret.push_back(&map->slist);
+        return ret;
+    }
+
+    sl_merge_iterator<typename Node::key_cmp> itr;
+};
+
@@ -0,0 +1,287 @@
+/**
+ * Copyright (C) 2017-present Jung-Sang Ahn <jungsang.ahn@gmail.com>
+ * All rights reserved.
+ *
+ * https://github.com/greensky00
+ *
+ * Skiplist node pool
+ * Version: 0.2.0
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "skiplist.h"
+#include "sl_engine.h"
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+// Slabs are carved into blocks of this size, or of huge pages.
+#define _SL_POOL_SLAB_SIZE (64 * 1024)
+#define _SL_POOL_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+// `extSlots` of a pool that has not allocated anything yet.
+#define _SL_POOL_NO_LAYOUT ((size_t)-1)
+
+// Slab allocator of the nodes of a container, along with their inline
+// towers sized for the options of `slist`. Blocks are in a class per
+// top layer, and freed blocks are kept
+// in free lists of the shard of each thread, to be reused by the next
+// allocation. A thread whose lists are empty takes from other shards
+// before carving a new block. Memory goes back to the system only when
+// the pool is destroyed.
+//
+// All blocks of a class have the same size, as the options of `slist`
+// are fixed by the first allocation: once they change, `alloc()` and
+// `reserve()` refuse. `sl_map` and `sl_set` set them only when built.
+class sl_node_pool {
+public:
+    // `_slist` is only kept, it can be initialized later.
+    sl_node_pool(size_t _struct_size, skiplist_raw* _slist)
+        : structSize(_struct_size)
+        , slist(_slist)
+        , hugePages(false)
+        , extSlots(_SL_POOL_NO_LAYOUT)
+        , numFree(0)
+        , slabCur(nullptr)
+        , slabEnd(nullptr)
+    {
+        for (Shard& shard: shards) {
+            for (FreeBlock*& head: shard.heads) head = nullptr;
+        }
+    }
+
+    ~sl_node_pool() {
+        for (Slab& slab: slabs) freeSlab(slab);
+    }
+
+    // Applied to the slabs allocated from now on.
+    void setHugePages(bool huge_pages) {
+        std::lock_guard<std::mutex> l(slabLock);
+        hugePages = huge_pages;
+    }
+
+    // Memory for a node whose top layer is `top_layer`, or nullptr if
+    // the options of `slist` changed since the first allocation.
+    void* alloc(size_t top_layer) {
+        if (!fixLayout()) return nullptr;
+        if (top_layer >= SKIPLIST_MAX_LAYER) {
+            top_layer = SKIPLIST_MAX_LAYER - 1;
+        }
+        size_t idx = _sl_shard_idx();
+        void* mem = popFree(shards[idx], top_layer, false);
+        if (mem) return mem;
+        for (size_t ii = 1; ii < _SL_SIZE_SHARDS && numFree.load(); ++ii) {
+            mem = popFree(shards[(idx + ii) % _SL_SIZE_SHARDS],
+                          top_layer, true);
+            if (mem) return mem;
+        }
+
+        std::lock_guard<std::mutex> l(slabLock);
+        return carve(blockSize(top_layer));
+    }
+
+    // Give back `mem` of `alloc(top_layer)`.
+    void free(void* mem, size_t top_layer) {
+        if (top_layer >= SKIPLIST_MAX_LAYER) {
+            top_layer = SKIPLIST_MAX_LAYER - 1;
+        }
+        Shard& shard = shards[_sl_shard_idx()];
+        std::lock_guard<std::mutex> l(shard.lock);
+        FreeBlock* block = static_cast<FreeBlock*>(mem);
+        block->next = shard.heads[top_layer];
+        shard.heads[top_layer] = block;
+        numFree.fetch_add(1);
+    }
+
+    // Allocate one slab for `num` nodes at once, split into the classes
+    // in the ratio of the top layers of built-in level generators.
+    void reserve(size_t num, size_t fanout, size_t max_layer) {
+        if (!num || !fixLayout()) return;
+        if (fanout < 2) fanout = 2;
+        if (max_layer > SKIPLIST_MAX_LAYER) max_layer = SKIPLIST_MAX_LAYER;
+        if (max_layer < 1) max_layer = 1;
+
+        // `counts[ii]`: nodes whose top layer is `ii`.
+        std::vector<size_t> counts(max_layer, 0);
+        size_t at_or_above = num, total_size = 0, ii;
+        for (ii = 0; ii < max_layer; ++ii) {
+            size_t above = (ii + 1 < max_layer) ? at_or_above / fanout : 0;
+            counts[ii] = at_or_above - above;
+            at_or_above = above;
+        }
+        for (ii = 0; ii < max_layer; ++ii) {
+            total_size += counts[ii] * blockSize(ii);
+        }
+
+        std::vector<FreeBlock*> heads(max_layer, nullptr);
+        {
+            std::lock_guard<std::mutex> l(slabLock);
+            newSlab(total_size);
+            for (ii = 0; ii < max_layer; ++ii) {
+                for (size_t jj = 0; jj < counts[ii]; ++jj) {
+                    FreeBlock* block =
+                        static_cast<FreeBlock*>(carve(blockSize(ii)));
+                    block->next = heads[ii];
+                    heads[ii] = block;
+                }
+            }
+        }
+
+        Shard& shard = shards[_sl_shard_idx()];
+        std::lock_guard<std::mutex> l(shard.lock);
+        numFree.fetch_add(num);
+        for (ii = 0; ii < max_layer; ++ii) {
+            while (heads[ii]) {
+                FreeBlock* block = heads[ii];
+                heads[ii] = block->next;
+                block->next = shard.heads[ii];
+                shard.heads[ii] = block;
+            }
+        }
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex lock;
+        FreeBlock* heads[SKIPLIST_MAX_LAYER];
+    };
+
+    struct Slab {
+        void* mem;
+        size_t size;
+        bool mapped;
+    };
+
+    // Fix the slots for options of the blocks to those of `slist`
+    // if not yet, and return false if they differ.
+    bool fixLayout() {
+        size_t ext_slots = _sl_ext_slots(slist);
+        size_t fixed = extSlots.load(std::memory_order_relaxed);
+        if (fixed == ext_slots) return true;
+        if (fixed != _SL_POOL_NO_LAYOUT) return false;
+        return extSlots.compare_exchange_strong(fixed, ext_slots) ||
+               fixed == ext_slots;
+    }
+
+    // `fixLayout()` should have been done.
+    size_t blockSize(size_t top_layer) const {
+        size_t align = alignof(std::max_align_t);
+        size_t size = skiplist_inline_node_size(slist, structSize, top_layer);
+        return (size + align - 1) / align * align;
+    }
+
+    void* popFree(Shard& shard, size_t top_layer, bool try_only) {
+        std::unique_lock<std::mutex> l(shard.lock, std::defer_lock);
+        if (try_only) {
+            if (!l.try_lock()) return nullptr;
+        } else {
+            l.lock();
+        }
+        FreeBlock* block = shard.heads[top_layer];
+        if (block) {
+            shard.heads[top_layer] = block->next;
+            numFree.fetch_sub(1);
+        }
+        return block;
+    }
+
+    // Should hold `slabLock`.
+    void* carve(size_t size) {
+        if (!slabCur || slabCur + size > slabEnd) {
+            // The rest of the current slab is wasted.
+            newSlab(size);
+        }
+        void* ret = slabCur;
+        slabCur += size;
+        return ret;
+    }
+
+    // Should hold `slabLock`.
+    void newSlab(size_t min_size) {
+        size_t unit = hugePages ? _SL_POOL_HUGE_PAGE_SIZE
+                                : _SL_POOL_SLAB_SIZE;
+        size_t size = (min_size + unit - 1) / unit * unit;
+        Slab slab = {nullptr, size, false};
+
+#if defined(__linux__) && defined(MAP_HUGETLB)
+        if (hugePages) {
+            slab.mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                            -1, 0);
+            if (slab.mem == MAP_FAILED) {
+                // No huge pages reserved, ask for transparent ones.
+                slab.mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (slab.mem == MAP_FAILED) {
+                    slab.mem = nullptr;
+                } else {
+                    madvise(slab.mem, size, MADV_HUGEPAGE);
+                }
+            }
+            slab.mapped = (slab.mem != nullptr);
+        }
+#endif
+        if (!slab.mem) slab.mem = ::operator new(size);
+
+        slabs.push_back(slab);
+        slabCur = static_cast<uint8_t*>(slab.mem);
+        slabEnd = slabCur + size;
+    }
+
+    static void freeSlab(Slab& slab) {
+#if defined(__linux__) && defined(MAP_HUGETLB)
+        if (slab.mapped) {
+            munmap(slab.mem, slab.size);
+            return;
+        }
+#endif
+        ::operator delete(slab.mem);
+    }
+
+    const size_t structSize;
+    skiplist_raw* const slist;
+    bool hugePages;
+    // Slots for options that the blocks have room for.
+    std::atomic<size_t> extSlots;
+    Shard shards[_SL_SIZE_SHARDS];
+    // Blocks in all free lists, to skip looking into other shards.
+    std::atomic<size_t> numFree;
+
+    std::mutex slabLock;
+    std::vector<Slab> slabs;
+    uint8_t* slabCur;
+    uint8_t* slabEnd;
+};
+
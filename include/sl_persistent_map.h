@@ -0,0 +1,596 @@
+/**
+ * Copyright (C) 2017-present Jung-Sang Ahn <jungsang.ahn@gmail.com>
+ * All rights reserved.
+ *
+ * https://github.com/greensky00
+ *
+ * Persistent skiplist map
+ * Version: 0.2.0
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "skiplist.h"
+
+#include <algorithm>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define _SL_PMAP_MAGIC "SLPMAP01"
+#define _SL_PMAP_VERSION (1)
+// Address space reserved for the file, which can grow up to it.
+#define _SL_PMAP_DEFAULT_CAPACITY ((size_t)1 << 36)
+#define _SL_PMAP_MIN_GROWTH ((size_t)1 << 20)
+
+// Link to a node: its offset from the beginning of the file, 0: null.
+typedef uint64_t sl_poffset;
+
+// Beginning of the file. Nodes are carved right after it, and the
+// tower of the head node is `head`.
+struct sl_persistent_header {
+    char magic[8];
+    uint32_t version;
+    // Set by `close()` after everything is synced, cleared by `open()`.
+    uint32_t clean;
+    uint32_t key_size;
+    uint32_t value_size;
+    uint32_t fanout;
+    uint32_t max_layer;
+    // End of the nodes carved so far.
+    uint64_t alloc_end;
+    uint64_t num_entries;
+    uint64_t top_layer;
+    sl_poffset head[SKIPLIST_MAX_LAYER];
+    // Erased nodes by their top layer, linked by `next[0]`.
+    sl_poffset free_heads[SKIPLIST_MAX_LAYER];
+};
+
+template<typename K, typename V>
+struct persistent_node {
+    static const uint32_t LINKED = 0x1;
+
+    // Size of a node with its tower up to `top_layer`.
+    static size_t size(size_t top_layer) {
+        return sizeof(persistent_node) + top_layer * sizeof(sl_poffset);
+    }
+
+    uint32_t top_layer;
+    uint32_t flags;
+    K key;
+    V value;
+    // Actual size is `top_layer + 1`.
+    sl_poffset next[1];
+};
+
+template<typename K, typename V> class sl_persistent_map;
+
+template<typename K, typename V>
+class persistent_map_iterator {
+    friend class sl_persistent_map<K, V>;
+
+private:
+    using T = std::pair<K, V>;
+    using Map = sl_persistent_map<K, V>;
+
+public:
+    persistent_map_iterator() : map(nullptr), cursor(0) {}
+
+    bool operator==(const persistent_map_iterator& src) const {
+        return (cursor == src.cursor);
+    }
+    bool operator!=(const persistent_map_iterator& src) const {
+        return !operator==(src);
+    }
+
+    // Copy of the entry as of when the iterator moved to it.
+    const T* operator->() const { return &kv; }
+    const T& operator*() const { return kv; }
+
+    // ++A
+    persistent_map_iterator& operator++() {
+        if (!map || !cursor) {
+            cursor = 0;
+            return *this;
+        }
+        map->seekForward(*this);
+        return *this;
+    }
+    // A++
+    persistent_map_iterator& operator++(int) { return operator++(); }
+
+private:
+    persistent_map_iterator(Map* _map, sl_poffset _cursor, const T& _kv)
+        : map(_map), cursor(_cursor), kv(_kv) {}
+
+    Map* map;
+    sl_poffset cursor;
+    T kv;
+};
+
+// Map of trivially copyable keys and values, whose nodes are in a
+// memory-mapped file and linked by offsets, so that reopening the file
+// gives back the skiplist without rebuilding it.
+//
+// POSIX only: the file is mapped by `mmap()` of `<sys/mman.h>`, and
+// guarded by a `pthread_rwlock_t`.
+//
+// The file is mapped at a fixed range of `capacity` bytes, and grows
+// within it. Lookups and iterators share the lock, while inserts and
+// erases take it exclusively. Iterators hold a copy of the entry
+// instead of a reference to the node.
+//
+// Each update is done in an order that keeps the file consistent at
+// any moment:
+//   * A new node is written first, and then published by linking it
+//     on layer 0, before the upper layers.
+//   * An erased node is unlinked from the upper layers first, and
+//     layer 0 last, before it is put into a free list.
+// Hence layer 0 is always the exact set of entries. If the process
+// dies without `close()`, the clean flag is not set, and the next
+// `open()` relinks the upper layers from layer 0, and puts all nodes
+// not on layer 0 (e.g., erased but not yet in a free list) into the
+// free lists again. Updates survive a crash of the machine only once
+// `sync()` or `close()` returns.
+template<typename K, typename V>
+class sl_persistent_map {
+    friend class persistent_map_iterator<K, V>;
+
+private:
+    static_assert(std::is_trivially_copyable<K>::value &&
+                  std::is_trivially_copyable<V>::value,
+                  "keys and values are stored in the file as they are");
+    using T = std::pair<K, V>;
+    using Node = persistent_node<K, V>;
+    using Header = sl_persistent_header;
+
+public:
+    using iterator = persistent_map_iterator<K, V>;
+
+    sl_persistent_map()
+        : fd(-1), base(nullptr), capacity(0), fileSize(0)
+        , recovered(false), randState(1)
+    {
+        pthread_rwlockattr_t attr;
+        pthread_rwlockattr_init(&attr);
+#if defined(__GLIBC__)
+        // Readers come and go all the time, do not let them starve writers.
+        pthread_rwlockattr_setkind_np
+            (&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+        pthread_rwlock_init(&lock, &attr);
+        pthread_rwlockattr_destroy(&attr);
+    }
+
+    ~sl_persistent_map() {
+        close();
+        pthread_rwlock_destroy(&lock);
+    }
+
+    // Owns the file, its mapping and the lock.
+    sl_persistent_map(const sl_persistent_map&) = delete;
+    sl_persistent_map& operator=(const sl_persistent_map&) = delete;
+
+    // Open the file at `path`, or create it with `fanout` and `maxLayer`
+    // of `config` if it does not exist. Return 0 on success, -1 if the
+    // file cannot be opened or mapped, -2 if it is not a map of the same
+    // key and value sizes.
+    int open(const std::string& path,
+             size_t _capacity = _SL_PMAP_DEFAULT_CAPACITY,
+             const skiplist_raw_config& config =
+                 skiplist_get_default_config())
+    {
+        if (fd >= 0) return -1;
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) return -1;
+
+        struct stat st;
+        if (fstat(fd, &st) < 0) return openFail(-1);
+        bool create = ((size_t)st.st_size < sizeof(Header));
+        fileSize = create ? 0 : st.st_size;
+        capacity = std::max(_capacity, fileSize);
+
+        void* mem = mmap(nullptr, capacity, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_NORESERVE, fd, 0);
+        if (mem == MAP_FAILED) return openFail(-1);
+        base = static_cast<uint8_t*>(mem);
+
+        if (create) {
+            if (!grow(nodesBegin())) return openFail(-1);
+            Header* hdr = header();
+            memset(hdr, 0x0, sizeof(Header));
+            memcpy(hdr->magic, _SL_PMAP_MAGIC, sizeof(hdr->magic));
+            hdr->version = _SL_PMAP_VERSION;
+            hdr->key_size = sizeof(K);
+            hdr->value_size = sizeof(V);
+            hdr->fanout = std::max(config.fanout, (size_t)2);
+            hdr->max_layer = std::min(std::max(config.maxLayer, (size_t)1),
+                                      (size_t)SKIPLIST_MAX_LAYER);
+            hdr->alloc_end = nodesBegin();
+            hdr->clean = 1;
+        }
+
+        Header* hdr = header();
+        if (memcmp(hdr->magic, _SL_PMAP_MAGIC, sizeof(hdr->magic)) ||
+            hdr->version != _SL_PMAP_VERSION ||
+            hdr->key_size != sizeof(K) ||
+            hdr->value_size != sizeof(V) ||
+            hdr->fanout < 2 ||
+            hdr->max_layer < 1 || hdr->max_layer > SKIPLIST_MAX_LAYER ||
+            hdr->alloc_end > fileSize) {
+            return openFail(-2);
+        }
+
+        recovered = !hdr->clean;
+        if (recovered) relink();
+        // Any crash from now on should be detected.
+        hdr->clean = 0;
+        msync(base, sizeof(Header), MS_SYNC);
+
+        randState = (uint64_t)(uintptr_t)this ^ hdr->alloc_end;
+        randState |= 1;
+        return 0;
+    }
+
+    // Sync everything and mark the file as cleanly closed.
+    void close() {
+        if (fd < 0) return;
+        if (base) {
+            sync();
+            header()->clean = 1;
+            msync(base, sizeof(Header), MS_SYNC);
+            munmap(base, capacity);
+        }
+        ::close(fd);
+        fd = -1;
+        base = nullptr;
+    }
+
+    // Make all updates so far durable.
+    int sync() {
+        ReadLock l(lock);
+        return msync(base, header()->alloc_end, MS_SYNC);
+    }
+
+    // True if the last `open()` found the file not cleanly closed,
+    // and relinked it.
+    bool was_recovered() const { return recovered; }
+
+    bool empty() {
+        return !size();
+    }
+
+    size_t size() {
+        ReadLock l(lock);
+        return header()->num_entries;
+    }
+
+    // Throw `std::bad_alloc` if the file cannot grow any more.
+    std::pair<iterator, bool> insert(const T& kv) {
+        WriteLock l(lock);
+        Header* hdr = header();
+        sl_poffset* prevs[SKIPLIST_MAX_LAYER];
+        sl_poffset found = search(kv.first, prevs);
+        if (found) {
+            return std::make_pair(makeIterator(found), false);
+        }
+
+        size_t top_layer = decideTopLayer();
+        sl_poffset off = allocNode(top_layer);
+        Node* node = nodeAt(off);
+        node->flags = 0;
+        node->key = kv.first;
+        node->value = kv.second;
+        for (size_t layer = 0; layer <= top_layer; ++layer) {
+            node->next[layer] = prevs[layer][layer];
+        }
+        // Layer 0 publishes the node.
+        for (size_t layer = 0; layer <= top_layer; ++layer) {
+            setLink(prevs[layer][layer], off);
+        }
+        node->flags = Node::LINKED;
+        hdr->num_entries++;
+        if (top_layer > hdr->top_layer) hdr->top_layer = top_layer;
+        return std::make_pair(makeIterator(off), true);
+    }
+
+    iterator find(const K& key) {
+        ReadLock l(lock);
+        sl_poffset* prevs[SKIPLIST_MAX_LAYER];
+        sl_poffset found = search(key, prevs);
+        return found ? makeIterator(found) : end();
+    }
+
+    // The first entry not smaller than `key`.
+    iterator lower_bound(const K& key) {
+        ReadLock l(lock);
+        sl_poffset* prevs[SKIPLIST_MAX_LAYER];
+        search(key, prevs);
+        return makeIterator(prevs[0][0]);
+    }
+
+    size_t erase(const K& key) {
+        WriteLock l(lock);
+        sl_poffset* prevs[SKIPLIST_MAX_LAYER];
+        sl_poffset found = search(key, prevs);
+        if (!found) return 0;
+        eraseNode(found, prevs);
+        return 1;
+    }
+
+    // Erase the entry of `position`, and return the next one.
+    iterator erase(iterator& position) {
+        if (position == end()) return end();
+        erase(position.kv.first);
+        iterator ret = lower_bound(position.kv.first);
+        position = end();
+        return ret;
+    }
+
+    iterator begin() {
+        ReadLock l(lock);
+        return makeIterator(header()->head[0]);
+    }
+
+    iterator end() { return iterator(); }
+
+private:
+    Header* header() const {
+        return reinterpret_cast<Header*>(base);
+    }
+
+    Node* nodeAt(sl_poffset off) const {
+        return reinterpret_cast<Node*>(base + off);
+    }
+
+    static size_t nodesBegin() {
+        return (sizeof(Header) + 63) / 64 * 64;
+    }
+
+    static size_t blockSize(size_t top_layer) {
+        size_t align = alignof(Node);
+        return (Node::size(top_layer) + align - 1) / align * align;
+    }
+
+    int openFail(int ret) {
+        if (base) munmap(base, capacity);
+        ::close(fd);
+        fd = -1;
+        base = nullptr;
+        return ret;
+    }
+
+    // Extend the file to `size` or more, within `capacity`.
+    bool grow(size_t size) {
+        if (size <= fileSize) return true;
+        if (size > capacity) return false;
+        size_t new_size = std::max(size, fileSize * 2);
+        new_size = std::max(new_size, _SL_PMAP_MIN_GROWTH);
+        new_size = std::min(new_size, capacity);
+        if (ftruncate(fd, new_size) < 0) return false;
+        fileSize = new_size;
+        return true;
+    }
+
+    // Stores to links in the order of the program, so that the file
+    // left by a crash has them in that order.
+    static void setLink(sl_poffset& link, sl_poffset off) {
+        __atomic_store_n(&link, off, __ATOMIC_RELEASE);
+    }
+
+    size_t decideTopLayer() {
+        Header* hdr = header();
+        size_t layer = 0;
+        while (layer + 1 < hdr->max_layer) {
+            // xorshift64.
+            randState ^= randState << 13;
+            randState ^= randState >> 7;
+            randState ^= randState << 17;
+            if (randState % hdr->fanout) break;
+            layer++;
+        }
+        return layer;
+    }
+
+    // Return the node of `key` if exists. `prevs[layer]` is the tower
+    // of the last node smaller than `key` on each layer.
+    sl_poffset search(const K& key, sl_poffset** prevs) {
+        Header* hdr = header();
+        sl_poffset* links = hdr->head;
+        for (size_t layer = hdr->top_layer + 1; layer < hdr->max_layer;
+             ++layer) {
+            prevs[layer] = links;
+        }
+        for (int layer = hdr->top_layer; layer >= 0; --layer) {
+            for (;;) {
+                sl_poffset off = links[layer];
+                if (!off) break;
+                Node* node = nodeAt(off);
+                if (!(node->key < key)) break;
+                links = node->next;
+            }
+            prevs[layer] = links;
+        }
+        sl_poffset off = prevs[0][0];
+        if (off && !(key < nodeAt(off)->key)) return off;
+        return 0;
+    }
+
+    sl_poffset allocNode(size_t top_layer) {
+        Header* hdr = header();
+        sl_poffset off = hdr->free_heads[top_layer];
+        if (off) {
+            hdr->free_heads[top_layer] = nodeAt(off)->next[0];
+            return off;
+        }
+
+        size_t size = blockSize(top_layer);
+        off = hdr->alloc_end;
+        if (!grow(off + size)) throw std::bad_alloc();
+        // The node should be walkable by `relink()` before it is
+        // counted in `alloc_end`.
+        Node* node = nodeAt(off);
+        node->top_layer = top_layer;
+        node->flags = 0;
+        __atomic_store_n(&hdr->alloc_end, off + size, __ATOMIC_RELEASE);
+        return off;
+    }
+
+    void freeNode(sl_poffset off) {
+        Header* hdr = header();
+        Node* node = nodeAt(off);
+        node->flags = 0;
+        node->next[0] = hdr->free_heads[node->top_layer];
+        setLink(hdr->free_heads[node->top_layer], off);
+    }
+
+    void eraseNode(sl_poffset off, sl_poffset** prevs) {
+        Header* hdr = header();
+        Node* node = nodeAt(off);
+        node->flags = 0;
+        // Layer 0 last, so that the node stays an entry until then.
+        for (int layer = node->top_layer; layer >= 0; --layer) {
+            setLink(prevs[layer][layer], node->next[layer]);
+        }
+        hdr->num_entries--;
+        while (hdr->top_layer && !hdr->head[hdr->top_layer]) {
+            hdr->top_layer--;
+        }
+        freeNode(off);
+    }
+
+    // Rebuild everything but layer 0 from layer 0:
+    //   1) Walk all nodes in the file, and clear their flags.
+    //   2) Walk layer 0, flag the nodes and link them on upper layers.
+    //   3) Walk all nodes in the file, and put unflagged ones into
+    //      the free lists.
+    void relink() {
+        Header* hdr = header();
+        sl_poffset end = nodesBegin();
+        for (sl_poffset off = nodesBegin(); off < hdr->alloc_end; ) {
+            Node* node = nodeAt(off);
+            if (node->top_layer >= hdr->max_layer) break;
+            node->flags = 0;
+            off += blockSize(node->top_layer);
+            end = off;
+        }
+        // A broken node, the rest is lost.
+        hdr->alloc_end = end;
+
+        sl_poffset* lasts[SKIPLIST_MAX_LAYER];
+        size_t layer;
+        for (layer = 0; layer < SKIPLIST_MAX_LAYER; ++layer) {
+            lasts[layer] = hdr->head;
+            hdr->free_heads[layer] = 0;
+        }
+        uint64_t num_entries = 0;
+        size_t top_layer = 0;
+        Node* prev = nullptr;
+        sl_poffset off = hdr->head[0];
+        while (off) {
+            Node* node = (off >= nodesBegin() && off < end)
+                         ? nodeAt(off) : nullptr;
+            if (!node || node->flags ||
+                (prev && !(prev->key < node->key))) {
+                // Out of the file, loop, or out of order: cut here.
+                lasts[0][0] = 0;
+                break;
+            }
+            node->flags = Node::LINKED;
+            for (layer = 1; layer <= node->top_layer; ++layer) {
+                lasts[layer][layer] = off;
+                lasts[layer] = node->next;
+            }
+            lasts[0] = node->next;
+            top_layer = std::max(top_layer, (size_t)node->top_layer);
+            num_entries++;
+            prev = node;
+            off = node->next[0];
+        }
+        for (layer = 1; layer < SKIPLIST_MAX_LAYER; ++layer) {
+            lasts[layer][layer] = 0;
+        }
+        hdr->num_entries = num_entries;
+        hdr->top_layer = top_layer;
+
+        for (off = nodesBegin(); off < end; ) {
+            Node* node = nodeAt(off);
+            if (!node->flags) freeNode(off);
+            off += blockSize(node->top_layer);
+        }
+        msync(base, end, MS_SYNC);
+    }
+
+    // Should hold `lock`.
+    iterator makeIterator(sl_poffset off) {
+        if (!off) return end();
+        Node* node = nodeAt(off);
+        return iterator(this, off, T(node->key, node->value));
+    }
+
+    void seekForward(iterator& itr) {
+        ReadLock l(lock);
+        Node* node = nodeAt(itr.cursor);
+        if ((node->flags & Node::LINKED) &&
+            !(node->key < itr.kv.first) && !(itr.kv.first < node->key)) {
+            itr = makeIterator(node->next[0]);
+            return;
+        }
+        // Erased meanwhile, find the next key.
+        sl_poffset* prevs[SKIPLIST_MAX_LAYER];
+        sl_poffset off = search(itr.kv.first, prevs);
+        if (off) off = nodeAt(off)->next[0];
+        else off = prevs[0][0];
+        itr = makeIterator(off);
+    }
+
+    struct ReadLock {
+        ReadLock(pthread_rwlock_t& _l) : l(_l) { pthread_rwlock_rdlock(&l); }
+        ~ReadLock() { pthread_rwlock_unlock(&l); }
+        pthread_rwlock_t& l;
+    };
+
+    struct WriteLock {
+        WriteLock(pthread_rwlock_t& _l) : l(_l) { pthread_rwlock_wrlock(&l); }
+        ~WriteLock() { pthread_rwlock_unlock(&l); }
+        pthread_rwlock_t& l;
+    };
+
+    int fd;
+    uint8_t* base;
+    size_t capacity;
+    size_t fileSize;
+    bool recovered;
+    uint64_t randState;
+    pthread_rwlock_t lock;
+};
+
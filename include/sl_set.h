@@ -32,10 +32,15 @@
 #pragma once
 
 #include "skiplist.h"
+#include "sl_checkpoint.h"
+#include "sl_engine.h"
+#include "sl_node_pool.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cstdlib>
 #include <mutex>
+#include <new>
 #include <thread>
 #include <utility>
 #include <vector>
@@ -56,6 +61,33 @@ struct set_node {
         if (aa->key > bb->key) return 1;
         return 0;
     }
+    // Comparator of `sl_engine`, so that `cmp()` is inlined.
+    struct key_cmp {
+        key_cmp(skiplist_raw*) {}
+        int operator()(skiplist_node* a, skiplist_node* b) const {
+            return cmp(a, b, nullptr);
+        }
+    };
+    // Allocate a node along with its inline tower up to `top_layer`
+    // from `pool`.
+    static set_node* create(size_t top_layer, sl_node_pool* pool) {
+        void* mem = pool->alloc(top_layer);
+        set_node* node = new (mem) set_node();
+        skiplist_init_node_inline(&node->snode, node,
+                                  sizeof(set_node), top_layer);
+        return node;
+    }
+    // `pool` should be the one given to `create()`.
+    static void dispose(set_node* node, sl_node_pool* pool) {
+        size_t top_layer = _sl_tower_size(&node->snode) - 1;
+        node->~set_node();
+        pool->free(node, top_layer);
+    }
+    // `ctx`: the pool of the node.
+    static void destroy(skiplist_node* node, void* ctx) {
+        dispose( _get_entry(node, set_node, snode),
+                 static_cast<sl_node_pool*>(ctx) );
+    }
 
     skiplist_node snode;
     K key;
@@ -70,28 +102,53 @@ class set_iterator {
     friend class sl_set_gc<K>;
 public:
     using Node = set_node<K>;
+    using Engine = sl_engine<typename Node::key_cmp>;
 
-    set_iterator() : slist(nullptr), cursor(nullptr) {}
+    set_iterator()
+        : slist(nullptr), cursor(nullptr), hazard(nullptr)
+        , seq(_SL_SEQ_LATEST) {}
 
     set_iterator(set_iterator&& src)
-        : slist(src.slist), cursor(src.cursor)
+        : slist(src.slist), cursor(src.cursor), hazard(src.hazard)
+        , seq(src.seq)
     {
         // Mimic perfect forwarding.
         src.slist = nullptr;
         src.cursor = nullptr;
+        src.hazard = nullptr;
     }
 
     ~set_iterator() {
-        if (cursor) skiplist_release_node(cursor);
+        release();
     }
 
     void operator=(const set_iterator& src) {
+        if (this == &src) return;
+        if (src.hazard) {
+            // Hazard pointer mode: reuse our slot if we have one.
+            if (!hazard) {
+                release();
+                hazard = skiplist_hazard_acquire(src.slist);
+            }
+            skiplist_hazard_set(hazard, src.cursor);
+            slist = src.slist;
+            cursor = src.cursor;
+            seq = src.seq;
+            return;
+        }
+
         // This reference counting is similar to that of shared_ptr.
         skiplist_node* tmp = cursor;
+        skiplist_hazard* tmp_hazard = hazard;
         if (src.cursor)
             skiplist_grab_node(src.cursor);
+        slist = src.slist;
         cursor = src.cursor;
-        if (tmp)
+        hazard = nullptr;
+        seq = src.seq;
+        if (tmp_hazard)
+            skiplist_hazard_release(slist, tmp_hazard);
+        else if (tmp)
             skiplist_release_node(tmp);
     }
 
@@ -113,7 +170,11 @@ public:
             cursor = nullptr;
             return *this;
         }
-        skiplist_node* next = skiplist_next(slist, cursor);
+        if (hazard) {
+            cursor = Engine::hazard_next(slist, hazard, seq);
+            return *this;
+        }
+        skiplist_node* next = Engine::next(slist, cursor, seq);
         skiplist_release_node(cursor);
         cursor = next;
         return *this;
@@ -128,7 +189,11 @@ public:
             cursor = nullptr;
             return *this;
         }
-        skiplist_node* prev = skiplist_prev(slist, cursor);
+        if (hazard) {
+            cursor = Engine::hazard_prev(slist, hazard, seq);
+            return *this;
+        }
+        skiplist_node* prev = Engine::prev(slist, cursor, seq);
         skiplist_release_node(cursor);
         cursor = prev;
         return *this;
@@ -138,12 +203,36 @@ public:
     set_iterator operator--(int) { return operator--(); }
 
 private:
+    // `_cursor` should be grabbed by caller, and then owned by iterator.
+    // With `_seq`, it moves on the snapshot of that sequence number.
     set_iterator(skiplist_raw* _slist,
-                 skiplist_node* _cursor)
-        : slist(_slist), cursor(_cursor) {}
+                 skiplist_node* _cursor,
+                 uint64_t _seq = _SL_SEQ_LATEST)
+        : slist(_slist), cursor(_cursor), hazard(nullptr), seq(_seq)
+    {
+        // In hazard pointer mode, keep `cursor` alive
+        // by a hazard slot instead of `ref_count`.
+        hazard = (slist && cursor) ? skiplist_hazard_acquire(slist) : nullptr;
+        if (hazard) {
+            skiplist_hazard_set(hazard, cursor);
+            skiplist_release_node(cursor);
+        }
+    }
+
+    void release() {
+        if (hazard) {
+            skiplist_hazard_release(slist, hazard);
+            hazard = nullptr;
+        } else if (cursor) {
+            skiplist_release_node(cursor);
+        }
+        cursor = nullptr;
+    }
 
     skiplist_raw* slist;
     skiplist_node* cursor;
+    skiplist_hazard* hazard;
+    uint64_t seq;
 };
 
 
@@ -151,23 +240,71 @@ template<typename K>
 class sl_set {
 private:
     using Node = set_node<K>;
+    using Engine = sl_engine<typename Node::key_cmp>;
 
 public:
     using iterator = set_iterator<K>;
     using reverse_iterator = set_iterator<K>;
 
-    sl_set() {
+    sl_set() : pool(sizeof(Node), &slist) {
         skiplist_init(&slist, Node::cmp);
     }
 
+    // E.g., `reclaimMode = SKIPLIST_RECLAIM_EPOCH` or `_HAZARD` lets
+    // `erase()` return without waiting for readers of the erased node.
+    sl_set(const skiplist_raw_config& config) : pool(sizeof(Node), &slist) {
+        skiplist_init(&slist, Node::cmp);
+        skiplist_set_config(&slist, config);
+        pool.setHugePages(config.hugePages);
+    }
+
+    // Build from `[first, last)` at once, duplicate keys are skipped.
+    // It takes O(n) if the input is sorted by key.
+    template<typename InputIt>
+    sl_set(InputIt first, InputIt last,
+           const skiplist_raw_config& config = skiplist_get_default_config())
+        : pool(sizeof(Node), &slist)
+    {
+        skiplist_init(&slist, Node::cmp);
+        skiplist_set_config(&slist, config);
+        pool.setHugePages(config.hugePages);
+
+        std::vector<K> items(first, last);
+        bool sorted = true;
+        for (size_t ii = 1; ii < items.size(); ++ii) {
+            if (items[ii] < items[ii-1]) {
+                sorted = false;
+                break;
+            }
+        }
+        if (!sorted) {
+            std::stable_sort(items.begin(), items.end());
+        }
+
+        // Keep the first one among the same keys.
+        std::vector<skiplist_node*> snodes;
+        snodes.reserve(items.size());
+        for (size_t ii = 0; ii < items.size(); ++ii) {
+            if (ii && !(items[ii-1] < items[ii])) continue;
+            Node* node = Node::create
+                         ( skiplist_bulk_load_top_layer(&slist, snodes.size()),
+                           &pool );
+            node->key = items[ii];
+            snodes.push_back(&node->snode);
+        }
+        if (!snodes.empty()) {
+            skiplist_bulk_load(&slist, &snodes[0], snodes.size());
+        }
+    }
+
     virtual
     ~sl_set() {
         skiplist_node* cursor = skiplist_begin(&slist);
         while (cursor) {
             Node* node = _get_entry(cursor, Node, snode);
-            cursor = skiplist_next(&slist, cursor);
+            cursor = Engine::next(&slist, cursor);
             // Don't need to care about release.
-            delete node;
+            Node::dispose(node, &pool);
         }
         skiplist_free(&slist);
     }
@@ -183,23 +320,28 @@ public:
 
     size_t size() { return skiplist_get_size(&slist); }
 
+    // Preallocate nodes for `n` more keys at once, e.g., before
+    // a bulk of inserts. Erased nodes are reused by later inserts.
+    void reserve(size_t n) {
+        skiplist_raw_config config = skiplist_get_config(&slist);
+        pool.reserve(n, config.fanout, config.maxLayer);
+    }
+
     std::pair<iterator, bool> insert(const K& key) {
+        // The same node is used again if the other one is gone meanwhile.
+        Node* node = newNode(key);
+        node->key = key;
         do {
-            Node* node = new Node();
-            node->key = key;
-
-            int rc = skiplist_insert_nodup(&slist, &node->snode);
+            int rc = Engine::insert_nodup(&slist, &node->snode);
             if (rc == 0) {
                 skiplist_grab_node(&node->snode);
                 return std::pair<iterator, bool>
                        ( iterator(&slist, &node->snode), true );
             }
-            delete node;
 
-            Node query;
-            query.key = key;
-            skiplist_node* cursor = skiplist_find(&slist, &query.snode);
+            skiplist_node* cursor = Engine::find(&slist, &node->snode);
             if (cursor) {
+                Node::dispose(node, &pool);
                 return std::pair<iterator, bool>
                        ( iterator(&slist, cursor), false );
             }
@@ -209,25 +351,186 @@ public:
         return std::pair<iterator, bool>(iterator(), false);
     }
 
+    // Duplicate keys (including the ones in the input) are skipped.
+    // If the input is sorted by key, it is inserted as a batch.
+    template<typename InputIt>
+    void insert(InputIt first, InputIt last) {
+        std::vector<Node*> nodes;
+        std::vector<skiplist_node*> snodes;
+        bool sorted = true;
+        for (InputIt ii = first; ii != last; ++ii) {
+            Node* node = newNode(*ii);
+            node->key = *ii;
+            if ( !nodes.empty() &&
+                 node->key < nodes.back()->key ) {
+                sorted = false;
+            }
+            nodes.push_back(node);
+            snodes.push_back(&node->snode);
+        }
+        if (nodes.empty()) return;
+
+        std::vector<int> results(nodes.size());
+        if (sorted) {
+            Engine::insert_batch_nodup(&slist, &snodes[0], snodes.size(),
+                                       &results[0]);
+        } else {
+            for (size_t ii = 0; ii < snodes.size(); ++ii) {
+                results[ii] = Engine::insert_nodup(&slist, snodes[ii]);
+            }
+        }
+        for (size_t ii = 0; ii < nodes.size(); ++ii) {
+            if (results[ii] != 0) Node::dispose(nodes[ii], &pool);
+        }
+    }
+
     iterator find(const K& key) {
         Node query;
         query.key = key;
-        skiplist_node* cursor = skiplist_find(&slist, &query.snode);
+        skiplist_node* cursor = Engine::find(&slist, &query.snode);
+        return iterator(&slist, cursor);
+    }
+
+    // `find()` on each of `keys`, the results are in the same order.
+    // The searches advance together, so that their cache misses overlap.
+    std::vector<iterator> multi_find(const std::vector<K>& keys) {
+        size_t num = keys.size();
+        std::vector<Node> queries(num);
+        std::vector<skiplist_node*> query_nodes(num);
+        std::vector<skiplist_node*> results(num);
+        for (size_t ii = 0; ii < num; ++ii) {
+            queries[ii].key = keys[ii];
+            query_nodes[ii] = &queries[ii].snode;
+        }
+        std::vector<iterator> ret;
+        if (!num) return ret;
+
+        Engine::find_batch(&slist, &query_nodes[0], &results[0], num);
+        ret.reserve(num);
+        for (size_t ii = 0; ii < num; ++ii) {
+            ret.push_back(iterator(&slist, results[ii]));
+        }
+        return ret;
+    }
+
+    // Entry at rank `k` (0: the smallest one), `end()` if out of range.
+    // O(log n) if `indexable` is set in the config, O(k) otherwise.
+    iterator nth(size_t k) {
+        return iterator(&slist, Engine::select(&slist, k));
+    }
+
+    // Number of entries smaller than `key`.
+    size_t rank(const K& key) {
+        Node query;
+        query.key = key;
+        return Engine::rank(&slist, &query.snode);
+    }
+
+    // Take a snapshot, which needs `versioned` in the config.
+    // Iterators from `snapshot_begin()` and `snapshot_find()` with it
+    // see the entries as of then, until `release_snapshot()` is called.
+    uint64_t snapshot() {
+        return skiplist_snapshot(&slist);
+    }
+
+    void release_snapshot(uint64_t seq) {
+        skiplist_snapshot_release(&slist, seq);
+    }
+
+    iterator snapshot_begin(uint64_t seq) {
+        return iterator(&slist, Engine::begin(&slist, seq), seq);
+    }
+
+    iterator snapshot_find(uint64_t seq, const K& key) {
+        Node query;
+        query.key = key;
+        skiplist_node* cursor = Engine::find(&slist, &query.snode, seq);
+        return iterator(&slist, cursor, seq);
+    }
+
+    // Write all keys to `out` in the format of `sl_checkpoint.h`.
+    // Writers are not blocked, and with `versioned` in the config, it
+    // is a snapshot as of the call. Return 0 on success.
+    int checkpoint(std::ostream& out) {
+        sl_checkpoint_writer<K, sl_checkpoint_no_value> writer(out);
+        uint64_t seq = snapshot();
+        for (iterator itr = snapshot_begin(seq); itr != end(); ++itr) {
+            writer.add(*itr, sl_checkpoint_no_value());
+        }
+        release_snapshot(seq);
+        return writer.finish();
+    }
+
+    // Load keys from `checkpoint()`, skipping the ones that exist.
+    // An empty set is built at once in O(n), which should not run
+    // along with other writers. Return 0 on success, -1 if `in` ends
+    // early, or -2 if the checkpoint is broken or of other types, in
+    // which case nothing is loaded.
+    int load_checkpoint(std::istream& in) {
+        sl_checkpoint_reader<K, sl_checkpoint_no_value> reader(in);
+        sl_checkpoint_no_value none;
+        int rc = reader.open();
+        if (rc < 0) return rc;
+
+        std::vector<K> keys;
+        bool sorted = true;
+        K key;
+        while ((rc = reader.next(key, none)) > 0) {
+            if (!keys.empty() && !(keys.back() < key)) sorted = false;
+            keys.push_back(std::move(key));
+        }
+        if (rc < 0) return rc;
+        if (!sorted) std::stable_sort(keys.begin(), keys.end());
+        keys.erase( std::unique( keys.begin(), keys.end(),
+                                 [](const K& a, const K& b) {
+                                     return !(a < b);
+                                 } ),
+                    keys.end() );
+
+        // Heights by the final positions, as `skiplist_bulk_load()`
+        // gives them, now that sorting and dedup are done.
+        std::vector<skiplist_node*> snodes;
+        snodes.reserve(keys.size());
+        for (size_t ii = 0; ii < keys.size(); ++ii) {
+            Node* node = Node::create
+                         ( skiplist_bulk_load_top_layer(&slist, ii), &pool );
+            node->key = std::move(keys[ii]);
+            snodes.push_back(&node->snode);
+        }
+        if (snodes.empty()) return 0;
+        if (skiplist_bulk_load(&slist, &snodes[0], snodes.size()) == 0) {
+            return 0;
+        }
+
+        // Not empty.
+        std::vector<int> results(snodes.size());
+        Engine::insert_batch_nodup(&slist, &snodes[0], snodes.size(),
+                                   &results[0]);
+        for (size_t ii = 0; ii < snodes.size(); ++ii) {
+            if (results[ii] == 0) continue;
+            Node::dispose(_get_entry(snodes[ii], Node, snode), &pool);
+        }
+        return 0;
+    }
+
+    // Search from `hint`, cheap if `key` is close to (and after) it.
+    iterator find(const iterator& hint, const K& key) {
+        Node query;
+        query.key = key;
+        skiplist_node* cursor =
+            Engine::find_from(&slist, hint.cursor, &query.snode);
         return iterator(&slist, cursor);
     }
 
     virtual
     iterator erase(iterator& position) {
         skiplist_node* cursor = position.cursor;
-        skiplist_node* next = skiplist_next(&slist, cursor);
+        skiplist_node* next = Engine::next(&slist, cursor);
 
-        skiplist_erase_node(&slist, cursor);
-        skiplist_release_node(cursor);
-        skiplist_wait_for_free(cursor);
-        Node* node = _get_entry(cursor, Node, snode);
-        delete node;
+        Engine::erase_node(&slist, cursor);
+        position.release();
+        skiplist_retire_node(&slist, cursor, Node::destroy, &pool);
 
-        position.cursor = nullptr;
         return iterator(&slist, next);
     }
 
@@ -236,22 +539,45 @@ public:
         size_t count = 0;
         Node query;
         query.key = key;
-        skiplist_node* cursor = skiplist_find(&slist, &query.snode);
+        skiplist_node* cursor = Engine::find(&slist, &query.snode);
         while (cursor) {
             Node* node = _get_entry(cursor, Node, snode);
             if (node->key != key) break;
 
-            cursor = skiplist_next(&slist, cursor);
+            cursor = Engine::next(&slist, cursor);
 
-            skiplist_erase_node(&slist, &node->snode);
+            Engine::erase_node(&slist, &node->snode);
             skiplist_release_node(&node->snode);
-            skiplist_wait_for_free(&node->snode);
-            delete node;
+            skiplist_retire_node(&slist, &node->snode, Node::destroy, &pool);
         }
         if (cursor) skiplist_release_node(cursor);
         return count;
     }
 
+    // Erase `[first, last)` at once, and return `last`.
+    // `first` is released, as the node it points to is erased.
+    iterator erase(iterator& first, const iterator& last) {
+        iterator ret;
+        ret = last;
+        if (!first.cursor || first == last) return ret;
+
+        Node from;
+        from.key = *first;
+        first.release();
+        Engine::erase_range(&slist, &from.snode, last.cursor, retireCb, this);
+        return ret;
+    }
+    iterator erase(iterator&& first, const iterator& last) {
+        return erase(first, last);
+    }
+
+    // Erase all keys smaller than `key`, and return the number of them.
+    size_t truncate_before(const K& key) {
+        Node to;
+        to.key = key;
+        return Engine::truncate_before(&slist, &to.snode, retireCb, this);
+    }
+
     iterator begin() {
         skiplist_node* cursor = skiplist_begin(&slist);
         return iterator(&slist, cursor);
@@ -265,6 +591,30 @@ public:
     reverse_iterator rend() { return reverse_iterator(); }
 
 protected:
+    // Called for each node erased by `erase(first, last)`.
+    virtual
+    void retireNode(Node* node) {
+        skiplist_retire_node(&slist, &node->snode, Node::destroy, &pool);
+    }
+    static void retireCb(skiplist_node* node, void* ctx) {
+        static_cast<sl_set*>(ctx)->retireNode(_get_entry(node, Node, snode));
+    }
+
+    Node* newNode(const K& key) {
+        // Built-in random generators do not look at the key.
+        if ( slist.level_gen == skiplist_level_gen_fast ||
+             slist.level_gen == skiplist_level_gen_rand ) {
+            return Node::create(skiplist_decide_top_layer(&slist, nullptr),
+                                &pool);
+        }
+        Node query;
+        query.key = key;
+        return Node::create(skiplist_decide_top_layer(&slist, &query.snode),
+                            &pool);
+    }
+
+    // Nodes and their towers.
+    sl_node_pool pool;
     skiplist_raw slist;
 };
 
@@ -272,6 +622,7 @@ template<typename K>
 class sl_set_gc : public sl_set<K> {
 private:
     using Node = set_node<K>;
+    using Engine = sl_engine<typename Node::key_cmp>;
 
 public:
     using iterator = set_iterator<K>;
@@ -291,23 +642,24 @@ public:
         execGc();
         for (std::atomic<Node*>*& a_node: gcVector) {
             Node* node = a_node->load();
-            delete node;
+            if (node) Node::dispose(node, &this->pool);
             delete a_node;
         }
     }
 
+    using sl_set<K>::erase;
+
     iterator erase(iterator& position) {
         skiplist_node* cursor = position.cursor;
-        skiplist_node* next = skiplist_next(&this->slist, cursor);
+        skiplist_node* next = Engine::next(&this->slist, cursor);
 
-        skiplist_erase_node(&this->slist, cursor);
+        Engine::erase_node(&this->slist, cursor);
 
         Node* node = _get_entry(cursor, Node, snode);
         gcPush(node);
-        skiplist_release_node(cursor);
+        position.release();
         execGc();
 
-        position.cursor = nullptr;
         return iterator(&this->slist, next);
     }
 
@@ -315,14 +667,14 @@ public:
         size_t count = 0;
         Node query;
         query.key = key;
-        skiplist_node* cursor = skiplist_find(&this->slist, &query.snode);
+        skiplist_node* cursor = Engine::find(&this->slist, &query.snode);
         while (cursor) {
             Node* node = _get_entry(cursor, Node, snode);
             if (node->key != key) break;
 
-            cursor = skiplist_next(&this->slist, cursor);
+            cursor = Engine::next(&this->slist, cursor);
 
-            skiplist_erase_node(&this->slist, &node->snode);
+            Engine::erase_node(&this->slist, &node->snode);
             gcPush(node);
             skiplist_release_node(&node->snode);
         }
@@ -332,6 +684,11 @@ public:
         return count;
     }
 
+protected:
+    void retireNode(Node* node) {
+        gcPush(node);
+    }
+
 private:
     void gcPush(Node* node) {
         size_t v_len = gcVector.size();
@@ -369,7 +726,7 @@ private:
                 a_node.compare_exchange_strong
                        ( exp, val, std::memory_order_relaxed );
 
-                delete node;
+                Node::dispose(node, &this->pool);
             }
         }
     }
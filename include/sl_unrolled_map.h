@@ -0,0 +1,748 @@
+/**
+ * Copyright (C) 2017-present Jung-Sang Ahn <jungsang.ahn@gmail.com>
+ * All rights reserved.
+ *
+ * https://github.com/greensky00
+ *
+ * Skiplist unrolled map container
+ * Version: 0.2.0
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "skiplist.h"
+#include "sl_engine.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Same interface as `sl_map`, but each skiplist node (chunk) holds up to
+// `N` entries in sorted arrays, so that the node header and the tower
+// are shared by the entries, and most steps of a search or a scan are
+// within an array instead of a pointer chase.
+//
+// A chunk covers the keys in `[low, high)`, where `high` is the `low` of
+// the next chunk. The first chunk covers everything below that, and is
+// never removed. Each chunk has its own lock:
+//   * A full chunk is split by moving its upper half to a new chunk,
+//     which is linked before the lock is released.
+//   * A chunk below a quarter full absorbs the next one if they fit in
+//     three quarters, and the next one is marked dead and unlinked.
+// Operations on a dead chunk, or on a chunk that does not cover the key
+// anymore, search again.
+//
+// Entries move between chunks, hence iterators hold a copy of the entry
+// (and the chunk, to find the next one quickly). The copy is read-only,
+// as changing it would not change the map.
+
+// Lower bound of the keys of a chunk, the key of the chunk in skiplist.
+template<typename K>
+struct unrolled_bound {
+    unrolled_bound() : first(false), low() {
+        skiplist_init_node(&snode);
+    }
+    ~unrolled_bound() {
+        skiplist_free_node(&snode);
+    }
+    static int cmp(skiplist_node* a, skiplist_node* b, void* aux) {
+        unrolled_bound *aa, *bb;
+        aa = _get_entry(a, unrolled_bound, snode);
+        bb = _get_entry(b, unrolled_bound, snode);
+        // The first chunk is smaller than all others.
+        if (aa->first || bb->first) return (int)bb->first - (int)aa->first;
+        if (aa->low < bb->low) return -1;
+        if (aa->low > bb->low) return 1;
+        return 0;
+    }
+    // Comparator of `sl_engine`, so that `cmp()` is inlined.
+    struct key_cmp {
+        key_cmp(skiplist_raw*) {}
+        int operator()(skiplist_node* a, skiplist_node* b) const {
+            return cmp(a, b, nullptr);
+        }
+    };
+
+    skiplist_node snode;
+    bool first;
+    K low;
+};
+
+template<typename K, typename V, size_t N>
+struct unrolled_chunk {
+    using Bound = unrolled_bound<K>;
+
+    unrolled_chunk() : dead(false), has_high(false), high(), count(0) {}
+
+    // Allocate a chunk along with its inline tower up to `top_layer`,
+    // to be inserted into `slist`.
+    static unrolled_chunk* create(skiplist_raw* slist, size_t top_layer) {
+        void* mem = ::operator new
+                    ( skiplist_inline_node_size(slist, sizeof(unrolled_chunk),
+                                                top_layer) );
+        unrolled_chunk* chunk = new (mem) unrolled_chunk();
+        skiplist_init_node_inline(&chunk->bound.snode, chunk,
+                                  sizeof(unrolled_chunk), top_layer);
+        return chunk;
+    }
+    static void dispose(unrolled_chunk* chunk) {
+        chunk->~unrolled_chunk();
+        ::operator delete(chunk);
+    }
+    static void destroy(skiplist_node* node, void* ctx) {
+        dispose(get(node));
+    }
+    static unrolled_chunk* get(skiplist_node* node) {
+        Bound* bound = _get_entry(node, Bound, snode);
+        return _get_entry(bound, unrolled_chunk, bound);
+    }
+
+    bool covers(const K& key) const {
+        return (bound.first || !(key < bound.low)) &&
+               (!has_high || key < high);
+    }
+
+    // Position of the first key not less than `key`,
+    // or greater than `key` if `upper`.
+    size_t search(const K& key, bool upper) const {
+        if (std::is_arithmetic<K>::value) {
+            // Count without branches, so that compilers vectorize it.
+            size_t pos = 0, ii;
+            if (upper) {
+                for (ii = 0; ii < count; ++ii) pos += !(key < keys[ii]);
+            } else {
+                for (ii = 0; ii < count; ++ii) pos += (keys[ii] < key);
+            }
+            return pos;
+        }
+        return upper ? std::upper_bound(keys, keys + count, key) - keys
+                     : std::lower_bound(keys, keys + count, key) - keys;
+    }
+
+    void insert(size_t pos, const K& key, const V& value) {
+        std::move_backward(keys + pos, keys + count, keys + count + 1);
+        std::move_backward(values + pos, values + count, values + count + 1);
+        keys[pos] = key;
+        values[pos] = value;
+        count++;
+    }
+
+    void remove(size_t pos, size_t num) {
+        std::move(keys + pos + num, keys + count, keys + pos);
+        std::move(values + pos + num, values + count, values + pos);
+        count -= num;
+    }
+
+    // Move `[pos, count)` to the end of `dst`.
+    void moveTo(size_t pos, unrolled_chunk* dst) {
+        std::move(keys + pos, keys + count, dst->keys + dst->count);
+        std::move(values + pos, values + count, dst->values + dst->count);
+        dst->count += count - pos;
+        count = pos;
+    }
+
+    Bound bound;
+    std::mutex lock;
+    // Merged into the previous chunk, and being unlinked.
+    bool dead;
+    bool has_high;
+    K high;
+    size_t count;
+    K keys[N];
+    V values[N];
+};
+
+template<typename K, typename V, size_t N> class sl_unrolled_map;
+
+template<typename K, typename V, size_t N>
+class unrolled_map_iterator {
+    friend class sl_unrolled_map<K, V, N>;
+
+private:
+    using T = std::pair<K, V>;
+    using Map = sl_unrolled_map<K, V, N>;
+
+public:
+    unrolled_map_iterator() : map(nullptr), cursor(nullptr) {}
+
+    unrolled_map_iterator(unrolled_map_iterator&& src)
+        : map(src.map), cursor(src.cursor), kv(std::move(src.kv))
+    {
+        // Mimic perfect forwarding.
+        src.map = nullptr;
+        src.cursor = nullptr;
+    }
+
+    ~unrolled_map_iterator() {
+        release();
+    }
+
+    void operator=(const unrolled_map_iterator& src) {
+        if (this == &src) return;
+        if (src.cursor) skiplist_grab_node(src.cursor);
+        release();
+        map = src.map;
+        cursor = src.cursor;
+        kv = src.kv;
+    }
+
+    // The same entry can be in different chunks over time.
+    bool operator==(const unrolled_map_iterator& src) const {
+        if (!cursor || !src.cursor) return (cursor == src.cursor);
+        return !(kv.first < src.kv.first) && !(src.kv.first < kv.first);
+    }
+    bool operator!=(const unrolled_map_iterator& src) const {
+        return !operator==(src);
+    }
+
+    const T* operator->() const { return &kv; }
+    const T& operator*() const { return kv; }
+
+    // ++A
+    unrolled_map_iterator& operator++() {
+        if (!map || !cursor) {
+            cursor = nullptr;
+            return *this;
+        }
+        skiplist_node* cur = cursor;
+        cursor = nullptr;
+        map->seekForward(*this, cur, &kv.first, false);
+        return *this;
+    }
+    // A++
+    unrolled_map_iterator& operator++(int) { return operator++(); }
+    // --A
+    unrolled_map_iterator& operator--() {
+        if (!map || !cursor) {
+            cursor = nullptr;
+            return *this;
+        }
+        skiplist_node* cur = cursor;
+        cursor = nullptr;
+        map->seekBackward(*this, cur, &kv.first);
+        return *this;
+    }
+    // A--
+    unrolled_map_iterator& operator--(int) { return operator--(); }
+
+private:
+    // `_cursor` should be grabbed by caller, and then owned by iterator.
+    unrolled_map_iterator(Map* _map,
+                          skiplist_node* _cursor,
+                          const T& _kv)
+        : map(_map), cursor(_cursor), kv(_kv) {}
+
+    void release() {
+        if (cursor) skiplist_release_node(cursor);
+        cursor = nullptr;
+    }
+
+    Map* map;
+    // Chunk where the entry was.
+    skiplist_node* cursor;
+    T kv;
+};
+
+template<typename K, typename V, size_t N = 32>
+class sl_unrolled_map {
+    friend class unrolled_map_iterator<K, V, N>;
+
+private:
+    static_assert(N >= 4, "a chunk should hold at least 4 entries");
+    using T = std::pair<K, V>;
+    using Bound = unrolled_bound<K>;
+    using Chunk = unrolled_chunk<K, V, N>;
+    using Engine = sl_engine<typename Bound::key_cmp>;
+
+public:
+    using iterator = unrolled_map_iterator<K, V, N>;
+    using reverse_iterator = unrolled_map_iterator<K, V, N>;
+
+    sl_unrolled_map() : numEntries(0) {
+        skiplist_init(&slist, Bound::cmp);
+        Engine::insert(&slist, &newChunk(nullptr)->bound.snode);
+    }
+
+    sl_unrolled_map(const skiplist_raw_config& config) : numEntries(0) {
+        skiplist_init(&slist, Bound::cmp);
+        skiplist_set_config(&slist, config);
+        Engine::insert(&slist, &newChunk(nullptr)->bound.snode);
+    }
+
+    // Build from `[first, last)` at once, duplicate keys are skipped.
+    // Chunks are filled up to three quarters.
+    template<typename InputIt>
+    sl_unrolled_map(InputIt first, InputIt last,
+                    const skiplist_raw_config& config =
+                        skiplist_get_default_config())
+        : numEntries(0)
+    {
+        skiplist_init(&slist, Bound::cmp);
+        skiplist_set_config(&slist, config);
+
+        std::vector<T> items(first, last);
+        std::stable_sort(items.begin(), items.end(),
+                         [](const T& a, const T& b) {
+                             return a.first < b.first;
+                         });
+        // Keep the first one among the same keys.
+        size_t ii, num = 0;
+        for (ii = 0; ii < items.size(); ++ii) {
+            if (num && !(items[num-1].first < items[ii].first)) continue;
+            if (num != ii) items[num] = items[ii];
+            num++;
+        }
+
+        size_t per_chunk = N * 3 / 4;
+        std::vector<skiplist_node*> snodes;
+        for (ii = 0; ii == 0 || ii < num; ii += per_chunk) {
+            Chunk* chunk = Chunk::create
+                           ( &slist,
+                             skiplist_bulk_load_top_layer(&slist,
+                                                          snodes.size()) );
+            chunk->bound.first = (ii == 0);
+            if (ii) chunk->bound.low = items[ii].first;
+            for (size_t jj = ii; jj < num && jj < ii + per_chunk; ++jj) {
+                chunk->insert(chunk->count, items[jj].first,
+                              items[jj].second);
+            }
+            if (ii + per_chunk < num) {
+                chunk->has_high = true;
+                chunk->high = items[ii + per_chunk].first;
+            }
+            snodes.push_back(&chunk->bound.snode);
+        }
+        skiplist_bulk_load(&slist, &snodes[0], snodes.size());
+        numEntries = num;
+    }
+
+    virtual
+    ~sl_unrolled_map() {
+        skiplist_node* cursor = skiplist_begin(&slist);
+        while (cursor) {
+            Chunk* chunk = Chunk::get(cursor);
+            cursor = Engine::next(&slist, cursor);
+            // Don't need to care about release.
+            Chunk::dispose(chunk);
+        }
+        for (Chunk* chunk: deadChunks) Chunk::dispose(chunk);
+        skiplist_free(&slist);
+    }
+
+    bool empty() { return size() == 0; }
+
+    size_t size() { return numEntries.load(); }
+
+    std::pair<iterator, bool> insert(const T& kv) {
+        skiplist_node* cursor = nullptr;
+        Chunk* chunk = lockChunk(kv.first, cursor);
+        size_t pos = chunk->search(kv.first, false);
+        if (pos < chunk->count && !(kv.first < chunk->keys[pos])) {
+            // Already exists.
+            T found(chunk->keys[pos], chunk->values[pos]);
+            chunk->lock.unlock();
+            return std::pair<iterator, bool>
+                   ( iterator(this, cursor, found), false );
+        }
+
+        if (chunk->count < N) {
+            chunk->insert(pos, kv.first, kv.second);
+            numEntries.fetch_add(1);
+            chunk->lock.unlock();
+            return std::pair<iterator, bool>
+                   ( iterator(this, cursor, kv), true );
+        }
+
+        // Full: move the upper half to a new chunk.
+        Bound bound;
+        bound.low = chunk->keys[N / 2];
+        Chunk* right = newChunk(&bound);
+        right->bound.low = bound.low;
+        chunk->moveTo(N / 2, right);
+        right->has_high = chunk->has_high;
+        right->high = chunk->high;
+        chunk->has_high = true;
+        chunk->high = right->bound.low;
+
+        if (kv.first < right->bound.low) {
+            chunk->insert(pos, kv.first, kv.second);
+        } else {
+            right->insert(right->search(kv.first, false),
+                          kv.first, kv.second);
+            // The iterator holds the new chunk instead.
+            skiplist_grab_node(&right->bound.snode);
+            skiplist_release_node(cursor);
+            cursor = &right->bound.snode;
+        }
+        numEntries.fetch_add(1);
+        Engine::insert(&slist, &right->bound.snode);
+        chunk->lock.unlock();
+        return std::pair<iterator, bool>(iterator(this, cursor, kv), true);
+    }
+
+    // Duplicate keys (including the ones in the input) are skipped.
+    template<typename InputIt>
+    void insert(InputIt first, InputIt last) {
+        for (InputIt ii = first; ii != last; ++ii) insert(*ii);
+    }
+
+    iterator find(const K& key) {
+        skiplist_node* cursor = nullptr;
+        Chunk* chunk = lockChunk(key, cursor);
+        size_t pos = chunk->search(key, false);
+        if (pos < chunk->count && !(key < chunk->keys[pos])) {
+            T found(chunk->keys[pos], chunk->values[pos]);
+            chunk->lock.unlock();
+            return iterator(this, cursor, found);
+        }
+        chunk->lock.unlock();
+        skiplist_release_node(cursor);
+        return iterator();
+    }
+
+    // `find()` on each of `keys`, the results are in the same order.
+    // There are `N` times fewer nodes than `sl_map`, so each search
+    // is short, and they are not interleaved.
+    std::vector<iterator> multi_find(const std::vector<K>& keys) {
+        std::vector<iterator> ret;
+        ret.reserve(keys.size());
+        for (size_t ii = 0; ii < keys.size(); ++ii) {
+            ret.push_back(find(keys[ii]));
+        }
+        return ret;
+    }
+
+    virtual
+    iterator erase(iterator& position) {
+        iterator next;
+        next = position;
+        ++next;
+        erase(position.kv.first);
+        position.release();
+        return next;
+    }
+
+    virtual
+    size_t erase(const K& key) {
+        skiplist_node* cursor = nullptr;
+        Chunk* chunk = lockChunk(key, cursor);
+        size_t pos = chunk->search(key, false);
+        if (pos == chunk->count || key < chunk->keys[pos]) {
+            chunk->lock.unlock();
+            skiplist_release_node(cursor);
+            return 0;
+        }
+        chunk->remove(pos, 1);
+        numEntries.fetch_sub(1);
+        mergeAndUnlock(chunk, cursor);
+        return 1;
+    }
+
+    // Erase `[first, last)` at once, and return `last`.
+    // `first` is released, as the entry it points to is erased.
+    iterator erase(iterator& first, const iterator& last) {
+        iterator ret;
+        ret = last;
+        if (!first.cursor || first == last) return ret;
+
+        K from = first->first;
+        first.release();
+        eraseRange(&from, last.cursor ? &last.kv.first : nullptr);
+        return ret;
+    }
+    iterator erase(iterator&& first, const iterator& last) {
+        return erase(first, last);
+    }
+
+    // Erase all keys smaller than `key`, and return the number of them.
+    size_t truncate_before(const K& key) {
+        return eraseRange(nullptr, &key);
+    }
+
+    iterator begin() {
+        iterator ret(this, nullptr, T());
+        seekForward(ret, nullptr, nullptr, true);
+        return ret;
+    }
+    iterator end() { return iterator(); }
+
+    reverse_iterator rbegin() {
+        reverse_iterator ret(this, nullptr, T());
+        seekBackward(ret, nullptr, nullptr);
+        return ret;
+    }
+    reverse_iterator rend() { return reverse_iterator(); }
+
+private:
+    // `bound` is used by the level generator only, the first chunk if NULL.
+    Chunk* newChunk(Bound* bound) {
+        Chunk* chunk = nullptr;
+        if ( !bound ||
+             slist.level_gen == skiplist_level_gen_fast ||
+             slist.level_gen == skiplist_level_gen_rand ) {
+            chunk = Chunk::create
+                    ( &slist, skiplist_decide_top_layer(&slist, nullptr) );
+        } else {
+            chunk = Chunk::create
+                    ( &slist,
+                      skiplist_decide_top_layer(&slist, &bound->snode) );
+        }
+        chunk->bound.first = !bound;
+        return chunk;
+    }
+
+    // The chunk that covers `key`, locked, and grabbed in `cursor`.
+    Chunk* lockChunk(const K& key, skiplist_node*& cursor) {
+        Bound query;
+        query.low = key;
+        for (;;) {
+            // Never NULL, as the first chunk is smaller than any key.
+            cursor = Engine::find_smaller_or_equal(&slist, &query.snode);
+            Chunk* chunk = Chunk::get(cursor);
+            chunk->lock.lock();
+            if (!chunk->dead && chunk->covers(key)) return chunk;
+
+            // Split or merged in the meantime.
+            chunk->lock.unlock();
+            skiplist_release_node(cursor);
+            std::this_thread::yield();
+        }
+    }
+
+    // Absorb the next chunk if `chunk` is small enough, and then unlock
+    // and release `chunk`. Chunks are locked from left to right.
+    void mergeAndUnlock(Chunk* chunk, skiplist_node* cursor) {
+        skiplist_node* next_cursor = nullptr;
+        Chunk* next = nullptr;
+        if (chunk->count < N / 4 && chunk->has_high) {
+            Bound query;
+            query.low = chunk->high;
+            next_cursor = Engine::find(&slist, &query.snode);
+        }
+        if (next_cursor) {
+            next = Chunk::get(next_cursor);
+            next->lock.lock();
+            if (!next->dead && chunk->count + next->count <= N * 3 / 4) {
+                next->moveTo(0, chunk);
+                chunk->has_high = next->has_high;
+                chunk->high = next->high;
+                next->dead = true;
+                Engine::erase_node(&slist, next_cursor);
+            } else {
+                next->lock.unlock();
+                skiplist_release_node(next_cursor);
+                next = nullptr;
+            }
+        }
+        if (next) next->lock.unlock();
+        chunk->lock.unlock();
+        skiplist_release_node(cursor);
+
+        if (next) {
+            skiplist_release_node(next_cursor);
+            retire(next);
+        }
+    }
+
+    void retire(Chunk* chunk) {
+        if (slist.reclaim_mode != SKIPLIST_RECLAIM_REFCOUNT) {
+            skiplist_retire_node(&slist, &chunk->bound.snode,
+                                 Chunk::destroy, nullptr);
+            return;
+        }
+        // Iterators can hold the chunk for long, even the ones of the
+        // caller of `erase()`, so free it later instead of waiting here.
+        std::lock_guard<std::mutex> l(deadChunksLock);
+        deadChunks.push_back(chunk);
+        size_t ii, num = 0;
+        for (ii = 0; ii < deadChunks.size(); ++ii) {
+            if (skiplist_is_safe_to_free(&deadChunks[ii]->bound.snode)) {
+                Chunk::dispose(deadChunks[ii]);
+            } else {
+                deadChunks[num++] = deadChunks[ii];
+            }
+        }
+        deadChunks.resize(num);
+    }
+
+    // Erase keys in `[from, to)`, NULL means unbounded.
+    size_t eraseRange(const K* from, const K* to) {
+        size_t num_removed = 0;
+        bool has_cur = (from != nullptr);
+        K cur = has_cur ? *from : K();
+        for (;;) {
+            skiplist_node* cursor = nullptr;
+            Chunk* chunk = nullptr;
+            if (has_cur) {
+                chunk = lockChunk(cur, cursor);
+            } else {
+                // The first chunk is never removed.
+                cursor = Engine::begin(&slist);
+                chunk = Chunk::get(cursor);
+                chunk->lock.lock();
+            }
+
+            size_t begin = has_cur ? chunk->search(cur, false) : 0;
+            size_t end = to ? chunk->search(*to, false) : chunk->count;
+            if (begin < end) {
+                chunk->remove(begin, end - begin);
+                numEntries.fetch_sub(end - begin);
+                num_removed += end - begin;
+            }
+
+            bool more = chunk->has_high && (!to || chunk->high < *to);
+            if (more) {
+                cur = chunk->high;
+                has_cur = true;
+            }
+            mergeAndUnlock(chunk, cursor);
+            if (!more) break;
+        }
+        return num_removed;
+    }
+
+    // Set `itr` to the first entry after `key` (or at `key` if
+    // `inclusive`, or the first one if `key` is NULL), starting from
+    // the chunk of `cursor` (grabbed, or NULL to search) if it still
+    // covers `key`. `itr` becomes the end if there is no such entry.
+    void seekForward(iterator& itr,
+                     skiplist_node* cursor,
+                     const K* key,
+                     bool inclusive) {
+        bool has_bound = (key != nullptr);
+        K bound = has_bound ? *key : K();
+        Bound query;
+        for (;;) {
+            if (!cursor && has_bound) {
+                query.low = bound;
+                cursor = Engine::find_smaller_or_equal(&slist, &query.snode);
+            } else if (!cursor) {
+                cursor = Engine::begin(&slist);
+            }
+
+            Chunk* chunk = Chunk::get(cursor);
+            chunk->lock.lock();
+            bool valid = !chunk->dead &&
+                         ( has_bound ? chunk->covers(bound)
+                                     : chunk->bound.first );
+            if (!valid) {
+                chunk->lock.unlock();
+                skiplist_release_node(cursor);
+                cursor = nullptr;
+                std::this_thread::yield();
+                continue;
+            }
+
+            size_t pos = has_bound ? chunk->search(bound, !inclusive) : 0;
+            if (pos < chunk->count) {
+                itr.cursor = cursor;
+                itr.kv = T(chunk->keys[pos], chunk->values[pos]);
+                chunk->lock.unlock();
+                return;
+            }
+            if (!chunk->has_high) {
+                chunk->lock.unlock();
+                skiplist_release_node(cursor);
+                return;
+            }
+
+            // The next chunk, if it still begins at `high`.
+            bound = chunk->high;
+            has_bound = true;
+            inclusive = true;
+            chunk->lock.unlock();
+            skiplist_node* next = Engine::next(&slist, cursor);
+            skiplist_release_node(cursor);
+            cursor = next;
+        }
+    }
+
+    // Set `itr` to the last entry before `key` (or the last one if
+    // `key` is NULL), in the same way as `seekForward()`.
+    void seekBackward(iterator& itr,
+                      skiplist_node* cursor,
+                      const K* key) {
+        bool has_bound = (key != nullptr);
+        K bound = has_bound ? *key : K();
+        Bound query;
+        for (;;) {
+            if (!cursor && has_bound) {
+                query.low = bound;
+                cursor = Engine::find_smaller_or_equal(&slist, &query.snode);
+            } else if (!cursor) {
+                cursor = skiplist_end(&slist);
+            }
+
+            Chunk* chunk = Chunk::get(cursor);
+            chunk->lock.lock();
+            // Either the one covering `bound`, or the one right before.
+            bool valid = !chunk->dead &&
+                         ( has_bound ? ( chunk->covers(bound) ||
+                                         ( chunk->has_high &&
+                                           !(chunk->high < bound) &&
+                                           !(bound < chunk->high) ) )
+                                     : !chunk->has_high );
+            if (!valid) {
+                chunk->lock.unlock();
+                skiplist_release_node(cursor);
+                cursor = nullptr;
+                std::this_thread::yield();
+                continue;
+            }
+
+            size_t pos = has_bound ? chunk->search(bound, false)
+                                   : chunk->count;
+            if (pos > 0) {
+                itr.cursor = cursor;
+                itr.kv = T(chunk->keys[pos - 1], chunk->values[pos - 1]);
+                chunk->lock.unlock();
+                return;
+            }
+            if (chunk->bound.first) {
+                chunk->lock.unlock();
+                skiplist_release_node(cursor);
+                return;
+            }
+
+            bound = chunk->bound.low;
+            has_bound = true;
+            chunk->lock.unlock();
+            skiplist_node* prev = Engine::prev(&slist, cursor);
+            skiplist_release_node(cursor);
+            cursor = prev;
+        }
+    }
+
+    skiplist_raw slist;
+    std::atomic<size_t> numEntries;
+    // Merged chunks not freed yet, in `SKIPLIST_RECLAIM_REFCOUNT` mode.
+    std::vector<Chunk*> deadChunks;
+    std::mutex deadChunksLock;
+};
+
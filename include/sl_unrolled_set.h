@@ -0,0 +1,188 @@
+/**
+ * Copyright (C) 2017-present Jung-Sang Ahn <jungsang.ahn@gmail.com>
+ * All rights reserved.
+ *
+ * https://github.com/greensky00
+ *
+ * Skiplist unrolled set container
+ * Version: 0.2.0
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "sl_unrolled_map.h"
+
+#include <utility>
+#include <vector>
+
+// `sl_unrolled_map` without values, in the interface of `sl_set`.
+struct unrolled_set_none {};
+
+template<typename K, size_t N> class sl_unrolled_set;
+
+template<typename K, size_t N>
+class unrolled_set_iterator {
+    friend class sl_unrolled_set<K, N>;
+
+private:
+    using MapIterator = unrolled_map_iterator<K, unrolled_set_none, N>;
+
+public:
+    unrolled_set_iterator() {}
+
+    unrolled_set_iterator(unrolled_set_iterator&& src)
+        : itr(std::move(src.itr)) {}
+
+    void operator=(const unrolled_set_iterator& src) {
+        itr = src.itr;
+    }
+
+    bool operator==(const unrolled_set_iterator& src) const {
+        return itr == src.itr;
+    }
+    bool operator!=(const unrolled_set_iterator& src) const {
+        return itr != src.itr;
+    }
+
+    const K* operator->() const { return &itr->first; }
+    const K& operator*() const { return itr->first; }
+
+    // ++A
+    unrolled_set_iterator& operator++() {
+        ++itr;
+        return *this;
+    }
+    // A++
+    unrolled_set_iterator& operator++(int) { return operator++(); }
+    // --A
+    unrolled_set_iterator& operator--() {
+        --itr;
+        return *this;
+    }
+    // A--
+    unrolled_set_iterator& operator--(int) { return operator--(); }
+
+private:
+    unrolled_set_iterator(MapIterator&& _itr) : itr(std::move(_itr)) {}
+
+    MapIterator itr;
+};
+
+template<typename K, size_t N = 32>
+class sl_unrolled_set {
+private:
+    using Map = sl_unrolled_map<K, unrolled_set_none, N>;
+
+public:
+    using iterator = unrolled_set_iterator<K, N>;
+    using reverse_iterator = unrolled_set_iterator<K, N>;
+
+    sl_unrolled_set() {}
+
+    sl_unrolled_set(const skiplist_raw_config& config) : map(config) {}
+
+    // Build from `[first, last)` at once, duplicate keys are skipped.
+    template<typename InputIt>
+    sl_unrolled_set(InputIt first, InputIt last,
+                    const skiplist_raw_config& config =
+                        skiplist_get_default_config())
+        : sl_unrolled_set(toEntries(first, last), config) {}
+
+    bool empty() { return map.empty(); }
+
+    size_t size() { return map.size(); }
+
+    std::pair<iterator, bool> insert(const K& key) {
+        auto ret = map.insert(std::make_pair(key, unrolled_set_none()));
+        return std::pair<iterator, bool>( iterator(std::move(ret.first)),
+                                          ret.second );
+    }
+
+    // Duplicate keys (including the ones in the input) are skipped.
+    template<typename InputIt>
+    void insert(InputIt first, InputIt last) {
+        for (InputIt ii = first; ii != last; ++ii) insert(*ii);
+    }
+
+    iterator find(const K& key) {
+        return iterator(map.find(key));
+    }
+
+    // `find()` on each of `keys`, the results are in the same order.
+    std::vector<iterator> multi_find(const std::vector<K>& keys) {
+        std::vector<iterator> ret;
+        ret.reserve(keys.size());
+        for (size_t ii = 0; ii < keys.size(); ++ii) {
+            ret.push_back(find(keys[ii]));
+        }
+        return ret;
+    }
+
+    iterator erase(iterator& position) {
+        return iterator(map.erase(position.itr));
+    }
+
+    size_t erase(const K& key) {
+        return map.erase(key);
+    }
+
+    // Erase `[first, last)` at once, and return `last`.
+    iterator erase(iterator& first, const iterator& last) {
+        return iterator(map.erase(first.itr, last.itr));
+    }
+    iterator erase(iterator&& first, const iterator& last) {
+        return erase(first, last);
+    }
+
+    // Erase all keys smaller than `key`, and return the number of them.
+    size_t truncate_before(const K& key) {
+        return map.truncate_before(key);
+    }
+
+    iterator begin() { return iterator(map.begin()); }
+    iterator end() { return iterator(); }
+
+    reverse_iterator rbegin() { return reverse_iterator(map.rbegin()); }
+    reverse_iterator rend() { return reverse_iterator(); }
+
+private:
+    using Entries = std::vector<std::pair<K, unrolled_set_none>>;
+
+    sl_unrolled_set(const Entries& entries,
+                    const skiplist_raw_config& config)
+        : map(entries.begin(), entries.end(), config) {}
+
+    template<typename InputIt>
+    static Entries toEntries(InputIt first, InputIt last) {
+        Entries ret;
+        for (InputIt ii = first; ii != last; ++ii) {
+            ret.push_back(std::make_pair(*ii, unrolled_set_none()));
+        }
+        return ret;
+    }
+
+    Map map;
+};
+
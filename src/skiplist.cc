@@ -31,106 +31,439 @@
 
 #include "skiplist.h"
 
+// Keep internal macros (`ATM_*`, etc.) for this file.
+#define _SL_ENGINE_KEEP_MACROS (1)
+#include "sl_engine.h"
+
 #include <stdlib.h>
 
-#define __SLD_RT_INS(e, n, t, c)
-#define __SLD_NC_INS(n, nn, t, c)
-#define __SLD_RT_RMV(e, n, t, c)
-#define __SLD_NC_RMV(n, nn, t, c)
-#define __SLD_BM(n)
-#define __SLD_ASSERT(cond)
-#define __SLD_P(args...)
-#define __SLD_(b)
-
-//#define __SL_DEBUG (1)
-#ifdef __SL_DEBUG
-    #ifndef __cplusplus
-        #error "Debug mode is available with C++ compiler only."
-    #endif
-    #include "skiplist_debug.h"
-#endif
-
-#define __SL_YIELD (1)
-#ifdef __SL_YIELD
-    #ifdef __cplusplus
-        #include <thread>
-        #define YIELD() std::this_thread::yield()
-    #else
-        #include <sched.h>
-        #define YIELD() sched_yield()
-    #endif
-#else
-    #define YIELD()
-#endif
-
-#if defined(_STL_ATOMIC) && defined(__cplusplus)
-    // C++ (STL) atomic operations
-    #define MOR                         std::memory_order_relaxed
-    #define ATM_GET(var)                (var).load(MOR)
-    #define ATM_LOAD(var, val)          (val) = (var).load(MOR)
-    #define ATM_STORE(var, val)         (var).store((val), MOR)
-    #define ATM_CAS(var, exp, val)      (var).compare_exchange_weak((exp), (val))
-    #define ATM_FETCH_ADD(var, val)     (var).fetch_add(val, MOR)
-    #define ATM_FETCH_SUB(var, val)     (var).fetch_sub(val, MOR)
-    #define ALLOC_(type, var, count)    (var) = new type[count]
-    #define FREE_(var)                  delete[] (var)
-#else
-    // C-style atomic operations
-    #ifndef __cplusplus
-        typedef uint8_t bool;
-        #ifndef true
-            #define true 1
-        #endif
-        #ifndef false
-            #define false 0
-        #endif
-    #endif
-
-    #ifndef __cplusplus
-        #define thread_local /*_Thread_local*/
-    #endif
-
-    #define MOR                         __ATOMIC_RELAXED
-    #define ATM_GET(var)                (var)
-    #define ATM_LOAD(var, val)          __atomic_load(&(var), &(val), MOR)
-    #define ATM_STORE(var, val)         __atomic_store(&(var), &(val), MOR)
-    #define ATM_CAS(var, exp, val)      \
-            __atomic_compare_exchange(&(var), &(exp), &(val), 1, MOR, MOR)
-    #define ATM_FETCH_ADD(var, val)     __atomic_fetch_add(&(var), (val), MOR)
-    #define ATM_FETCH_SUB(var, val)     __atomic_fetch_sub(&(var), (val), MOR)
-    #define ALLOC_(type, var, count)    \
-            (var) = (type*)calloc(count, sizeof(type))
-    #define FREE_(var)                  free(var)
-#endif
-
-static inline void _sl_node_init(skiplist_node *node,
-                                 size_t top_layer)
+// ==== Memory reclamation: epoch / hazard pointer ====
+//
+// Each operation grabs a record (`in_use`), and clears it when done.
+// Retired nodes are kept in the limbo list of a record.
+//
+// Epoch mode:
+//   An operation announces the global epoch on its record, and retired
+//   nodes are tagged with the global epoch at the time of retiring.
+//   The global epoch moves forward only when all active records have
+//   announced the current one, so that once it advances twice, no reader
+//   can still see the nodes retired before.
+//
+// Hazard pointer mode:
+//   An operation publishes every node it is visiting in the hazard slots
+//   of its record, and then validates that the node is still reachable.
+//   Retired nodes are freed if they are not in any hazard slot, including
+//   the ones held by iterators (`skiplist_hazard`).
+//
+// Records are not bound to threads: a thread tries the one it used last
+// time, and scans the list (or adds a new one) if that is busy.
+//
+// Record and domain structures are in `sl_engine.h`,
+// as every operation of the engine touches them.
+
+struct _skiplist_hazard {
+    atm_node_ptr node;
+    atm_bool in_use;
+    struct _skiplist_hazard* next;
+};
+
+static atm_uint64_t _sl_reclaim_id_seq;
+
+static thread_local struct {
+    uint64_t id;
+    _sl_reclaim_rec* rec;
+} _sl_rec_hint;
+
+
+static struct _skiplist_reclaim* _sl_reclaim_create()
 {
-    if (top_layer > UINT8_MAX) top_layer = UINT8_MAX;
+    struct _skiplist_reclaim* rc;
+    ALLOC_(struct _skiplist_reclaim, rc, 1);
+    rc->id = ATM_FETCH_ADD(_sl_reclaim_id_seq, 1) + 1;
+
+    uint64_t epoch = 1;
+    ATM_STORE(rc->global_epoch, epoch);
+    _sl_reclaim_rec* head = NULL;
+    ATM_STORE(rc->recs, head);
+    skiplist_hazard* hazard_head = NULL;
+    ATM_STORE(rc->hazards, hazard_head);
+    return rc;
+}
 
-    __SLD_ASSERT(node->is_fully_linked == false);
-    __SLD_ASSERT(node->being_modified == false);
+static void _sl_reclaim_destroy(struct _skiplist_reclaim* rc)
+{
+    // No other thread is accessing the skiplist at this point,
+    // free all retired nodes regardless of epoch or hazards.
+    _sl_reclaim_rec* rec = NULL;
+    ATM_LOAD(rc->recs, rec);
+    while (rec) {
+        _sl_reclaim_rec* next = rec->next;
+        size_t ii;
+        for (ii = 0; ii < rec->num_limbo; ++ii) {
+            _sl_limbo_entry* entry = &rec->limbo[ii];
+            if (entry->free_func) entry->free_func(entry->node, entry->ctx);
+        }
+        if (rec->limbo) FREE_(rec->limbo);
+        FREE_(rec);
+        rec = next;
+    }
 
-    bool bool_val = false;
-    ATM_STORE(node->is_fully_linked, bool_val);
-    ATM_STORE(node->being_modified, bool_val);
-    ATM_STORE(node->removed, bool_val);
+    skiplist_hazard* hazard = NULL;
+    ATM_LOAD(rc->hazards, hazard);
+    while (hazard) {
+        skiplist_hazard* next = hazard->next;
+        FREE_(hazard);
+        hazard = next;
+    }
+    FREE_(rc);
+}
 
-    if (node->top_layer != top_layer ||
-        node->next == NULL) {
+_sl_reclaim_rec* _sl_rec_acquire(struct _skiplist_reclaim* rc)
+{
+    bool exp = false;
+    bool bool_true = true;
+    _sl_reclaim_rec* rec = NULL;
 
-        node->top_layer = top_layer;
+    // Fast path: the record that this thread used last time.
+    if (_sl_rec_hint.id == rc->id) {
+        rec = _sl_rec_hint.rec;
+        if (ATM_CAS(rec->in_use, exp, bool_true)) return rec;
+    }
 
-        if (node->next) FREE_(node->next);
-        ALLOC_(atm_node_ptr, node->next, top_layer+1);
+    _sl_reclaim_rec* head = NULL;
+    ATM_LOAD(rc->recs, head);
+    for (rec = head; rec; rec = rec->next) {
+        exp = false;
+        if (ATM_CAS(rec->in_use, exp, bool_true)) break;
     }
+
+    if (!rec) {
+        // All records are busy, add a new one.
+        ALLOC_(_sl_reclaim_rec, rec, 1);
+        uint64_t epoch = 0;
+        ATM_STORE(rec->epoch, epoch);
+        skiplist_node* null_node = NULL;
+        size_t ii;
+        for (ii = 0; ii < _SL_NUM_HAZARDS; ++ii) {
+            ATM_STORE(rec->hazards[ii], null_node);
+        }
+        ATM_STORE(rec->in_use, bool_true);
+        rec->saved = NULL;
+        rec->limbo = NULL;
+        rec->num_limbo = 0;
+        rec->limbo_size = 0;
+        rec->reclaim_at = _SL_LIMBO_THRESHOLD;
+        do {
+            ATM_LOAD(rc->recs, head);
+            rec->next = head;
+        } while (!ATM_CAS(rc->recs, head, rec));
+    }
+
+    _sl_rec_hint.id = rc->id;
+    _sl_rec_hint.rec = rec;
+    return rec;
+}
+
+static void _sl_epoch_try_advance(struct _skiplist_reclaim* rc)
+{
+    uint64_t epoch = 0, rec_epoch = 0;
+    ATM_FENCE();
+    ATM_LOAD(rc->global_epoch, epoch);
+
+    _sl_reclaim_rec* rec = NULL;
+    ATM_LOAD(rc->recs, rec);
+    for (; rec; rec = rec->next) {
+        ATM_LOAD(rec->epoch, rec_epoch);
+        // Someone is still in the previous epoch.
+        if (rec_epoch && rec_epoch != epoch) return;
+    }
+
+    uint64_t new_epoch = epoch + 1;
+    ATM_CAS(rc->global_epoch, epoch, new_epoch);
 }
 
+static size_t _sl_rec_reclaim_epoch(struct _skiplist_reclaim* rc,
+                                    _sl_reclaim_rec* rec)
+{
+    _sl_epoch_try_advance(rc);
+
+    uint64_t epoch = 0;
+    ATM_LOAD(rc->global_epoch, epoch);
+
+    size_t ii, num_left = 0, num_freed = 0;
+    for (ii = 0; ii < rec->num_limbo; ++ii) {
+        _sl_limbo_entry entry = rec->limbo[ii];
+        // Nodes grabbed by user (e.g., iterator) should stay.
+        if (entry.epoch + 2 <= epoch && skiplist_is_safe_to_free(entry.node)) {
+            if (entry.free_func) entry.free_func(entry.node, entry.ctx);
+            num_freed++;
+        } else {
+            rec->limbo[num_left++] = entry;
+        }
+    }
+    rec->num_limbo = num_left;
+    return num_freed;
+}
+
+typedef struct {
+    skiplist_node** arr;
+    size_t num;
+    size_t size;
+} _sl_hp_snapshot;
+
+static void _sl_hp_snapshot_add(_sl_hp_snapshot* ss,
+                                skiplist_node* node)
+{
+    if (!node) return;
+    if (ss->num == ss->size) {
+        size_t new_size = ss->size ? ss->size * 2 : _SL_NUM_HAZARDS * 4;
+        skiplist_node** new_arr;
+        ALLOC_(skiplist_node*, new_arr, new_size);
+        size_t ii;
+        for (ii = 0; ii < ss->num; ++ii) new_arr[ii] = ss->arr[ii];
+        if (ss->arr) FREE_(ss->arr);
+        ss->arr = new_arr;
+        ss->size = new_size;
+    }
+    ss->arr[ss->num++] = node;
+}
+
+static int _sl_ptr_cmp(const void* a, const void* b)
+{
+    uintptr_t aa = (uintptr_t)*(skiplist_node* const*)a;
+    uintptr_t bb = (uintptr_t)*(skiplist_node* const*)b;
+    return (aa > bb) - (aa < bb);
+}
+
+static size_t _sl_rec_reclaim_hazard(struct _skiplist_reclaim* rc,
+                                     _sl_reclaim_rec* rec)
+{
+    // A node moves between `ref_count` and hazard slots (e.g., API result
+    // or iterator), by setting the new one before clearing the old one.
+    // Checking `ref_count` both before and after scanning hazard slots
+    // will catch it in either direction.
+    size_t ii, num_left = 0, num_freed = 0;
+    for (ii = 0; ii < rec->num_limbo; ++ii) {
+        if (!skiplist_is_safe_to_free(rec->limbo[ii].node)) {
+            _sl_limbo_entry temp = rec->limbo[num_left];
+            rec->limbo[num_left++] = rec->limbo[ii];
+            rec->limbo[ii] = temp;
+        }
+    }
+    if (num_left == rec->num_limbo) return 0;
+
+    ATM_FENCE();
+    _sl_hp_snapshot ss = {NULL, 0, 0};
+    skiplist_node* node = NULL;
+
+    // Operations hand nodes over to iterators, not the other way around.
+    // Scan operations first, so as not to miss the node in the middle.
+    _sl_reclaim_rec* cur_rec = NULL;
+    ATM_LOAD(rc->recs, cur_rec);
+    for (; cur_rec; cur_rec = cur_rec->next) {
+        for (ii = 0; ii < _SL_NUM_HAZARDS; ++ii) {
+            ATM_LOAD(cur_rec->hazards[ii], node);
+            _sl_hp_snapshot_add(&ss, node);
+        }
+    }
+    ATM_FENCE();
+    skiplist_hazard* hazard = NULL;
+    ATM_LOAD(rc->hazards, hazard);
+    for (; hazard; hazard = hazard->next) {
+        ATM_LOAD(hazard->node, node);
+        _sl_hp_snapshot_add(&ss, node);
+    }
+    ATM_FENCE();
+    if (ss.num) qsort(ss.arr, ss.num, sizeof(skiplist_node*), _sl_ptr_cmp);
+
+    for (ii = num_left; ii < rec->num_limbo; ++ii) {
+        _sl_limbo_entry entry = rec->limbo[ii];
+        bool hazardous = ss.num &&
+                         bsearch(&entry.node, ss.arr, ss.num,
+                                 sizeof(skiplist_node*), _sl_ptr_cmp);
+        if (!hazardous && skiplist_is_safe_to_free(entry.node)) {
+            if (entry.free_func) entry.free_func(entry.node, entry.ctx);
+            num_freed++;
+        } else {
+            rec->limbo[num_left++] = entry;
+        }
+    }
+    rec->num_limbo = num_left;
+    if (ss.arr) FREE_(ss.arr);
+    return num_freed;
+}
+
+// Free limbo entries of `rec` that no reader can access.
+// Caller should own `rec`.
+static size_t _sl_rec_reclaim(skiplist_raw* slist,
+                              _sl_reclaim_rec* rec)
+{
+    size_t num_freed = 0;
+    if (slist->reclaim_mode == SKIPLIST_RECLAIM_HAZARD) {
+        num_freed = _sl_rec_reclaim_hazard(slist->reclaim, rec);
+    } else {
+        num_freed = _sl_rec_reclaim_epoch(slist->reclaim, rec);
+    }
+
+    // If nodes are held by a slow reader, they will not be freed soon.
+    // Defer the next attempt not to re-scan them on every retire.
+    rec->reclaim_at = rec->num_limbo * 2;
+    if (rec->reclaim_at < _SL_LIMBO_THRESHOLD) {
+        rec->reclaim_at = _SL_LIMBO_THRESHOLD;
+    }
+    return num_freed;
+}
+
+// ==== Versions ====
+//
+// Every write of a versioned skiplist gets a sequence number, and they
+// become visible in the order of the numbers (`visible_seq`). A snapshot
+// is the visible sequence number at the time, which is published in a
+// slot and then validated, in the same way as hazard pointers: a writer
+// publishes its number and then scans the slots, so that either side
+// sees the other.
+//
+// An erased node older than all snapshots is unlinked right away.
+// Otherwise, it is kept in the list until `skiplist_retire_node()`
+// (or releasing a snapshot) finds that no snapshot can see it. Once
+// unlinked, a node still referenced by a reader is deferred to a later
+// purge, rather than waiting for the reader, which can be the caller.
+
+static struct _skiplist_versions* _sl_versions_create()
+{
+    struct _skiplist_versions* vs;
+    ALLOC_(struct _skiplist_versions, vs, 1);
+    uint64_t zero = 0;
+    ATM_STORE(vs->last_seq, zero);
+    ATM_STORE(vs->visible_seq, zero);
+    _sl_snapshot_slot* null_slot = NULL;
+    ATM_STORE(vs->snapshots, null_slot);
+    bool bool_false = false;
+    ATM_STORE(vs->pending_lock, bool_false);
+    vs->pending_head = NULL;
+    vs->pending_tail = NULL;
+    _sl_version_entry* null_entry = NULL;
+    ATM_STORE(vs->deferred, null_entry);
+    return vs;
+}
+
+static void _sl_version_free_chain(_sl_version_entry* entry)
+{
+    while (entry) {
+        _sl_version_entry* next = entry->next;
+        if (entry->free_func) entry->free_func(entry->node, entry->ctx);
+        FREE_(entry);
+        entry = next;
+    }
+}
+
+static void _sl_versions_destroy(struct _skiplist_versions* vs)
+{
+    // The skiplist is being destroyed, nobody sees the erased nodes.
+    _sl_version_free_chain(vs->pending_head);
+    _sl_version_entry* entry = NULL;
+    ATM_LOAD(vs->deferred, entry);
+    _sl_version_free_chain(entry);
+
+    _sl_snapshot_slot* slot = NULL;
+    ATM_LOAD(vs->snapshots, slot);
+    while (slot) {
+        _sl_snapshot_slot* next = slot->next;
+        FREE_(slot);
+        slot = next;
+    }
+    FREE_(vs);
+}
+
+static void _sl_pending_lock(struct _skiplist_versions* vs)
+{
+    for (;;) {
+        bool exp = false;
+        bool bool_true = true;
+        if (ATM_CAS(vs->pending_lock, exp, bool_true)) break;
+        YIELD();
+    }
+    ATM_FENCE();
+}
+
+static void _sl_pending_unlock(struct _skiplist_versions* vs)
+{
+    bool bool_false = false;
+    ATM_STORE_REL(vs->pending_lock, bool_false);
+}
+
+// Put `entry` in the pending list, in the order of `erase_seq`.
+static void _sl_version_add(struct _skiplist_versions* vs,
+                            _sl_version_entry* entry)
+{
+    _sl_pending_lock(vs);
+    _sl_version_entry* prev = vs->pending_tail;
+    while (prev && prev->erase_seq > entry->erase_seq) prev = prev->prev;
+    entry->prev = prev;
+    entry->next = prev ? prev->next : vs->pending_head;
+    if (entry->next) entry->next->prev = entry;
+    else vs->pending_tail = entry;
+    if (prev) prev->next = entry;
+    else vs->pending_head = entry;
+    _sl_pending_unlock(vs);
+}
+
+// Detach the entries no snapshot can see any more, up to `oldest`.
+static _sl_version_entry* _sl_version_take(struct _skiplist_versions* vs,
+                                           uint64_t oldest)
+{
+    _sl_pending_lock(vs);
+    _sl_version_entry* ret = vs->pending_head;
+    _sl_version_entry* last = NULL;
+    _sl_version_entry* entry = ret;
+    while (entry && entry->erase_seq <= oldest) {
+        last = entry;
+        entry = entry->next;
+    }
+    if (!last) {
+        ret = NULL;
+    } else {
+        last->next = NULL;
+        vs->pending_head = entry;
+        if (entry) entry->prev = NULL;
+        else vs->pending_tail = NULL;
+    }
+    _sl_pending_unlock(vs);
+    return ret;
+}
+
+static void _sl_version_defer(struct _skiplist_versions* vs,
+                              _sl_version_entry* entry)
+{
+    _sl_version_entry* head = NULL;
+    do {
+        ATM_LOAD(vs->deferred, head);
+        entry->next = head;
+    } while (!ATM_CAS(vs->deferred, head, entry));
+}
+
+static size_t _sl_purge_versions(skiplist_raw* slist);
+
 void skiplist_init(skiplist_raw *slist,
                    skiplist_cmp_t *cmp_func) {
 
     slist->cmp_func = NULL;
     slist->aux = NULL;
+    slist->reclaim_mode = SKIPLIST_RECLAIM_REFCOUNT;
+    slist->sync_mode = SKIPLIST_SYNC_LOCK;
+    slist->wait_mode = SKIPLIST_WAIT_YIELD;
+    slist->backward_links = 0;
+    slist->indexable = 0;
+    slist->index_seq = 0;
+    slist->versioned = 0;
+    slist->versions = NULL;
+    slist->prefetch_depth = 0;
+    slist->search_prefetch = 1;
+    slist->huge_pages = 0;
+    slist->reclaim = NULL;
+    slist->level_gen = skiplist_level_gen_fast;
+    slist->hash_func = NULL;
+    slist->level_seed = 0;
 
     // fanout 4 + layer 12: 4^12 ~= upto 17M items under O(lg n) complexity.
     // for +17M items, complexity will grow linearly: O(k lg n).
@@ -138,34 +471,53 @@ void skiplist_init(skiplist_raw *slist,
     slist->max_layer = 12;
     slist->num_entries = 0;
 
+    size_t ii;
+    ALLOC_(struct _skiplist_size_shard, slist->size_shards, _SL_SIZE_SHARDS);
+    for (ii = 0; ii < _SL_SIZE_SHARDS; ++ii) {
+        slist->size_shards[ii].delta = 0;
+    }
     ALLOC_(atm_uint32_t, slist->layer_entries, slist->max_layer);
+    for (ii = 0; ii < slist->max_layer; ++ii) slist->layer_entries[ii] = 0;
     slist->top_layer = 0;
 
     skiplist_init_node(&slist->head);
     skiplist_init_node(&slist->tail);
 
-    _sl_node_init(&slist->head, slist->max_layer);
-    _sl_node_init(&slist->tail, slist->max_layer);
+    _sl_node_init(&slist->head, slist->max_layer, _SL_EXT_SLOTS_MAX);
+    _sl_node_init(&slist->tail, slist->max_layer, _SL_EXT_SLOTS_MAX);
 
     size_t layer;
+    uint32_t span = 1;
     for (layer = 0; layer < slist->max_layer; ++layer) {
         slist->head.next[layer] = &slist->tail;
         slist->tail.next[layer] = NULL;
+        ATM_STORE(_sl_span(&slist->head)[layer], span);
     }
+    _sl_prev_ptr(&slist->tail) = &slist->head;
 
-    bool bool_val = true;
-    ATM_STORE(slist->head.is_fully_linked, bool_val);
-    ATM_STORE(slist->tail.is_fully_linked, bool_val);
+    _sl_set_state(&slist->head, _SL_ST_LINKED, true);
+    _sl_set_state(&slist->tail, _SL_ST_LINKED, true);
     slist->cmp_func = cmp_func;
 }
 
 void skiplist_free(skiplist_raw *slist)
 {
+    if (slist->reclaim) {
+        _sl_reclaim_destroy(slist->reclaim);
+        slist->reclaim = NULL;
+    }
+    if (slist->versions) {
+        _sl_versions_destroy(slist->versions);
+        slist->versions = NULL;
+    }
+
     skiplist_free_node(&slist->head);
     skiplist_free_node(&slist->tail);
 
     FREE_(slist->layer_entries);
     slist->layer_entries = NULL;
+    FREE_(slist->size_shards);
+    slist->size_shards = NULL;
 
     slist->aux = NULL;
     slist->cmp_func = NULL;
@@ -175,25 +527,63 @@ void skiplist_init_node(skiplist_node *node)
 {
     node->next = NULL;
 
-    bool bool_false = false;
-    ATM_STORE(node->is_fully_linked, bool_false);
-    ATM_STORE(node->being_modified, bool_false);
-    ATM_STORE(node->removed, bool_false);
-
-    node->accessing_next = 0;
-    node->top_layer = 0;
-    node->ref_count = 0;
+    uint64_t state = 0;
+    ATM_STORE(node->state, state);
 }
 
 void skiplist_free_node(skiplist_node *node)
 {
+    if (_sl_tower_size(node)) return;
     FREE_(node->next);
     node->next = NULL;
 }
 
+// Tower starts at pointer-aligned offset after the struct.
+static inline size_t _sl_tower_offset(size_t struct_size)
+{
+    size_t align = sizeof(atm_node_ptr);
+    return (struct_size + align - 1) / align * align;
+}
+
+size_t skiplist_inline_node_size(skiplist_raw* slist,
+                                 size_t struct_size,
+                                 size_t top_layer)
+{
+    if (top_layer >= SKIPLIST_MAX_LAYER) top_layer = SKIPLIST_MAX_LAYER - 1;
+    return _sl_tower_offset(struct_size) +
+           ( _sl_tower_slots(top_layer + 1) + _sl_ext_slots(slist) ) *
+           sizeof(atm_node_ptr);
+}
+
+void skiplist_init_node_inline(skiplist_node* node,
+                               void* mem,
+                               size_t struct_size,
+                               size_t top_layer)
+{
+    skiplist_init_node(node);
+    if (top_layer >= SKIPLIST_MAX_LAYER) top_layer = SKIPLIST_MAX_LAYER - 1;
+    node->next = (atm_node_ptr*)
+                 ((uint8_t*)mem + _sl_tower_offset(struct_size));
+    _sl_set_layers(node, top_layer, top_layer + 1);
+}
+
 size_t skiplist_get_size(skiplist_raw* slist) {
-    uint32_t val;
+    uint64_t val = 0, delta = 0;
+    ATM_LOAD(slist->num_entries, val);
+    size_t ii;
+    for (ii = 0; ii < _SL_SIZE_SHARDS; ++ii) {
+        ATM_LOAD(slist->size_shards[ii].delta, delta);
+        val += delta;
+    }
+    // Can be negative for a moment, while a shard is being flushed.
+    if ((int64_t)val < 0) return 0;
+    return val;
+}
+
+size_t skiplist_get_size_approx(skiplist_raw* slist) {
+    uint64_t val = 0;
     ATM_LOAD(slist->num_entries, val);
+    if ((int64_t)val < 0) return 0;
     return val;
 }
 
@@ -203,6 +593,18 @@ skiplist_raw_config skiplist_get_default_config()
     ret.fanout = 4;
     ret.maxLayer = 12;
     ret.aux = NULL;
+    ret.reclaimMode = SKIPLIST_RECLAIM_REFCOUNT;
+    ret.levelGen = NULL;
+    ret.hashFunc = NULL;
+    ret.levelSeed = 0;
+    ret.syncMode = SKIPLIST_SYNC_LOCK;
+    ret.waitMode = SKIPLIST_WAIT_YIELD;
+    ret.backwardLinks = 0;
+    ret.indexable = 0;
+    ret.versioned = 0;
+    ret.prefetchDepth = 0;
+    ret.searchPrefetch = 1;
+    ret.hugePages = 0;
     return ret;
 }
 
@@ -212,165 +614,138 @@ skiplist_raw_config skiplist_get_config(skiplist_raw *slist)
     ret.fanout = slist->fanout;
     ret.maxLayer = slist->max_layer;
     ret.aux = slist->aux;
+    ret.reclaimMode = (skiplist_reclaim_mode)slist->reclaim_mode;
+    ret.levelGen = slist->level_gen;
+    ret.hashFunc = slist->hash_func;
+    ret.levelSeed = slist->level_seed;
+    ret.syncMode = (skiplist_sync_mode)slist->sync_mode;
+    ret.waitMode = (skiplist_wait_mode)slist->wait_mode;
+    ret.backwardLinks = slist->backward_links;
+    ret.indexable = slist->indexable;
+    ret.versioned = slist->versioned;
+    ret.prefetchDepth = slist->prefetch_depth;
+    ret.searchPrefetch = slist->search_prefetch;
+    ret.hugePages = slist->huge_pages;
     return ret;
 }
 
-void skiplist_set_config(skiplist_raw *slist,
-                         skiplist_raw_config config)
+void skiplist_set_prefetch(skiplist_raw *slist,
+                           int prefetch_depth,
+                           int search_prefetch)
 {
-    slist->fanout = config.fanout;
-
-    slist->max_layer = config.maxLayer;
-    if (slist->layer_entries) FREE_(slist->layer_entries);
-    ALLOC_(atm_uint32_t, slist->layer_entries, slist->max_layer);
-
-    slist->aux = config.aux;
+    if (prefetch_depth < 0) prefetch_depth = 0;
+    if (prefetch_depth > 255) prefetch_depth = 255;
+    slist->prefetch_depth = prefetch_depth;
+    slist->search_prefetch = search_prefetch ? 1 : 0;
 }
 
-static inline int _sl_cmp(skiplist_raw *slist,
-                          skiplist_node *a,
-                          skiplist_node *b)
+void skiplist_set_config(skiplist_raw *slist,
+                         skiplist_raw_config config)
 {
-    if (a == b) return 0;
-    if (a == &slist->head || b == &slist->tail) return -1;
-    if (a == &slist->tail || b == &slist->head) return 1;
-    return slist->cmp_func(a, b, slist->aux);
-}
-
-static inline bool _sl_valid_node(skiplist_node *node) {
-    bool is_fully_linked = false;
-    ATM_LOAD(node->is_fully_linked, is_fully_linked);
-    return is_fully_linked;
-}
+    slist->fanout = config.fanout;
 
-static inline void _sl_read_lock_an(skiplist_node* node) {
-    for(;;) {
-        // Wait for active writer to release the lock
-        uint32_t accessing_next = 0;
-        ATM_LOAD(node->accessing_next, accessing_next);
-        while (accessing_next & 0xfff00000) {
-            YIELD();
-            ATM_LOAD(node->accessing_next, accessing_next);
+    if (config.maxLayer > SKIPLIST_MAX_LAYER) {
+        config.maxLayer = SKIPLIST_MAX_LAYER;
+    }
+    if (slist->max_layer != config.maxLayer) {
+        // Head and tail should span all layers.
+        slist->max_layer = config.maxLayer;
+        _sl_node_init(&slist->head, slist->max_layer, _SL_EXT_SLOTS_MAX);
+        _sl_node_init(&slist->tail, slist->max_layer, _SL_EXT_SLOTS_MAX);
+        size_t layer;
+        uint32_t span = 1;
+        for (layer = 0; layer < slist->max_layer; ++layer) {
+            slist->head.next[layer] = &slist->tail;
+            slist->tail.next[layer] = NULL;
+            ATM_STORE(_sl_span(&slist->head)[layer], span);
         }
-
-        ATM_FETCH_ADD(node->accessing_next, 0x1);
-        ATM_LOAD(node->accessing_next, accessing_next);
-        if ((accessing_next & 0xfff00000) == 0) {
-            return;
+        _sl_prev_ptr(&slist->tail) = &slist->head;
+        _sl_set_state(&slist->head, _SL_ST_LINKED, true);
+        _sl_set_state(&slist->tail, _SL_ST_LINKED, true);
+
+        // `top_layer` is maintained from these counts, so they are
+        // kept as long as the layers stay the same.
+        if (slist->layer_entries) FREE_(slist->layer_entries);
+        ALLOC_(atm_uint32_t, slist->layer_entries, slist->max_layer);
+        for (layer = 0; layer < slist->max_layer; ++layer) {
+            slist->layer_entries[layer] = 0;
         }
-
-        ATM_FETCH_SUB(node->accessing_next, 0x1);
+        slist->top_layer = 0;
     }
-}
-
-static inline void _sl_read_unlock_an(skiplist_node* node) {
-    ATM_FETCH_SUB(node->accessing_next, 0x1);
-}
 
-static inline void _sl_write_lock_an(skiplist_node* node) {
-    for(;;) {
-        // Wait for active writer to release the lock
-        uint32_t accessing_next = 0;
-        ATM_LOAD(node->accessing_next, accessing_next);
-        while (accessing_next & 0xfff00000) {
-            YIELD();
-            ATM_LOAD(node->accessing_next, accessing_next);
+    slist->aux = config.aux;
+    slist->level_gen = config.levelGen ? config.levelGen
+                                       : skiplist_level_gen_fast;
+    slist->hash_func = config.hashFunc;
+    slist->level_seed = config.levelSeed;
+    slist->wait_mode = config.waitMode;
+    skiplist_set_prefetch(slist, config.prefetchDepth, config.searchPrefetch);
+    slist->huge_pages = config.hugePages ? 1 : 0;
+
+    if (slist->reclaim_mode != config.reclaimMode) {
+        if (slist->reclaim) {
+            _sl_reclaim_destroy(slist->reclaim);
+            slist->reclaim = NULL;
         }
-
-        ATM_FETCH_ADD(node->accessing_next, 0x100000);
-        ATM_LOAD(node->accessing_next, accessing_next);
-        if((accessing_next & 0xfff00000) == 0x100000) {
-            // Wait until there's no more readers
-            while (accessing_next & 0x000fffff) {
-                YIELD();
-                ATM_LOAD(node->accessing_next, accessing_next);
-            }
-            return;
+        if ( config.reclaimMode == SKIPLIST_RECLAIM_EPOCH ||
+             config.reclaimMode == SKIPLIST_RECLAIM_HAZARD ) {
+            slist->reclaim = _sl_reclaim_create();
         }
+        slist->reclaim_mode = config.reclaimMode;
+    }
 
-        ATM_FETCH_SUB(node->accessing_next, 0x100000);
+    slist->sync_mode = SKIPLIST_SYNC_LOCK;
+    if ( config.syncMode == SKIPLIST_SYNC_LOCK_FREE &&
+         ( slist->reclaim_mode == SKIPLIST_RECLAIM_EPOCH ||
+           slist->reclaim_mode == SKIPLIST_RECLAIM_NONE ) ) {
+        slist->sync_mode = SKIPLIST_SYNC_LOCK_FREE;
+    }
+    // Lock-free writers cannot update both links at once.
+    slist->backward_links = (config.backwardLinks &&
+                             slist->sync_mode == SKIPLIST_SYNC_LOCK);
+    // Spans are updated under the sequence lock of writers.
+    slist->indexable = (config.indexable &&
+                        slist->sync_mode == SKIPLIST_SYNC_LOCK);
+    // Versions of the same key are ordered by the time of insert,
+    // which lock-free writers do not keep.
+    slist->versioned = (config.versioned &&
+                        slist->sync_mode == SKIPLIST_SYNC_LOCK);
+    if (slist->versioned && !slist->versions) {
+        slist->versions = _sl_versions_create();
     }
 }
 
-static inline void _sl_write_unlock_an(skiplist_node* node) {
-    ATM_FETCH_SUB(node->accessing_next, 0x100000);
+// Number of bits per layer if `fanout` is a power of 2, or 0.
+static inline int _sl_fanout_bits(skiplist_raw *slist)
+{
+    size_t fanout = slist->fanout;
+    if (fanout < 2 || (fanout & (fanout - 1))) return 0;
+    return __builtin_ctzll(fanout);
 }
 
-// Note: it increases the `ref_count` of returned node.
-//       Caller is responsible to decrease it.
-static inline skiplist_node* _sl_next(skiplist_raw* slist,
-                                      skiplist_node* cur_node,
-                                      int layer,
-                                      skiplist_node* node_to_find,
-                                      bool* found)
+static inline uint64_t _sl_mix64(uint64_t x)
 {
-    skiplist_node *next_node = NULL;
-
-    // Turn on `accessing_next`:
-    // now `cur_node` is not removable from skiplist,
-    // which means that `cur_node->next` will be consistent
-    // until clearing `accessing_next`.
-    _sl_read_lock_an(cur_node); {
-        if (!_sl_valid_node(cur_node)) {
-            _sl_read_unlock_an(cur_node);
-            return NULL;
-        }
-        ATM_LOAD(cur_node->next[layer], next_node);
-        // Increase ref count of `next_node`:
-        // now `next_node` is not destroyable.
-
-        //   << Remaining issue >>
-        // 1) initially: A -> B
-        // 2) T1: call _sl_next(A):
-        //        A.accessing_next := true;
-        //        next_node := B;
-        // ----- context switch happens here -----
-        // 3) T2: insert C:
-        //        A -> C -> B
-        // 4) T2: and then erase B, and free B.
-        //        A -> C    B(freed)
-        // ----- context switch back again -----
-        // 5) T1: try to do something with B,
-        //        but crash happens.
-        //
-        // ... maybe resolved using RW spinlock (Aug 21, 2017).
-        __SLD_ASSERT(next_node);
-        ATM_FETCH_ADD(next_node->ref_count, 1);
-        __SLD_ASSERT(next_node->top_layer >= layer);
-    } _sl_read_unlock_an(cur_node);
-
-    size_t num_nodes = 0;
-    skiplist_node* nodes[256];
-
-    while ( (next_node && !_sl_valid_node(next_node)) ||
-             next_node == node_to_find ) {
-        if (found && node_to_find == next_node) *found = true;
-
-        skiplist_node* temp = next_node;
-        _sl_read_lock_an(temp); {
-            __SLD_ASSERT(next_node);
-            if (!_sl_valid_node(temp)) {
-                _sl_read_unlock_an(temp);
-                ATM_FETCH_SUB(temp->ref_count, 1);
-                next_node = NULL;
-                break;
-            }
-            ATM_LOAD(temp->next[layer], next_node);
-            ATM_FETCH_ADD(next_node->ref_count, 1);
-            nodes[num_nodes++] = temp;
-            __SLD_ASSERT(next_node->top_layer >= layer);
-        } _sl_read_unlock_an(temp);
-    }
-
-    for (size_t ii=0; ii<num_nodes; ++ii) {
-        ATM_FETCH_SUB(nodes[ii]->ref_count, 1);
-    }
+    // splitmix64 finalizer.
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
 
-    return next_node;
+// Top layer from random bits `r`: each layer consumes `log2(fanout)` bits,
+// and grows only if all of them are zero: 1/fanout probability.
+static inline size_t _sl_layer_from_bits(skiplist_raw *slist,
+                                         uint64_t r,
+                                         int bits)
+{
+    if (!r) return slist->max_layer;
+    return __builtin_ctzll(r) / bits;
 }
 
-static inline size_t _sl_decide_top_layer(skiplist_raw *slist)
+size_t skiplist_level_gen_rand(skiplist_raw* slist,
+                               skiplist_node* node)
 {
+    (void)node;
     size_t layer = 0;
     while (layer+1 < slist->max_layer) {
         // coin filp
@@ -385,571 +760,566 @@ static inline size_t _sl_decide_top_layer(skiplist_raw *slist)
     return layer;
 }
 
-static inline void _sl_clr_flags(skiplist_node** node_arr,
-                                 int start_layer,
-                                 int top_layer)
-{
-    int layer;
-    for (layer = start_layer; layer <= top_layer; ++layer) {
-        if ( layer == top_layer ||
-             node_arr[layer] != node_arr[layer+1] ) {
+// Shared by all skiplists of the thread, hence not seeded by any
+// `level_seed`: threads are told apart by the order of their first calls.
+static thread_local uint64_t _sl_xs_state;
+static atm_uint64_t _sl_xs_thread_seq;
 
-            bool exp = true;
-            bool bool_false = false;
-            if (!ATM_CAS(node_arr[layer]->being_modified, exp, bool_false)) {
-                __SLD_ASSERT(0);
-            }
-        }
+static inline uint64_t _sl_xorshift()
+{
+    uint64_t x = _sl_xs_state;
+    if (!x) {
+        // First call of this thread.
+        uint64_t seq = ATM_FETCH_ADD(_sl_xs_thread_seq, 1);
+        x = _sl_mix64(seq);
+        if (!x) x = 1;
     }
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    _sl_xs_state = x;
+    return x;
 }
 
-static inline bool _sl_valid_prev_next(skiplist_node *prev,
-                                       skiplist_node *next) {
-    return _sl_valid_node(prev) && _sl_valid_node(next);
-}
-
-static inline int _skiplist_insert(skiplist_raw *slist,
-                                   skiplist_node *node,
-                                   bool no_dup)
+size_t skiplist_level_gen_fast(skiplist_raw* slist,
+                               skiplist_node* node)
 {
-    __SLD_(
-        thread_local std::thread::id tid = std::this_thread::get_id();
-        thread_local size_t tid_hash = std::hash<std::thread::id>{}(tid) % 256;
-        (void)tid_hash;
-    )
-
-    int top_layer = _sl_decide_top_layer(slist);
-    bool bool_true = true;
-
-    // init node before insertion
-    _sl_node_init(node, top_layer);
-    _sl_write_lock_an(node);
-
-    skiplist_node* prevs[SKIPLIST_MAX_LAYER];
-    skiplist_node* nexts[SKIPLIST_MAX_LAYER];
-
-    __SLD_P("%02x ins %p begin\n", (int)tid_hash, node);
-
-insert_retry:
-    // in pure C, a label can only be part of a stmt.
-    (void)top_layer;
-
-    int cmp = 0, cur_layer = 0, layer;
-    skiplist_node *cur_node = &slist->head;
-    ATM_FETCH_ADD(cur_node->ref_count, 1);
-
-    __SLD_(size_t nh = 0);
-    __SLD_(thread_local skiplist_node* history[1024]; (void)history);
-
-    int sl_top_layer = slist->top_layer;
-    if (top_layer > sl_top_layer) sl_top_layer = top_layer;
-    for (cur_layer = sl_top_layer; cur_layer >= 0; --cur_layer) {
-        do {
-            __SLD_( history[nh++] = cur_node );
-
-            skiplist_node *next_node = _sl_next(slist, cur_node, cur_layer,
-                                                NULL, NULL);
-            if (!next_node) {
-                _sl_clr_flags(prevs, cur_layer+1, top_layer);
-                ATM_FETCH_SUB(cur_node->ref_count, 1);
-                YIELD();
-                goto insert_retry;
-            }
-            cmp = _sl_cmp(slist, node, next_node);
-            if (cmp > 0) {
-                // cur_node < next_node < node
-                // => move to next node
-                skiplist_node* temp = cur_node;
-                cur_node = next_node;
-                ATM_FETCH_SUB(temp->ref_count, 1);
-                continue;
-            } else {
-                // otherwise: cur_node < node <= next_node
-                ATM_FETCH_SUB(next_node->ref_count, 1);
-            }
-
-            if (no_dup && cmp == 0) {
-                // Duplicate key is not allowed.
-                _sl_clr_flags(prevs, cur_layer+1, top_layer);
-                ATM_FETCH_SUB(cur_node->ref_count, 1);
-                return -1;
-            }
+    (void)node;
+    int bits = _sl_fanout_bits(slist);
+    if (bits) return _sl_layer_from_bits(slist, _sl_xorshift(), bits);
 
-            if (cur_layer <= top_layer) {
-                prevs[cur_layer] = cur_node;
-                nexts[cur_layer] = next_node;
-                // both 'prev' and 'next' should be fully linked before
-                // insertion, and no other thread should not modify 'prev'
-                // at the same time.
-
-                int error_code = 0;
-                int locked_layer = cur_layer + 1;
-
-                // check if prev node is duplicated with upper layer
-                if (cur_layer < top_layer &&
-                    prevs[cur_layer] == prevs[cur_layer+1]) {
-                    // duplicate
-                    // => which means that 'being_modified' flag is already true
-                    // => do nothing
-                } else {
-                    bool expected = false;
-                    if (ATM_CAS(prevs[cur_layer]->being_modified,
-                                expected, bool_true)) {
-                        locked_layer = cur_layer;
-                    } else {
-                        error_code = -1;
-                    }
-                }
-
-                if (error_code == 0 &&
-                    !_sl_valid_prev_next(prevs[cur_layer], nexts[cur_layer])) {
-                    error_code = -2;
-                }
-
-                if (error_code != 0) {
-                    __SLD_RT_INS(error_code, node, top_layer, cur_layer);
-                    _sl_clr_flags(prevs, locked_layer, top_layer);
-                    ATM_FETCH_SUB(cur_node->ref_count, 1);
-                    YIELD();
-                    goto insert_retry;
-                }
-
-                // set current node's pointers
-                ATM_STORE(node->next[cur_layer], nexts[cur_layer]);
-
-                // check if `cur_node->next` has been changed from `next_node`.
-                skiplist_node* next_node_again =
-                    _sl_next(slist, cur_node, cur_layer, NULL, NULL);
-                ATM_FETCH_SUB(next_node_again->ref_count, 1);
-                if (next_node_again != next_node) {
-                    __SLD_NC_INS(cur_node, next_node, top_layer, cur_layer);
-                    // clear including the current layer
-                    // as we already set modification flag above.
-                    _sl_clr_flags(prevs, cur_layer, top_layer);
-                    ATM_FETCH_SUB(cur_node->ref_count, 1);
-                    YIELD();
-                    goto insert_retry;
-                }
-            }
-
-            if (cur_layer) {
-                // non-bottom layer => go down
-                break;
-            }
+    size_t layer = 0;
+    while ( layer+1 < slist->max_layer &&
+            _sl_xorshift() % slist->fanout == 0 ) {
+        layer++;
+    }
+    return layer;
+}
 
-            // bottom layer => insertion succeeded
-            // change prev/next nodes' prev/next pointers from 0 ~ top_layer
-            for (layer = 0; layer <= top_layer; ++layer) {
-                // `accessing_next` works as a spin-lock.
-                _sl_write_lock_an(prevs[layer]);
-                skiplist_node* exp = nexts[layer];
-                if ( !ATM_CAS(prevs[layer]->next[layer], exp, node) ) {
-                    __SLD_P("%02x ASSERT ins %p[%d] -> %p (expected %p)\n",
-                            (int)tid_hash, prevs[layer], cur_layer,
-                            ATM_GET(prevs[layer]->next[layer]), nexts[layer] );
-                    __SLD_ASSERT(0);
-                }
-                __SLD_P("%02x ins %p[%d] -> %p -> %p\n",
-                        (int)tid_hash, prevs[layer], layer,
-                        node, ATM_GET(node->next[layer]) );
-                _sl_write_unlock_an(prevs[layer]);
-            }
+size_t skiplist_level_gen_hash(skiplist_raw* slist,
+                               skiplist_node* node)
+{
+    if (!slist->hash_func || !node) return skiplist_level_gen_fast(slist, node);
 
-            // now this node is fully linked
-            ATM_STORE(node->is_fully_linked, bool_true);
+    uint64_t h = _sl_mix64(slist->hash_func(node, slist->aux) ^
+                           slist->level_seed);
+    int bits = _sl_fanout_bits(slist);
+    if (bits) return _sl_layer_from_bits(slist, h, bits);
 
-            // allow removing next nodes
-            _sl_write_unlock_an(node);
+    size_t layer = 0;
+    while (layer+1 < slist->max_layer && h % slist->fanout == 0) {
+        layer++;
+        h = _sl_mix64(h);
+    }
+    return layer;
+}
 
-            __SLD_P("%02x ins %p done\n", (int)tid_hash, node);
+size_t skiplist_decide_top_layer(skiplist_raw* slist,
+                                 skiplist_node* node)
+{
+    size_t layer = slist->level_gen(slist, node);
+    if (layer+1 > slist->max_layer) layer = slist->max_layer - 1;
+    return layer;
+}
 
-            ATM_FETCH_ADD(slist->num_entries, 1);
-            ATM_FETCH_ADD(slist->layer_entries[node->top_layer], 1);
-            for (int ii=slist->max_layer-1; ii>=0; --ii) {
-                if (slist->layer_entries[ii] > 0) {
-                    slist->top_layer = ii;
-                    break;
-                }
-            }
+size_t skiplist_bulk_load_top_layer(skiplist_raw *slist,
+                                    size_t index)
+{
+    // Perfectly balanced: node `i` grows to layer `L` if `i+1` is
+    // a multiple of `fanout^L`.
+    size_t top_layer = 0;
+    int bits = _sl_fanout_bits(slist);
+    if (bits) {
+        top_layer = __builtin_ctzll(index + 1) / bits;
+    } else {
+        size_t pos = index + 1;
+        while (pos % slist->fanout == 0) {
+            pos /= slist->fanout;
+            top_layer++;
+        }
+    }
+    if (top_layer + 1 > slist->max_layer) {
+        top_layer = slist->max_layer - 1;
+    }
+    return top_layer;
+}
 
-            // modification is done for all layers
-            _sl_clr_flags(prevs, 0, top_layer);
-            ATM_FETCH_SUB(cur_node->ref_count, 1);
+int skiplist_bulk_load(skiplist_raw *slist,
+                       skiplist_node **nodes,
+                       size_t num_nodes)
+{
+    // Not the size: erased nodes that snapshots can still see stay
+    // linked in a versioned list.
+    skiplist_node* first = NULL;
+    ATM_LOAD(slist->head.next[0], first);
+    if (first != &slist->tail) return -1;
+
+    skiplist_node* lasts[SKIPLIST_MAX_LAYER];
+    // Positions of `lasts`, to set the spans of their links.
+    uint32_t last_pos[SKIPLIST_MAX_LAYER];
+    size_t ii, layer;
+    for (layer = 0; layer < slist->max_layer; ++layer) {
+        lasts[layer] = &slist->head;
+        last_pos[layer] = 0;
+    }
 
-            return 0;
-        } while (cur_node != &slist->tail);
+    for (ii = 0; ii < num_nodes; ++ii) {
+        skiplist_node* node = nodes[ii];
+        // Node with inline tower has its own height.
+        size_t top_layer = _sl_tower_size(node)
+                           ? _sl_decide_top_layer(slist, node)
+                           : skiplist_bulk_load_top_layer(slist, ii);
+        _sl_node_init(node, top_layer, _sl_ext_slots(slist));
+        if (slist->backward_links) _sl_prev_ptr(node) = lasts[0];
+        if (slist->versioned) {
+            // Seen by all snapshots.
+            _sl_insert_seq(slist, node) = 0;
+            _sl_erase_seq(slist, node) = _SL_SEQ_NONE;
+        }
+        for (layer = 0; layer <= top_layer; ++layer) {
+            lasts[layer]->next[layer] = node;
+            _sl_span(lasts[layer])[layer] = ii + 1 - last_pos[layer];
+            lasts[layer] = node;
+            last_pos[layer] = ii + 1;
+        }
+        _sl_set_state(node, _SL_ST_LINKED, true);
+        if (top_layer) slist->layer_entries[top_layer]++;
+    }
+    for (layer = 0; layer < slist->max_layer; ++layer) {
+        lasts[layer]->next[layer] = &slist->tail;
+        _sl_span(lasts[layer])[layer] = num_nodes + 1 - last_pos[layer];
+        if (slist->layer_entries[layer]) slist->top_layer = layer;
     }
+    _sl_prev_ptr(&slist->tail) = lasts[0];
+
+    // Shards may still have deltas summing up to zero.
+    uint64_t num_entries = num_nodes;
+    ATM_FETCH_ADD(slist->num_entries, num_entries);
+    // Publish all links above.
+    ATM_FENCE();
     return 0;
 }
 
+typedef sl_engine<_sl_fn_cmp> _sl_engine;
+
 int skiplist_insert(skiplist_raw *slist,
                     skiplist_node *node)
 {
-    return _skiplist_insert(slist, node, false);
+    return _sl_engine::insert(slist, node);
 }
 
 int skiplist_insert_nodup(skiplist_raw *slist,
                           skiplist_node *node)
 {
-    return _skiplist_insert(slist, node, true);
-}
-
-typedef enum {
-    SM   = -2,
-    SMEQ = -1,
-    EQ   =  0,
-    GTEQ =  1,
-    GT   =  2
-} _sl_find_mode;
-
-// Note: it increases the `ref_count` of returned node.
-//       Caller is responsible to decrease it.
-static inline skiplist_node* _sl_find(skiplist_raw *slist,
-                                      skiplist_node *query,
-                                      _sl_find_mode mode)
-{
-    // mode:
-    //  SM   -2: smaller
-    //  SMEQ -1: smaller or equal
-    //  EQ    0: equal
-    //  GTEQ  1: greater or equal
-    //  GT    2: greater
-find_retry:
-    (void)mode;
-    int cmp = 0;
-    int cur_layer = 0;
-    skiplist_node *cur_node = &slist->head;
-    ATM_FETCH_ADD(cur_node->ref_count, 1);
-
-    __SLD_(size_t nh = 0);
-    __SLD_(thread_local skiplist_node* history[1024]; (void)history);
-
-    uint8_t sl_top_layer = slist->top_layer;
-    for (cur_layer = sl_top_layer; cur_layer >= 0; --cur_layer) {
-        do {
-            __SLD_(history[nh++] = cur_node);
-
-            skiplist_node *next_node = _sl_next(slist, cur_node, cur_layer,
-                                                NULL, NULL);
-            if (!next_node) {
-                ATM_FETCH_SUB(cur_node->ref_count, 1);
-                YIELD();
-                goto find_retry;
-            }
-            cmp = _sl_cmp(slist, query, next_node);
-            if (cmp > 0) {
-                // cur_node < next_node < query
-                // => move to next node
-                skiplist_node* temp = cur_node;
-                cur_node = next_node;
-                ATM_FETCH_SUB(temp->ref_count, 1);
-                continue;
-            } else if (-1 <= mode && mode <= 1 && cmp == 0) {
-                // cur_node < query == next_node .. return
-                ATM_FETCH_SUB(cur_node->ref_count, 1);
-                return next_node;
-            }
-
-            // otherwise: cur_node < query < next_node
-            if (cur_layer) {
-                // non-bottom layer => go down
-                ATM_FETCH_SUB(next_node->ref_count, 1);
-                break;
-            }
+    return _sl_engine::insert_nodup(slist, node);
+}
 
-            // bottom layer
-            if (mode < 0 && cur_node != &slist->head) {
-                // smaller mode
-                ATM_FETCH_SUB(next_node->ref_count, 1);
-                return cur_node;
-            } else if (mode > 0 && next_node != &slist->tail) {
-                // greater mode
-                ATM_FETCH_SUB(cur_node->ref_count, 1);
-                return next_node;
-            }
-            // otherwise: exact match mode OR not found
-            ATM_FETCH_SUB(cur_node->ref_count, 1);
-            ATM_FETCH_SUB(next_node->ref_count, 1);
-            return NULL;
-        } while (cur_node != &slist->tail);
-    }
+size_t skiplist_insert_batch(skiplist_raw *slist,
+                             skiplist_node **nodes,
+                             size_t num_nodes)
+{
+    return _sl_engine::insert_batch(slist, nodes, num_nodes);
+}
 
-    return NULL;
+size_t skiplist_insert_batch_nodup(skiplist_raw *slist,
+                                   skiplist_node **nodes,
+                                   size_t num_nodes,
+                                   int *results)
+{
+    return _sl_engine::insert_batch_nodup(slist, nodes, num_nodes, results);
 }
 
 skiplist_node* skiplist_find(skiplist_raw *slist,
                              skiplist_node *query)
 {
-    return _sl_find(slist, query, EQ);
+    return _sl_engine::find(slist, query);
 }
 
 skiplist_node* skiplist_find_smaller_or_equal(skiplist_raw *slist,
                                               skiplist_node *query)
 {
-    return _sl_find(slist, query, SMEQ);
+    return _sl_engine::find_smaller_or_equal(slist, query);
 }
 
 skiplist_node* skiplist_find_greater_or_equal(skiplist_raw *slist,
                                               skiplist_node *query)
 {
-    return _sl_find(slist, query, GTEQ);
+    return _sl_engine::find_greater_or_equal(slist, query);
+}
+
+skiplist_node* skiplist_find_from(skiplist_raw *slist,
+                                  skiplist_node *hint,
+                                  skiplist_node *query)
+{
+    return _sl_engine::find_from(slist, hint, query);
+}
+
+skiplist_node* skiplist_find_smaller_or_equal_from(skiplist_raw *slist,
+                                                   skiplist_node *hint,
+                                                   skiplist_node *query)
+{
+    return _sl_engine::find_smaller_or_equal_from(slist, hint, query);
+}
+
+skiplist_node* skiplist_find_greater_or_equal_from(skiplist_raw *slist,
+                                                   skiplist_node *hint,
+                                                   skiplist_node *query)
+{
+    return _sl_engine::find_greater_or_equal_from(slist, hint, query);
+}
+
+size_t skiplist_find_batch(skiplist_raw *slist,
+                           skiplist_node **queries,
+                           skiplist_node **results,
+                           size_t num_queries)
+{
+    return _sl_engine::find_batch(slist, queries, results, num_queries);
 }
 
 int skiplist_erase_node_passive(skiplist_raw *slist,
                                 skiplist_node *node)
 {
-    __SLD_(
-        thread_local std::thread::id tid = std::this_thread::get_id();
-        thread_local size_t tid_hash = std::hash<std::thread::id>{}(tid) % 256;
-        (void)tid_hash;
-    )
+    return _sl_engine::erase_node_passive(slist, node);
+}
 
-    int top_layer = node->top_layer;
-    bool bool_true = true, bool_false = false;
-    bool removed = false;
-    bool is_fully_linked = false;
+int skiplist_erase_node(skiplist_raw *slist,
+                        skiplist_node *node)
+{
+    return _sl_engine::erase_node(slist, node);
+}
 
-    ATM_LOAD(node->removed, removed);
-    if (removed) {
-        // already removed
-        return -1;
-    }
+int skiplist_erase(skiplist_raw *slist,
+                   skiplist_node *query)
+{
+    return _sl_engine::erase(slist, query);
+}
 
-    skiplist_node* prevs[SKIPLIST_MAX_LAYER];
-    skiplist_node* nexts[SKIPLIST_MAX_LAYER];
+size_t skiplist_erase_range(skiplist_raw *slist,
+                            skiplist_node *from,
+                            skiplist_node *to,
+                            skiplist_node_cb_t *on_removed,
+                            void *ctx)
+{
+    return _sl_engine::erase_range(slist, from, to, on_removed, ctx);
+}
 
-    bool expected = false;
-    if (!ATM_CAS(node->being_modified, expected, bool_true)) {
-        // already being modified .. cannot work on this node for now.
-        __SLD_BM(node);
-        return -2;
-    }
+size_t skiplist_truncate_before(skiplist_raw *slist,
+                                skiplist_node *to,
+                                skiplist_node_cb_t *on_removed,
+                                void *ctx)
+{
+    return _sl_engine::truncate_before(slist, to, on_removed, ctx);
+}
 
-    // set removed flag first, so that reader cannot read this node.
-    ATM_STORE(node->removed, bool_true);
+size_t skiplist_rank(skiplist_raw* slist,
+                     skiplist_node* query)
+{
+    return _sl_engine::rank(slist, query);
+}
 
-    __SLD_P("%02x rmv %p begin\n", (int)tid_hash, node);
+skiplist_node* skiplist_select(skiplist_raw* slist,
+                               size_t k)
+{
+    return _sl_engine::select(slist, k);
+}
 
-erase_node_retry:
-    ATM_LOAD(node->is_fully_linked, is_fully_linked);
-    if (!is_fully_linked) {
-        // already unlinked .. remove is done by other thread
-        ATM_STORE(node->removed, bool_false);
-        ATM_STORE(node->being_modified, bool_false);
-        return -3;
-    }
+size_t skiplist_count(skiplist_raw* slist,
+                      skiplist_node* from,
+                      skiplist_node* to)
+{
+    return _sl_engine::count(slist, from, to);
+}
 
-    int cmp = 0;
-    bool found_node_to_erase = false;
-    (void)found_node_to_erase;
-    skiplist_node *cur_node = &slist->head;
-    ATM_FETCH_ADD(cur_node->ref_count, 1);
+int skiplist_is_valid_node(skiplist_node* node) {
+    return _sl_valid_node(node);
+}
 
-    __SLD_(size_t nh = 0);
-    __SLD_(thread_local skiplist_node* history[1024]; (void)history);
+int skiplist_is_safe_to_free(skiplist_node* node) {
+    // Removed, and nothing else: no lock, flag or reference.
+    uint64_t state = _sl_state(node);
+    uint64_t mask = _SL_ST_AN | _SL_ST_MODIFYING | _SL_ST_REMOVED |
+                    ((uint64_t)UINT64_MAX << _SL_ST_REF_SHIFT);
+    return (state & mask) == _SL_ST_REMOVED;
+}
 
-    int cur_layer = slist->top_layer;
-    for (; cur_layer >= 0; --cur_layer) {
-        do {
-            __SLD_( history[nh++] = cur_node );
-
-            bool node_found = false;
-            skiplist_node *next_node = _sl_next(slist, cur_node, cur_layer,
-                                                node, &node_found);
-            if (!next_node) {
-                _sl_clr_flags(prevs, cur_layer+1, top_layer);
-                ATM_FETCH_SUB(cur_node->ref_count, 1);
-                YIELD();
-                goto erase_node_retry;
-            }
+void skiplist_wait_for_free(skiplist_node* node) {
+    while (!skiplist_is_safe_to_free(node)) {
+        YIELD();
+    }
+}
 
-            // Note: unlike insert(), we should find exact position of `node`.
-            cmp = _sl_cmp(slist, node, next_node);
-            if (cmp > 0 || (cur_layer <= top_layer && !node_found) ) {
-                // cur_node <= next_node < node
-                // => move to next node
-                skiplist_node* temp = cur_node;
-                cur_node = next_node;
-                __SLD_( if (cmp > 0) {
-                    int cmp2 = _sl_cmp(slist, cur_node, node);
-                    if (cmp2 > 0) {
-                        // node < cur_node <= next_node: not found.
-                        _sl_clr_flags(prevs, cur_layer+1, top_layer);
-                        ATM_FETCH_SUB(temp->ref_count, 1);
-                        ATM_FETCH_SUB(next_node->ref_count, 1);
-                        __SLD_ASSERT(0);
-                    }
-                } )
-                ATM_FETCH_SUB(temp->ref_count, 1);
-                continue;
-            } else {
-                // otherwise: cur_node <= node <= next_node
-                ATM_FETCH_SUB(next_node->ref_count, 1);
-            }
+void skiplist_retire_node(skiplist_raw* slist,
+                          skiplist_node* node,
+                          skiplist_node_cb_t* free_func,
+                          void* ctx)
+{
+    if (slist->versioned && _sl_valid_node(node)) {
+        // Erased, but still linked for old snapshots.
+        _sl_version_entry* entry;
+        ALLOC_(_sl_version_entry, entry, 1);
+        entry->node = node;
+        entry->free_func = free_func;
+        entry->ctx = ctx;
+        ATM_LOAD(_sl_erase_seq(slist, node), entry->erase_seq);
+        _sl_version_add(slist->versions, entry);
+        _sl_purge_versions(slist);
+        return;
+    }
 
-            if (cur_layer <= top_layer) {
-                prevs[cur_layer] = cur_node;
-                // note: 'next_node' and 'node' should not be the same,
-                //       as 'removed' flag is already set.
-                __SLD_ASSERT(next_node != node);
-                nexts[cur_layer] = next_node;
-
-                // check if prev node duplicates with upper layer
-                int error_code = 0;
-                int locked_layer = cur_layer + 1;
-                if (cur_layer < top_layer &&
-                    prevs[cur_layer] == prevs[cur_layer+1]) {
-                    // duplicate with upper layer
-                    // => which means that 'being_modified' flag is already true
-                    // => do nothing.
-                } else {
-                    expected = false;
-                    if (ATM_CAS(prevs[cur_layer]->being_modified,
-                                expected, bool_true)) {
-                        locked_layer = cur_layer;
-                    } else {
-                        error_code = -1;
-                    }
-                }
-
-                if (error_code == 0 &&
-                    !_sl_valid_prev_next(prevs[cur_layer], nexts[cur_layer])) {
-                    error_code = -2;
-                }
-
-                if (error_code != 0) {
-                    __SLD_RT_RMV(error_code, node, top_layer, cur_layer);
-                    _sl_clr_flags(prevs, locked_layer, top_layer);
-                    ATM_FETCH_SUB(cur_node->ref_count, 1);
-                    YIELD();
-                    goto erase_node_retry;
-                }
-
-                skiplist_node* next_node_again =
-                    _sl_next(slist, cur_node, cur_layer, node, NULL);
-                ATM_FETCH_SUB(next_node_again->ref_count, 1);
-                if (next_node_again != nexts[cur_layer]) {
-                    // `next` pointer has been changed, retry.
-                    __SLD_NC_RMV(cur_node, nexts[cur_layer], top_layer, cur_layer);
-                    _sl_clr_flags(prevs, cur_layer, top_layer);
-                    ATM_FETCH_SUB(cur_node->ref_count, 1);
-                    YIELD();
-                    goto erase_node_retry;
-                }
-            }
-            if (cur_layer == 0) found_node_to_erase = true;
-            // go down
-            break;
-        } while (cur_node != &slist->tail);
-    }
-    // Not exist in the skiplist, should not happen.
-    __SLD_ASSERT(found_node_to_erase);
-    // bottom layer => removal succeeded.
-    // mark this node unlinked
-    _sl_write_lock_an(node); {
-        ATM_STORE(node->is_fully_linked, bool_false);
-    } _sl_write_unlock_an(node);
-
-    // change prev nodes' next pointer from 0 ~ top_layer
-    for (cur_layer = 0; cur_layer <= top_layer; ++cur_layer) {
-        _sl_write_lock_an(prevs[cur_layer]);
-        skiplist_node* exp = node;
-        __SLD_ASSERT(exp != nexts[cur_layer]);
-        __SLD_ASSERT(nexts[cur_layer]->is_fully_linked);
-        if ( !ATM_CAS(prevs[cur_layer]->next[cur_layer],
-                      exp, nexts[cur_layer]) ) {
-            __SLD_P("%02x ASSERT rmv %p[%d] -> %p (node %p)\n",
-                    (int)tid_hash, prevs[cur_layer], cur_layer,
-                    ATM_GET(prevs[cur_layer]->next[cur_layer]), node );
-            __SLD_ASSERT(0);
+    if (slist->reclaim_mode == SKIPLIST_RECLAIM_REFCOUNT) {
+        skiplist_wait_for_free(node);
+        if (free_func) free_func(node, ctx);
+        return;
+    }
+    if (slist->reclaim_mode == SKIPLIST_RECLAIM_NONE) {
+        if (free_func) free_func(node, ctx);
+        return;
+    }
+
+    struct _skiplist_reclaim* rc = slist->reclaim;
+    _sl_reclaim_rec* rec = _sl_rec_acquire(rc);
+    ATM_FENCE();
+
+    if (rec->num_limbo == rec->limbo_size) {
+        size_t new_size = rec->limbo_size ? rec->limbo_size * 2
+                                          : _SL_LIMBO_THRESHOLD;
+        _sl_limbo_entry* new_limbo;
+        ALLOC_(_sl_limbo_entry, new_limbo, new_size);
+        size_t ii;
+        for (ii = 0; ii < rec->num_limbo; ++ii) {
+            new_limbo[ii] = rec->limbo[ii];
         }
-        __SLD_ASSERT(nexts[cur_layer]->top_layer >= cur_layer);
-        __SLD_P("%02x rmv %p[%d] -> %p (node %p)\n",
-                (int)tid_hash, prevs[cur_layer], cur_layer,
-                nexts[cur_layer], node);
-        _sl_write_unlock_an(prevs[cur_layer]);
+        if (rec->limbo) FREE_(rec->limbo);
+        rec->limbo = new_limbo;
+        rec->limbo_size = new_size;
     }
 
-    __SLD_P("%02x rmv %p done\n", (int)tid_hash, node);
+    _sl_limbo_entry* entry = &rec->limbo[rec->num_limbo++];
+    entry->node = node;
+    entry->free_func = free_func;
+    entry->ctx = ctx;
+    ATM_LOAD(rc->global_epoch, entry->epoch);
 
-    ATM_FETCH_SUB(slist->num_entries, 1);
-    ATM_FETCH_SUB(slist->layer_entries[node->top_layer], 1);
-    for (int ii=slist->max_layer-1; ii>=0; --ii) {
-        if (slist->layer_entries[ii] > 0) {
-            slist->top_layer = ii;
-            break;
+    if (rec->num_limbo >= rec->reclaim_at) {
+        _sl_rec_reclaim(slist, rec);
+    }
+    _sl_rec_release(rec);
+}
+
+// Unlink and retire the erased nodes that no snapshot can see any more.
+// Returns the number of nodes freed.
+static size_t _sl_purge_versions(skiplist_raw* slist)
+{
+    struct _skiplist_versions* vs = slist->versions;
+    size_t num_freed = 0;
+
+    // Retry the ones that readers were holding.
+    _sl_version_entry* entry = NULL;
+    _sl_version_entry* null_entry = NULL;
+    do {
+        ATM_LOAD(vs->deferred, entry);
+    } while (entry && !ATM_CAS(vs->deferred, entry, null_entry));
+    while (entry) {
+        _sl_version_entry* next = entry->next;
+        if (skiplist_is_safe_to_free(entry->node)) {
+            if (entry->free_func) entry->free_func(entry->node, entry->ctx);
+            FREE_(entry);
+            num_freed++;
+        } else {
+            _sl_version_defer(vs, entry);
         }
+        entry = next;
     }
 
-    // modification is done for all layers
-    _sl_clr_flags(prevs, 0, top_layer);
-    ATM_FETCH_SUB(cur_node->ref_count, 1);
+    entry = _sl_version_take(vs, _sl_oldest_snapshot(slist));
+    _sl_fn_cmp comp(slist);
+    while (entry) {
+        _sl_version_entry* next = entry->next;
+        _sl_reclaim_rec* rec = _sl_op_begin(slist);
+        int ret = 0;
+        do {
+            ret = _sl_unlink_node(slist, comp, entry->node, NULL);
+        } while (ret == -2);
+        _sl_op_end(slist, rec);
+
+        // Not linked any more, retire it as usual. The caller may be
+        // holding it (or others in the chain) in refcount mode, so
+        // defer it instead of waiting.
+        if ( slist->reclaim_mode == SKIPLIST_RECLAIM_REFCOUNT &&
+             !skiplist_is_safe_to_free(entry->node) ) {
+            _sl_version_defer(vs, entry);
+        } else {
+            // Epoch and hazard modes free it later, in their own reclaim.
+            if ( slist->reclaim_mode == SKIPLIST_RECLAIM_REFCOUNT ||
+                 slist->reclaim_mode == SKIPLIST_RECLAIM_NONE ) {
+                num_freed++;
+            }
+            skiplist_retire_node(slist, entry->node,
+                                 entry->free_func, entry->ctx);
+            FREE_(entry);
+        }
+        entry = next;
+    }
+    return num_freed;
+}
 
-    ATM_STORE(node->being_modified, bool_false);
+uint64_t skiplist_snapshot(skiplist_raw* slist)
+{
+    if (!slist->versioned) return 0;
+    struct _skiplist_versions* vs = slist->versions;
+
+    // Reuse a free slot, or add a new one.
+    _sl_snapshot_slot* slot = NULL;
+    ATM_LOAD(vs->snapshots, slot);
+    for (; slot; slot = slot->next) {
+        uint64_t exp = _SL_SEQ_NONE;
+        uint64_t zero = 0;
+        if (ATM_CAS(slot->seq, exp, zero)) break;
+    }
+    if (!slot) {
+        ALLOC_(_sl_snapshot_slot, slot, 1);
+        uint64_t zero = 0;
+        ATM_STORE(slot->seq, zero);
+        _sl_snapshot_slot* head = NULL;
+        do {
+            ATM_LOAD(vs->snapshots, head);
+            slot->next = head;
+        } while (!ATM_CAS(vs->snapshots, head, slot));
+    }
 
-    return 0;
+    // Publish the number and then check that it is still visible,
+    // so that an erase after it sees the slot, and keeps its node.
+    uint64_t seq = 0, visible = 0;
+    for (;;) {
+        ATM_LOAD(vs->visible_seq, seq);
+        ATM_STORE(slot->seq, seq);
+        ATM_FENCE();
+        ATM_LOAD(vs->visible_seq, visible);
+        if (visible == seq) break;
+    }
+    return seq;
 }
 
-int skiplist_erase_node(skiplist_raw *slist,
-                        skiplist_node *node)
+void skiplist_snapshot_release(skiplist_raw* slist,
+                               uint64_t seq)
 {
-    int ret = 0;
-    do {
-        ret = skiplist_erase_node_passive(slist, node);
-        // if ret == -2, other thread is accessing the same node
-        // at the same time. try again.
-    } while (ret == -2);
-    return ret;
+    if (!slist->versioned) return;
+
+    _sl_snapshot_slot* slot = NULL;
+    ATM_LOAD(slist->versions->snapshots, slot);
+    for (; slot; slot = slot->next) {
+        uint64_t exp = seq;
+        uint64_t none = _SL_SEQ_NONE;
+        if (ATM_CAS(slot->seq, exp, none)) break;
+    }
+    _sl_purge_versions(slist);
 }
 
-int skiplist_erase(skiplist_raw *slist,
-                   skiplist_node *query)
+size_t skiplist_reclaim(skiplist_raw* slist)
+{
+    size_t num_freed = 0;
+    if (slist->versioned) num_freed += _sl_purge_versions(slist);
+    if (!slist->reclaim) return num_freed;
+
+    struct _skiplist_reclaim* rc = slist->reclaim;
+    _sl_reclaim_rec* rec = NULL;
+    ATM_LOAD(rc->recs, rec);
+    for (; rec; rec = rec->next) {
+        // Skip records being used by others.
+        bool exp = false;
+        bool bool_true = true;
+        if (!ATM_CAS(rec->in_use, exp, bool_true)) continue;
+        ATM_FENCE();
+        num_freed += _sl_rec_reclaim(slist, rec);
+        _sl_rec_release(rec);
+    }
+    return num_freed;
+}
+
+skiplist_hazard* skiplist_hazard_acquire(skiplist_raw* slist)
 {
-    skiplist_node *found = skiplist_find(slist, query);
-    if (!found) {
-        // key not found
-        return -4;
+    if (slist->reclaim_mode != SKIPLIST_RECLAIM_HAZARD) return NULL;
+
+    struct _skiplist_reclaim* rc = slist->reclaim;
+    bool exp = false;
+    bool bool_true = true;
+    skiplist_hazard* head = NULL;
+    skiplist_hazard* hazard = NULL;
+    ATM_LOAD(rc->hazards, head);
+    for (hazard = head; hazard; hazard = hazard->next) {
+        exp = false;
+        if (ATM_CAS(hazard->in_use, exp, bool_true)) return hazard;
     }
 
-    int ret = 0;
+    // All slots are busy, add a new one.
+    ALLOC_(skiplist_hazard, hazard, 1);
+    skiplist_node* null_node = NULL;
+    ATM_STORE(hazard->node, null_node);
+    ATM_STORE(hazard->in_use, bool_true);
     do {
-        ret = skiplist_erase_node_passive(slist, found);
-        // if ret == -2, other thread is accessing the same node
-        // at the same time. try again.
-    } while (ret == -2);
+        ATM_LOAD(rc->hazards, head);
+        hazard->next = head;
+    } while (!ATM_CAS(rc->hazards, head, hazard));
+    return hazard;
+}
 
-    ATM_FETCH_SUB(found->ref_count, 1);
-    return ret;
+void skiplist_hazard_release(skiplist_raw* slist,
+                             skiplist_hazard* hazard)
+{
+    (void)slist;
+    skiplist_hazard_set(hazard, NULL);
+    bool bool_false = false;
+    ATM_STORE_REL(hazard->in_use, bool_false);
 }
 
-int skiplist_is_valid_node(skiplist_node* node) {
-    return _sl_valid_node(node);
+void skiplist_hazard_set(skiplist_hazard* hazard,
+                         skiplist_node* node)
+{
+    ATM_STORE(hazard->node, node);
+    // Make it visible before the caller drops the previous protection.
+    ATM_FENCE();
 }
 
-int skiplist_is_safe_to_free(skiplist_node* node) {
-    if (node->accessing_next) return 0;
-    if (node->being_modified) return 0;
-    if (!node->removed) return 0;
+skiplist_node* skiplist_hazard_get(skiplist_hazard* hazard)
+{
+    skiplist_node* node = NULL;
+    ATM_LOAD(hazard->node, node);
+    return node;
+}
 
-    uint16_t ref_count = 0;
-    ATM_LOAD(node->ref_count, ref_count);
-    if (ref_count) return 0;
-    return 1;
+skiplist_node* skiplist_hazard_next(skiplist_raw* slist,
+                                    skiplist_hazard* hazard)
+{
+    return _sl_engine::hazard_next(slist, hazard);
 }
 
-void skiplist_wait_for_free(skiplist_node* node) {
-    while (!skiplist_is_safe_to_free(node)) {
-        YIELD();
-    }
+skiplist_node* skiplist_hazard_prev(skiplist_raw* slist,
+                                    skiplist_hazard* hazard)
+{
+    return _sl_engine::hazard_prev(slist, hazard);
 }
 
 void skiplist_grab_node(skiplist_node* node) {
-    ATM_FETCH_ADD(node->ref_count, 1);
+    ATM_FETCH_ADD(node->state, _SL_ST_REF);
 }
 
 void skiplist_release_node(skiplist_node* node) {
-    __SLD_ASSERT(node->ref_count);
-    ATM_FETCH_SUB(node->ref_count, 1);
+    __SLD_ASSERT(_sl_ref_count(node));
+    ATM_FETCH_SUB(node->state, _SL_ST_REF);
+}
+
+skiplist_node* skiplist_snapshot_find(skiplist_raw *slist,
+                                      uint64_t seq,
+                                      skiplist_node *query)
+{
+    return _sl_engine::find(slist, query, seq);
+}
+
+skiplist_node* skiplist_snapshot_find_greater_or_equal(skiplist_raw *slist,
+                                                       uint64_t seq,
+                                                       skiplist_node *query)
+{
+    return _sl_engine::find_greater_or_equal(slist, query, seq);
 }
 
 skiplist_node* skiplist_next(skiplist_raw *slist,
@@ -981,27 +1351,62 @@ skiplist_node* skiplist_next(skiplist_raw *slist,
     // In this case, start over from the top layer,
     // to find valid link (same as in prev()).
 
-    skiplist_node *next = _sl_next(slist, node, 0, NULL, NULL);
-    if (!next) next = _sl_find(slist, node, GT);
+    return _sl_engine::next(slist, node);
+}
 
-    if (next == &slist->tail) return NULL;
-    return next;
+// Comparator that puts the query after all nodes,
+// so that the search for its predecessor ends at the last node.
+struct _sl_last_cmp {
+    _sl_last_cmp(skiplist_raw*) {}
+    int operator()(skiplist_node*, skiplist_node*) const { return 1; }
+};
+
+// Last node seen by the snapshot of `seq`. `_sl_last_cmp` only finds the
+// last linked node: stepping back over the versions hidden from `seq`
+// needs the actual comparator, as it searches for the node itself.
+static skiplist_node* _sl_last(skiplist_raw *slist, uint64_t seq)
+{
+    _sl_last_cmp last_comp(slist);
+    _sl_fn_cmp comp(slist);
+    _sl_reclaim_rec* rec = _sl_op_begin(slist);
+    skiplist_node *last = _sl_prev_link(slist, &slist->tail);
+    if (!last) last = _sl_find(slist, last_comp, &slist->tail, _SL_SM);
+    if (last) last = _sl_prev_visible(slist, comp, last, seq);
+    if (last == &slist->head) {
+        _sl_release(slist, last);
+        last = NULL;
+    }
+    _sl_pin(slist, last);
+    _sl_op_end(slist, rec);
+    return last;
 }
 
 skiplist_node* skiplist_prev(skiplist_raw *slist,
                              skiplist_node *node) {
-    skiplist_node *prev = _sl_find(slist, node, SM);
-    if (prev == &slist->head) return NULL;
-    return prev;
+    if (node == &slist->tail) return _sl_last(slist, _SL_SEQ_LATEST);
+    return _sl_engine::prev(slist, node);
 }
 
 skiplist_node* skiplist_begin(skiplist_raw *slist) {
-    skiplist_node *next = NULL;
-    while (!next) {
-        next = _sl_next(slist, &slist->head, 0, NULL, NULL);
-    }
-    if (next == &slist->tail) return NULL;
-    return next;
+    return _sl_engine::begin(slist);
+}
+
+skiplist_node* skiplist_snapshot_next(skiplist_raw *slist,
+                                      uint64_t seq,
+                                      skiplist_node *node) {
+    return _sl_engine::next(slist, node, seq);
+}
+
+skiplist_node* skiplist_snapshot_prev(skiplist_raw *slist,
+                                      uint64_t seq,
+                                      skiplist_node *node) {
+    if (node == &slist->tail) return _sl_last(slist, seq);
+    return _sl_engine::prev(slist, node, seq);
+}
+
+skiplist_node* skiplist_snapshot_begin(skiplist_raw *slist,
+                                       uint64_t seq) {
+    return _sl_engine::begin(slist, seq);
 }
 
 skiplist_node* skiplist_end(skiplist_raw *slist) {
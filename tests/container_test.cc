@@ -1,13 +1,27 @@
 #include "sl_map.h"
+#include "sl_memtable.h"
+#include "sl_merge_iterator.h"
+#include "sl_persistent_map.h"
 #include "sl_set.h"
+#include "sl_unrolled_map.h"
+#include "sl_unrolled_set.h"
 
 #include "test_common.h"
 
+#include <algorithm>
 #include <chrono>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
 #include <thread>
 #include <vector>
 
+#include <fcntl.h>
 #include <stdio.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 int _map_basic(sl_map<int, int>& sl) {
@@ -71,6 +85,303 @@ int map_basic_wait() {
     return _map_basic(sl_wait);
 }
 
+int map_basic_epoch() {
+    skiplist_raw_config config = skiplist_get_default_config();
+    config.reclaimMode = SKIPLIST_RECLAIM_EPOCH;
+    sl_map<int, int> sl_epoch(config);
+    return _map_basic(sl_epoch);
+}
+
+int map_basic_hazard() {
+    skiplist_raw_config config = skiplist_get_default_config();
+    config.reclaimMode = SKIPLIST_RECLAIM_HAZARD;
+    sl_map<int, int> sl_hazard(config);
+    return _map_basic(sl_hazard);
+}
+
+int map_hazard_iterator_test() {
+    skiplist_raw_config config = skiplist_get_default_config();
+    config.reclaimMode = SKIPLIST_RECLAIM_HAZARD;
+    sl_map<int, int> sl(config);
+    for (int i=0; i<10; ++i) {
+        sl.insert( std::make_pair(i, i*10) );
+    }
+
+    // Iterator keeps the erased entry alive by its hazard slot.
+    auto ii = sl.find(3);
+    auto jj = sl.find(3);
+    sl.erase(3);
+    CHK_TRUE(sl.find(3) == sl.end());
+    CHK_EQ(3, ii->first);
+    CHK_EQ(30, ii->second);
+
+    ii++;
+    CHK_EQ(4, ii->first);
+    --jj;
+    CHK_EQ(2, jj->first);
+
+    jj = ii;
+    CHK_EQ(4, jj->first);
+    ii = sl.end();
+    CHK_EQ(4, jj->first);
+    return 0;
+}
+
+int map_find_hint_test() {
+    sl_map<int, int> sl;
+    for (int i=0; i<1000; ++i) {
+        sl.insert( std::make_pair(i, i*10) );
+    }
+
+    auto hint = sl.find(100);
+    for (int i=95; i<110; ++i) {
+        auto entry = sl.find(hint, i);
+        CHK_TRUE(entry != sl.end());
+        CHK_EQ(i, entry->first);
+        CHK_EQ(i*10, entry->second);
+    }
+    CHK_TRUE(sl.find(hint, 1000) == sl.end());
+    CHK_TRUE(sl.find(sl.end(), 500) != sl.end());
+    return 0;
+}
+
+int map_nth_test() {
+    skiplist_raw_config config = skiplist_get_default_config();
+    config.indexable = 1;
+    sl_map<int, int> sl(config);
+    for (int i=0; i<1000; ++i) {
+        sl.insert( std::make_pair(i*2, i) );
+    }
+    for (int i=0; i<1000; i+=2) {
+        sl.erase(i*2);
+    }
+    // 2, 6, 10, ...
+    for (int k=0; k<500; ++k) {
+        auto entry = sl.nth(k);
+        CHK_TRUE(entry != sl.end());
+        CHK_EQ(k*4 + 2, entry->first);
+        CHK_EQ((size_t)k, sl.rank(k*4 + 2));
+        CHK_EQ((size_t)k + 1, sl.rank(k*4 + 3));
+    }
+    CHK_TRUE(sl.nth(500) == sl.end());
+    return 0;
+}
+
+int map_multi_find_test() {
+    sl_map<int, int> sl;
+    for (int i=0; i<1000; ++i) {
+        sl.insert( std::make_pair(i*2, i) );
+    }
+    std::vector<int> keys;
+    for (int i=0; i<100; ++i) keys.push_back(i * 7);
+    auto ret = sl.multi_find(keys);
+    CHK_EQ(keys.size(), ret.size());
+    for (size_t i=0; i<keys.size(); ++i) {
+        if (keys[i] % 2) {
+            CHK_TRUE(ret[i] == sl.end());
+            continue;
+        }
+        CHK_TRUE(ret[i] != sl.end());
+        CHK_EQ(keys[i] / 2, ret[i]->second);
+    }
+    CHK_Z(sl.multi_find(std::vector<int>()).size());
+    return 0;
+}
+
+int set_multi_find_test() {
+    sl_set<int> sl;
+    for (int i=0; i<100; ++i) sl.insert(i*3);
+    std::vector<int> keys = {0, 1, 3, 299, 297};
+    auto ret = sl.multi_find(keys);
+    CHK_EQ(0, *ret[0]);
+    CHK_TRUE(ret[1] == sl.end());
+    CHK_EQ(3, *ret[2]);
+    CHK_TRUE(ret[3] == sl.end());
+    CHK_EQ(297, *ret[4]);
+    return 0;
+}
+
+int set_nth_test() {
+    sl_set<int> sl;
+    for (int i=0; i<100; ++i) sl.insert(i*2);
+    // Works without `indexable` as well.
+    CHK_EQ(10, *sl.nth(5));
+    CHK_EQ((size_t)5, sl.rank(9));
+    CHK_TRUE(sl.nth(100) == sl.end());
+    return 0;
+}
+
+int map_snapshot_test() {
+    skiplist_raw_config config = skiplist_get_default_config();
+    config.reclaimMode = SKIPLIST_RECLAIM_HAZARD;
+    config.versioned = 1;
+    sl_map<int, int> sl(config);
+    for (int i=0; i<100; ++i) {
+        sl.insert( std::make_pair(i, i) );
+    }
+    uint64_t seq = sl.snapshot();
+    for (int i=0; i<100; i+=2) sl.erase(i);
+    sl.insert( std::make_pair(100, 100) );
+
+    // The snapshot still sees 0 ~ 99.
+    int expected = 0;
+    for (auto it = sl.snapshot_begin(seq); it != sl.end(); ++it) {
+        CHK_EQ(expected, it->first);
+        expected++;
+    }
+    CHK_EQ(100, expected);
+    CHK_TRUE(sl.snapshot_find(seq, 10) != sl.end());
+    CHK_TRUE(sl.snapshot_find(seq, 100) == sl.end());
+
+    // The latest view: 1, 3, ..., 99, 100.
+    CHK_TRUE(sl.find(10) == sl.end());
+    CHK_EQ((size_t)51, sl.size());
+    auto it = sl.begin();
+    CHK_EQ(1, it->first);
+    ++it;
+    CHK_EQ(3, it->first);
+    sl.release_snapshot(seq);
+    return 0;
+}
+
+int map_insert_range_test() {
+    sl_map<int, int> sl;
+    sl.insert( std::make_pair(10, 0) );
+
+    // Sorted, with duplicates.
+    std::vector< std::pair<int, int> > sorted;
+    for (int i=0; i<20; ++i) sorted.push_back( std::make_pair(i, i*10) );
+    sorted.push_back( std::make_pair(19, 0) );
+    sl.insert(sorted.begin(), sorted.end());
+    CHK_EQ(20, (int)sl.size());
+
+    // Unsorted.
+    std::vector< std::pair<int, int> > unsorted;
+    for (int i=39; i>=15; --i) unsorted.push_back( std::make_pair(i, i*10) );
+    sl.insert(unsorted.begin(), unsorted.end());
+    CHK_EQ(40, (int)sl.size());
+
+    int count = 0;
+    for (auto& entry: sl) {
+        CHK_EQ(count, entry.first);
+        CHK_EQ(count == 10 ? 0 : count*10, entry.second);
+        count++;
+    }
+    CHK_EQ(40, count);
+    return 0;
+}
+
+int map_bulk_load_test() {
+    std::vector< std::pair<int, int> > sorted;
+    for (int i=0; i<1000; ++i) sorted.push_back( std::make_pair(i, i*10) );
+    sl_map<int, int> sl(sorted.begin(), sorted.end());
+    CHK_EQ(1000, (int)sl.size());
+
+    int count = 0;
+    for (auto& entry: sl) {
+        CHK_EQ(count, entry.first);
+        CHK_EQ(count*10, entry.second);
+        count++;
+    }
+    CHK_EQ(1000, count);
+
+    // Unsorted, with duplicates: the first one wins.
+    std::vector< std::pair<int, int> > unsorted;
+    for (int i=99; i>=0; --i) unsorted.push_back( std::make_pair(i, i*10) );
+    unsorted.push_back( std::make_pair(50, 0) );
+    skiplist_raw_config config = skiplist_get_default_config();
+    config.reclaimMode = SKIPLIST_RECLAIM_EPOCH;
+    sl_map<int, int> sl2(unsorted.begin(), unsorted.end(), config);
+    CHK_EQ(100, (int)sl2.size());
+    count = 0;
+    for (auto& entry: sl2) {
+        CHK_EQ(count, entry.first);
+        CHK_EQ(count*10, entry.second);
+        count++;
+    }
+    sl2.insert( std::make_pair(1000, 1) );
+    sl2.erase(0);
+    CHK_EQ(100, (int)sl2.size());
+    CHK_TRUE(sl2.find(1000) != sl2.end());
+    return 0;
+}
+
+int set_bulk_load_test() {
+    std::vector<int> keys;
+    for (int i=0; i<1000; ++i) keys.push_back(i % 500);
+    sl_set<int> sl(keys.begin(), keys.end());
+    CHK_EQ(500, (int)sl.size());
+
+    int count = 0;
+    for (auto& entry: sl) {
+        CHK_EQ(count, entry);
+        count++;
+    }
+    CHK_EQ(500, count);
+    return 0;
+}
+
+int _map_erase_range(sl_map<int, int>& sl) {
+    for (int i=0; i<100; ++i) sl.insert( std::make_pair(i, i*10) );
+
+    // Iterators pin their nodes, so they should be gone before
+    // the nodes are erased.
+    {
+        auto first = sl.find(20);
+        auto last = sl.find(30);
+        auto itr = sl.erase(first, last);
+        CHK_TRUE(itr == last);
+        CHK_EQ(30, itr->first);
+    }
+    CHK_EQ(90, (int)sl.size());
+    CHK_TRUE(sl.find(19) != sl.end());
+    CHK_TRUE(sl.find(20) == sl.end());
+    CHK_TRUE(sl.find(29) == sl.end());
+
+    CHK_EQ(10, (int)sl.truncate_before(10));
+    CHK_EQ(0, (int)sl.truncate_before(10));
+    CHK_EQ(10, sl.begin()->first);
+
+    CHK_TRUE(sl.erase(sl.find(90), sl.end()) == sl.end());
+    CHK_EQ(70, (int)sl.size());
+
+    int count = 0;
+    for (auto& entry: sl) {
+        int expected = (count < 10) ? count + 10 : count + 20;
+        CHK_EQ(expected, entry.first);
+        count++;
+    }
+    CHK_EQ(70, count);
+
+    sl.erase(sl.begin(), sl.end());
+    CHK_EQ(0, (int)sl.size());
+    CHK_TRUE(sl.begin() == sl.end());
+    return 0;
+}
+
+int map_erase_range_test() {
+    sl_map<int, int> sl;
+    return _map_erase_range(sl);
+}
+
+int map_erase_range_gc_test() {
+    sl_map_gc<int, int> sl_gc;
+    return _map_erase_range(sl_gc);
+}
+
+int set_erase_range_test() {
+    skiplist_raw_config config = skiplist_get_default_config();
+    config.reclaimMode = SKIPLIST_RECLAIM_EPOCH;
+    sl_set<int> sl(config);
+    for (int i=0; i<100; ++i) sl.insert(i);
+
+    CHK_EQ(50, (int)sl.truncate_before(50));
+    CHK_EQ(70, *sl.erase(sl.find(60), sl.find(70)));
+    CHK_EQ(40, (int)sl.size());
+    CHK_EQ(50, *sl.begin());
+    return 0;
+}
+
 int map_basic_gc() {
     sl_map_gc<int, int> sl_gc;
     return _map_basic(sl_gc);
@@ -135,6 +446,20 @@ int set_basic_wait() {
     return _set_basic(sl_wait);
 }
 
+int set_basic_epoch() {
+    skiplist_raw_config config = skiplist_get_default_config();
+    config.reclaimMode = SKIPLIST_RECLAIM_EPOCH;
+    sl_set<int> sl_epoch(config);
+    return _set_basic(sl_epoch);
+}
+
+int set_basic_hazard() {
+    skiplist_raw_config config = skiplist_get_default_config();
+    config.reclaimMode = SKIPLIST_RECLAIM_HAZARD;
+    sl_set<int> sl_hazard(config);
+    return _set_basic(sl_hazard);
+}
+
 int set_basic_gc() {
     sl_set_gc<int> sl_gc;
     return _set_basic(sl_gc);
@@ -173,15 +498,965 @@ int set_self_refer_test() {
     return 0;
 }
 
+int unrolled_map_test(skiplist_reclaim_mode mode) {
+    skiplist_raw_config config = skiplist_get_default_config();
+    config.reclaimMode = mode;
+    // Small chunks, so that they are split and merged a lot.
+    sl_unrolled_map<int, int, 8> sl(config);
+
+    int n = 2000;
+    std::vector<int> keys;
+    for (int i=0; i<n; ++i) keys.push_back(i);
+    std::mt19937 rng(n);
+    std::shuffle(keys.begin(), keys.end(), rng);
+    for (int k: keys) {
+        auto ret = sl.insert( std::make_pair(k, k*10) );
+        CHK_TRUE(ret.second);
+        CHK_EQ(k, ret.first->first);
+        CHK_EQ(k*10, ret.first->second);
+    }
+    CHK_EQ((size_t)n, sl.size());
+    CHK_FALSE(sl.insert( std::make_pair(7, 0) ).second);
+    CHK_EQ(70, sl.find(7)->second);
+    CHK_TRUE(sl.find(n) == sl.end());
+
+    // Forward and backward.
+    int count = 0;
+    for (auto& entry: sl) {
+        CHK_EQ(count, entry.first);
+        CHK_EQ(count*10, entry.second);
+        count++;
+    }
+    CHK_EQ(n, count);
+    for (auto itr = sl.rbegin(); itr != sl.rend(); --itr) {
+        count--;
+        CHK_EQ(count, itr->first);
+    }
+    CHK_Z(count);
+
+    // Erase odd keys, by key and by iterator, which merges chunks.
+    for (int i=1; i<n/2; i+=2) CHK_EQ((size_t)1, sl.erase(i));
+    auto itr = sl.find(n/2 + 1);
+    while (itr != sl.end()) {
+        itr = sl.erase(itr);
+        if (itr != sl.end()) ++itr;
+    }
+    CHK_Z(sl.erase(1));
+    CHK_EQ((size_t)n/2, sl.size());
+    count = 0;
+    for (auto& entry: sl) {
+        CHK_EQ(count, entry.first);
+        count += 2;
+    }
+    CHK_EQ(n, count);
+
+    // Erase the middle, and then the beginning.
+    auto first = sl.find(100);
+    auto last = sl.find(1000);
+    auto ret = sl.erase(first, last);
+    CHK_EQ(1000, ret->first);
+    CHK_EQ((size_t)n/2 - 450, sl.size());
+    CHK_EQ(98, (--ret)->first);
+    CHK_EQ((size_t)50, sl.truncate_before(1000));
+    CHK_EQ(1000, sl.begin()->first);
+    CHK_EQ((size_t)n/2 - 500, sl.size());
+
+    CHK_EQ((size_t)n/2 - 500, sl.truncate_before(n));
+    CHK_TRUE(sl.empty());
+    CHK_TRUE(sl.begin() == sl.end());
+    CHK_TRUE(sl.rbegin() == sl.rend());
+    return 0;
+}
+
+void unrolled_map_writer(sl_unrolled_map<int, int, 16>* sl,
+                         int id, int num_threads, int n) {
+    for (int i=id; i<n; i+=num_threads) sl->insert( std::make_pair(i, i) );
+    // Leave multiples of 3 only.
+    for (int i=id; i<n; i+=num_threads) {
+        if (i % 3) sl->erase(i);
+    }
+}
+
+int unrolled_map_concurrent_test() {
+    sl_unrolled_map<int, int, 16> sl;
+    int n = 30000, num_threads = 4;
+    std::vector<std::thread> writers;
+    for (int i=0; i<num_threads; ++i) {
+        writers.push_back( std::thread( unrolled_map_writer,
+                                        &sl, i, num_threads, n ) );
+    }
+    // Scans see sorted entries, while chunks are split and merged.
+    for (int i=0; i<20; ++i) {
+        int prev = -1;
+        for (auto& entry: sl) {
+            CHK_GT(entry.first, prev);
+            CHK_EQ(entry.first, entry.second);
+            prev = entry.first;
+        }
+    }
+    for (auto& t: writers) t.join();
+
+    CHK_EQ((size_t)n/3, sl.size());
+    int count = 0;
+    for (auto& entry: sl) {
+        CHK_EQ(count, entry.first);
+        count += 3;
+    }
+    CHK_EQ(n, count);
+    return 0;
+}
+
+int unrolled_map_bulk_load_test() {
+    std::vector<std::pair<int, int>> entries;
+    for (int i=999; i>=0; --i) entries.push_back( std::make_pair(i, i*2) );
+    entries.push_back( std::make_pair(5, 0) );
+    sl_unrolled_map<int, int, 16> sl(entries.begin(), entries.end());
+    CHK_EQ((size_t)1000, sl.size());
+    int count = 0;
+    for (auto& entry: sl) {
+        CHK_EQ(count, entry.first);
+        CHK_EQ(count*2, entry.second);
+        count++;
+    }
+    CHK_EQ(1000, count);
+
+    // Still works as usual.
+    CHK_TRUE(sl.insert( std::make_pair(1000, 0) ).second);
+    CHK_EQ((size_t)1, sl.erase(500));
+    std::vector<int> keys = {0, 500, 1000, 1001};
+    auto ret = sl.multi_find(keys);
+    CHK_EQ(0, ret[0]->first);
+    CHK_TRUE(ret[1] == sl.end());
+    CHK_EQ(1000, ret[2]->first);
+    CHK_TRUE(ret[3] == sl.end());
+
+    sl_unrolled_map<int, int> sl_empty(entries.end(), entries.end());
+    CHK_TRUE(sl_empty.empty());
+    CHK_TRUE(sl_empty.begin() == sl_empty.end());
+    return 0;
+}
+
+int unrolled_set_test() {
+    sl_unrolled_set<int, 8> sl;
+    for (int i=0; i<500; ++i) CHK_TRUE(sl.insert((i * 7) % 500).second);
+    CHK_FALSE(sl.insert(3).second);
+    CHK_EQ((size_t)500, sl.size());
+    CHK_EQ(3, *sl.find(3));
+
+    int count = 0;
+    for (auto& key: sl) CHK_EQ(count++, key);
+    CHK_EQ(500, count);
+    for (auto itr = sl.rbegin(); itr != sl.rend(); --itr) {
+        CHK_EQ(--count, *itr);
+    }
+
+    for (int i=0; i<500; i+=2) CHK_EQ((size_t)1, sl.erase(i));
+    CHK_EQ(1, *sl.begin());
+    CHK_EQ((size_t)10, sl.truncate_before(21));
+    CHK_EQ(21, *sl.begin());
+
+    std::vector<int> keys = {9, 3, 3, 1};
+    sl_unrolled_set<int> sl2(keys.begin(), keys.end());
+    CHK_EQ((size_t)3, sl2.size());
+    auto ret = sl2.multi_find(keys);
+    CHK_EQ(9, *ret[0]);
+    CHK_EQ(1, *ret[3]);
+    auto itr = sl2.begin();
+    itr = sl2.erase(itr);
+    CHK_EQ(3, *itr);
+    return 0;
+}
+
+int node_pool_test() {
+    skiplist_raw slist;
+    skiplist_init(&slist, map_node<int, int>::cmp);
+    sl_node_pool pool(sizeof(map_node<int, int>), &slist);
+    // Freed blocks are reused first.
+    void* mem = pool.alloc(0);
+    pool.free(mem, 0);
+    CHK_EQ(mem, pool.alloc(0));
+    void* mem2 = pool.alloc(3);
+    CHK_NEQ(mem, mem2);
+    pool.free(mem2, 3);
+    CHK_EQ(mem2, pool.alloc(3));
+
+    // Reserved blocks, whose sizes fit the towers.
+    pool.reserve(1000, 4, 12);
+    std::vector<map_node<int, int>*> nodes;
+    for (int i=0; i<1000; ++i) {
+        nodes.push_back( map_node<int, int>::create(i % 5, &pool) );
+        nodes.back()->kv = std::make_pair(i, i);
+    }
+    for (auto& node: nodes) map_node<int, int>::dispose(node, &pool);
+
+    // Freed blocks have no room for the options turned on later.
+    skiplist_raw_config config = skiplist_get_config(&slist);
+    config.backwardLinks = 1;
+    skiplist_set_config(&slist, config);
+    CHK_NULL(pool.alloc(0));
+    config.backwardLinks = 0;
+    skiplist_set_config(&slist, config);
+    CHK_NONNULL(pool.alloc(0));
+    skiplist_free(&slist);
+    return 0;
+}
+
+int map_pool_test(bool huge_pages) {
+    skiplist_raw_config config = skiplist_get_default_config();
+    config.hugePages = huge_pages;
+    sl_map<int, std::string> sl(config);
+    sl.reserve(1000);
+    for (int round=0; round<3; ++round) {
+        for (int i=0; i<1000; ++i) {
+            CHK_TRUE(sl.insert( std::make_pair(i, std::to_string(i)) ).second);
+        }
+        CHK_FALSE(sl.insert( std::make_pair(7, std::string()) ).second);
+        CHK_EQ((size_t)1000, sl.size());
+        CHK_EQ(std::string("7"), sl.find(7)->second);
+        // Erased nodes go back to the pool for the next round.
+        for (int i=0; i<1000; ++i) sl.erase(i);
+        CHK_TRUE(sl.empty());
+    }
+
+    sl_set_gc<int> sl_gc;
+    sl_gc.reserve(100);
+    for (int i=0; i<100; ++i) sl_gc.insert(i);
+    for (int i=0; i<100; i+=2) sl_gc.erase(i);
+    CHK_EQ((size_t)50, sl_gc.size());
+    return 0;
+}
+
+int map_merge_iterator_test() {
+    // Memtables, the newest first: value tells which one has the entry.
+    int num_maps = 4;
+    std::vector<sl_map<int, int>> maps(num_maps);
+    std::vector<sl_map<int, int>*> map_ptrs;
+    std::map<int, int> newest;
+    std::mt19937 rng(1);
+    for (int i=0; i<num_maps; ++i) {
+        map_ptrs.push_back(&maps[i]);
+        for (int j=0; j<5000; ++j) {
+            int key = rng() % 10000;
+            maps[i].insert( std::make_pair(key, i) );
+            newest.insert( std::make_pair(key, i) );
+        }
+    }
+
+    sl_map_merge_iterator<int, int> itr(map_ptrs);
+    auto expected = newest.begin();
+    for (itr.seek_to_first(); itr.valid(); itr.next()) {
+        CHK_TRUE(expected != newest.end());
+        CHK_EQ(expected->first, itr->first);
+        CHK_EQ(expected->second, itr->second);
+        CHK_EQ(expected->second, (int)itr.source());
+        ++expected;
+    }
+    CHK_TRUE(expected == newest.end());
+
+    // Seek to each key, and to the ones in between.
+    for (int key=0; key<10000; key+=97) {
+        itr.seek(key);
+        auto lb = newest.lower_bound(key);
+        if (lb == newest.end()) {
+            CHK_FALSE(itr.valid());
+            continue;
+        }
+        CHK_EQ(lb->first, (*itr).first);
+        CHK_EQ(lb->second, (*itr).second);
+    }
+
+    size_t total = 0;
+    for (auto& map: maps) total += map.size();
+    sl_map_merge_iterator<int, int> all(map_ptrs, SL_MERGE_ALL);
+    size_t count = 0;
+    for (all.seek_to_first(); all.valid(); all.next()) count++;
+    CHK_EQ(total, count);
+    return 0;
+}
+
+// Serializer of a non-trivial type, given by the user.
+template<>
+struct sl_serializer<std::vector<int>> {
+    static const uint32_t fixed_size = 0;
+
+    static void write(const std::vector<int>& val, std::string& buf) {
+        uint32_t len = val.size();
+        buf.append(reinterpret_cast<const char*>(&len), sizeof(len));
+        for (int v: val) buf.append(reinterpret_cast<const char*>(&v), 4);
+    }
+
+    static bool read(const char*& pos, const char* end,
+                     std::vector<int>& val) {
+        uint32_t len;
+        if (!sl_serializer<uint32_t>::read(pos, end, len)) return false;
+        val.resize(len);
+        for (int& v: val) {
+            if (!sl_serializer<int>::read(pos, end, v)) return false;
+        }
+        return true;
+    }
+};
+
+int map_checkpoint_test() {
+    int n = 100000;
+    sl_map<int, std::string> sl;
+    std::vector<std::pair<int, std::string>> items;
+    for (int i=0; i<n; ++i) {
+        items.push_back( std::make_pair(i, std::to_string(i)) );
+    }
+    sl.insert(items.begin(), items.end());
+
+    std::stringstream ss;
+    CHK_Z(sl.checkpoint(ss));
+    std::string image = ss.str();
+
+    // Built at once.
+    sl_map<int, std::string> sl2;
+    std::stringstream in(image);
+    CHK_Z(sl2.load_checkpoint(in));
+    CHK_EQ((size_t)n, sl2.size());
+    int count = 0;
+    for (auto& entry: sl2) {
+        CHK_EQ(count, entry.first);
+        CHK_EQ(std::to_string(count), entry.second);
+        count++;
+    }
+    CHK_EQ(n, count);
+    CHK_EQ(std::string("777"), sl2.find(777)->second);
+
+    // Into a non-empty map, existing keys are kept.
+    sl_map<int, std::string> sl3;
+    sl3.insert( std::make_pair(5, std::string("five")) );
+    sl3.insert( std::make_pair(n + 5, std::string("more")) );
+    in.clear();
+    in.str(image);
+    CHK_Z(sl3.load_checkpoint(in));
+    CHK_EQ((size_t)n + 1, sl3.size());
+    CHK_EQ(std::string("five"), sl3.find(5)->second);
+    CHK_EQ(std::string("6"), sl3.find(6)->second);
+
+    // Not sorted, with duplicates: the first one of each key is kept.
+    std::stringstream ss_unsorted;
+    sl_checkpoint_writer<int, std::string> writer(ss_unsorted);
+    for (int i=0; i<1000; ++i) {
+        int key = (i * 7919) % 500;
+        writer.add(key, std::to_string(i));
+    }
+    CHK_Z(writer.finish());
+    sl_map<int, std::string> sl_unsorted;
+    CHK_Z(sl_unsorted.load_checkpoint(ss_unsorted));
+    CHK_EQ((size_t)500, sl_unsorted.size());
+    count = 0;
+    for (auto& entry: sl_unsorted) {
+        CHK_EQ(count, entry.first);
+        // `i` and `i + 500` give the same key.
+        int first = std::stoi(entry.second);
+        CHK_GT(500, first);
+        CHK_EQ(count, (first * 7919) % 500);
+        count++;
+    }
+    CHK_EQ(500, count);
+
+    // Broken, truncated, or of other types: nothing is loaded.
+    sl_map<int, std::string> sl4;
+    std::string broken = image;
+    broken[image.size() / 2] ^= 0x1;
+    in.clear();
+    in.str(broken);
+    CHK_EQ(-2, sl4.load_checkpoint(in));
+    in.clear();
+    in.str(image.substr(0, image.size() - 1));
+    CHK_EQ(-1, sl4.load_checkpoint(in));
+    CHK_TRUE(sl4.empty());
+    sl_map<int, int> sl5;
+    in.clear();
+    in.str(image);
+    CHK_EQ(-2, sl5.load_checkpoint(in));
+
+    // A broken block header, or a huge size which is not allocated
+    // before the payload is there.
+    size_t blk_pos = sizeof(sl_checkpoint_header);
+    broken = image;
+    broken[blk_pos + offsetof(sl_checkpoint_block, num_records)] ^= 0x1;
+    in.clear();
+    in.str(broken);
+    CHK_EQ(-2, sl4.load_checkpoint(in));
+    broken = image;
+    uint32_t huge = 0xffffffff;
+    memcpy(&broken[blk_pos + offsetof(sl_checkpoint_block, size)],
+           &huge, sizeof(huge));
+    in.clear();
+    in.str(broken);
+    CHK_EQ(-1, sl4.load_checkpoint(in));
+    CHK_TRUE(sl4.empty());
+
+    sl_map<int, int> sl_int;
+    for (int i=0; i<n; ++i) sl_int.insert( std::make_pair(i, i) );
+    std::stringstream ss_int;
+    CHK_Z(sl_int.checkpoint(ss_int));
+    broken = ss_int.str();
+    memcpy(&broken[blk_pos + offsetof(sl_checkpoint_block, size)],
+           &huge, sizeof(huge));
+    in.clear();
+    in.str(broken);
+    CHK_EQ(-2, sl5.load_checkpoint(in));
+    CHK_TRUE(sl5.empty());
+
+    // User-defined serializer.
+    sl_map<uint64_t, std::vector<int>> sl6;
+    for (int i=0; i<100; ++i) {
+        sl6.insert( std::make_pair((uint64_t)i, std::vector<int>(i, i)) );
+    }
+    std::stringstream ss6;
+    CHK_Z(sl6.checkpoint(ss6));
+    sl_map<uint64_t, std::vector<int>> sl7;
+    CHK_Z(sl7.load_checkpoint(ss6));
+    CHK_EQ((size_t)100, sl7.size());
+    CHK_EQ((size_t)42, sl7.find(42)->second.size());
+    CHK_EQ(42, sl7.find(42)->second[41]);
+    return 0;
+}
+
+int map_checkpoint_concurrent_test() {
+    // Snapshot of the entries, while a writer keeps going.
+    skiplist_raw_config config = skiplist_get_default_config();
+    config.versioned = 1;
+    config.reclaimMode = SKIPLIST_RECLAIM_EPOCH;
+    sl_map<int, int> sl(config);
+    int n = 100000;
+    for (int i=0; i<n; ++i) sl.insert( std::make_pair(i * 2, i) );
+
+    std::atomic<bool> stop(false);
+    std::thread writer([&]() {
+        int i = 0;
+        while (!stop) {
+            sl.insert( std::make_pair(i * 2 + 1, i) );
+            sl.erase(i * 2 + 1);
+            i = (i + 1) % n;
+        }
+    });
+    std::stringstream ss;
+    CHK_Z(sl.checkpoint(ss));
+    stop = true;
+    writer.join();
+
+    sl_map<int, int> sl2;
+    CHK_Z(sl2.load_checkpoint(ss));
+    int count = 0;
+    int odd = 0;
+    for (auto& entry: sl2) {
+        if (entry.first % 2) odd++;
+        else count++;
+    }
+    CHK_EQ(n, count);
+    CHK_SMEQ(odd, 1);
+    return 0;
+}
+
+int set_checkpoint_test() {
+    sl_set<std::string> sl;
+    for (int i=0; i<1000; ++i) sl.insert(std::to_string(i));
+    std::stringstream ss;
+    CHK_Z(sl.checkpoint(ss));
+
+    sl_set<std::string> sl2;
+    CHK_Z(sl2.load_checkpoint(ss));
+    CHK_EQ((size_t)1000, sl2.size());
+    auto itr = sl.begin();
+    for (auto& key: sl2) {
+        CHK_EQ(*itr, key);
+        ++itr;
+    }
+
+    // A map checkpoint is not a set one.
+    sl_map<std::string, int> sl3;
+    sl3.insert( std::make_pair(std::string("a"), 1) );
+    std::stringstream ss3;
+    CHK_Z(sl3.checkpoint(ss3));
+    sl_set<std::string> sl4;
+    CHK_EQ(-2, sl4.load_checkpoint(ss3));
+    return 0;
+}
+
+std::string _pmap_path(const char* name) {
+    return std::string("/tmp/sl_pmap_") + name + "_" +
+           std::to_string(getpid());
+}
+
+size_t _file_size(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0) return 0;
+    return st.st_size;
+}
+
+int persistent_map_test() {
+    std::string path = _pmap_path("basic");
+    unlink(path.c_str());
+    {
+        sl_persistent_map<int, uint64_t> sl;
+        CHK_Z(sl.open(path));
+        CHK_FALSE(sl.was_recovered());
+        for (int i=0; i<10000; ++i) {
+            CHK_TRUE(sl.insert( std::make_pair(i, (uint64_t)i * 10) ).second);
+        }
+        CHK_FALSE(sl.insert( std::make_pair(7, (uint64_t)0) ).second);
+        for (int i=0; i<10000; i+=2) CHK_EQ((size_t)1, sl.erase(i));
+        CHK_EQ((size_t)0, sl.erase(0));
+        CHK_EQ((size_t)5000, sl.size());
+    }
+
+    // Everything is back, without rebuilding.
+    sl_persistent_map<int, uint64_t> sl;
+    CHK_Z(sl.open(path));
+    CHK_FALSE(sl.was_recovered());
+    CHK_EQ((size_t)5000, sl.size());
+    CHK_EQ((uint64_t)70, sl.find(7)->second);
+    CHK_TRUE(sl.find(8) == sl.end());
+    CHK_EQ(9, sl.lower_bound(8)->first);
+    int count = 0;
+    for (auto& entry: sl) {
+        CHK_EQ(count * 2 + 1, entry.first);
+        CHK_EQ((uint64_t)entry.first * 10, entry.second);
+        count++;
+    }
+    CHK_EQ(5000, count);
+
+    // Iterator on an erased entry moves to the next one.
+    auto itr = sl.find(11);
+    sl.erase(11);
+    sl.erase(13);
+    ++itr;
+    CHK_EQ(15, itr->first);
+    itr = sl.erase(itr);
+    CHK_EQ(17, itr->first);
+
+    // Erased nodes are reused.
+    size_t file_size = _file_size(path);
+    for (int i=0; i<10000; i+=2) sl.insert( std::make_pair(i, (uint64_t)i) );
+    CHK_EQ(file_size, _file_size(path));
+    sl.close();
+
+    // Different type.
+    sl_persistent_map<int, uint32_t> sl2;
+    CHK_EQ(-2, sl2.open(path));
+    unlink(path.c_str());
+    return 0;
+}
+
+int persistent_map_recovery_test() {
+    std::string path = _pmap_path("crash");
+    std::string copy_path = _pmap_path("crash_copy");
+    unlink(path.c_str());
+    unlink(copy_path.c_str());
+
+    sl_persistent_map<uint64_t, uint64_t> sl;
+    CHK_Z(sl.open(path));
+    for (uint64_t i=0; i<10000; ++i) sl.insert( std::make_pair(i, i) );
+    for (uint64_t i=0; i<10000; i+=3) sl.erase(i);
+
+    // Copy of the file as a crash would leave it, without the clean flag.
+    // Upper layers and free lists are lost as well.
+    size_t file_size = _file_size(path);
+    std::vector<char> buf(file_size);
+    int fd = open(path.c_str(), O_RDONLY);
+    CHK_EQ((ssize_t)file_size, pread(fd, &buf[0], file_size, 0));
+    close(fd);
+    sl_persistent_header* hdr = (sl_persistent_header*)&buf[0];
+    CHK_Z(hdr->clean);
+    for (size_t i=1; i<SKIPLIST_MAX_LAYER; ++i) hdr->head[i] = 0;
+    for (size_t i=0; i<SKIPLIST_MAX_LAYER; ++i) hdr->free_heads[i] = 0;
+    hdr->num_entries = 0;
+    fd = open(copy_path.c_str(), O_RDWR | O_CREAT, 0644);
+    CHK_EQ((ssize_t)file_size, pwrite(fd, &buf[0], file_size, 0));
+    close(fd);
+    sl.close();
+
+    sl_persistent_map<uint64_t, uint64_t> sl2;
+    CHK_Z(sl2.open(copy_path));
+    CHK_TRUE(sl2.was_recovered());
+    CHK_EQ((size_t)6666, sl2.size());
+    for (uint64_t i=0; i<10000; ++i) {
+        auto itr = sl2.find(i);
+        if (i % 3 == 0) {
+            CHK_TRUE(itr == sl2.end());
+        } else {
+            CHK_EQ(i, itr->second);
+        }
+    }
+    // Erased nodes are found again.
+    for (uint64_t i=0; i<10000; i+=3) sl2.insert( std::make_pair(i, i) );
+    CHK_EQ((size_t)10000, sl2.size());
+    CHK_EQ(file_size, _file_size(copy_path));
+    sl2.close();
+
+    sl_persistent_map<uint64_t, uint64_t> sl3;
+    CHK_Z(sl3.open(copy_path));
+    CHK_FALSE(sl3.was_recovered());
+    CHK_EQ((size_t)10000, sl3.size());
+    sl3.close();
+
+    unlink(path.c_str());
+    unlink(copy_path.c_str());
+    return 0;
+}
+
+int persistent_map_concurrent_test() {
+    std::string path = _pmap_path("concurrent");
+    unlink(path.c_str());
+    sl_persistent_map<int, int> sl;
+    CHK_Z(sl.open(path));
+    int n = 10000;
+    for (int i=0; i<n; i+=2) sl.insert( std::make_pair(i, i) );
+
+    // Readers share the lock, while a writer moves odd keys in and out.
+    std::atomic<bool> stop(false);
+    std::thread writer([&]() {
+        while (!stop.load()) {
+            for (int i=1; i<n; i+=2) sl.insert( std::make_pair(i, i) );
+            for (int i=1; i<n; i+=2) sl.erase(i);
+        }
+    });
+    int num_readers = 4;
+    std::vector<std::thread> readers(num_readers);
+    std::atomic<int> num_errors(0);
+    for (int t=0; t<num_readers; ++t) {
+        readers[t] = std::thread([&, t]() {
+            for (int r=0; r<3; ++r) {
+                for (int i=t*2; i<n; i+=num_readers*2) {
+                    auto itr = sl.find(i);
+                    if (itr == sl.end() || itr->second != i) num_errors++;
+                }
+                int last = -1, evens = 0;
+                for (auto& entry: sl) {
+                    if (entry.first <= last) num_errors++;
+                    if (entry.first % 2 == 0) evens++;
+                    last = entry.first;
+                }
+                if (evens != n / 2) num_errors++;
+            }
+        });
+    }
+    for (auto& entry: readers) entry.join();
+    stop = true;
+    writer.join();
+    CHK_Z(num_errors.load());
+    CHK_EQ((size_t)n / 2, sl.size());
+
+    sl.close();
+    unlink(path.c_str());
+    return 0;
+}
+
+int memtable_test() {
+    sl_memtable<int, std::string> mt;
+    CHK_TRUE(mt.empty());
+    size_t mem_empty = mt.memory_usage();
+
+    std::map<int, std::string> expected;
+    std::mt19937 rng(1);
+    for (int i=0; i<10000; ++i) {
+        int key = rng() % 20000;
+        std::string val = std::to_string(i);
+        auto ret = mt.insert( std::make_pair(key, val) );
+        auto ret_exp = expected.insert( std::make_pair(key, val) );
+        CHK_EQ(ret_exp.second, ret.second);
+        CHK_EQ(key, ret.first->first);
+        // The first one is kept.
+        CHK_EQ(ret_exp.first->second, ret.first->second);
+    }
+    CHK_EQ(expected.size(), mt.size());
+    CHK_GT(mt.memory_usage(), mem_empty);
+
+    for (int key=0; key<20000; key+=7) {
+        auto itr = mt.find(key);
+        auto itr_exp = expected.find(key);
+        if (itr_exp == expected.end()) {
+            CHK_TRUE(itr == mt.end());
+            continue;
+        }
+        CHK_EQ(itr_exp->second, itr->second);
+
+        auto lb = mt.lower_bound(key + 1);
+        auto lb_exp = expected.lower_bound(key + 1);
+        if (lb_exp == expected.end()) {
+            CHK_TRUE(lb == mt.end());
+        } else {
+            CHK_EQ(lb_exp->first, lb->first);
+        }
+    }
+
+    mt.freeze();
+    CHK_TRUE(mt.frozen());
+    auto ret = mt.insert( std::make_pair(20001, std::string("x")) );
+    CHK_FALSE(ret.second);
+    CHK_TRUE(ret.first == mt.end());
+    CHK_EQ(expected.size(), mt.size());
+
+    // Flush.
+    auto itr_exp = expected.begin();
+    for (auto& entry: mt) {
+        CHK_TRUE(itr_exp != expected.end());
+        CHK_EQ(itr_exp->first, entry.first);
+        CHK_EQ(itr_exp->second, entry.second);
+        ++itr_exp;
+    }
+    CHK_TRUE(itr_exp == expected.end());
+    return 0;
+}
+
+int memtable_concurrent_test() {
+    sl_memtable<int, int> mt;
+    int num_writers = 4;
+    int num_keys = 100000;
+    std::atomic<bool> stop(false);
+    std::atomic<bool> unsorted(false);
+    std::atomic<size_t> num_inserted(0);
+
+    // Writers insert until frozen, the same keys in different orders.
+    std::vector<std::thread> writers;
+    for (int t=0; t<num_writers; ++t) {
+        writers.push_back(std::thread([&, t]() {
+            std::mt19937 rng(t);
+            while (!mt.frozen()) {
+                int key = rng() % num_keys;
+                if (mt.insert( std::make_pair(key, key) ).second) {
+                    num_inserted.fetch_add(1);
+                }
+            }
+        }));
+    }
+    // Readers see sorted entries while inserts go on.
+    std::thread reader([&]() {
+        while (!stop) {
+            int prev = -1;
+            for (auto& entry: mt) {
+                if (entry.first <= prev || entry.first != entry.second) {
+                    unsorted = true;
+                }
+                prev = entry.first;
+            }
+        }
+    });
+
+    while ( mt.memory_usage() < 2 * 1024 * 1024 &&
+            mt.size() < (size_t)num_keys ) {
+        std::this_thread::yield();
+    }
+    mt.freeze();
+    for (auto& w: writers) w.join();
+    stop = true;
+    reader.join();
+    CHK_FALSE(unsorted);
+
+    // Nothing slips in after `freeze()` returns.
+    size_t count = 0;
+    int prev = -1;
+    for (auto& entry: mt) {
+        CHK_GT(entry.first, prev);
+        prev = entry.first;
+        count++;
+    }
+    CHK_EQ(num_inserted.load(), count);
+    CHK_EQ(count, mt.size());
+    return 0;
+}
+
+// Counts how many are built from a number, and throws if it is negative.
+struct EmplaceVal {
+    EmplaceVal() : val(0) {}
+    explicit EmplaceVal(int _val) : val(_val) {
+        if (val < 0) throw std::runtime_error("negative");
+        numBuilt++;
+    }
+    int val;
+    static int numBuilt;
+};
+int EmplaceVal::numBuilt = 0;
+
+int map_emplace_test(skiplist_sync_mode sync_mode) {
+    skiplist_raw_config config = skiplist_get_default_config();
+    if (sync_mode == SKIPLIST_SYNC_LOCK_FREE) {
+        config.reclaimMode = SKIPLIST_RECLAIM_EPOCH;
+        config.syncMode = SKIPLIST_SYNC_LOCK_FREE;
+    }
+
+    // Move-only values.
+    sl_map<int, std::unique_ptr<int>> sl(config);
+    for (int i=0; i<1000; i+=2) {
+        auto ret = sl.emplace(i, std::unique_ptr<int>(new int(i)));
+        CHK_TRUE(ret.second);
+        CHK_EQ(i, *ret.first->second);
+    }
+    for (int i=0; i<1000; ++i) {
+        std::unique_ptr<int> val(new int(i * 10));
+        auto ret = sl.try_emplace(i, std::move(val));
+        CHK_EQ(i % 2 == 1, ret.second);
+        // Not moved from if the key is already there.
+        CHK_EQ(i % 2 == 0, (bool)val);
+        CHK_EQ(i, ret.first->first);
+        CHK_EQ((i % 2 == 1) ? i * 10 : i, *ret.first->second);
+    }
+    CHK_EQ((size_t)1000, sl.size());
+
+    for (int i=0; i<2000; i+=3) {
+        std::unique_ptr<int> val(new int(-i));
+        auto ret = sl.insert_or_assign(i, std::move(val));
+        CHK_EQ(i >= 1000, ret.second);
+        CHK_EQ(-i, *ret.first->second);
+    }
+    for (int i=0; i<2000; ++i) {
+        auto itr = sl.find(i);
+        if (i % 3 == 0) {
+            CHK_EQ(-i, *itr->second);
+        } else if (i < 1000) {
+            CHK_EQ((i % 2 == 1) ? i * 10 : i, *itr->second);
+        } else {
+            CHK_TRUE(itr == sl.end());
+        }
+    }
+
+    // Keys moved in, and the ones already there.
+    sl_map<std::string, std::string> sl_str(config);
+    std::string key = "key", val = "val";
+    CHK_TRUE(sl_str.try_emplace(std::move(key), 3, 'a').second);
+    CHK_EQ(std::string("aaa"), sl_str.find("key")->second);
+    std::string dup_key = "key";
+    CHK_FALSE(sl_str.try_emplace(std::move(dup_key), "b").second);
+    CHK_EQ(std::string("key"), dup_key);
+    CHK_FALSE(sl_str.insert_or_assign(std::string("key"), val).second);
+    CHK_EQ(std::string("val"), val);
+    CHK_EQ(std::string("val"), sl_str.find("key")->second);
+    CHK_FALSE(sl_str.insert( std::make_pair(std::string("key"),
+                                            std::string("c")) ).second);
+    CHK_EQ(std::string("val"), sl_str.find("key")->second);
+
+    // The value is built only if inserted, and what it throws leaves
+    // the map as it was.
+    sl_map<int, EmplaceVal> sl_val(config);
+    EmplaceVal::numBuilt = 0;
+    CHK_TRUE(sl_val.try_emplace(1, 10).second);
+    CHK_FALSE(sl_val.try_emplace(1, 20).second);
+    CHK_EQ(1, EmplaceVal::numBuilt);
+    CHK_EQ(10, sl_val.find(1)->second.val);
+    bool thrown = false;
+    try {
+        sl_val.try_emplace(2, -1);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    CHK_TRUE(thrown);
+    CHK_TRUE(sl_val.find(2) == sl_val.end());
+    CHK_TRUE(sl_val.try_emplace(2, 30).second);
+    CHK_EQ((size_t)2, sl_val.size());
+    return 0;
+}
+
+int map_insert_or_assign_concurrent_test() {
+    sl_map<int, int> sl;
+    int num_threads = 4;
+    int num_keys = 1000;
+
+    // Every key ends up with the value of one of the threads.
+    std::vector<std::thread> threads;
+    std::atomic<int> num_inserted(0);
+    for (int t=0; t<num_threads; ++t) {
+        threads.push_back(std::thread([&, t]() {
+            for (int i=0; i<num_keys * 10; ++i) {
+                int key = (i * 7 + t) % num_keys;
+                if (sl.insert_or_assign(key, t).second) num_inserted++;
+            }
+        }));
+    }
+    for (auto& th: threads) th.join();
+
+    CHK_EQ(num_keys, num_inserted.load());
+    CHK_EQ((size_t)num_keys, sl.size());
+    for (auto& entry: sl) {
+        CHK_SM(entry.second, num_threads);
+    }
+
+    // Same with `try_emplace()`: the first one of each key stays.
+    sl_map<int, int> sl_try;
+    threads.clear();
+    num_inserted = 0;
+    std::atomic<int> num_wrong(0);
+    for (int t=0; t<num_threads; ++t) {
+        threads.push_back(std::thread([&, t]() {
+            for (int i=0; i<num_keys * 10; ++i) {
+                int key = (i * 7 + t) % num_keys;
+                auto ret = sl_try.try_emplace(key, t);
+                if (ret.second) num_inserted++;
+                if (ret.first->first != key) num_wrong++;
+            }
+        }));
+    }
+    for (auto& th: threads) th.join();
+
+    CHK_EQ(num_keys, num_inserted.load());
+    CHK_Z(num_wrong.load());
+    CHK_EQ((size_t)num_keys, sl_try.size());
+    return 0;
+}
+
 int main(int argc, char** argv) {
     TestSuite tt(argc, argv);
 
     tt.doTest("container map test (busy wait)", map_basic_wait);
     tt.doTest("container map test (lazy gc)", map_basic_gc);
+    tt.doTest("container map test (epoch)", map_basic_epoch);
+    tt.doTest("container map test (hazard)", map_basic_hazard);
+    tt.doTest("container map hazard iterator test", map_hazard_iterator_test);
     tt.doTest("container map self refer test", map_self_refer_test);
+    tt.doTest("container map find hint test", map_find_hint_test);
+    tt.doTest("container map nth test", map_nth_test);
+    tt.doTest("container map multi find test", map_multi_find_test);
+    tt.doTest("container map snapshot test", map_snapshot_test);
+    tt.doTest("container map insert range test", map_insert_range_test);
+    tt.doTest("container map bulk load test", map_bulk_load_test);
+    tt.doTest("container map erase range test", map_erase_range_test);
+    tt.doTest("container map erase range test (lazy gc)",
+              map_erase_range_gc_test);
     tt.doTest("container set test (busy wait)", set_basic_wait);
     tt.doTest("container set test (lazy gc)", set_basic_gc);
+    tt.doTest("container set test (epoch)", set_basic_epoch);
+    tt.doTest("container set test (hazard)", set_basic_hazard);
     tt.doTest("container set self refer test", set_self_refer_test);
+    tt.doTest("container set bulk load test", set_bulk_load_test);
+    tt.doTest("container set nth test", set_nth_test);
+    tt.doTest("container set multi find test", set_multi_find_test);
+    tt.doTest("container set erase range test", set_erase_range_test);
+    tt.doTest("container node pool test", node_pool_test);
+    tt.doTest("container map pool test", map_pool_test, false);
+    tt.doTest("container map pool test (huge pages)", map_pool_test, true);
+    tt.doTest("container unrolled map test", unrolled_map_test,
+              SKIPLIST_RECLAIM_REFCOUNT);
+    tt.doTest("container unrolled map test (epoch)", unrolled_map_test,
+              SKIPLIST_RECLAIM_EPOCH);
+    tt.doTest("container unrolled map test (hazard)", unrolled_map_test,
+              SKIPLIST_RECLAIM_HAZARD);
+    tt.doTest("container unrolled map concurrent test",
+              unrolled_map_concurrent_test);
+    tt.doTest("container unrolled map bulk load test",
+              unrolled_map_bulk_load_test);
+    tt.doTest("container unrolled set test", unrolled_set_test);
+    tt.doTest("container map merge iterator test", map_merge_iterator_test);
+    tt.doTest("container map checkpoint test", map_checkpoint_test);
+    tt.doTest("container map checkpoint concurrent test",
+              map_checkpoint_concurrent_test);
+    tt.doTest("container set checkpoint test", set_checkpoint_test);
+    tt.doTest("container persistent map test", persistent_map_test);
+    tt.doTest("container persistent map recovery test",
+              persistent_map_recovery_test);
+    tt.doTest("container persistent map concurrent test",
+              persistent_map_concurrent_test);
+    tt.doTest("container memtable test", memtable_test);
+    tt.doTest("container memtable concurrent test", memtable_concurrent_test);
+    tt.doTest("container map emplace test", map_emplace_test,
+              SKIPLIST_SYNC_LOCK);
+    tt.doTest("container map emplace test (lock-free)", map_emplace_test,
+              SKIPLIST_SYNC_LOCK_FREE);
+    tt.doTest("container map insert or assign concurrent test",
+              map_insert_or_assign_concurrent_test);
 
     return 0;
 }
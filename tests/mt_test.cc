@@ -1,4 +1,5 @@
 #include "skiplist.h"
+#include "sl_engine.h"
 
 #include "test_common.h"
 
@@ -90,10 +91,10 @@ int _writer_thread(ThreadArgs* args) {
         if (cursor) {
             node = _get_entry(cursor, TestNode, snode);
             skiplist_erase_node(args->slist, &node->snode);
-            if (node->snode.being_modified ||
-                !node->snode.removed)
-                printf("%d %d\n", (int)node->snode.being_modified,
-                    (int)node->snode.removed);
+            if (_sl_being_modified(&node->snode) ||
+                !_sl_removed(&node->snode))
+                printf("%d %d\n", (int)_sl_being_modified(&node->snode),
+                    (int)_sl_removed(&node->snode));
             skiplist_release_node(&node->snode);
             skiplist_wait_for_free(&node->snode);
             delete node;
@@ -135,7 +136,7 @@ int itr_write_erase() {
     CHK_EQ(num, (int)skiplist_get_size(&slist));
 
     for (int ii=0; ii<num; ii+=1) {
-        CHK_EQ(0, node[ii]->snode.ref_count);
+        CHK_EQ(0, _sl_ref_count(&node[ii]->snode));
     }
 
     for (int ii=0; ii<num; ii+=2) {
@@ -143,7 +144,7 @@ int itr_write_erase() {
         delete node[ii];
     }
     for (int ii=1; ii<num; ii+=2) {
-        CHK_EQ(0, node[ii]->snode.ref_count);
+        CHK_EQ(0, _sl_ref_count(&node[ii]->snode));
     }
 
     ThreadArgs args_itr;
@@ -165,9 +166,9 @@ int itr_write_erase() {
     skiplist_node* cursor = skiplist_begin(&slist);
     while(cursor) {
         TestNode* cur_node = _get_entry(cursor, TestNode, snode);
-        if (cur_node->snode.ref_count != 1)
-            printf("%d %d\n", (int)cur_node->value, (int)cur_node->snode.ref_count);
-        CHK_EQ(1, cur_node->snode.ref_count);
+        if (_sl_ref_count(&cur_node->snode) != 1)
+            printf("%d %d\n", (int)cur_node->value, (int)_sl_ref_count(&cur_node->snode));
+        CHK_EQ(1, _sl_ref_count(&cur_node->snode));
         cursor = skiplist_next(&slist, cursor);
         skiplist_release_node(&cur_node->snode);
         delete cur_node;
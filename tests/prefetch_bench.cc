@@ -0,0 +1,296 @@
+/**
+ * Copyright (C) 2017-present Jung-Sang Ahn <jungsang.ahn@gmail.com>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Throughput of lookups and scans on large skiplists, whose nodes are
+// scattered in memory as if they were inserted in random order.
+// Lookups are done one by one, and then by `skiplist_find_batch()`.
+//
+// Scans are measured for each `prefetchDepth`, and lookups with
+// `searchPrefetch` on and off. Cache references and misses per operation
+// are read by `perf_event_open()` where available. Otherwise (not Linux,
+// no PMU as in many VMs, or `perf_event_paranoid` too high) only
+// throughputs are printed, and `perf stat -e cache-references,
+// cache-misses` on the whole run gives the totals instead.
+//
+// Each entry takes about 80 bytes: 100M entries need 8+ GB of memory.
+// Use `-r <number of entries>` to run only one of them.
+
+#include "skiplist.h"
+
+#include "test_common.h"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+struct BenchNode {
+    skiplist_node snode;
+    uint64_t key;
+    uint64_t value;
+};
+
+int _cmp_BenchNode(skiplist_node *a, skiplist_node *b, void *aux)
+{
+    BenchNode *aa, *bb;
+    aa = _get_entry(a, BenchNode, snode);
+    bb = _get_entry(b, BenchNode, snode);
+    if (aa->key < bb->key) return -1;
+    if (aa->key > bb->key) return 1;
+    return 0;
+}
+
+// Hardware cache references and misses of the calling thread.
+class CacheCounters {
+public:
+    CacheCounters() : refs(-1), misses(-1), error(0) {
+#if defined(__linux__)
+        refs = open(PERF_COUNT_HW_CACHE_REFERENCES);
+        misses = open(PERF_COUNT_HW_CACHE_MISSES);
+#else
+        error = ENOSYS;
+#endif
+    }
+
+    ~CacheCounters() {
+#if defined(__linux__)
+        if (refs >= 0) close(refs);
+        if (misses >= 0) close(misses);
+#endif
+    }
+
+    bool available() const { return refs >= 0 && misses >= 0; }
+
+    // Reason of `!available()`.
+    const char* why() const { return strerror(error); }
+
+    void start() {
+#if defined(__linux__)
+        if (!available()) return;
+        for (int fd: {refs, misses}) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    // ", N refs/op, M misses/op" of `num_ops` since `start()`,
+    // or an empty string if not available.
+    std::string stop(int num_ops) {
+        if (!available()) return std::string();
+        uint64_t num_refs = 0, num_misses = 0;
+#if defined(__linux__)
+        for (int fd: {refs, misses}) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+        if ( read(refs, &num_refs, sizeof(num_refs)) != sizeof(num_refs) ||
+             read(misses, &num_misses, sizeof(num_misses))
+                 != sizeof(num_misses) ) {
+            return std::string();
+        }
+#endif
+        char buf[128];
+        sprintf(buf, ", %.1f cache refs/op, %.1f misses/op",
+                (double)num_refs / num_ops, (double)num_misses / num_ops);
+        return buf;
+    }
+
+private:
+#if defined(__linux__)
+    int open(uint64_t config) {
+        struct perf_event_attr attr;
+        memset(&attr, 0x0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        int fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fd < 0) error = errno;
+        return fd;
+    }
+#endif
+
+    int refs;
+    int misses;
+    int error;
+};
+
+int prefetch_bench(int n)
+{
+    char msg[1024];
+    TestSuite::Timer tt;
+    TestSuite::appendResultMessage("\n");
+
+    // Epoch mode, so that any `prefetchDepth` applies.
+    skiplist_raw list;
+    skiplist_init(&list, _cmp_BenchNode);
+    skiplist_raw_config config = skiplist_get_default_config();
+    config.reclaimMode = SKIPLIST_RECLAIM_EPOCH;
+    skiplist_set_config(&list, config);
+
+    // Allocate the nodes in random order of keys.
+    std::vector<size_t> order(n);
+    for (int i=0; i<n; ++i) order[i] = i;
+    std::mt19937_64 rng(n);
+    std::shuffle(order.begin(), order.end(), rng);
+
+    std::vector<skiplist_node*> nodes(n);
+    for (int i=0; i<n; ++i) {
+        size_t idx = order[i];
+        size_t top = skiplist_bulk_load_top_layer(&list, idx);
+        BenchNode* node = (BenchNode*)
+            malloc(skiplist_inline_node_size(&list, sizeof(BenchNode), top));
+        skiplist_init_node_inline(&node->snode, node,
+                                  sizeof(BenchNode), top);
+        // Even numbers only, so that half of lookups miss.
+        node->key = idx * 2;
+        node->value = idx;
+        nodes[idx] = &node->snode;
+    }
+    CHK_Z(skiplist_bulk_load(&list, &nodes[0], n));
+    sprintf(msg, "build %d entries: %.1f sec\n",
+            n, tt.getTimeUs() / 1000000.0);
+    TestSuite::appendResultMessage(msg);
+
+    CacheCounters counters;
+    if (!counters.available()) {
+        sprintf(msg, "cache counters not available (%s), "
+                "run under `perf stat` instead\n", counters.why());
+        TestSuite::appendResultMessage(msg);
+    }
+
+    // Random lookups, one by one and then in batches of 32, with the
+    // prefetch on the search path and without. The same queries for both.
+    int num_queries = 1000000;
+    int batch = 32;
+    std::vector<BenchNode> queries(batch);
+    std::vector<skiplist_node*> query_nodes(batch);
+    std::vector<skiplist_node*> results(batch);
+    for (int i=0; i<batch; ++i) query_nodes[i] = &queries[i].snode;
+    double elapsed_sec = 0;
+    for (int search_prefetch = 1; search_prefetch >= 0; --search_prefetch) {
+        skiplist_set_prefetch(&list, config.prefetchDepth, search_prefetch);
+        const char* on_off = search_prefetch ? "on" : "off";
+
+        std::mt19937_64 qrng(n);
+        int num_found = 0;
+        BenchNode query;
+        counters.start();
+        tt.reset();
+        for (int i=0; i<num_queries; ++i) {
+            query.key = qrng() % ((uint64_t)n * 2);
+            skiplist_node* cur = skiplist_find(&list, &query.snode);
+            if (cur) {
+                num_found++;
+                skiplist_release_node(cur);
+            }
+        }
+        elapsed_sec = tt.getTimeUs() / 1000000.0;
+        std::string cache = counters.stop(num_queries);
+        sprintf(msg, "find (search prefetch %s): %.1f ops/sec, "
+                "found %.1f%%%s\n",
+                on_off, num_queries / elapsed_sec,
+                num_found * 100.0 / num_queries, cache.c_str());
+        TestSuite::appendResultMessage(msg);
+
+        num_found = 0;
+        counters.start();
+        tt.reset();
+        for (int i=0; i<num_queries; i+=batch) {
+            for (int j=0; j<batch; ++j) {
+                queries[j].key = qrng() % ((uint64_t)n * 2);
+            }
+            num_found += skiplist_find_batch(&list, &query_nodes[0],
+                                             &results[0], batch);
+            for (int j=0; j<batch; ++j) {
+                if (results[j]) skiplist_release_node(results[j]);
+            }
+        }
+        elapsed_sec = tt.getTimeUs() / 1000000.0;
+        cache = counters.stop(num_queries);
+        sprintf(msg, "find batch (%d, search prefetch %s): %.1f ops/sec, "
+                "found %.1f%%%s\n",
+                batch, on_off, num_queries / elapsed_sec,
+                num_found * 100.0 / num_queries, cache.c_str());
+        TestSuite::appendResultMessage(msg);
+    }
+
+    // Full scans with read-ahead.
+    std::vector<int> depths = {0, 1, 2, 4, 8};
+    for (int depth: depths) {
+        skiplist_set_prefetch(&list, depth, 1);
+
+        uint64_t sum = 0;
+        int count = 0;
+        counters.start();
+        tt.reset();
+        skiplist_node* cur = skiplist_begin(&list);
+        while (cur) {
+            sum += _get_entry(cur, BenchNode, snode)->value;
+            skiplist_node* next = skiplist_next(&list, cur);
+            skiplist_release_node(cur);
+            cur = next;
+            count++;
+        }
+        elapsed_sec = tt.getTimeUs() / 1000000.0;
+        std::string cache = counters.stop(count);
+        CHK_EQ(n, count);
+        CHK_EQ((uint64_t)n * (n - 1) / 2, sum);
+        sprintf(msg, "scan (prefetch depth %d): %.1f ops/sec%s\n",
+                depth, count / elapsed_sec, cache.c_str());
+        TestSuite::appendResultMessage(msg);
+    }
+
+    for (int i=0; i<n; ++i) {
+        free(_get_entry(nodes[i], BenchNode, snode));
+    }
+    skiplist_free(&list);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    TestSuite tt(argc, argv);
+
+    std::vector<int> params = {1000000, 10000000, 100000000};
+    tt.options.printTestMessage = true;
+    tt.doTest("prefetch benchmark", prefetch_bench, TestRange<int>(params));
+
+    return 0;
+}
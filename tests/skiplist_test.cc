@@ -25,9 +25,13 @@
  */
 
 #include "skiplist.h"
+#include "sl_engine.h"
+#include "sl_merge_iterator.h"
 
 #include "test_common.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <ctime>
 #include <mutex>
@@ -283,8 +287,23 @@ struct test_args {
     int n_readers;
     bool random_order;
     bool use_skiplist;
+    skiplist_reclaim_mode reclaim_mode;
+    skiplist_sync_mode sync_mode;
+    skiplist_wait_mode wait_mode;
 };
 
+void set_reclaim_mode(skiplist_raw* list,
+                      skiplist_reclaim_mode mode,
+                      skiplist_sync_mode sync_mode = SKIPLIST_SYNC_LOCK,
+                      skiplist_wait_mode wait_mode = SKIPLIST_WAIT_YIELD)
+{
+    skiplist_raw_config config = skiplist_get_default_config();
+    config.reclaimMode = mode;
+    config.syncMode = sync_mode;
+    config.waitMode = wait_mode;
+    skiplist_set_config(list, config);
+}
+
 int writer_thread(void *voidargs)
 {
     thread_args *args = (thread_args*)voidargs;
@@ -363,6 +382,8 @@ int concurrent_write_test(test_args t_args)
     std::set<int> stl_set;
 
     skiplist_init(&list, _cmp_IntNode);
+    set_reclaim_mode(&list, t_args.reclaim_mode,
+                     t_args.sync_mode, t_args.wait_mode);
 
     int i, j, temp;
     int n = t_args.n_keys;
@@ -469,6 +490,8 @@ int concurrent_write_erase_test(struct test_args t_args)
     std::set<int> stl_set;
 
     skiplist_init(&list, _cmp_IntNode);
+    set_reclaim_mode(&list, t_args.reclaim_mode,
+                     t_args.sync_mode, t_args.wait_mode);
 
     int i, j, temp;
     int n = t_args.n_keys;
@@ -666,6 +689,8 @@ int concurrent_write_read_test(struct test_args t_args)
     std::set<int> stl_set;
 
     skiplist_init(&list, _cmp_IntNode);
+    set_reclaim_mode(&list, t_args.reclaim_mode,
+                     t_args.sync_mode, t_args.wait_mode);
 
     int i, j, temp;
     int n = t_args.n_keys;
@@ -801,29 +826,2168 @@ int concurrent_write_read_test(struct test_args t_args)
     return 0;
 }
 
-int main(int argc, char** argv) {
-    TestSuite ts(argc, argv);
-    srand(0xabcd);
+void _free_IntNode(skiplist_node *node, void *ctx)
+{
+    std::atomic<size_t>* num_freed = (std::atomic<size_t>*)ctx;
+    IntNode *item = _get_entry(node, IntNode, snode);
+    // Poison the value, so that a reader can detect use-after-free.
+    item->value = -1;
+    delete item;
+    num_freed->fetch_add(1);
+}
 
-    struct test_args args;
-    args.n_keys = 40000;
-    args.random_order = true;
-    args.use_skiplist = true;
+struct retire_args {
+    skiplist_raw* list;
+    int n;
+    int begin;
+    int step;
+    std::atomic<size_t>* num_freed;
+    int num_corruption;
+};
 
-    //ts.options.printTestMessage = true;
-    ts.doTest("basic insert and erase", basic_insert_and_erase);
-    ts.doTest("find test", find_test);
+void retire_eraser(retire_args* args)
+{
+    for (int i = args->begin; i < args->n; i += args->step) {
+        IntNode query;
+        query.value = i;
+        skiplist_node *cur = skiplist_find(args->list, &query.snode);
+        if (!cur) continue;
 
-    args.n_writers = 8;
-    ts.doTest("concurrent write test", concurrent_write_test, args);
+        skiplist_erase_node(args->list, cur);
+        skiplist_release_node(cur);
+        // Should not wait for readers.
+        skiplist_retire_node(args->list, cur, _free_IntNode, args->num_freed);
+    }
+}
 
-    args.n_writers = 4;
-    args.n_erasers = 4;
-    ts.doTest("concurrent write erase test", concurrent_write_erase_test, args);
+void retire_reader(retire_args* args)
+{
+    for (int i = 0; i < args->n; ++i) {
+        IntNode query;
+        query.value = rand() % args->n;
+        skiplist_node *cur = skiplist_find(args->list, &query.snode);
+        if (!cur) continue;
 
-    args.n_writers = 1;
-    args.n_readers = 7;
-    ts.doTest("concurrent write read test", concurrent_write_read_test, args);
+        IntNode *item = _get_entry(cur, IntNode, snode);
+        if (item->value != query.value) args->num_corruption++;
+        skiplist_release_node(cur);
+    }
+}
+
+void retire_iterator(retire_args* args)
+{
+    // Hold each node by a hazard slot only, while erasers retire it.
+    skiplist_hazard* hazard = skiplist_hazard_acquire(args->list);
+    for (int i = 0; i < args->n / 100; ++i) {
+        skiplist_node *cur = skiplist_begin(args->list);
+        if (!cur) break;
+        skiplist_hazard_set(hazard, cur);
+        skiplist_release_node(cur);
+
+        int prev_value = -1;
+        for (int j = 0; cur && j < 100; ++j) {
+            IntNode *item = _get_entry(cur, IntNode, snode);
+            if (item->value <= prev_value) args->num_corruption++;
+            prev_value = item->value;
+            cur = skiplist_hazard_next(args->list, hazard);
+        }
+    }
+    skiplist_hazard_release(args->list, hazard);
+}
+
+int retire_test(skiplist_reclaim_mode mode)
+{
+    skiplist_raw list;
+    skiplist_init(&list, _cmp_IntNode);
+    set_reclaim_mode(&list, mode);
+
+    int i;
+    int n = 40000;
+    int n_erasers = 4;
+    int n_readers = 4;
+    for (i=0; i<n; ++i) {
+        IntNode *node = new IntNode();
+        node->value = i;
+        skiplist_insert(&list, &node->snode);
+    }
+
+    std::atomic<size_t> num_freed(0);
+    std::vector<retire_args> args(n_erasers + n_readers);
+    std::vector<std::thread> threads(n_erasers + n_readers);
+    for (i=0; i<n_erasers + n_readers; ++i) {
+        args[i].list = &list;
+        args[i].n = n;
+        args[i].begin = i;
+        args[i].step = n_erasers;
+        args[i].num_freed = &num_freed;
+        args[i].num_corruption = 0;
+        if (i < n_erasers) {
+            threads[i] = std::thread(retire_eraser, &args[i]);
+        } else if (mode == SKIPLIST_RECLAIM_HAZARD && i % 2) {
+            threads[i] = std::thread(retire_iterator, &args[i]);
+        } else {
+            threads[i] = std::thread(retire_reader, &args[i]);
+        }
+    }
+    for (i=0; i<n_erasers + n_readers; ++i) threads[i].join();
+
+    for (i=n_erasers; i<n_erasers + n_readers; ++i) {
+        CHK_EQ(0, args[i].num_corruption);
+    }
+    CHK_EQ(0, (int)skiplist_get_size(&list));
+    CHK_NULL(skiplist_begin(&list));
+
+    // Nobody is accessing the list now: each call advances the epoch
+    // (no-op for hazard), so that all retired nodes should be freed.
+    for (i=0; i<3; ++i) skiplist_reclaim(&list);
+    CHK_EQ((size_t)n, num_freed.load());
+
+    skiplist_free(&list);
+    return 0;
+}
+
+int finger_search_test()
+{
+    TestSuite::Timer tt;
+    TestSuite::appendResultMessage("\n");
+
+    double elapsed_sec = 1;
+    char msg[1024];
+
+    skiplist_raw list;
+    skiplist_init(&list, _cmp_IntNode);
+
+    int i, d;
+    int n = 100000;
+    std::vector<IntNode> arr(n);
+    for (i=0; i<n; ++i) {
+        arr[i].value = i*10;
+        skiplist_insert(&list, &arr[i].snode);
+    }
+
+    IntNode query, *item;
+    skiplist_node *ret, *hint;
+
+    // Various distances, including backward and out of range.
+    int dists[] = {1, 2, 7, 100, 5000, -1, -300};
+    for (d = 0; d < (int)(sizeof(dists) / sizeof(int)); ++d) {
+        for (i=0; i<1000; ++i) {
+            int h = rand() % n;
+            int q = h + dists[d];
+            hint = &arr[h].snode;
+
+            query.value = q*10;
+            ret = skiplist_find_from(&list, hint, &query.snode);
+            if (0 <= q && q < n) {
+                CHK_NONNULL(ret);
+                item = _get_entry(ret, IntNode, snode);
+                CHK_EQ(query.value, item->value);
+                skiplist_release_node(ret);
+            } else {
+                CHK_NULL(ret);
+            }
+
+            query.value = q*10 + 5;
+            ret = skiplist_find_smaller_or_equal_from(&list, hint,
+                                                      &query.snode);
+            if (0 <= q && q < n) {
+                CHK_NONNULL(ret);
+                item = _get_entry(ret, IntNode, snode);
+                CHK_EQ(q*10, item->value);
+                skiplist_release_node(ret);
+            }
+
+            query.value = q*10 - 5;
+            ret = skiplist_find_greater_or_equal_from(&list, hint,
+                                                      &query.snode);
+            if (0 <= q && q < n) {
+                CHK_NONNULL(ret);
+                item = _get_entry(ret, IntNode, snode);
+                CHK_EQ(q*10, item->value);
+                skiplist_release_node(ret);
+            }
+        }
+    }
+
+    // Sequential access: search from the previous result.
+    tt.reset();
+    hint = NULL;
+    for (i=0; i<n; ++i) {
+        query.value = i*10;
+        ret = skiplist_find_from(&list, hint, &query.snode);
+        CHK_NONNULL(ret);
+        if (hint) skiplist_release_node(hint);
+        hint = ret;
+    }
+    skiplist_release_node(hint);
+    elapsed_sec = tt.getTimeUs() / 1000000.0;
+    sprintf(msg, "find from hint (sequential): %.4f (%.1f ops/sec)\n",
+            elapsed_sec, n / elapsed_sec);
+    TestSuite::appendResultMessage(msg);
+
+    tt.reset();
+    for (i=0; i<n; ++i) {
+        query.value = i*10;
+        ret = skiplist_find(&list, &query.snode);
+        CHK_NONNULL(ret);
+        skiplist_release_node(ret);
+    }
+    elapsed_sec = tt.getTimeUs() / 1000000.0;
+    sprintf(msg, "find from head (sequential): %.4f (%.1f ops/sec)\n",
+            elapsed_sec, n / elapsed_sec);
+    TestSuite::appendResultMessage(msg);
+
+    skiplist_free(&list);
+    return 0;
+}
+
+void batch_inserter(skiplist_raw* list, IntNode* arr, int n)
+{
+    std::vector<skiplist_node*> nodes(n);
+    for (int i=0; i<n; ++i) nodes[i] = &arr[i].snode;
+    // Multiple runs.
+    for (int i=0; i<n; i+=n/4) {
+        skiplist_insert_batch(list, &nodes[i], n/4);
+    }
+}
+
+int batch_insert_test(skiplist_reclaim_mode mode)
+{
+    TestSuite::Timer tt;
+    TestSuite::appendResultMessage("\n");
+    char msg[1024];
+
+    int i;
+    int n = 100000;
+    int n_threads = 4;
+
+    // Single thread: compare with individual inserts.
+    for (int batch = 0; batch < 2; ++batch) {
+        skiplist_raw list;
+        skiplist_init(&list, _cmp_IntNode);
+        set_reclaim_mode(&list, mode);
+        std::vector<IntNode> arr(n);
+        std::vector<skiplist_node*> nodes(n);
+        for (i=0; i<n; ++i) {
+            arr[i].value = i;
+            nodes[i] = &arr[i].snode;
+        }
+
+        tt.reset();
+        if (batch) {
+            CHK_EQ((size_t)n, skiplist_insert_batch(&list, &nodes[0], n));
+        } else {
+            for (i=0; i<n; ++i) skiplist_insert(&list, nodes[i]);
+        }
+        double elapsed_sec = tt.getTimeUs() / 1000000.0;
+        sprintf(msg, "%s: %.4f (%.1f ops/sec)\n",
+                batch ? "batch insert" : "single insert",
+                elapsed_sec, n / elapsed_sec);
+        TestSuite::appendResultMessage(msg);
+
+        CHK_EQ(n, (int)skiplist_get_size(&list));
+        skiplist_node* cur = skiplist_begin(&list);
+        for (i=0; i<n; ++i) {
+            CHK_NONNULL(cur);
+            CHK_EQ(i, _get_entry(cur, IntNode, snode)->value);
+            skiplist_node* next = skiplist_next(&list, cur);
+            skiplist_release_node(cur);
+            cur = next;
+        }
+        CHK_NULL(cur);
+        skiplist_free(&list);
+    }
+
+    // Duplicate keys, within the batch and with existing ones.
+    {
+        skiplist_raw list;
+        skiplist_init(&list, _cmp_IntNode);
+        set_reclaim_mode(&list, mode);
+        std::vector<IntNode> arr(30);
+        std::vector<skiplist_node*> nodes(20);
+        std::vector<int> results(20);
+        for (i=0; i<10; ++i) {
+            arr[i].value = i*2;
+            skiplist_insert(&list, &arr[i].snode);
+        }
+        for (i=0; i<20; ++i) {
+            // 0, 0, 1, 1, 2, 2, ...
+            arr[10+i].value = i/2;
+            nodes[i] = &arr[10+i].snode;
+        }
+        CHK_EQ(5, (int)skiplist_insert_batch_nodup(&list, &nodes[0], 20,
+                                                   &results[0]));
+        for (i=0; i<20; ++i) {
+            bool inserted = (i % 2 == 0) && ((i/2) % 2 == 1);
+            CHK_EQ(inserted ? 0 : -1, results[i]);
+        }
+        CHK_EQ(15, (int)skiplist_get_size(&list));
+        skiplist_free(&list);
+    }
+
+    // Concurrent: interleaved sorted runs.
+    {
+        skiplist_raw list;
+        skiplist_init(&list, _cmp_IntNode);
+        set_reclaim_mode(&list, mode);
+        std::vector< std::vector<IntNode> > arr(n_threads);
+        std::vector<std::thread> threads(n_threads);
+        for (int t=0; t<n_threads; ++t) {
+            arr[t] = std::vector<IntNode>(n / n_threads);
+            for (i=0; i<n/n_threads; ++i) arr[t][i].value = i*n_threads + t;
+            threads[t] = std::thread(batch_inserter, &list,
+                                     &arr[t][0], n / n_threads);
+        }
+        for (int t=0; t<n_threads; ++t) threads[t].join();
+
+        CHK_EQ(n, (int)skiplist_get_size(&list));
+        skiplist_node* cur = skiplist_begin(&list);
+        for (i=0; i<n; ++i) {
+            CHK_NONNULL(cur);
+            CHK_EQ(i, _get_entry(cur, IntNode, snode)->value);
+            skiplist_node* next = skiplist_next(&list, cur);
+            skiplist_release_node(cur);
+            cur = next;
+        }
+        CHK_NULL(cur);
+        skiplist_free(&list);
+    }
+    return 0;
+}
+
+void _count_removed(skiplist_node *node, void *ctx)
+{
+    std::vector<int>* removed = (std::vector<int>*)ctx;
+    removed->push_back(_get_entry(node, IntNode, snode)->value);
+}
+
+void range_inserter(skiplist_raw* list, IntNode* arr, int n)
+{
+    for (int i=0; i<n; ++i) skiplist_insert(list, &arr[i].snode);
+}
+
+int erase_range_test(skiplist_reclaim_mode mode)
+{
+    TestSuite::Timer tt;
+    TestSuite::appendResultMessage("\n");
+    char msg[1024];
+
+    int i;
+    int n = 100000;
+
+    // Single thread: compare with individual erases.
+    for (int range = 0; range < 2; ++range) {
+        skiplist_raw list;
+        skiplist_init(&list, _cmp_IntNode);
+        set_reclaim_mode(&list, mode);
+        std::vector<IntNode> arr(n);
+        for (i=0; i<n; ++i) {
+            arr[i].value = i;
+            skiplist_insert(&list, &arr[i].snode);
+        }
+
+        IntNode from, to;
+        from.value = n / 4;
+        to.value = n / 4 * 3;
+        std::vector<int> removed;
+        tt.reset();
+        if (range) {
+            CHK_EQ((size_t)n/2, skiplist_erase_range(&list, &from.snode,
+                                                     &to.snode,
+                                                     _count_removed,
+                                                     &removed));
+        } else {
+            for (i=from.value; i<to.value; ++i) {
+                skiplist_erase_node(&list, &arr[i].snode);
+            }
+        }
+        double elapsed_sec = tt.getTimeUs() / 1000000.0;
+        sprintf(msg, "%s: %.4f (%.1f ops/sec)\n",
+                range ? "range erase" : "single erase",
+                elapsed_sec, n / 2 / elapsed_sec);
+        TestSuite::appendResultMessage(msg);
+
+        if (range) {
+            CHK_EQ((size_t)n/2, removed.size());
+            for (i=0; i<n/2; ++i) CHK_EQ(n/4 + i, removed[i]);
+        }
+        CHK_EQ(n/2, (int)skiplist_get_size(&list));
+        skiplist_node* cur = skiplist_begin(&list);
+        for (i=0; i<n; ++i) {
+            if (from.value <= i && i < to.value) continue;
+            CHK_EQ(&arr[i].snode, cur);
+            skiplist_node* next = skiplist_next(&list, cur);
+            skiplist_release_node(cur);
+            cur = next;
+        }
+        CHK_NULL(cur);
+        skiplist_free(&list);
+    }
+
+    // Boundaries: empty range, prefix, and suffix.
+    {
+        skiplist_raw list;
+        skiplist_init(&list, _cmp_IntNode);
+        set_reclaim_mode(&list, mode);
+        std::vector<IntNode> arr(100);
+        for (i=0; i<100; ++i) {
+            arr[i].value = i * 10;
+            skiplist_insert(&list, &arr[i].snode);
+        }
+        IntNode from, to;
+        from.value = 11;
+        to.value = 19;
+        CHK_Z(skiplist_erase_range(&list, &from.snode, &to.snode, NULL, NULL));
+        to.value = 0;
+        CHK_Z(skiplist_truncate_before(&list, &to.snode, NULL, NULL));
+
+        to.value = 105;
+        CHK_EQ(11, (int)skiplist_truncate_before(&list, &to.snode,
+                                                 NULL, NULL));
+        from.value = 905;
+        CHK_EQ(9, (int)skiplist_erase_range(&list, &from.snode, NULL,
+                                            NULL, NULL));
+        CHK_EQ(80, (int)skiplist_get_size(&list));
+        skiplist_node* cur = skiplist_begin(&list);
+        CHK_EQ(&arr[11].snode, cur);
+        skiplist_release_node(cur);
+        cur = skiplist_end(&list);
+        CHK_EQ(&arr[90].snode, cur);
+        skiplist_release_node(cur);
+
+        CHK_EQ(80, (int)skiplist_erase_range(&list, NULL, NULL, NULL, NULL));
+        CHK_NULL(skiplist_begin(&list));
+        skiplist_free(&list);
+    }
+
+    // Concurrent: truncate while others insert on both sides.
+    {
+        skiplist_raw list;
+        skiplist_init(&list, _cmp_IntNode);
+        set_reclaim_mode(&list, mode);
+        int n_threads = 2;
+        std::vector<IntNode> arr(n);
+        for (i=0; i<n/2; ++i) {
+            arr[i].value = i * 2;
+            skiplist_insert(&list, &arr[i].snode);
+        }
+        std::vector<std::thread> threads(n_threads);
+        for (int t=0; t<n_threads; ++t) {
+            // Odd numbers in the lower and upper half.
+            IntNode* base = &arr[n/2 + t * n/4];
+            for (i=0; i<n/4; ++i) base[i].value = (t * n/2) + i * 2 + 1;
+            threads[t] = std::thread(range_inserter, &list, base, n/4);
+        }
+        IntNode to;
+        to.value = n / 2;
+        std::vector<int> removed;
+        skiplist_truncate_before(&list, &to.snode, _count_removed, &removed);
+        for (int t=0; t<n_threads; ++t) threads[t].join();
+
+        std::set<int> removed_set(removed.begin(), removed.end());
+        CHK_EQ(removed.size(), removed_set.size());
+        int num_left = 0;
+        skiplist_node* cur = skiplist_begin(&list);
+        int prev_value = -1;
+        while (cur) {
+            int value = _get_entry(cur, IntNode, snode)->value;
+            CHK_GT(value, prev_value);
+            CHK_FALSE(removed_set.count(value));
+            prev_value = value;
+            num_left++;
+            skiplist_node* next = skiplist_next(&list, cur);
+            skiplist_release_node(cur);
+            cur = next;
+        }
+        CHK_EQ(n, (int)removed.size() + num_left);
+        CHK_EQ(num_left, (int)skiplist_get_size(&list));
+        skiplist_free(&list);
+    }
+    return 0;
+}
+
+void lock_free_eraser(skiplist_raw* list,
+                      std::vector<IntNode>* arr,
+                      std::atomic<int>* num_erased,
+                      std::atomic<int>* num_errors)
+{
+    for (size_t i=0; i<arr->size(); ++i) {
+        int ret = skiplist_erase_node(list, &(*arr)[i].snode);
+        if (ret == 0) {
+            num_erased->fetch_add(1);
+        } else if (ret != -1) {
+            // Should be either erased by this thread or others.
+            num_errors->fetch_add(1);
+        }
+    }
+}
+
+void lock_free_inserter(skiplist_raw* list,
+                        IntNode* arr,
+                        int n,
+                        std::atomic<int>* num_inserted)
+{
+    for (int i=0; i<n; ++i) {
+        if (skiplist_insert_nodup(list, &arr[i].snode) == 0) {
+            num_inserted->fetch_add(1);
+        }
+    }
+}
+
+int lock_free_test()
+{
+    int i;
+    skiplist_raw list;
+    skiplist_init(&list, _cmp_IntNode);
+
+    // Supported in epoch mode only.
+    set_reclaim_mode(&list, SKIPLIST_RECLAIM_REFCOUNT, SKIPLIST_SYNC_LOCK_FREE);
+    CHK_EQ(SKIPLIST_SYNC_LOCK, skiplist_get_config(&list).syncMode);
+    set_reclaim_mode(&list, SKIPLIST_RECLAIM_HAZARD, SKIPLIST_SYNC_LOCK_FREE);
+    CHK_EQ(SKIPLIST_SYNC_LOCK, skiplist_get_config(&list).syncMode);
+    set_reclaim_mode(&list, SKIPLIST_RECLAIM_EPOCH, SKIPLIST_SYNC_LOCK_FREE);
+    CHK_EQ(SKIPLIST_SYNC_LOCK_FREE, skiplist_get_config(&list).syncMode);
+
+    // Duplicate keys, and return values of erase.
+    int n = 100;
+    std::vector<IntNode> arr(n);
+    for (i=0; i<n; ++i) {
+        arr[i].value = i / 4;
+        CHK_Z(skiplist_insert(&list, &arr[i].snode));
+    }
+    IntNode dup;
+    dup.value = 10;
+    CHK_EQ(-1, skiplist_insert_nodup(&list, &dup.snode));
+    CHK_EQ(-3, skiplist_erase_node(&list, &dup.snode));
+    CHK_Z(skiplist_erase_node(&list, &arr[41].snode));
+    CHK_EQ(-1, skiplist_erase_node(&list, &arr[41].snode));
+    CHK_Z(skiplist_erase(&list, &dup.snode));
+    CHK_EQ(n - 2, (int)skiplist_get_size(&list));
+
+    int count = 0;
+    skiplist_node* cur = skiplist_begin(&list);
+    while (cur) {
+        IntNode* node = _get_entry(cur, IntNode, snode);
+        CHK_EQ(count / 4, node->value);
+        CHK_NEQ(&arr[41], node);
+        count += (count == 39) ? 3 : 1;
+        cur = skiplist_next(&list, cur);
+        skiplist_release_node(&node->snode);
+    }
+    CHK_EQ(n, count);
+    skiplist_free(&list);
+
+    // Erasers race on the same nodes: each node is erased exactly once.
+    {
+        skiplist_init(&list, _cmp_IntNode);
+        set_reclaim_mode(&list, SKIPLIST_RECLAIM_EPOCH,
+                         SKIPLIST_SYNC_LOCK_FREE);
+        n = 10000;
+        std::vector<IntNode> nodes(n);
+        for (i=0; i<n; ++i) {
+            nodes[i].value = i;
+            skiplist_insert(&list, &nodes[i].snode);
+        }
+        std::atomic<int> num_erased(0), num_errors(0);
+        std::vector<std::thread> threads(4);
+        for (auto& entry: threads) {
+            entry = std::thread(lock_free_eraser, &list, &nodes,
+                                &num_erased, &num_errors);
+        }
+        for (auto& entry: threads) entry.join();
+        CHK_EQ(n, num_erased.load());
+        CHK_Z(num_errors.load());
+        CHK_Z(skiplist_get_size(&list));
+        CHK_NULL(skiplist_begin(&list));
+        skiplist_free(&list);
+    }
+
+    // Inserters race on the same keys: each key is inserted exactly once.
+    {
+        skiplist_init(&list, _cmp_IntNode);
+        set_reclaim_mode(&list, SKIPLIST_RECLAIM_EPOCH,
+                         SKIPLIST_SYNC_LOCK_FREE);
+        n = 10000;
+        int n_threads = 4;
+        std::vector<IntNode> nodes(n * n_threads);
+        for (i=0; i<n * n_threads; ++i) nodes[i].value = i % n;
+        std::atomic<int> num_inserted(0);
+        std::vector<std::thread> threads(n_threads);
+        for (int t=0; t<n_threads; ++t) {
+            threads[t] = std::thread(lock_free_inserter, &list,
+                                     &nodes[t * n], n, &num_inserted);
+        }
+        for (auto& entry: threads) entry.join();
+        CHK_EQ(n, num_inserted.load());
+        CHK_EQ(n, (int)skiplist_get_size(&list));
+
+        count = 0;
+        cur = skiplist_begin(&list);
+        while (cur) {
+            CHK_EQ(count, _get_entry(cur, IntNode, snode)->value);
+            skiplist_node* next = skiplist_next(&list, cur);
+            skiplist_release_node(cur);
+            cur = next;
+            count++;
+        }
+        CHK_EQ(n, count);
+        skiplist_free(&list);
+    }
+    return 0;
+}
+
+void parked_reader(skiplist_raw* list,
+                   skiplist_node* node,
+                   std::atomic<skiplist_node*>* result)
+{
+    result->store(skiplist_next(list, node));
+}
+
+int spin_park_test()
+{
+    skiplist_raw list;
+    skiplist_init(&list, _cmp_IntNode);
+    set_reclaim_mode(&list, SKIPLIST_RECLAIM_REFCOUNT,
+                     SKIPLIST_SYNC_LOCK, SKIPLIST_WAIT_SPIN_PARK);
+    CHK_EQ(SKIPLIST_WAIT_SPIN_PARK, skiplist_get_config(&list).waitMode);
+
+    std::vector<IntNode> arr(2);
+    for (int i=0; i<2; ++i) {
+        arr[i].value = i;
+        skiplist_insert(&list, &arr[i].snode);
+    }
+
+    // Reader waits for the writer, longer than spinning.
+    skiplist_node* dummy = &arr[0].snode;
+    std::atomic<skiplist_node*> result(dummy);
+    _sl_write_lock_an(&list, &arr[0].snode);
+    std::thread reader(parked_reader, &list, &arr[0].snode, &result);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHK_EQ(dummy, result.load());
+    CHK_TRUE(_sl_state(&arr[0].snode) & _SL_AN_PARKED);
+
+    _sl_write_unlock_an(&arr[0].snode);
+    reader.join();
+    CHK_EQ(&arr[1].snode, result.load());
+    skiplist_release_node(result.load());
+    CHK_Z(_sl_state(&arr[0].snode) & _SL_ST_AN);
+
+    skiplist_free(&list);
+    return 0;
+}
+
+void size_counter_worker(skiplist_raw* list, IntNode* arr, int n)
+{
+    for (int i=0; i<n; ++i) skiplist_insert(list, &arr[i].snode);
+    // Erase every other one.
+    for (int i=0; i<n; i+=2) skiplist_erase_node(list, &arr[i].snode);
+}
+
+int size_counter_test()
+{
+    skiplist_raw list;
+    skiplist_init(&list, _cmp_IntNode);
+
+    // Not too many, as the list degrades once upper layers are gone below.
+    int i, n = 16000, n_threads = 8;
+    std::vector<IntNode> arr(n);
+    for (i=0; i<n; ++i) arr[i].value = i;
+
+    std::vector<std::thread> threads(n_threads);
+    for (int t=0; t<n_threads; ++t) {
+        int per_thread = n / n_threads;
+        threads[t] = std::thread(size_counter_worker, &list,
+                                 &arr[t * per_thread], per_thread);
+    }
+    for (auto& entry: threads) entry.join();
+
+    CHK_EQ(n/2, (int)skiplist_get_size(&list));
+    size_t approx = skiplist_get_size_approx(&list);
+    CHK_SMEQ((size_t)n/2 - _SL_SIZE_SHARDS * _SL_SIZE_BATCH, approx);
+    CHK_SMEQ(approx, (size_t)n/2 + _SL_SIZE_SHARDS * _SL_SIZE_BATCH);
+
+    // `top_layer` follows the tallest node left.
+    int max_top = 0;
+    for (i=1; i<n; i+=2) {
+        int top = _sl_top_layer(&arr[i].snode);
+        if (top > max_top) max_top = top;
+    }
+    CHK_EQ(max_top, (int)list.top_layer);
+
+    for (int layer = max_top; layer > 0; --layer) {
+        for (i=1; i<n; i+=2) {
+            if ((int)_sl_top_layer(&arr[i].snode) == layer) {
+                skiplist_erase_node(&list, &arr[i].snode);
+            }
+        }
+        CHK_EQ(layer - 1, (int)list.top_layer);
+    }
+    for (i=1; i<n; i+=2) skiplist_erase_node(&list, &arr[i].snode);
+    CHK_Z(skiplist_get_size(&list));
+    CHK_Z((int)list.top_layer);
+
+    skiplist_free(&list);
+    return 0;
+}
+
+void backward_link_writer(skiplist_raw* list, IntNode* arr, int n)
+{
+    for (int i=0; i<n; ++i) skiplist_insert(list, &arr[i].snode);
+    for (int i=0; i<n; i+=2) skiplist_erase_node(list, &arr[i].snode);
+}
+
+int backward_link_test(skiplist_reclaim_mode mode)
+{
+    TestSuite::Timer tt;
+    TestSuite::appendResultMessage("\n");
+    char msg[1024];
+
+    int i, n = 100000;
+    for (int links = 0; links < 2; ++links) {
+        skiplist_raw list;
+        skiplist_init(&list, _cmp_IntNode);
+        skiplist_raw_config config = skiplist_get_default_config();
+        config.reclaimMode = mode;
+        config.backwardLinks = links;
+        skiplist_set_config(&list, config);
+        CHK_EQ(links, skiplist_get_config(&list).backwardLinks);
+
+        std::vector<IntNode> arr(n);
+        for (i=0; i<n; ++i) {
+            arr[i].value = (i * 7919) % n;
+            skiplist_insert(&list, &arr[i].snode);
+        }
+        // Erase some of them, to check the links of their neighbors.
+        for (i=0; i<n; i+=3) skiplist_erase_node(&list, &arr[i].snode);
+
+        tt.reset();
+        int count = 0, last = n;
+        skiplist_node* cur = skiplist_end(&list);
+        while (cur) {
+            IntNode* node = _get_entry(cur, IntNode, snode);
+            CHK_GT(last, node->value);
+            last = node->value;
+            skiplist_node* prev = skiplist_prev(&list, cur);
+            skiplist_release_node(cur);
+            cur = prev;
+            count++;
+        }
+        double elapsed_sec = tt.getTimeUs() / 1000000.0;
+        CHK_EQ((int)skiplist_get_size(&list), count);
+        sprintf(msg, "reverse iteration (%s): %.4f (%.1f ops/sec)\n",
+                links ? "backward links" : "search",
+                elapsed_sec, count / elapsed_sec);
+        TestSuite::appendResultMessage(msg);
+        skiplist_free(&list);
+    }
+
+    // Re-insert of the same height keeps the tower, with `prev`.
+    {
+        skiplist_raw list;
+        skiplist_init(&list, _cmp_IntNode);
+        skiplist_raw_config config = skiplist_get_default_config();
+        config.reclaimMode = mode;
+        config.backwardLinks = 1;
+        config.maxLayer = 1;
+        skiplist_set_config(&list, config);
+
+        IntNode node;
+        node.value = 1;
+        skiplist_insert(&list, &node.snode);
+        atm_node_ptr* tower = node.snode.next;
+        skiplist_erase_node(&list, &node.snode);
+        skiplist_wait_for_free(&node.snode);
+        skiplist_insert(&list, &node.snode);
+        CHK_EQ(tower, node.snode.next);
+
+        skiplist_node* cur = skiplist_end(&list);
+        CHK_EQ(&node.snode, cur);
+        CHK_NULL(skiplist_prev(&list, cur));
+        skiplist_release_node(cur);
+        skiplist_erase_node(&list, &node.snode);
+        skiplist_wait_for_free(&node.snode);
+        skiplist_free(&list);
+
+        // And grows for a list with more options.
+        skiplist_init(&list, _cmp_IntNode);
+        config.versioned = 1;
+        skiplist_set_config(&list, config);
+        skiplist_insert(&list, &node.snode);
+        uint64_t seq = skiplist_snapshot(&list);
+        cur = skiplist_snapshot_find(&list, seq, &node.snode);
+        CHK_EQ(&node.snode, cur);
+        skiplist_release_node(cur);
+        skiplist_snapshot_release(&list, seq);
+        skiplist_erase_node(&list, &node.snode);
+        skiplist_wait_for_free(&node.snode);
+        skiplist_free(&list);
+    }
+
+    // Reverse scan while others insert and erase.
+    {
+        skiplist_raw list;
+        skiplist_init(&list, _cmp_IntNode);
+        skiplist_raw_config config = skiplist_get_default_config();
+        config.reclaimMode = mode;
+        config.backwardLinks = 1;
+        skiplist_set_config(&list, config);
+
+        int n_threads = 4;
+        std::vector<IntNode> arr(n);
+        for (i=0; i<n; ++i) arr[i].value = (i * 7919) % n;
+        std::vector<std::thread> threads(n_threads);
+        for (int t=0; t<n_threads; ++t) {
+            threads[t] = std::thread(backward_link_writer, &list,
+                                     &arr[t * n / n_threads], n / n_threads);
+        }
+        for (int round = 0; round < 10; ++round) {
+            int last = n;
+            skiplist_node* cur = skiplist_end(&list);
+            while (cur) {
+                IntNode* node = _get_entry(cur, IntNode, snode);
+                CHK_GT(last, node->value);
+                last = node->value;
+                skiplist_node* prev = skiplist_prev(&list, cur);
+                skiplist_release_node(cur);
+                cur = prev;
+            }
+        }
+        for (auto& entry: threads) entry.join();
+
+        int count = 0;
+        skiplist_node* cur = skiplist_end(&list);
+        while (cur) {
+            skiplist_node* prev = skiplist_prev(&list, cur);
+            skiplist_release_node(cur);
+            cur = prev;
+            count++;
+        }
+        CHK_EQ(n / 2, count);
+        skiplist_free(&list);
+    }
+
+    // Not available in lock-free mode.
+    if (mode == SKIPLIST_RECLAIM_EPOCH) {
+        skiplist_raw list;
+        skiplist_init(&list, _cmp_IntNode);
+        skiplist_raw_config config = skiplist_get_default_config();
+        config.reclaimMode = mode;
+        config.syncMode = SKIPLIST_SYNC_LOCK_FREE;
+        config.backwardLinks = 1;
+        skiplist_set_config(&list, config);
+        CHK_Z(skiplist_get_config(&list).backwardLinks);
+        skiplist_free(&list);
+    }
+    return 0;
+}
+
+// Check rank, select and count of `list` against `expected` (sorted).
+int check_index(skiplist_raw* list, const std::vector<int>& expected)
+{
+    size_t i, n = expected.size();
+    CHK_EQ(n, skiplist_count(list, NULL, NULL));
+    CHK_NULL(skiplist_select(list, n));
+
+    IntNode query, query2;
+    size_t step = n / 997 + 1;
+    for (i=0; i<n; i+=step) {
+        skiplist_node* ret = skiplist_select(list, i);
+        CHK_NONNULL(ret);
+        CHK_EQ(expected[i], _get_entry(ret, IntNode, snode)->value);
+        skiplist_release_node(ret);
+
+        query.value = expected[i];
+        size_t lower = std::lower_bound(expected.begin(), expected.end(),
+                                        expected[i]) - expected.begin();
+        CHK_EQ(lower, skiplist_rank(list, &query.snode));
+
+        // [expected[i], expected[i] + 100)
+        query2.value = expected[i] + 100;
+        size_t upper = std::lower_bound(expected.begin(), expected.end(),
+                                        query2.value) - expected.begin();
+        CHK_EQ(upper - lower,
+               skiplist_count(list, &query.snode, &query2.snode));
+        CHK_EQ(n - lower, skiplist_count(list, &query.snode, NULL));
+    }
+    return 0;
+}
+
+void index_test_writer(skiplist_raw* list, IntNode* arr, int n)
+{
+    for (int i=0; i<n; ++i) skiplist_insert(list, &arr[i].snode);
+    for (int i=0; i<n; ++i) skiplist_erase_node(list, &arr[i].snode);
+}
+
+int index_test(skiplist_reclaim_mode mode)
+{
+    TestSuite::Timer tt;
+    TestSuite::appendResultMessage("\n");
+    char msg[1024];
+
+    int i, n = 100000;
+    std::vector<int> expected;
+    for (int indexable = 0; indexable < 2; ++indexable) {
+        // Every query walks on layer 0 without `indexable`.
+        int n = indexable ? 100000 : 10000;
+        skiplist_raw list;
+        skiplist_init(&list, _cmp_IntNode);
+        skiplist_raw_config config = skiplist_get_default_config();
+        config.reclaimMode = mode;
+        config.indexable = indexable;
+        skiplist_set_config(&list, config);
+        CHK_EQ(indexable, skiplist_get_config(&list).indexable);
+
+        // Random order, with duplicate keys.
+        std::vector<IntNode> arr(n);
+        expected.clear();
+        for (i=0; i<n; ++i) {
+            arr[i].value = ((i * 7919) % n) / 2 * 2;
+            skiplist_insert(&list, &arr[i].snode);
+            expected.push_back(arr[i].value);
+        }
+        std::sort(expected.begin(), expected.end());
+        CHK_Z(check_index(&list, expected));
+
+        tt.reset();
+        for (i=0; i<n; i+=97) {
+            skiplist_node* ret = skiplist_select(&list, i);
+            skiplist_release_node(ret);
+        }
+        double elapsed_sec = tt.getTimeUs() / 1000000.0;
+        sprintf(msg, "select (%s, %d): %.4f (%.1f ops/sec)\n",
+                indexable ? "indexable" : "walk", n,
+                elapsed_sec, (n / 97) / elapsed_sec);
+        TestSuite::appendResultMessage(msg);
+
+        // Erase some of them, and the range of [n/2, n/2 + 1000).
+        for (i=0; i<n; i+=3) skiplist_erase_node(&list, &arr[i].snode);
+        IntNode from, to;
+        from.value = n / 2;
+        to.value = n / 2 + 1000;
+        skiplist_erase_range(&list, &from.snode, &to.snode, NULL, NULL);
+        expected.clear();
+        for (i=0; i<n; ++i) {
+            if (skiplist_is_valid_node(&arr[i].snode)) {
+                expected.push_back(arr[i].value);
+            }
+        }
+        std::sort(expected.begin(), expected.end());
+        CHK_Z(check_index(&list, expected));
+
+        // Batch insert of odd numbers.
+        std::vector<IntNode> arr_odd(n / 10);
+        std::vector<skiplist_node*> odd_nodes(n / 10);
+        for (i=0; i<n/10; ++i) {
+            arr_odd[i].value = i * 10 + 1;
+            odd_nodes[i] = &arr_odd[i].snode;
+            expected.push_back(arr_odd[i].value);
+        }
+        skiplist_insert_batch(&list, &odd_nodes[0], n / 10);
+        std::sort(expected.begin(), expected.end());
+        CHK_Z(check_index(&list, expected));
+
+        skiplist_free(&list);
+    }
+
+    // Bulk load.
+    {
+        skiplist_raw list;
+        skiplist_init(&list, _cmp_IntNode);
+        skiplist_raw_config config = skiplist_get_default_config();
+        config.reclaimMode = mode;
+        config.indexable = 1;
+        skiplist_set_config(&list, config);
+
+        std::vector<IntNode> arr(n);
+        std::vector<skiplist_node*> nodes(n);
+        expected.clear();
+        for (i=0; i<n; ++i) {
+            arr[i].value = i * 2;
+            nodes[i] = &arr[i].snode;
+            expected.push_back(arr[i].value);
+        }
+        CHK_Z(skiplist_bulk_load(&list, &nodes[0], n));
+        CHK_Z(check_index(&list, expected));
+        skiplist_free(&list);
+    }
+
+    // Even numbers stay, while other threads insert and erase odd ones.
+    {
+        skiplist_raw list;
+        skiplist_init(&list, _cmp_IntNode);
+        skiplist_raw_config config = skiplist_get_default_config();
+        config.reclaimMode = mode;
+        config.indexable = 1;
+        skiplist_set_config(&list, config);
+
+        int n_threads = 4, n_even = n / 2;
+        std::vector<IntNode> arr(n);
+        for (i=0; i<n_even; ++i) {
+            arr[i].value = i * 2;
+            skiplist_insert(&list, &arr[i].snode);
+        }
+        for (i=n_even; i<n; ++i) arr[i].value = (i - n_even) * 2 + 1;
+
+        int per_thread = (n - n_even) / n_threads;
+        std::vector<std::thread> threads(n_threads);
+        for (int t=0; t<n_threads; ++t) {
+            threads[t] = std::thread(index_test_writer, &list,
+                                     &arr[n_even + t * per_thread],
+                                     per_thread);
+        }
+        IntNode query, query2;
+        for (i=0; i<10000; ++i) {
+            int k = (i * 7919) % n_even;
+            // Number of even numbers smaller than `k*2` is `k`,
+            // and there are at most `k` odd numbers.
+            query.value = k * 2;
+            size_t rank = skiplist_rank(&list, &query.snode);
+            CHK_GTEQ(rank, (size_t)k);
+            CHK_SMEQ(rank, (size_t)k * 2);
+
+            // Exactly one even number in [k*2, k*2 + 1].
+            query2.value = k * 2 + 1;
+            CHK_EQ(1, (int)skiplist_count(&list, &query.snode,
+                                          &query2.snode));
+
+            skiplist_node* ret = skiplist_select(&list, k);
+            CHK_NONNULL(ret);
+            CHK_SMEQ(_get_entry(ret, IntNode, snode)->value, k * 2);
+            skiplist_release_node(ret);
+        }
+        for (auto& entry: threads) entry.join();
+
+        expected.clear();
+        for (i=0; i<n_even; ++i) expected.push_back(i * 2);
+        CHK_Z(check_index(&list, expected));
+        skiplist_free(&list);
+    }
+
+    // Not available in lock-free mode.
+    if (mode == SKIPLIST_RECLAIM_EPOCH) {
+        skiplist_raw list;
+        skiplist_init(&list, _cmp_IntNode);
+        skiplist_raw_config config = skiplist_get_default_config();
+        config.reclaimMode = mode;
+        config.syncMode = SKIPLIST_SYNC_LOCK_FREE;
+        config.indexable = 1;
+        skiplist_set_config(&list, config);
+        CHK_Z(skiplist_get_config(&list).indexable);
+        skiplist_free(&list);
+    }
+    return 0;
+}
+
+void index_progress_writer(skiplist_raw* list, IntNode* arr, int n,
+                           std::atomic<bool>* stop)
+{
+    while (!stop->load()) {
+        for (int i=0; i<n; ++i) skiplist_insert(list, &arr[i].snode);
+        for (int i=0; i<n; ++i) {
+            skiplist_erase_node(list, &arr[i].snode);
+            skiplist_wait_for_free(&arr[i].snode);
+        }
+    }
+}
+
+// Writers keep going until the reader is done, so rank and select
+// should return without waiting for a quiet moment.
+int index_progress_test()
+{
+    TestSuite::Timer tt;
+    TestSuite::appendResultMessage("\n");
+    char msg[1024];
+
+    skiplist_raw list;
+    skiplist_init(&list, _cmp_IntNode);
+    skiplist_raw_config config = skiplist_get_default_config();
+    config.indexable = 1;
+    skiplist_set_config(&list, config);
+
+    int i, n_even = 10000, n_threads = 4, per_thread = 1000;
+    std::vector<IntNode> evens(n_even);
+    for (i=0; i<n_even; ++i) {
+        evens[i].value = i * 2;
+        skiplist_insert(&list, &evens[i].snode);
+    }
+    std::vector<IntNode> odds(n_threads * per_thread);
+    for (i=0; i<n_threads * per_thread; ++i) odds[i].value = i * 2 + 1;
+
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> threads(n_threads);
+    for (int t=0; t<n_threads; ++t) {
+        threads[t] = std::thread(index_progress_writer, &list,
+                                 &odds[t * per_thread], per_thread, &stop);
+    }
+
+    IntNode query;
+    int n_queries = 2000;
+    for (i=0; i<n_queries; ++i) {
+        int k = (i * 7919) % n_even;
+        query.value = k * 2;
+        size_t rank = skiplist_rank(&list, &query.snode);
+        CHK_GTEQ(rank, (size_t)k);
+        CHK_SMEQ(rank, (size_t)k * 2);
+
+        skiplist_node* ret = skiplist_select(&list, k);
+        CHK_NONNULL(ret);
+        CHK_SMEQ(_get_entry(ret, IntNode, snode)->value, k * 2);
+        skiplist_release_node(ret);
+    }
+    stop = true;
+    for (auto& entry: threads) entry.join();
+
+    double elapsed_sec = tt.getTimeUs() / 1000000.0;
+    sprintf(msg, "rank/select under %d writers %.4f (%.1f ops/sec)\n",
+            n_threads, elapsed_sec, n_queries / elapsed_sec);
+    TestSuite::appendResultMessage(msg);
+
+    CHK_EQ((size_t)n_even, skiplist_get_size(&list));
+    skiplist_free(&list);
+    return 0;
+}
+
+// Values seen by the snapshot of `seq` (the latest view if not versioned).
+std::vector<int> snapshot_values(skiplist_raw* list, uint64_t seq)
+{
+    std::vector<int> ret;
+    skiplist_node* cur = skiplist_snapshot_begin(list, seq);
+    while (cur) {
+        ret.push_back(_get_entry(cur, IntNode, snode)->value);
+        skiplist_node* next = skiplist_snapshot_next(list, seq, cur);
+        skiplist_release_node(cur);
+        cur = next;
+    }
+    return ret;
+}
+
+void versioned_erase(skiplist_raw* list,
+                     int value,
+                     std::atomic<size_t>* num_freed)
+{
+    IntNode query;
+    query.value = value;
+    skiplist_node* cur = skiplist_find(list, &query.snode);
+    if (!cur) return;
+    skiplist_erase_node(list, cur);
+    skiplist_release_node(cur);
+    skiplist_retire_node(list, cur, _free_IntNode, num_freed);
+}
+
+void versioned_writer(skiplist_raw* list,
+                      int begin,
+                      int n,
+                      std::atomic<size_t>* num_freed)
+{
+    // Move each of `[begin, begin + n)` to `+ n * 8`.
+    for (int i = begin; i < begin + n; ++i) {
+        IntNode* node = new IntNode();
+        node->value = i + n * 8;
+        skiplist_insert(list, &node->snode);
+        versioned_erase(list, i, num_freed);
+    }
+}
+
+int versioned_test(skiplist_reclaim_mode mode)
+{
+    skiplist_raw list;
+    skiplist_init(&list, _cmp_IntNode);
+    skiplist_raw_config config = skiplist_get_default_config();
+    config.reclaimMode = mode;
+    config.versioned = 1;
+    skiplist_set_config(&list, config);
+    CHK_EQ(1, skiplist_get_config(&list).versioned);
+
+    int i, n = 1000;
+    std::atomic<size_t> num_freed(0);
+    for (i=0; i<n; ++i) {
+        IntNode* node = new IntNode();
+        node->value = i;
+        skiplist_insert(&list, &node->snode);
+    }
+
+    // Snapshot keeps the old view while the latest one moves on.
+    uint64_t seq = skiplist_snapshot(&list);
+    CHK_GT(seq, (uint64_t)0);
+    for (i=0; i<n; i+=2) versioned_erase(&list, i, &num_freed);
+    for (i=n; i<n+100; ++i) {
+        IntNode* node = new IntNode();
+        node->value = i;
+        skiplist_insert(&list, &node->snode);
+    }
+
+    std::vector<int> values = snapshot_values(&list, seq);
+    CHK_EQ((size_t)n, values.size());
+    for (i=0; i<n; ++i) CHK_EQ(i, values[i]);
+
+    uint64_t latest = skiplist_snapshot(&list);
+    values = snapshot_values(&list, latest);
+    skiplist_snapshot_release(&list, latest);
+    CHK_EQ((size_t)(n / 2 + 100), values.size());
+    CHK_EQ((size_t)(n / 2 + 100), skiplist_get_size(&list));
+    for (i=0; i<n/2; ++i) CHK_EQ(i * 2 + 1, values[i]);
+
+    IntNode query;
+    query.value = 10;
+    CHK_NULL(skiplist_find(&list, &query.snode));
+    skiplist_node* cur = skiplist_snapshot_find(&list, seq, &query.snode);
+    CHK_NONNULL(cur);
+    CHK_EQ(10, _get_entry(cur, IntNode, snode)->value);
+    skiplist_release_node(cur);
+    cur = skiplist_find_greater_or_equal(&list, &query.snode);
+    CHK_EQ(11, _get_entry(cur, IntNode, snode)->value);
+    skiplist_release_node(cur);
+    query.value = n + 50;
+    CHK_NULL(skiplist_snapshot_find_greater_or_equal(&list, seq,
+                                                     &query.snode));
+
+    // Erased nodes are freed once the snapshot is gone.
+    for (i=0; i<3; ++i) skiplist_reclaim(&list);
+    CHK_Z(num_freed.load());
+    skiplist_snapshot_release(&list, seq);
+    for (i=0; i<3; ++i) skiplist_reclaim(&list);
+    CHK_EQ((size_t)(n / 2), num_freed.load());
+
+    // Without snapshots, erased nodes are unlinked right away.
+    versioned_erase(&list, 1, &num_freed);
+    for (i=0; i<3; ++i) skiplist_reclaim(&list);
+    CHK_EQ((size_t)(n / 2 + 1), num_freed.load());
+
+    // Insert the same key again, while a snapshot sees the old one.
+    seq = skiplist_snapshot(&list);
+    query.value = 3;
+    skiplist_node* old_node = skiplist_find(&list, &query.snode);
+    skiplist_release_node(old_node);
+    versioned_erase(&list, 3, &num_freed);
+    IntNode* new_node = new IntNode();
+    new_node->value = 3;
+    CHK_Z(skiplist_insert_nodup(&list, &new_node->snode));
+    IntNode* dup_node = new IntNode();
+    dup_node->value = 3;
+    CHK_EQ(-1, skiplist_insert_nodup(&list, &dup_node->snode));
+    delete dup_node;
+
+    cur = skiplist_find(&list, &query.snode);
+    CHK_EQ(&new_node->snode, cur);
+    skiplist_release_node(cur);
+    cur = skiplist_snapshot_find(&list, seq, &query.snode);
+    CHK_EQ(old_node, cur);
+    skiplist_release_node(cur);
+
+    query.value = 5;
+    skiplist_node* five = skiplist_find(&list, &query.snode);
+    cur = skiplist_prev(&list, five);
+    CHK_EQ(&new_node->snode, cur);
+    skiplist_release_node(cur);
+    cur = skiplist_snapshot_prev(&list, seq, five);
+    CHK_EQ(old_node, cur);
+    skiplist_release_node(cur);
+    skiplist_release_node(five);
+
+    // The last node is hidden from the latest view only.
+    versioned_erase(&list, n + 99, &num_freed);
+    cur = skiplist_end(&list);
+    CHK_EQ(n + 98, _get_entry(cur, IntNode, snode)->value);
+    skiplist_release_node(cur);
+    cur = skiplist_snapshot_prev(&list, seq, &list.tail);
+    CHK_EQ(n + 99, _get_entry(cur, IntNode, snode)->value);
+    skiplist_release_node(cur);
+    skiplist_snapshot_release(&list, seq);
+
+    // Writers move keys, while scans of the same snapshot stay the same.
+    {
+        int n_threads = 4, per_thread = 2000;
+        std::vector<std::thread> threads(n_threads);
+        for (int t=0; t<n_threads; ++t) {
+            threads[t] = std::thread(versioned_writer, &list,
+                                     n * 2 + t * per_thread,
+                                     per_thread, &num_freed);
+        }
+        for (int round = 0; round < 10; ++round) {
+            uint64_t snap = skiplist_snapshot(&list);
+            values = snapshot_values(&list, snap);
+            std::vector<int> again = snapshot_values(&list, snap);
+            skiplist_snapshot_release(&list, snap);
+            CHK_OK(values == again);
+            CHK_OK(std::is_sorted(values.begin(), values.end()));
+        }
+        for (auto& entry: threads) entry.join();
+    }
+
+    // Free the remaining ones.
+    size_t num_left = skiplist_get_size(&list);
+    latest = skiplist_snapshot(&list);
+    values = snapshot_values(&list, latest);
+    skiplist_snapshot_release(&list, latest);
+    CHK_EQ(num_left, values.size());
+    for (i=0; i<(int)values.size(); ++i) {
+        versioned_erase(&list, values[i], &num_freed);
+    }
+    CHK_Z(skiplist_get_size(&list));
+    skiplist_free(&list);
+
+    // Not available in lock-free mode.
+    if (mode == SKIPLIST_RECLAIM_EPOCH) {
+        skiplist_init(&list, _cmp_IntNode);
+        config.syncMode = SKIPLIST_SYNC_LOCK_FREE;
+        skiplist_set_config(&list, config);
+        CHK_Z(skiplist_get_config(&list).versioned);
+        CHK_Z(skiplist_snapshot(&list));
+        skiplist_free(&list);
+    }
+    return 0;
+}
+
+int versioned_purge_test()
+{
+    skiplist_raw list;
+    skiplist_init(&list, _cmp_IntNode);
+    skiplist_raw_config config = skiplist_get_default_config();
+    config.versioned = 1;
+    skiplist_set_config(&list, config);
+
+    int i, n = 100;
+    std::atomic<size_t> num_freed(0);
+    for (i=0; i<n; ++i) {
+        IntNode* node = new IntNode();
+        node->value = i;
+        skiplist_insert(&list, &node->snode);
+    }
+
+    // Erase all while a snapshot sees them, and the caller holds one.
+    uint64_t seq = skiplist_snapshot(&list);
+    IntNode query;
+    query.value = n / 2;
+    skiplist_node* held = skiplist_find(&list, &query.snode);
+    CHK_NONNULL(held);
+    for (i=0; i<n; ++i) versioned_erase(&list, i, &num_freed);
+    CHK_Z(num_freed.load());
+
+    // Empty, but the erased ones are still linked for the snapshot.
+    CHK_Z(skiplist_get_size(&list));
+    IntNode extra;
+    skiplist_node* extra_node = &extra.snode;
+    CHK_EQ(-1, skiplist_bulk_load(&list, &extra_node, 1));
+
+    // Releasing the snapshot frees the others without waiting for
+    // the held one, which is freed later.
+    skiplist_snapshot_release(&list, seq);
+    CHK_EQ((size_t)(n - 1), num_freed.load());
+    CHK_Z(skiplist_reclaim(&list));
+    skiplist_release_node(held);
+    CHK_EQ((size_t)1, skiplist_reclaim(&list));
+    CHK_EQ((size_t)n, num_freed.load());
+
+    skiplist_free(&list);
+    return 0;
+}
+
+void find_batch_eraser(skiplist_raw* list, IntNode* arr, int n)
+{
+    for (int i=0; i<n; i+=4) skiplist_erase_node(list, &arr[i].snode);
+}
+
+int find_batch_test(skiplist_reclaim_mode mode)
+{
+    skiplist_raw list;
+    skiplist_init(&list, _cmp_IntNode);
+    set_reclaim_mode(&list, mode);
+
+    int i, n = 100000, num_queries = 100;
+    std::vector<IntNode> arr(n);
+    for (i=0; i<n; ++i) {
+        arr[i].value = i * 2;
+        skiplist_insert(&list, &arr[i].snode);
+    }
+
+    // Odd numbers are missing.
+    std::vector<IntNode> queries(num_queries);
+    std::vector<skiplist_node*> query_nodes(num_queries);
+    std::vector<skiplist_node*> results(num_queries);
+    for (int round = 0; round < 100; ++round) {
+        int expected = 0;
+        for (i=0; i<num_queries; ++i) {
+            queries[i].value = rand() % (n * 2);
+            query_nodes[i] = &queries[i].snode;
+            if (queries[i].value % 2 == 0) expected++;
+        }
+        CHK_EQ((size_t)expected,
+               skiplist_find_batch(&list, &query_nodes[0], &results[0],
+                                   num_queries));
+        for (i=0; i<num_queries; ++i) {
+            if (queries[i].value % 2) {
+                CHK_NULL(results[i]);
+                continue;
+            }
+            CHK_NONNULL(results[i]);
+            CHK_EQ(queries[i].value,
+                   _get_entry(results[i], IntNode, snode)->value);
+            skiplist_release_node(results[i]);
+        }
+    }
+    CHK_Z(skiplist_find_batch(&list, NULL, NULL, 0));
+
+    // While others are erased.
+    std::thread eraser(find_batch_eraser, &list, &arr[0], n);
+    for (int round = 0; round < 100; ++round) {
+        for (i=0; i<num_queries; ++i) {
+            queries[i].value = (rand() % n) * 2;
+        }
+        skiplist_find_batch(&list, &query_nodes[0], &results[0],
+                            num_queries);
+        for (i=0; i<num_queries; ++i) {
+            // Only multiples of 8 can be gone.
+            if (queries[i].value % 8) CHK_NONNULL(results[i]);
+            if (!results[i]) continue;
+            CHK_EQ(queries[i].value,
+                   _get_entry(results[i], IntNode, snode)->value);
+            skiplist_release_node(results[i]);
+        }
+    }
+    eraser.join();
+
+    skiplist_free(&list);
+    return 0;
+}
+
+void prefetch_test_eraser(skiplist_raw* list, IntNode* arr, int n)
+{
+    for (int i=0; i<n; i+=2) skiplist_erase_node(list, &arr[i].snode);
+}
+
+int prefetch_test(skiplist_reclaim_mode mode)
+{
+    skiplist_raw list;
+    skiplist_init(&list, _cmp_IntNode);
+    skiplist_raw_config config = skiplist_get_default_config();
+    CHK_Z(config.prefetchDepth);
+    config.reclaimMode = mode;
+    config.prefetchDepth = 1000;
+    skiplist_set_config(&list, config);
+    CHK_EQ(255, skiplist_get_config(&list).prefetchDepth);
+    config.prefetchDepth = 8;
+    skiplist_set_config(&list, config);
+    CHK_EQ(8, skiplist_get_config(&list).prefetchDepth);
+
+    int i, n = 100000;
+    std::vector<IntNode> arr(n);
+    for (i=0; i<n; ++i) {
+        arr[i].value = i;
+        skiplist_insert(&list, &arr[i].snode);
+    }
+
+    // Scan while the nodes ahead are being erased.
+    std::thread eraser(prefetch_test_eraser, &list, &arr[0], n);
+    for (int round = 0; round < 3; ++round) {
+        int last = -1;
+        skiplist_node* cur = skiplist_begin(&list);
+        while (cur) {
+            IntNode* node = _get_entry(cur, IntNode, snode);
+            CHK_GT(node->value, last);
+            last = node->value;
+            skiplist_node* next = skiplist_next(&list, cur);
+            skiplist_release_node(cur);
+            cur = next;
+        }
+    }
+    eraser.join();
+
+    int count = 0;
+    skiplist_node* cur = skiplist_begin(&list);
+    while (cur) {
+        CHK_EQ(count * 2 + 1, _get_entry(cur, IntNode, snode)->value);
+        skiplist_node* next = skiplist_next(&list, cur);
+        skiplist_release_node(cur);
+        cur = next;
+        count++;
+    }
+    CHK_EQ(n / 2, count);
+
+    // The layer counts survive a config with the same layers.
+    size_t top_layer = list.top_layer;
+    CHK_GT(top_layer, 0);
+    skiplist_set_config(&list, config);
+    CHK_EQ(top_layer, list.top_layer);
+
+    // Searches give the same results without their prefetch.
+    CHK_EQ(1, skiplist_get_config(&list).searchPrefetch);
+    skiplist_set_prefetch(&list, 8, 0);
+    CHK_Z(skiplist_get_config(&list).searchPrefetch);
+    CHK_EQ(8, skiplist_get_config(&list).prefetchDepth);
+    IntNode query;
+    for (i=0; i<n; i+=7) {
+        query.value = i;
+        cur = skiplist_find(&list, &query.snode);
+        if (i % 2) {
+            CHK_EQ(&arr[i].snode, cur);
+            skiplist_release_node(cur);
+        } else {
+            CHK_NULL(cur);
+        }
+    }
+    skiplist_free(&list);
+    return 0;
+}
+
+int bulk_load_test()
+{
+    TestSuite::Timer tt;
+    TestSuite::appendResultMessage("\n");
+    char msg[1024];
+
+    skiplist_raw list;
+    skiplist_init(&list, _cmp_IntNode);
+    skiplist_raw_config config = skiplist_get_config(&list);
+    config.maxLayer = 16;
+    skiplist_set_config(&list, config);
+
+    int i;
+    int n = 1000000;
+    std::vector<IntNode> arr(n);
+    std::vector<skiplist_node*> nodes(n);
+    for (i=0; i<n; ++i) {
+        arr[i].value = i*2;
+        nodes[i] = &arr[i].snode;
+    }
+
+    tt.reset();
+    CHK_Z(skiplist_bulk_load(&list, &nodes[0], n));
+    double elapsed_sec = tt.getTimeUs() / 1000000.0;
+    sprintf(msg, "bulk load: %.4f (%.1f ops/sec)\n",
+            elapsed_sec, n / elapsed_sec);
+    TestSuite::appendResultMessage(msg);
+
+    CHK_EQ(n, (int)skiplist_get_size(&list));
+    // fanout 4: 1/4 of nodes on layer 1, 1/16 on layer 2, ...
+    CHK_EQ((uint32_t)(n/4 - n/16), list.layer_entries[1]);
+    CHK_EQ((uint32_t)(n/16 - n/64), list.layer_entries[2]);
+    CHK_EQ(9, (int)list.top_layer);
+
+    // Not empty.
+    IntNode extra;
+    skiplist_node* extra_node = &extra.snode;
+    CHK_EQ(-1, skiplist_bulk_load(&list, &extra_node, 1));
+
+    IntNode query;
+    for (i=0; i<n; i+=997) {
+        query.value = i*2;
+        skiplist_node* ret = skiplist_find(&list, &query.snode);
+        CHK_NONNULL(ret);
+        CHK_EQ(i*2, _get_entry(ret, IntNode, snode)->value);
+        skiplist_release_node(ret);
+
+        query.value = i*2 + 1;
+        CHK_NULL(skiplist_find(&list, &query.snode));
+    }
+
+    // Should work as usual after bulk load.
+    std::vector<IntNode> arr_odd(1000);
+    for (i=0; i<1000; ++i) {
+        arr_odd[i].value = i*2 + 1;
+        skiplist_insert(&list, &arr_odd[i].snode);
+        skiplist_erase_node(&list, &arr[i].snode);
+    }
+    CHK_EQ(n, (int)skiplist_get_size(&list));
+
+    skiplist_node* cur = skiplist_begin(&list);
+    for (i=0; i<1000; ++i) {
+        CHK_NONNULL(cur);
+        CHK_EQ(i*2 + 1, _get_entry(cur, IntNode, snode)->value);
+        skiplist_node* next = skiplist_next(&list, cur);
+        skiplist_release_node(cur);
+        cur = next;
+    }
+    for (i=1000; i<n; ++i) {
+        CHK_NONNULL(cur);
+        CHK_EQ(i*2, _get_entry(cur, IntNode, snode)->value);
+        skiplist_node* next = skiplist_next(&list, cur);
+        skiplist_release_node(cur);
+        cur = next;
+    }
+    CHK_NULL(cur);
+
+    skiplist_free(&list);
+    return 0;
+}
+
+int inline_tower_test()
+{
+    TestSuite::Timer tt;
+    TestSuite::appendResultMessage("\n");
+    char msg[1024];
+
+    skiplist_raw list;
+    skiplist_init(&list, _cmp_IntNode);
+
+    int i;
+    int n = 100000;
+    std::vector<IntNode*> arr(n);
+    std::vector<size_t> top_layers(n);
+    for (i=0; i<n; ++i) {
+        top_layers[i] = skiplist_decide_top_layer(&list, NULL);
+        void* mem = malloc(skiplist_inline_node_size(&list, sizeof(IntNode),
+                                                     top_layers[i]));
+        arr[i] = new (mem) IntNode();
+        skiplist_init_node_inline(&arr[i]->snode, mem, sizeof(IntNode),
+                                  top_layers[i]);
+        arr[i]->value = i;
+    }
+
+    tt.reset();
+    for (i=0; i<n; ++i) {
+        skiplist_insert(&list, &arr[i]->snode);
+    }
+    double elapsed_sec = tt.getTimeUs() / 1000000.0;
+    sprintf(msg, "insert (inline tower): %.4f (%.1f ops/sec)\n",
+            elapsed_sec, n / elapsed_sec);
+    TestSuite::appendResultMessage(msg);
+
+    for (i=0; i<n; ++i) {
+        CHK_EQ(top_layers[i], (size_t)_sl_top_layer(&arr[i]->snode));
+    }
+
+    IntNode query;
+    tt.reset();
+    for (i=0; i<n; ++i) {
+        query.value = i;
+        skiplist_node* ret = skiplist_find(&list, &query.snode);
+        CHK_EQ(&arr[i]->snode, ret);
+        skiplist_release_node(ret);
+    }
+    elapsed_sec = tt.getTimeUs() / 1000000.0;
+    sprintf(msg, "find (inline tower): %.4f (%.1f ops/sec)\n",
+            elapsed_sec, n / elapsed_sec);
+    TestSuite::appendResultMessage(msg);
+
+    // Re-insert: should keep the same tower.
+    for (i=0; i<n; i+=2) {
+        skiplist_erase_node(&list, &arr[i]->snode);
+        atm_node_ptr* tower = arr[i]->snode.next;
+        skiplist_insert(&list, &arr[i]->snode);
+        CHK_EQ(tower, arr[i]->snode.next);
+        CHK_EQ(top_layers[i], (size_t)_sl_top_layer(&arr[i]->snode));
+    }
+    CHK_EQ(n, (int)skiplist_get_size(&list));
+
+    skiplist_node* cur = skiplist_begin(&list);
+    for (i=0; i<n; ++i) {
+        CHK_EQ(&arr[i]->snode, cur);
+        skiplist_node* next = skiplist_next(&list, cur);
+        skiplist_release_node(cur);
+        cur = next;
+    }
+    CHK_NULL(cur);
+
+    skiplist_free(&list);
+    for (i=0; i<n; ++i) {
+        arr[i]->~IntNode();
+        free(arr[i]);
+    }
+    return 0;
+}
+
+int node_state_test()
+{
+    // All flags and counters are in one word, and options keep their
+    // fields in the tower: 16 bytes on 64-bit platforms, down from 24
+    // of separate flags and counters.
+    CHK_EQ(sizeof(void*) + sizeof(uint64_t), sizeof(skiplist_node));
+
+    skiplist_raw list;
+    skiplist_init(&list, _cmp_IntNode);
+
+    size_t top = 5;
+    IntNode* node = (IntNode*)
+        malloc(skiplist_inline_node_size(&list, sizeof(IntNode), top));
+    new (node) IntNode();
+    skiplist_init_node_inline(&node->snode, node, sizeof(IntNode), top);
+    node->value = 1;
+    CHK_EQ(top, _sl_top_layer(&node->snode));
+    CHK_EQ(top + 1, _sl_tower_size(&node->snode));
+    CHK_FALSE(_sl_fully_linked(&node->snode));
+
+    skiplist_insert(&list, &node->snode);
+    CHK_TRUE(_sl_fully_linked(&node->snode));
+    CHK_EQ(top, _sl_top_layer(&node->snode));
+    CHK_EQ(top + 1, _sl_tower_size(&node->snode));
+
+    // Fields do not step on each other.
+    for (int i=0; i<1000; ++i) skiplist_grab_node(&node->snode);
+    CHK_EQ(1000, (int)_sl_ref_count(&node->snode));
+    CHK_TRUE(_sl_fully_linked(&node->snode));
+    CHK_EQ(top, _sl_top_layer(&node->snode));
+    CHK_Z(_sl_state(&node->snode) & _SL_ST_AN);
+    for (int i=0; i<1000; ++i) skiplist_release_node(&node->snode);
+    CHK_Z(_sl_ref_count(&node->snode));
+
+    CHK_FALSE(skiplist_is_safe_to_free(&node->snode));
+    skiplist_erase_node(&list, &node->snode);
+    CHK_TRUE(_sl_removed(&node->snode));
+    CHK_FALSE(_sl_fully_linked(&node->snode));
+    CHK_FALSE(_sl_being_modified(&node->snode));
+    CHK_EQ(top + 1, _sl_tower_size(&node->snode));
+    CHK_TRUE(skiplist_is_safe_to_free(&node->snode));
+    skiplist_grab_node(&node->snode);
+    CHK_FALSE(skiplist_is_safe_to_free(&node->snode));
+    skiplist_release_node(&node->snode);
+
+    skiplist_free(&list);
+    node->~IntNode();
+    free(node);
+    return 0;
+}
+
+int inline_tower_options_test()
+{
+    // Options take room at the end of the tower, only if they are set.
+    skiplist_raw list;
+    skiplist_init(&list, _cmp_IntNode);
+    size_t top = 3;
+    size_t plain_size = skiplist_inline_node_size(&list, sizeof(IntNode), top);
+    skiplist_raw_config config = skiplist_get_default_config();
+    config.backwardLinks = 1;
+    skiplist_set_config(&list, config);
+    CHK_EQ(plain_size + sizeof(void*),
+           skiplist_inline_node_size(&list, sizeof(IntNode), top));
+    config.versioned = 1;
+    skiplist_set_config(&list, config);
+    CHK_EQ(plain_size + sizeof(void*) + sizeof(uint64_t) * 2,
+           skiplist_inline_node_size(&list, sizeof(IntNode), top));
+
+    int i, n = 1000;
+    std::vector<IntNode*> arr(n);
+    for (i=0; i<n; ++i) {
+        size_t top_layer = skiplist_decide_top_layer(&list, NULL);
+        void* mem = malloc(skiplist_inline_node_size(&list, sizeof(IntNode),
+                                                     top_layer));
+        arr[i] = new (mem) IntNode();
+        skiplist_init_node_inline(&arr[i]->snode, mem, sizeof(IntNode),
+                                  top_layer);
+        arr[i]->value = (i * 7919) % n;
+        skiplist_insert(&list, &arr[i]->snode);
+    }
+    uint64_t seq = skiplist_snapshot(&list);
+    for (i=0; i<n; i+=3) skiplist_erase_node(&list, &arr[i]->snode);
+    CHK_EQ((size_t)n, snapshot_values(&list, seq).size());
+    skiplist_snapshot_release(&list, seq);
+
+    int count = 0, last = n;
+    skiplist_node* cur = skiplist_end(&list);
+    while (cur) {
+        IntNode* node = _get_entry(cur, IntNode, snode);
+        CHK_GT(last, node->value);
+        last = node->value;
+        skiplist_node* prev = skiplist_prev(&list, cur);
+        skiplist_release_node(cur);
+        cur = prev;
+        count++;
+    }
+    CHK_EQ((int)skiplist_get_size(&list), count);
+
+    skiplist_free(&list);
+    for (i=0; i<n; ++i) {
+        arr[i]->~IntNode();
+        free(arr[i]);
+    }
+    return 0;
+}
+
+uint64_t _hash_IntNode(skiplist_node *node, void *aux)
+{
+    IntNode *item = _get_entry(node, IntNode, snode);
+    return item->value;
+}
+
+int level_gen_test()
+{
+    int i;
+    int n = 10000;
+    const size_t n_lists = 3;
+    skiplist_raw lists[n_lists];
+    std::vector<IntNode> arr[n_lists];
+
+    // 0 and 1: same seed, 2: different seed.
+    for (size_t ii=0; ii<n_lists; ++ii) {
+        skiplist_init(&lists[ii], _cmp_IntNode);
+        skiplist_raw_config config = skiplist_get_config(&lists[ii]);
+        config.levelGen = skiplist_level_gen_hash;
+        config.hashFunc = _hash_IntNode;
+        config.levelSeed = (ii < 2) ? 1234 : 5678;
+        skiplist_set_config(&lists[ii], config);
+        arr[ii] = std::vector<IntNode>(n);
+    }
+
+    // Insert in different order.
+    for (i=0; i<n; ++i) {
+        arr[0][i].value = i;
+        skiplist_insert(&lists[0], &arr[0][i].snode);
+        arr[1][i].value = n - 1 - i;
+        skiplist_insert(&lists[1], &arr[1][i].snode);
+        arr[2][i].value = i;
+        skiplist_insert(&lists[2], &arr[2][i].snode);
+    }
+
+    int num_diff = 0;
+    for (i=0; i<n; ++i) {
+        size_t top = _sl_top_layer(&arr[0][i].snode);
+        CHK_EQ(top, _sl_top_layer(&arr[1][n - 1 - i].snode));
+        if (top != _sl_top_layer(&arr[2][i].snode)) num_diff++;
+    }
+    CHK_GT(num_diff, 0);
+
+    // Fast generator: 1/fanout of nodes should grow.
+    skiplist_raw list;
+    skiplist_init(&list, _cmp_IntNode);
+    std::vector<IntNode> arr_fast(n);
+    int num_upper = 0;
+    for (i=0; i<n; ++i) {
+        arr_fast[i].value = i;
+        skiplist_insert(&list, &arr_fast[i].snode);
+        if (_sl_top_layer(&arr_fast[i].snode) > 0) num_upper++;
+    }
+    CHK_GT(num_upper, n / 4 * 9 / 10);
+    CHK_SM(num_upper, n / 4 * 11 / 10);
+
+    skiplist_free(&list);
+    for (size_t ii=0; ii<n_lists; ++ii) skiplist_free(&lists[ii]);
+    return 0;
+}
+
+struct IntNodeCmp {
+    IntNodeCmp(skiplist_raw*) {}
+    int operator()(skiplist_node* a, skiplist_node* b) const {
+        int aa = _get_entry(a, IntNode, snode)->value;
+        int bb = _get_entry(b, IntNode, snode)->value;
+        return (aa > bb) - (aa < bb);
+    }
+};
+
+int engine_test()
+{
+    using Engine = sl_engine<IntNodeCmp>;
+
+    TestSuite::Timer tt;
+    TestSuite::appendResultMessage("\n");
+    char msg[1024];
+
+    // Epoch mode: no atomic operation per step, comparison dominates.
+    skiplist_raw list;
+    skiplist_init(&list, _cmp_IntNode);
+    set_reclaim_mode(&list, SKIPLIST_RECLAIM_EPOCH);
+
+    // Even numbers only, in random order.
+    int i;
+    int n = 100000;
+    std::vector<IntNode> arr(n);
+    std::vector<int> order(n);
+    for (i=0; i<n; ++i) order[i] = i;
+    for (i=0; i<n; ++i) std::swap(order[i], order[rand() % n]);
+
+    for (i=0; i<n; ++i) {
+        arr[order[i]].value = order[i] * 2;
+        CHK_Z(Engine::insert_nodup(&list, &arr[order[i]].snode));
+    }
+    CHK_EQ(n, (int)skiplist_get_size(&list));
+    IntNode dup;
+    dup.value = 0;
+    CHK_EQ(-1, Engine::insert_nodup(&list, &dup.snode));
+
+    // Both should find the same nodes.
+    IntNode query;
+    for (i=0; i<n*2; ++i) {
+        query.value = i;
+        skiplist_node* e_ret = Engine::find(&list, &query.snode);
+        skiplist_node* c_ret = skiplist_find(&list, &query.snode);
+        CHK_EQ(c_ret, e_ret);
+        if (i % 2) {
+            CHK_NULL(e_ret);
+        } else {
+            CHK_EQ(&arr[i/2].snode, e_ret);
+        }
+        if (e_ret) skiplist_release_node(e_ret);
+        if (c_ret) skiplist_release_node(c_ret);
+
+        e_ret = Engine::find_smaller_or_equal(&list, &query.snode);
+        CHK_EQ(&arr[i/2].snode, e_ret);
+        skiplist_release_node(e_ret);
+
+        e_ret = Engine::find_greater_or_equal(&list, &query.snode);
+        if (i+1 < n*2) {
+            CHK_EQ(&arr[(i+1)/2].snode, e_ret);
+            skiplist_release_node(e_ret);
+        } else {
+            CHK_NULL(e_ret);
+        }
+    }
+
+    // Iteration in both directions.
+    skiplist_node* cur = skiplist_begin(&list);
+    for (i=0; i<n; ++i) {
+        CHK_EQ(&arr[i].snode, cur);
+        skiplist_node* next = Engine::next(&list, cur);
+        skiplist_release_node(cur);
+        cur = next;
+    }
+    CHK_NULL(cur);
+    cur = skiplist_end(&list);
+    for (i=n-1; i>=0; --i) {
+        CHK_EQ(&arr[i].snode, cur);
+        skiplist_node* prev = Engine::prev(&list, cur);
+        skiplist_release_node(cur);
+        cur = prev;
+    }
+    CHK_NULL(cur);
+
+    // Inlined vs. function pointer comparator.
+    tt.reset();
+    for (i=0; i<n; ++i) {
+        query.value = order[i] * 2;
+        skiplist_node* ret = skiplist_find(&list, &query.snode);
+        skiplist_release_node(ret);
+    }
+    double c_sec = tt.getTimeUs() / 1000000.0;
+    tt.reset();
+    for (i=0; i<n; ++i) {
+        query.value = order[i] * 2;
+        skiplist_node* ret = Engine::find(&list, &query.snode);
+        skiplist_release_node(ret);
+    }
+    double e_sec = tt.getTimeUs() / 1000000.0;
+    sprintf(msg, "find (C API): %.1f ops/sec\n"
+                 "find (engine): %.1f ops/sec\n",
+            n / c_sec, n / e_sec);
+    TestSuite::appendResultMessage(msg);
+
+    // Erase half of them by node, and the other half by key.
+    for (i=0; i<n; ++i) {
+        if (i % 2) {
+            CHK_Z(Engine::erase_node(&list, &arr[i].snode));
+        } else {
+            query.value = i * 2;
+            CHK_Z(Engine::erase(&list, &query.snode));
+        }
+    }
+    CHK_Z(skiplist_get_size(&list));
+    CHK_NULL(skiplist_begin(&list));
+
+    skiplist_free(&list);
+    return 0;
+}
+
+int merge_iterator_test()
+{
+    // List `i` has the multiples of `i + 1` below `n`,
+    // and the value of each node tells its list.
+    int i, j;
+    int n = 1000;
+    int num_lists = 5;
+    std::vector<skiplist_raw> lists(num_lists);
+    std::vector<skiplist_raw*> list_ptrs;
+    std::vector<std::vector<IntNode>> arr;
+    for (i=0; i<num_lists; ++i) {
+        skiplist_init(&lists[i], _cmp_IntNode);
+        list_ptrs.push_back(&lists[i]);
+        arr.emplace_back(n / (i + 1) + 1);
+        for (j=0; j * (i + 1) < n; ++j) {
+            arr[i][j].value = j * (i + 1);
+            skiplist_insert(&lists[i], &arr[i][j].snode);
+        }
+    }
+    auto src = [&](skiplist_node* node) {
+        IntNode* entry = _get_entry(node, IntNode, snode);
+        for (int k=0; k<num_lists; ++k) {
+            if (entry >= &arr[k][0] && entry < &arr[k][0] + arr[k].size()) {
+                return k;
+            }
+        }
+        return -1;
+    };
+
+    // Newest wins: every key once, from the first list having it.
+    {
+        sl_merge_iterator<> itr(list_ptrs);
+        itr.seek_to_first();
+        for (i=0; i<n; ++i) {
+            CHK_TRUE(itr.valid());
+            CHK_EQ(i, _get_entry(itr.node(), IntNode, snode)->value);
+            CHK_EQ(src(itr.node()), (int)itr.source());
+            CHK_Z((int)itr.source());
+            itr.next();
+        }
+        CHK_FALSE(itr.valid());
+    }
+
+    // All, newer ones first among the same keys.
+    {
+        sl_merge_iterator<> itr(list_ptrs, SL_MERGE_ALL);
+        int count = 0, expected = 0;
+        for (i=0; i<num_lists; ++i) expected += (n + i) / (i + 1);
+        int last_value = -1, last_src = -1;
+        for (itr.seek_to_first(); itr.valid(); itr.next()) {
+            int value = _get_entry(itr.node(), IntNode, snode)->value;
+            int cur_src = itr.source();
+            CHK_GTEQ(value, last_value);
+            if (value == last_value) CHK_GT(cur_src, last_src);
+            CHK_Z(value % (cur_src + 1));
+            last_value = value;
+            last_src = cur_src;
+            count++;
+        }
+        CHK_EQ(expected, count);
+    }
+
+    // Seek, without the first list.
+    {
+        std::vector<skiplist_raw*> older(list_ptrs.begin() + 1,
+                                         list_ptrs.end());
+        sl_merge_iterator<> itr(older);
+        IntNode query;
+        query.value = 31;
+        itr.seek(&query.snode);
+        // 32 is in the lists of 2 and 4.
+        CHK_EQ(32, _get_entry(itr.node(), IntNode, snode)->value);
+        CHK_Z((int)itr.source());
+        itr.next();
+        CHK_EQ(33, _get_entry(itr.node(), IntNode, snode)->value);
+        CHK_EQ(1, (int)itr.source());
+        itr.next();
+        CHK_EQ(34, _get_entry(itr.node(), IntNode, snode)->value);
+        query.value = n;
+        itr.seek(&query.snode);
+        CHK_FALSE(itr.valid());
+    }
+
+    for (i=0; i<num_lists; ++i) skiplist_free(&lists[i]);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    TestSuite ts(argc, argv);
+    srand(0xabcd);
+
+    struct test_args args;
+    args.n_keys = 40000;
+    args.random_order = true;
+    args.use_skiplist = true;
+    args.reclaim_mode = SKIPLIST_RECLAIM_REFCOUNT;
+    args.sync_mode = SKIPLIST_SYNC_LOCK;
+    args.wait_mode = SKIPLIST_WAIT_YIELD;
+
+    //ts.options.printTestMessage = true;
+    ts.doTest("basic insert and erase", basic_insert_and_erase);
+    ts.doTest("find test", find_test);
+    ts.doTest("finger search test", finger_search_test);
+    ts.doTest("level generator test", level_gen_test);
+    ts.doTest("bulk load test", bulk_load_test);
+    ts.doTest("size counter test", size_counter_test);
+    ts.doTest("inline tower test", inline_tower_test);
+    ts.doTest("node state test", node_state_test);
+    ts.doTest("inline tower options test", inline_tower_options_test);
+    ts.doTest("engine test", engine_test);
+    ts.doTest("merge iterator test", merge_iterator_test);
+    ts.doTest("batch insert test", batch_insert_test,
+              SKIPLIST_RECLAIM_REFCOUNT);
+    ts.doTest("batch insert test (epoch)", batch_insert_test,
+              SKIPLIST_RECLAIM_EPOCH);
+    ts.doTest("batch insert test (hazard)", batch_insert_test,
+              SKIPLIST_RECLAIM_HAZARD);
+    ts.doTest("erase range test", erase_range_test,
+              SKIPLIST_RECLAIM_REFCOUNT);
+    ts.doTest("erase range test (epoch)", erase_range_test,
+              SKIPLIST_RECLAIM_EPOCH);
+    ts.doTest("erase range test (hazard)", erase_range_test,
+              SKIPLIST_RECLAIM_HAZARD);
+    ts.doTest("backward link test", backward_link_test,
+              SKIPLIST_RECLAIM_REFCOUNT);
+    ts.doTest("backward link test (epoch)", backward_link_test,
+              SKIPLIST_RECLAIM_EPOCH);
+    ts.doTest("backward link test (hazard)", backward_link_test,
+              SKIPLIST_RECLAIM_HAZARD);
+    ts.doTest("index test", index_test, SKIPLIST_RECLAIM_REFCOUNT);
+    ts.doTest("index test (epoch)", index_test, SKIPLIST_RECLAIM_EPOCH);
+    ts.doTest("index test (hazard)", index_test, SKIPLIST_RECLAIM_HAZARD);
+    ts.doTest("index progress test", index_progress_test);
+    ts.doTest("find batch test", find_batch_test, SKIPLIST_RECLAIM_REFCOUNT);
+    ts.doTest("find batch test (epoch)", find_batch_test,
+              SKIPLIST_RECLAIM_EPOCH);
+    ts.doTest("find batch test (hazard)", find_batch_test,
+              SKIPLIST_RECLAIM_HAZARD);
+    ts.doTest("prefetch test", prefetch_test, SKIPLIST_RECLAIM_REFCOUNT);
+    ts.doTest("prefetch test (epoch)", prefetch_test, SKIPLIST_RECLAIM_EPOCH);
+    ts.doTest("versioned test", versioned_test, SKIPLIST_RECLAIM_REFCOUNT);
+    ts.doTest("versioned test (epoch)", versioned_test,
+              SKIPLIST_RECLAIM_EPOCH);
+    ts.doTest("versioned test (hazard)", versioned_test,
+              SKIPLIST_RECLAIM_HAZARD);
+    ts.doTest("versioned purge test", versioned_purge_test);
+
+    args.n_writers = 8;
+    ts.doTest("concurrent write test", concurrent_write_test, args);
+
+    args.n_writers = 4;
+    args.n_erasers = 4;
+    ts.doTest("concurrent write erase test", concurrent_write_erase_test, args);
+
+    args.n_writers = 1;
+    args.n_readers = 7;
+    ts.doTest("concurrent write read test", concurrent_write_read_test, args);
+
+    args.reclaim_mode = SKIPLIST_RECLAIM_EPOCH;
+    args.n_writers = 4;
+    args.n_erasers = 4;
+    ts.doTest("concurrent write erase test (epoch)",
+              concurrent_write_erase_test, args);
+
+    args.n_writers = 1;
+    args.n_readers = 7;
+    ts.doTest("concurrent write read test (epoch)",
+              concurrent_write_read_test, args);
+
+    args.reclaim_mode = SKIPLIST_RECLAIM_HAZARD;
+    args.n_writers = 4;
+    args.n_erasers = 4;
+    ts.doTest("concurrent write erase test (hazard)",
+              concurrent_write_erase_test, args);
+
+    args.n_writers = 1;
+    args.n_readers = 7;
+    ts.doTest("concurrent write read test (hazard)",
+              concurrent_write_read_test, args);
+
+    args.reclaim_mode = SKIPLIST_RECLAIM_EPOCH;
+    args.sync_mode = SKIPLIST_SYNC_LOCK_FREE;
+    args.n_writers = 8;
+    ts.doTest("concurrent write test (lock-free)",
+              concurrent_write_test, args);
+
+    args.n_writers = 4;
+    args.n_erasers = 4;
+    ts.doTest("concurrent write erase test (lock-free)",
+              concurrent_write_erase_test, args);
+
+    args.n_writers = 1;
+    args.n_readers = 7;
+    ts.doTest("concurrent write read test (lock-free)",
+              concurrent_write_read_test, args);
+
+    ts.doTest("lock-free test", lock_free_test);
+
+    args.reclaim_mode = SKIPLIST_RECLAIM_REFCOUNT;
+    args.sync_mode = SKIPLIST_SYNC_LOCK;
+    args.wait_mode = SKIPLIST_WAIT_SPIN_PARK;
+    args.n_writers = 4;
+    args.n_erasers = 4;
+    ts.doTest("concurrent write erase test (spin-park)",
+              concurrent_write_erase_test, args);
+
+    args.n_writers = 1;
+    args.n_readers = 7;
+    ts.doTest("concurrent write read test (spin-park)",
+              concurrent_write_read_test, args);
+
+    ts.doTest("spin park test", spin_park_test);
+    ts.doTest("epoch retire test", retire_test, SKIPLIST_RECLAIM_EPOCH);
+    ts.doTest("hazard retire test", retire_test, SKIPLIST_RECLAIM_HAZARD);
 
     return 0;
 }